@@ -27,10 +27,26 @@ include $(PREBUILT_SHARED_LIBRARY)
 
 include $(CLEAR_VARS)
 LOCAL_MODULE    := libenzocodec
-LOCAL_SRC_FILES := $(LOCAL_PATH)/enzo-libs/libenzocodec.so
+LOCAL_SRC_FILES := $(patsubst $(LOCAL_PATH)/%,%, \
+	$(wildcard $(LOCAL_PATH)/enzo-libs/enzo_codec/*.c))
+LOCAL_C_INCLUDES += $(LOCAL_PATH)/enzo-libs/enzo_codec \
+	$(LOCAL_PATH)/enzo-libs/g2d \
+	$(LOCAL_PATH)/enzo-libs/vpu
 LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)/enzo-libs/enzo_codec
+LOCAL_SHARED_LIBRARIES := libvpu libg2d
+LOCAL_LDLIBS    := -llog
+LOCAL_CFLAGS += -std=gnu99 -Wall
 
-include $(PREBUILT_SHARED_LIBRARY)
+# The color conversion, scaling and copy loops have NEON versions
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_ARM_NEON := true
+endif
+
+ifeq ($(ENZO_TRACE),1)
+LOCAL_CFLAGS += -DENZO_TRACE
+endif
+
+include $(BUILD_SHARED_LIBRARY)
 include $(CLEAR_VARS)
 
 
@@ -40,9 +56,15 @@ LOCAL_C_INCLUDES += $(LOCAL_PATH) \
 	$(LOCAL_PATH)/enzo-libs/enzo_codec
 
 LOCAL_MODULE    := libcamview
-LOCAL_SRC_FILES := CamView.c
-LOCAL_SHARED_LIBRARIES := libvpu libg2d libenzocodec liblog libbinder libjnigraphics
-LOCAL_LDLIBS    := -llog -ljnigraphics
+LOCAL_SRC_FILES := CamView.c cam_session.c display_sink.c frame_pool.c \
+	pipeline.c stream_cache.c
+LOCAL_SHARED_LIBRARIES := libvpu libg2d libenzocodec liblog libbinder libandroid
+LOCAL_LDLIBS    := -llog -landroid
 LOCAL_CFLAGS += -std=c99 -Wall -Wextra
 
+# Build with ENZO_TRACE=1 to compile in the trace points
+ifeq ($(ENZO_TRACE),1)
+LOCAL_CFLAGS += -DENZO_TRACE
+endif
+
 include $(BUILD_SHARED_LIBRARY)
@@ -4,200 +4,391 @@
 
 #include "enzo_codec.h"
 #include "enzo_utils.h"
-#include "g2d.h"
+#include "cam_session.h"
+#include "stage_stats.h"
+#include "enzo_trace.h"
 #include "CamView.h"
 
-#include <android/bitmap.h>
+#include <android/native_window_jni.h>
 #include <malloc.h>
 
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 
 #define FPS			15
 
-/* These are the control structures for the encoder and camera */
-struct decoderInstance *mjpgDec;
-struct cameraInstance *usbCam;
-
-/* Control structures for the media buffers, which are used to
-   pass data between sources (like a camera or file), and pass them
-   to other components (like the VPU, a file, or a buffer) */
-struct mediaBuffer *camData, *yuvData;
+/* Frame description filled in by acquireFrame, order matches
+   CamFrame.java */
+enum {
+	FRAME_INFO_WIDTH = 0,
+	FRAME_INFO_HEIGHT,
+	FRAME_INFO_COLOR_SPACE,
+	FRAME_INFO_TIMESTAMP,
+	FRAME_INFO_SEQUENCE,
+	FRAME_INFO_PLANES,
+	FRAME_INFO_STRIDE,	/* One per plane */
+	FRAME_INFO_NUM = FRAME_INFO_STRIDE + FRAME_MAX_PLANES
+};
+
+/* Needed to call back into Java from the startup thread */
+static JavaVM *java_vm;
+
+/* Function prototypes */
+static struct cam_session *get_session(jlong handle);
+static void on_camera_ready(struct cam_session *session, int ok, void *arg);
+/* End function prototypes */
+
+static struct cam_session *get_session(jlong handle)
+{
+	if (handle == 0)
+		err_msg("Camera session is not open\n");
 
-struct g2d_buf *y420_buf, *y422_buf, *rgb_buf;
-struct g2d_surface y420_surf, y422_surf, rgb_surf;
-void *g2d_handle;
+	return (struct cam_session *)(intptr_t)handle;
+}
 
-JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_loadNextFrame(JNIEnv* env,
-		jobject thiz, jobject bitmap)
+/*
+ * Runs on the session's startup thread and forwards readiness to
+ * CamView.onCameraReady
+ */
+static void on_camera_ready(struct cam_session *session, int ok, void *arg)
 {
-	AndroidBitmapInfo info;
-	int result;
+	jobject view = arg;
+	JNIEnv *env;
+	jclass cls;
+	jmethodID method;
 
-	if((result = AndroidBitmap_getInfo(env, bitmap, &info)) < 0) {
-		err_msg("AndroidBitmap_getInfo() failed, error=%d", result);
+	if ((*java_vm)->AttachCurrentThread(java_vm, &env, NULL) != JNI_OK) {
+		err_msg("Could not attach startup thread to the VM\n");
 		return;
 	}
 
-	if(info.format != ANDROID_BITMAP_FORMAT_RGB_565) {
-		err_msg("Bitmap format is not RGBA_565 !");
-		return;
-	}
+	cls = (*env)->GetObjectClass(env, view);
+	method = (*env)->GetMethodID(env, cls, "onCameraReady", "(JZ)V");
+	if (method != NULL)
+		(*env)->CallVoidMethod(env, view, method,
+				       (jlong)(intptr_t)session,
+				       ok ? JNI_TRUE : JNI_FALSE);
+	if ((*env)->ExceptionCheck(env))
+		(*env)->ExceptionClear(env);
+	(*env)->DeleteLocalRef(env, cls);
+
+	(*java_vm)->DetachCurrentThread(java_vm);
+}
 
-	char *colors;
-	if((result = AndroidBitmap_lockPixels(env, bitmap, (void*)&colors)) < 0) {
-		err_msg("AndroidBitmap_lockPixels() failed, error=%d", result);
-	}
+JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_processCamera(JNIEnv* env,
+		jobject thiz, jlong handle)
+{
+	struct cam_session *session = get_session(handle);
+
+	if (session && cam_session_process(session) < 0)
+		err_msg("Could not start camera pipeline\n");
+}
+
+JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_stopProcessing(JNIEnv* env,
+		jobject thiz, jlong handle)
+{
+	struct cam_session *session = get_session(handle);
+
+	if (session)
+		cam_session_stop_processing(session);
+}
+
+/*
+ * Stops streaming and lets go of the Surface, but keeps the camera and
+ * decoder open so resumeCamera is quick
+ */
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_pauseCamera(JNIEnv* env,
+		jobject thiz, jlong handle)
+{
+	struct cam_session *session = get_session(handle);
+
+	if (session == NULL)
+		return -1;
 
-	//info_msg("Getting camera frame...\n");
-	result = cameraGetFrame(usbCam, camData);
-	if (result < 0) {
-		err_msg("Could not get camera frame\n");
+	return cam_session_pause(session);
+}
+
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_resumeCamera(JNIEnv* env,
+		jobject thiz, jlong handle)
+{
+	struct cam_session *session = get_session(handle);
+
+	if (session == NULL)
+		return -1;
+
+	return cam_session_resume(session);
+}
+
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_getStats(JNIEnv* env,
+		jobject thiz, jlong handle, jlongArray stats)
+{
+	struct cam_session *session = get_session(handle);
+	long long values[PIPELINE_NUM_STATS];
+	jlong out[PIPELINE_NUM_STATS];
+	int count, i;
+
+	if (session == NULL)
+		return 0;
+
+	count = (*env)->GetArrayLength(env, stats);
+	count = pipeline_get_stats(&session->pipeline, values, count);
+	for (i = 0; i < count; i++)
+		out[i] = values[i];
+	(*env)->SetLongArrayRegion(env, stats, 0, count, out);
+
+	return count;
+}
+
+/*
+ * Takes a reference on the newest decoded frame and wraps its planes in
+ * direct ByteBuffers, so Java reads the pool memory without a copy. The
+ * frame stays valid until releaseFrame is called with the returned handle.
+ */
+JNIEXPORT jlong JNICALL Java_com_example_enzocamtest_CamView_acquireFrame(JNIEnv* env,
+		jobject thiz, jlong handle, jobjectArray planes, jlongArray info)
+{
+	struct cam_session *session = get_session(handle);
+	struct pool_frame *frame;
+	jlong out[FRAME_INFO_NUM];
+	jobject plane;
+	int i;
+
+	if (session == NULL)
+		return 0;
+	if ((*env)->GetArrayLength(env, planes) < FRAME_MAX_PLANES ||
+	    (*env)->GetArrayLength(env, info) < FRAME_INFO_NUM) {
+		err_msg("Frame arrays are too small\n");
+		return 0;
 	}
 
-	//info_msg("Decoding camera frame...\n");
-	result = decoderDecodeFrame(mjpgDec, camData, yuvData);
-	if (result < 0) {
-		err_msg("Could not decode MJPG frame\n");
+	frame = frame_pool_acquire(&session->frames);
+	if (frame == NULL)
+		return 0;
+	TRACE_INSTANT("java acquire", frame->frame_id);
+
+	for (i = 0; i < FRAME_MAX_PLANES; i++) {
+		plane = NULL;
+		if (i < frame->num_planes) {
+			plane = (*env)->NewDirectByteBuffer(env,
+					frame->planes[i], frame->plane_size[i]);
+			if (plane == NULL) {
+				frame_pool_release(&session->frames, frame);
+				return 0;
+			}
+		}
+		(*env)->SetObjectArrayElement(env, planes, i, plane);
+		if (plane)
+			(*env)->DeleteLocalRef(env, plane);
 	}
 
-	if(g2d_open(&g2d_handle)) {
-		err_msg("Encoder: g2d_open fail.\n");
+	memset(out, 0, sizeof(out));
+	out[FRAME_INFO_WIDTH] = frame->width;
+	out[FRAME_INFO_HEIGHT] = frame->height;
+	out[FRAME_INFO_COLOR_SPACE] = frame->color_space;
+	out[FRAME_INFO_TIMESTAMP] = frame->timestamp;
+	out[FRAME_INFO_SEQUENCE] = frame->sequence;
+	out[FRAME_INFO_PLANES] = frame->num_planes;
+	for (i = 0; i < frame->num_planes; i++)
+		out[FRAME_INFO_STRIDE + i] = frame->stride[i];
+	(*env)->SetLongArrayRegion(env, info, 0, FRAME_INFO_NUM, out);
+
+	return (jlong)(intptr_t)frame;
+}
+
+JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_releaseFrame(JNIEnv* env,
+		jobject thiz, jlong handle, jlong frame)
+{
+	struct cam_session *session = get_session(handle);
+
+	struct pool_frame *f = (struct pool_frame *)(intptr_t)frame;
+
+	if (session == NULL)
+		return;
+	if (!frame_pool_owns(&session->frames, f)) {
+		err_msg("Invalid frame handle\n");
 		return;
 	}
+	TRACE_INSTANT("java release", f->frame_id);
+	frame_pool_release(&session->frames, f);
+}
 
-	int y_size = info.width * info.height;
+/*
+ * Timing histogram of one STAGE_* stage, summed over all threads of the
+ * process. Fills stats in STAGE_STAT_* order.
+ */
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_getStageStats(JNIEnv* env,
+		jclass cls, jint stage, jlongArray stats)
+{
+	long long values[STAGE_NUM_STATS];
+	jlong out[STAGE_NUM_STATS];
+	int count, i;
 
-	y422_buf->buf_paddr = (unsigned char *)yuvData->pBufOut;
-	y422_buf->buf_vaddr = (unsigned char *)yuvData->vBufOut;
+	count = (*env)->GetArrayLength(env, stats);
+	count = stage_get_stats(stage, values, count);
+	if (count < 0)
+		return -1;
+	for (i = 0; i < count; i++)
+		out[i] = values[i];
+	(*env)->SetLongArrayRegion(env, stats, 0, count, out);
 
-	g2d_copy(g2d_handle, y420_buf, y422_buf, y_size);
-	g2d_finish(g2d_handle);
+	return count;
+}
 
-	unsigned char *u_src;
-	unsigned char *u_dst;
-	int i = 0;
+JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_resetStageStats(JNIEnv* env,
+		jclass cls)
+{
+	stage_reset();
+}
 
-	u_src = y422_buf->buf_vaddr + y_size;
-	u_dst = y420_buf->buf_vaddr + y_size;
-	while (i < info.height) {
-		memcpy(u_dst, u_src, info.width/2);
-		u_dst += info.width/2;
-		u_src += info.width;
-		i++;
-	}
+/*
+ * Record trace events until stopTrace, which writes them to path as
+ * Chrome trace JSON. Only the trace points of code built with ENZO_TRACE
+ * record anything.
+ */
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_startTrace(JNIEnv* env,
+		jclass cls, jstring path)
+{
+	const char *trace_path;
+	int ret;
 
-	//info_msg("Converting frame to RGB565...\n");
-	g2d_blit(g2d_handle, &y420_surf, &rgb_surf);
-	g2d_finish(g2d_handle);
-	g2d_close(g2d_handle);
+	trace_path = (*env)->GetStringUTFChars(env, path, 0);
+	ret = trace_start(trace_path);
+	(*env)->ReleaseStringUTFChars(env, path, trace_path);
 
-	//info_msg("Copy RGB frame to bitmap...\n");
-	memcpy(colors, rgb_buf->buf_vaddr, info.width * info.height * 2);
+	return ret;
+}
 
-	AndroidBitmap_unlockPixels(env, bitmap);
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_stopTrace(JNIEnv* env,
+		jclass cls)
+{
+	return trace_stop();
 }
 
-JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_startCamera(JNIEnv* env,
-		jobject thiz, jstring deviceName, jint width, jint height)
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_getStartupTimeline(JNIEnv* env,
+		jobject thiz, jlong handle, jlongArray times)
 {
-	int ret = 0;
-	const char* dev_name = (*env)->GetStringUTFChars(env, deviceName, 0);
+	struct cam_session *session = get_session(handle);
+	long long values[CAM_NUM_TIMES];
+	jlong out[CAM_NUM_TIMES];
+	int count, i;
 
-	/* Initialize all the structures we will be using */
-	mjpgDec = (struct decoderInstance *)calloc(1, sizeof(struct decoderInstance));
-	usbCam = (struct cameraInstance  *)calloc(1, sizeof(struct cameraInstance));
+	if (session == NULL)
+		return 0;
 
-	camData = (struct mediaBuffer *)calloc(1, sizeof(struct mediaBuffer));
-	yuvData = (struct mediaBuffer *)calloc(1, sizeof(struct mediaBuffer));
+	count = (*env)->GetArrayLength(env, times);
+	count = cam_session_get_timeline(session, values, count);
+	for (i = 0; i < count; i++)
+		out[i] = values[i];
+	(*env)->SetLongArrayRegion(env, times, 0, count, out);
 
-	y422_buf = (struct g2d_buf *)calloc(1, sizeof(struct g2d_buf));
+	return count;
+}
 
-	/* Set properties for H264 AVC decoder */
-	mjpgDec->type = MJPEG;
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_setViewRect(JNIEnv* env,
+		jobject thiz, jlong handle, jint view, jint left, jint top,
+		jint right, jint bottom, jint rotation)
+{
+	struct cam_session *session = get_session(handle);
 
-	/* Set properties for USB camera */
-	usbCam->type = MJPEG;
-	usbCam->width = width;
-	usbCam->height = height;
-	usbCam->fps = FPS;
-	strcpy(usbCam->deviceName, dev_name);
+	if (session == NULL)
+		return -1;
 
-	/* Init the VPU. This must be done before a codec can be used.
-	   If this fails, we need to bail. */
-	ret = vpuInit();
-	if (ret < 0)
+	return display_sink_set_view(&session->display, view, left, top,
+				     right, bottom, rotation);
+}
+
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_setSurface(JNIEnv* env,
+		jobject thiz, jlong handle, jobject surface)
+{
+	struct cam_session *session = get_session(handle);
+	ANativeWindow *window;
+	int ret;
+
+	if (session == NULL)
 		return -1;
 
-	if (cameraInit(usbCam) < 0)
-		ret = -1;
-	/* In order to init mjpg decoder, it must be supplied with bitstream
-	   parse */
-	ret = cameraGetFrame(usbCam, camData);
-	if (ret < 0) {
-		err_msg("Could not get camera frame\n");
-		ret = -1;
-	}
-	if (decoderInit(mjpgDec, camData) < 0) {
-		err_msg("Could not init MJPG decoder\n");
-		ret = -1;
+	if (surface == NULL)
+		return display_sink_set_window(&session->display, NULL);
+
+	window = ANativeWindow_fromSurface(env, surface);
+	if (window == NULL) {
+		err_msg("Could not get native window from surface\n");
+		return -1;
 	}
 
-	y420_buf = g2d_alloc(width * height * 2, 0);
-	rgb_buf = g2d_alloc(width * height * 2, 0);
-
-	rgb_surf.planes[0] = rgb_buf->buf_paddr;
-	rgb_surf.left = 0;
-	rgb_surf.top = 0;
-	rgb_surf.right = width;
-	rgb_surf.bottom = height;
-	rgb_surf.stride = width;
-	rgb_surf.width = width;
-	rgb_surf.height = height;
-	rgb_surf.rot = G2D_ROTATION_0;
-	rgb_surf.format = G2D_RGB565;
-
-	y420_surf.planes[0] = y420_buf->buf_paddr;
-	y420_surf.planes[1] = y420_surf.planes[0] + width*height;
-	y420_surf.planes[2] = y420_surf.planes[1] + width*height/4;
-	y420_surf.left = 0;
-	y420_surf.top = 0;
-	y420_surf.right = width;
-	y420_surf.bottom = height;
-	y420_surf.stride = width;
-	y420_surf.width  = width;
-	y420_surf.height = height;
-	y420_surf.rot    = G2D_ROTATION_0;
-	y420_surf.format = G2D_I420;
-
-	info_msg("Finished setting up JNI codec and camera!\n");
+	ret = display_sink_set_window(&session->display, window);
+	ANativeWindow_release(window);
 
 	return ret;
 }
 
+/*
+ * Returns right away. The VPU, camera and decoder come up on a background
+ * thread, which calls CamView.onCameraReady when it is done. The display
+ * can be configured in the meantime, and processCamera starts streaming
+ * as soon as the camera is ready. The stream parameters of the camera
+ * are kept in cacheDir to warm start the next session.
+ *
+ * Return: session handle, or 0 on failure
+ */
+JNIEXPORT jlong JNICALL Java_com_example_enzocamtest_CamView_startCamera(JNIEnv* env,
+		jobject thiz, jstring deviceName, jint width, jint height,
+		jstring cacheDir)
+{
+	struct cam_session *session;
+	const char *dev_name, *cache_dir = NULL;
+	jobject view;
+
+	dev_name = (*env)->GetStringUTFChars(env, deviceName, 0);
+	if (cacheDir != NULL)
+		cache_dir = (*env)->GetStringUTFChars(env, cacheDir, 0);
+	session = cam_session_create(dev_name, width, height, FPS, cache_dir);
+	(*env)->ReleaseStringUTFChars(env, deviceName, dev_name);
+	if (cache_dir != NULL)
+		(*env)->ReleaseStringUTFChars(env, cacheDir, cache_dir);
+	if (session == NULL)
+		return 0;
+
+	view = (*env)->NewGlobalRef(env, thiz);
+	if (cam_session_start(session, on_camera_ready, view) < 0) {
+		cam_session_destroy(session);
+		(*env)->DeleteGlobalRef(env, view);
+		return 0;
+	}
+
+	return (jlong)(intptr_t)session;
+}
+
 JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_stopCamera(JNIEnv* env,
-		jobject thiz)
+		jobject thiz, jlong handle)
 {
-	cameraDeinit(usbCam);
-	decoderDeinit(mjpgDec);
-	free(mjpgDec);
-	free(usbCam);
-	free(camData);
-	free(yuvData);
-	free(y422_buf);
-	g2d_free(rgb_buf);
-	g2d_free(y420_buf);
-	vpuDeinit();
+	struct cam_session *session = get_session(handle);
+	jobject view;
+
+	if (session == NULL)
+		return;
+
+	view = session->ready_arg;
+	cam_session_destroy(session);
+	(*env)->DeleteGlobalRef(env, view);
 }
 
 JNIEXPORT jboolean JNICALL Java_com_example_enzocamtest_CamView_cameraAttached(JNIEnv* env,
-		jobject thiz)
+		jobject thiz, jlong handle)
 {
-	return 0;
+	struct cam_session *session = get_session(handle);
+
+	if (session == NULL)
+		return JNI_FALSE;
+
+	return cam_session_attached(session) ? JNI_TRUE : JNI_FALSE;
 }
 
 jint JNI_OnLoad(JavaVM* vm, void* reserved)
 {
+	java_vm = vm;
 	return JNI_VERSION_1_6;
 }
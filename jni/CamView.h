@@ -7,40 +7,136 @@
 /*
  * Class:     com_example_enzocamtest_CamView
  * Method:    startCamera
- * Signature: (Ljava/lang/String;II)I
+ * Signature: (Ljava/lang/String;IILjava/lang/String;)J
  */
-JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_startCamera
-  (JNIEnv *, jobject, jstring, jint, jint);
+JNIEXPORT jlong JNICALL Java_com_example_enzocamtest_CamView_startCamera
+  (JNIEnv *, jobject, jstring, jint, jint, jstring);
 
 /*
  * Class:     com_example_enzocamtest_CamView
  * Method:    processCamera
- * Signature: ()V
+ * Signature: (J)V
  */
 JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_processCamera
-  (JNIEnv *, jobject);
+  (JNIEnv *, jobject, jlong);
 
 /*
  * Class:     com_example_enzocamtest_CamView
  * Method:    cameraAttached
- * Signature: ()Z
+ * Signature: (J)Z
  */
 JNIEXPORT jboolean JNICALL Java_com_example_enzocamtest_CamView_cameraAttached
-  (JNIEnv *, jobject);
+  (JNIEnv *, jobject, jlong);
 
 /*
  * Class:     com_example_enzocamtest_CamView
  * Method:    stopCamera
- * Signature: ()V
+ * Signature: (J)V
  */
 JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_stopCamera
-  (JNIEnv *, jobject);
+  (JNIEnv *, jobject, jlong);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    stopProcessing
+ * Signature: (J)V
+ */
+JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_stopProcessing
+  (JNIEnv *, jobject, jlong);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    pauseCamera
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_pauseCamera
+  (JNIEnv *, jobject, jlong);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    resumeCamera
+ * Signature: (J)I
+ */
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_resumeCamera
+  (JNIEnv *, jobject, jlong);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    getStats
+ * Signature: (J[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_getStats
+  (JNIEnv *, jobject, jlong, jlongArray);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    setSurface
+ * Signature: (JLandroid/view/Surface;)I
+ */
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_setSurface
+  (JNIEnv *, jobject, jlong, jobject);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    setViewRect
+ * Signature: (JIIIIII)I
+ */
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_setViewRect
+  (JNIEnv *, jobject, jlong, jint, jint, jint, jint, jint, jint);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    acquireFrame
+ * Signature: (J[Ljava/nio/ByteBuffer;[J)J
+ */
+JNIEXPORT jlong JNICALL Java_com_example_enzocamtest_CamView_acquireFrame
+  (JNIEnv *, jobject, jlong, jobjectArray, jlongArray);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    releaseFrame
+ * Signature: (JJ)V
+ */
+JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_releaseFrame
+  (JNIEnv *, jobject, jlong, jlong);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    getStageStats
+ * Signature: (I[J)I
+ */
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_getStageStats
+  (JNIEnv *, jclass, jint, jlongArray);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    resetStageStats
+ * Signature: ()V
+ */
+JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_resetStageStats
+  (JNIEnv *, jclass);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    startTrace
+ * Signature: (Ljava/lang/String;)I
+ */
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_startTrace
+  (JNIEnv *, jclass, jstring);
+
+/*
+ * Class:     com_example_enzocamtest_CamView
+ * Method:    stopTrace
+ * Signature: ()I
+ */
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_stopTrace
+  (JNIEnv *, jclass);
 
 /*
  * Class:     com_example_enzocamtest_CamView
- * Method:    loadNextFrame
- * Signature: (Landroid/graphics/Bitmap;)V
+ * Method:    getStartupTimeline
+ * Signature: (J[J)I
  */
-JNIEXPORT void JNICALL Java_com_example_enzocamtest_CamView_loadNextFrame
-  (JNIEnv *, jobject, jobject);
+JNIEXPORT jint JNICALL Java_com_example_enzocamtest_CamView_getStartupTimeline
+  (JNIEnv *, jobject, jlong, jlongArray);
 
@@ -0,0 +1,424 @@
+#include "cam_session.h"
+#include "stream_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* The VPU is shared by all sessions, so it is initialized by the first
+   session and deinitialized with the last one */
+static pthread_mutex_t vpu_lock = PTHREAD_MUTEX_INITIALIZER;
+static int vpu_users;
+
+/* Function prototypes */
+static long long now_us(void);
+static int vpu_get(void);
+static void vpu_put(void);
+static void *vpu_start_thread(void *arg);
+static void *cam_start_thread(void *arg);
+static void release_resources(struct cam_session *session);
+static int process_locked(struct cam_session *session);
+static void update_cache(struct cam_session *session);
+/* End function prototypes */
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int vpu_get(void)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&vpu_lock);
+	/* Init the VPU. This must be done before a codec can be used. */
+	if (vpu_users == 0)
+		ret = vpuInit();
+	if (ret == 0)
+		vpu_users++;
+	pthread_mutex_unlock(&vpu_lock);
+
+	return ret;
+}
+
+static void vpu_put(void)
+{
+	pthread_mutex_lock(&vpu_lock);
+	if (--vpu_users == 0)
+		vpuDeinit();
+	pthread_mutex_unlock(&vpu_lock);
+}
+
+/*
+ * Loads the VPU firmware, reserves the contiguous memory arena and
+ * calibrates the copy engine, while the camera starts streaming
+ */
+static void *vpu_start_thread(void *arg)
+{
+	struct cam_session *session = arg;
+
+	if (vpu_get() == 0)
+		session->has_vpu = 1;
+
+	/* With the stream parameters of the last session, the decoder's
+	   framebuffers are allocated now instead of after the first parse */
+	if (session->has_vpu &&
+	    stream_cache_load(session->cache_dir, session->usbCam.deviceName,
+			      session->usbCam.width, session->usbCam.height,
+			      &session->cached_params) == 0 &&
+	    decoderPrewarm(&session->mjpgDec, &session->cached_params) == 0)
+		session->warm_start = 1;
+	session->timeline[CAM_TIME_VPU_READY] = now_us() - session->start_time;
+
+	return NULL;
+}
+
+static void *cam_start_thread(void *arg)
+{
+	struct cam_session *session = arg;
+	pthread_t vpu_thread;
+	int vpu_async, ok = 0;
+
+	vpu_async = pthread_create(&vpu_thread, NULL, vpu_start_thread,
+				   session) == 0;
+	if (!vpu_async)
+		vpu_start_thread(session);
+
+	/* Opening the device includes the first blocking DQBUF, which is
+	   the slowest part of startup */
+	if (cameraInit(&session->usbCam) < 0) {
+		err_msg("Could not init camera %s\n",
+			session->usbCam.deviceName);
+	} else {
+		session->has_camera = 1;
+	}
+	session->timeline[CAM_TIME_CAMERA_OPEN] = now_us() -
+						  session->start_time;
+
+	/* In order to init mjpg decoder, it must be supplied with bitstream
+	   parse. The frame dequeued by cameraInit is good for that. */
+	if (session->has_camera &&
+	    cameraGetCurrentFrame(&session->usbCam, &session->camData) < 0)
+		err_msg("Could not get camera frame\n");
+	session->timeline[CAM_TIME_FIRST_FRAME] = now_us() -
+						  session->start_time;
+
+	if (vpu_async)
+		pthread_join(vpu_thread, NULL);
+
+	if (session->has_vpu && session->has_camera) {
+		if (decoderInit(&session->mjpgDec, &session->camData) < 0)
+			err_msg("Could not init MJPG decoder\n");
+		else
+			session->has_decoder = 1;
+	}
+	session->timeline[CAM_TIME_DECODER_READY] = now_us() -
+						    session->start_time;
+
+	if (session->has_decoder) {
+		ok = 1;
+		update_cache(session);
+	} else {
+		release_resources(session);
+	}
+
+	pthread_mutex_lock(&session->lock);
+	session->state = ok ? CAM_READY : CAM_FAILED;
+	session->timeline[CAM_TIME_READY] = now_us() - session->start_time;
+	if (ok && session->paused)
+		cameraPause(&session->usbCam);
+	else if (ok && session->process_pending)
+		process_locked(session);
+	pthread_mutex_unlock(&session->lock);
+
+	info_msg("Camera %s: %s after %lld ms (VPU %lld ms, camera %lld ms, "
+		 "first frame %lld ms, decoder %lld ms)\n",
+		 session->usbCam.deviceName, ok ? "ready" : "failed",
+		 session->timeline[CAM_TIME_READY] / 1000,
+		 session->timeline[CAM_TIME_VPU_READY] / 1000,
+		 session->timeline[CAM_TIME_CAMERA_OPEN] / 1000,
+		 session->timeline[CAM_TIME_FIRST_FRAME] / 1000,
+		 session->timeline[CAM_TIME_DECODER_READY] / 1000);
+
+	if (session->ready_cb)
+		session->ready_cb(session, ok, session->ready_arg);
+
+	return NULL;
+}
+
+/*
+ * Confirm the cached stream parameters against the parsed stream, and
+ * save them when they are new or changed
+ */
+static void update_cache(struct cam_session *session)
+{
+	struct decoder_params params;
+
+	if (decoderGetStreamParams(&session->mjpgDec, &params) < 0)
+		return;
+
+	if (session->warm_start &&
+	    memcmp(&params, &session->cached_params, sizeof(params)) == 0) {
+		info_msg("Camera %s: warm start confirmed\n",
+			 session->usbCam.deviceName);
+		return;
+	}
+
+	if (session->warm_start)
+		warn_msg("Camera %s: stream parameters changed, updating "
+			 "cache\n", session->usbCam.deviceName);
+	stream_cache_store(session->cache_dir, session->usbCam.deviceName,
+			   session->usbCam.width, session->usbCam.height,
+			   &params);
+}
+
+static void release_resources(struct cam_session *session)
+{
+	if (session->has_decoder)
+		decoderDeinit(&session->mjpgDec);
+	if (session->has_camera)
+		cameraDeinit(&session->usbCam);
+	if (session->has_vpu)
+		vpu_put();
+	session->has_decoder = 0;
+	session->has_camera = 0;
+	session->has_vpu = 0;
+}
+
+/*
+ * Allocate a session. Nothing is opened until cam_session_start, but the
+ * display can be configured right away. Stream parameters are cached in
+ * cache_dir, which may be NULL.
+ *
+ * Return: session, or NULL on failure
+ */
+struct cam_session *cam_session_create(const char *dev_name, int width,
+				       int height, int fps,
+				       const char *cache_dir)
+{
+	struct cam_session *session;
+
+	/* Initialize all the structures we will be using */
+	session = (struct cam_session *)calloc(1, sizeof(struct cam_session));
+	if (session == NULL) {
+		err_msg("Could not allocate camera session\n");
+		return NULL;
+	}
+
+	/* Set properties for MJPEG decoder */
+	session->mjpgDec.type = MJPEG;
+	session->mjpgDec.chromaInterleave = 1;
+
+	/* Set properties for USB camera */
+	session->usbCam.type = MJPEG;
+	session->usbCam.width = width;
+	session->usbCam.height = height;
+	session->usbCam.fps = fps;
+	strncpy(session->usbCam.deviceName, dev_name,
+		sizeof(session->usbCam.deviceName) - 1);
+	if (cache_dir)
+		strncpy(session->cache_dir, cache_dir,
+			sizeof(session->cache_dir) - 1);
+
+	if (display_sink_init(&session->display) < 0) {
+		err_msg("Could not init display sink\n");
+		free(session);
+		return NULL;
+	}
+
+	if (frame_pool_init(&session->frames) < 0) {
+		display_sink_deinit(&session->display);
+		free(session);
+		return NULL;
+	}
+
+	pthread_mutex_init(&session->lock, NULL);
+	session->state = CAM_STARTING;
+
+	return session;
+}
+
+/*
+ * Bring up the VPU, camera and decoder on a background thread and return
+ * right away. cb is called from that thread once the session is ready or
+ * has failed.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int cam_session_start(struct cam_session *session, cam_ready_cb cb,
+		      void *arg)
+{
+	session->ready_cb = cb;
+	session->ready_arg = arg;
+	session->start_time = now_us();
+
+	if (pthread_create(&session->start_thread, NULL, cam_start_thread,
+			   session) != 0) {
+		err_msg("Could not start camera startup thread\n");
+		session->state = CAM_FAILED;
+		return -1;
+	}
+	session->has_start_thread = 1;
+
+	return 0;
+}
+
+/*
+ * Start moving frames to the display. While the session is still
+ * starting, the pipeline is started as soon as it is ready.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int cam_session_process(struct cam_session *session)
+{
+	int ret;
+
+	pthread_mutex_lock(&session->lock);
+	ret = process_locked(session);
+	pthread_mutex_unlock(&session->lock);
+
+	return ret;
+}
+
+static int process_locked(struct cam_session *session)
+{
+	if (session->state == CAM_STARTING) {
+		session->process_pending = 1;
+		return 0;
+	}
+	if (session->state == CAM_FAILED)
+		return -1;
+	if (session->paused) {
+		err_msg("Camera %s is paused\n", session->usbCam.deviceName);
+		return -1;
+	}
+
+	/* Capture, decode and display all happen on the pipeline thread, so
+	   nothing crosses JNI per frame */
+	session->pipeline.camera = &session->usbCam;
+	session->pipeline.decoder = &session->mjpgDec;
+	session->pipeline.cam_buf = &session->camData;
+	session->pipeline.yuv_buf = &session->yuvData;
+	session->pipeline.display = &session->display;
+	session->pipeline.frames = &session->frames;
+	if (pipeline_start(&session->pipeline) < 0) {
+		err_msg("Could not start camera pipeline\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Stop moving frames, and cancel a start requested while starting up.
+ * The camera keeps its buffers and the decoder stays open.
+ */
+void cam_session_stop_processing(struct cam_session *session)
+{
+	pthread_mutex_lock(&session->lock);
+	session->process_pending = 0;
+	pipeline_stop(&session->pipeline);
+	pthread_mutex_unlock(&session->lock);
+}
+
+/*
+ * Stop moving frames, stop the camera from streaming and let go of the
+ * window. The decoder, its framebuffers and the camera's buffers are kept,
+ * so cam_session_resume does not have to set anything up again. While the
+ * session is still starting, it is paused as soon as it is ready.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int cam_session_pause(struct cam_session *session)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&session->lock);
+	session->process_pending = 0;
+	pipeline_stop(&session->pipeline);
+	if (!session->paused && session->state == CAM_READY)
+		ret = cameraPause(&session->usbCam);
+	session->paused = 1;
+	pthread_mutex_unlock(&session->lock);
+
+	display_sink_set_window(&session->display, NULL);
+
+	return ret;
+}
+
+/*
+ * Restart the camera after cam_session_pause. Frames are moved again once
+ * cam_session_process is called.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int cam_session_resume(struct cam_session *session)
+{
+	long long start = now_us();
+	int ret = 0;
+
+	pthread_mutex_lock(&session->lock);
+	if (session->paused && session->state == CAM_READY)
+		ret = cameraResume(&session->usbCam);
+	if (ret == 0)
+		session->paused = 0;
+	pthread_mutex_unlock(&session->lock);
+
+	if (ret == 0)
+		info_msg("Camera %s: resumed in %lld us\n",
+			 session->usbCam.deviceName, now_us() - start);
+
+	return ret;
+}
+
+/*
+ * Stop everything and free the session. Waits for a startup in progress.
+ */
+void cam_session_destroy(struct cam_session *session)
+{
+	if (session->has_start_thread)
+		pthread_join(session->start_thread, NULL);
+
+	pipeline_stop(&session->pipeline);
+	release_resources(session);
+	frame_pool_deinit(&session->frames);
+	display_sink_deinit(&session->display);
+	pthread_mutex_destroy(&session->lock);
+	free(session);
+}
+
+/*
+ * Return: 1 = the camera is open and the session is ready, 0 = it is
+ * still starting or has failed
+ */
+int cam_session_attached(struct cam_session *session)
+{
+	int attached;
+
+	pthread_mutex_lock(&session->lock);
+	attached = session->state == CAM_READY && session->has_camera;
+	pthread_mutex_unlock(&session->lock);
+
+	return attached;
+}
+
+/*
+ * Copy up to count values, in CAM_TIME_* order, into times.
+ *
+ * Return: number of values copied
+ */
+int cam_session_get_timeline(struct cam_session *session, long long *times,
+			     int count)
+{
+	if (count > CAM_NUM_TIMES)
+		count = CAM_NUM_TIMES;
+
+	pthread_mutex_lock(&session->lock);
+	memcpy(times, session->timeline, count * sizeof(*times));
+	pthread_mutex_unlock(&session->lock);
+
+	return count;
+}
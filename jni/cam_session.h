@@ -0,0 +1,92 @@
+#ifndef CAM_SESSION_H
+#define CAM_SESSION_H
+
+#include "enzo_codec.h"
+#include "display_sink.h"
+#include "pipeline.h"
+
+#include <pthread.h>
+
+/* Session states */
+enum {
+	CAM_STARTING = 0,
+	CAM_READY,
+	CAM_FAILED
+};
+
+/* Startup timeline, in microseconds since the start was requested. The
+   VPU is brought up in parallel with the camera, so VPU_READY and
+   CAMERA_OPEN overlap. Order matches CamView.java. */
+enum {
+	CAM_TIME_VPU_READY = 0,
+	CAM_TIME_CAMERA_OPEN,
+	CAM_TIME_FIRST_FRAME,
+	CAM_TIME_DECODER_READY,
+	CAM_TIME_READY,
+	CAM_NUM_TIMES
+};
+
+struct cam_session;
+
+/* Called once from the startup thread when the session is ready to
+   stream (ok = 1) or has failed to start (ok = 0) */
+typedef void (*cam_ready_cb)(struct cam_session *session, int ok, void *arg);
+
+/*
+ * One camera pipeline: camera, MJPEG decoder, media buffers, display and
+ * the thread moving frames between them.
+ */
+struct cam_session {
+	/* These are the control structures for the decoder and camera */
+	struct decoderInstance mjpgDec;
+	struct cameraInstance usbCam;
+
+	/* Control structures for the media buffers, which are used to
+	   pass data between sources (like a camera or file), and pass them
+	   to other components (like the VPU, a file, or a buffer) */
+	struct mediaBuffer camData;
+	struct mediaBuffer yuvData;
+
+	/* Decoded frames are composed into the window of the Surface */
+	struct display_sink display;
+
+	/* Thread that moves frames from the camera to the display */
+	struct pipeline pipeline;
+
+	/* Decoded frames shared with the Java analytics */
+	struct frame_pool frames;
+
+	/* Startup */
+	pthread_t start_thread;
+	int has_start_thread;
+	pthread_mutex_t lock;
+	int state;
+	int process_pending;	/* Start the pipeline once ready */
+	int paused;		/* Camera is not streaming, see cam_session_pause */
+	int has_vpu;
+	int has_camera;
+	int has_decoder;
+	int warm_start;		/* Framebuffers were prepared from the cache */
+	struct decoder_params cached_params;
+	char cache_dir[256];
+	cam_ready_cb ready_cb;
+	void *ready_arg;
+	long long start_time;
+	long long timeline[CAM_NUM_TIMES];
+};
+
+struct cam_session *cam_session_create(const char *dev_name, int width,
+				       int height, int fps,
+				       const char *cache_dir);
+int cam_session_start(struct cam_session *session, cam_ready_cb cb,
+		      void *arg);
+int cam_session_process(struct cam_session *session);
+void cam_session_stop_processing(struct cam_session *session);
+int cam_session_pause(struct cam_session *session);
+int cam_session_resume(struct cam_session *session);
+void cam_session_destroy(struct cam_session *session);
+int cam_session_attached(struct cam_session *session);
+int cam_session_get_timeline(struct cam_session *session, long long *times,
+			     int count);
+
+#endif // CAM_SESSION_H
@@ -0,0 +1,496 @@
+#include "display_sink.h"
+#include "enzo_mem.h"
+#include "color_convert.h"
+#include "g2d_session.h"
+#include "stage_stats.h"
+#include "enzo_trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Function prototypes */
+static int alloc_comp(struct display_sink *sink, int width, int height);
+static void free_comp(struct display_sink *sink);
+static int clip_view(struct display_sink *sink, struct display_view *view,
+		     struct display_view *clip);
+static int draw_view_sw(struct display_sink *sink, struct display_view *view,
+			struct mediaBuffer *frame, u8 *bits, int stride);
+static void rotate_rgb565(const u8 *src, int src_width, int src_height,
+			  u8 *dst, int dst_stride, int rot);
+static void queue_view_g2d(struct display_sink *sink,
+			   struct g2d_session *g2d, struct display_view *view,
+			   struct mediaBuffer *frame);
+static void copy_rows(ANativeWindow_Buffer *buf, const u8 *src,
+		      int src_stride, int width, int height);
+static void clear_background(ANativeWindow_Buffer *buf, int width,
+			     int height, struct display_view *views,
+			     int count);
+static int render_direct(struct display_sink *sink,
+			 struct mediaBuffer *frames[], int count);
+/* End function prototypes */
+
+/*
+ * Return: 0 = success, -1 = failure
+ */
+int display_sink_init(struct display_sink *sink)
+{
+	memset(sink, 0, sizeof(*sink));
+	pthread_mutex_init(&sink->lock, NULL);
+
+	return 0;
+}
+
+void display_sink_deinit(struct display_sink *sink)
+{
+	display_sink_set_window(sink, NULL);
+	free_comp(sink);
+	free(sink->rot_buf);
+	sink->rot_buf = NULL;
+	pthread_mutex_destroy(&sink->lock);
+}
+
+static int alloc_comp(struct display_sink *sink, int width, int height)
+{
+	free_comp(sink);
+
+	/* The CPU copies the composition out, so it is cacheable */
+	sink->comp_buf = contig_g2d_alloc(width * height * 2, 1);
+	if (sink->comp_buf) {
+		sink->comp = sink->comp_buf->buf_vaddr;
+		memset(sink->comp, 0, width * height * 2);
+		contig_sync_for_device(sink->comp_buf);
+
+		sink->comp_surf.planes[0] = sink->comp_buf->buf_paddr;
+		sink->comp_surf.stride = width;
+		sink->comp_surf.width = width;
+		sink->comp_surf.height = height;
+		sink->comp_surf.format = G2D_RGB565;
+	} else {
+		warn_msg("Display: No contiguous composition buffer, "
+			 "drawing on CPU\n");
+		sink->comp = calloc(1, width * height * 2);
+		if (sink->comp == NULL) {
+			err_msg("Display: Could not allocate composition\n");
+			return -1;
+		}
+	}
+
+	sink->width = width;
+	sink->height = height;
+
+	return 0;
+}
+
+static void free_comp(struct display_sink *sink)
+{
+	if (sink->comp_buf)
+		contig_g2d_free(sink->comp_buf);
+	else
+		free(sink->comp);
+	sink->comp_buf = NULL;
+	sink->comp = NULL;
+	sink->width = 0;
+	sink->height = 0;
+}
+
+/*
+ * Attach the sink to a window, or detach it when window is NULL. The sink
+ * takes its own reference on the window. Window buffers match the window
+ * size, so the composition is shown without further scaling.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int display_sink_set_window(struct display_sink *sink, ANativeWindow *window)
+{
+	int width, height;
+	int ret = 0;
+
+	pthread_mutex_lock(&sink->lock);
+
+	if (sink->window)
+		ANativeWindow_release(sink->window);
+	sink->window = NULL;
+
+	if (window == NULL)
+		goto out;
+
+	width = ANativeWindow_getWidth(window);
+	height = ANativeWindow_getHeight(window);
+	if (ANativeWindow_setBuffersGeometry(window, width, height,
+					     WINDOW_FORMAT_RGB_565) < 0) {
+		err_msg("Display: Could not set window geometry\n");
+		ret = -1;
+		goto out;
+	}
+
+	if (sink->comp == NULL || width != sink->width ||
+	    height != sink->height) {
+		if (alloc_comp(sink, width, height) < 0) {
+			ret = -1;
+			goto out;
+		}
+	}
+
+	ANativeWindow_acquire(window);
+	sink->window = window;
+
+out:
+	pthread_mutex_unlock(&sink->lock);
+
+	return ret;
+}
+
+/*
+ * Set where the stream with the given index is drawn. An empty rectangle
+ * disables the view.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int display_sink_set_view(struct display_sink *sink, int index, int left,
+			  int top, int right, int bottom, int rot)
+{
+	struct display_view *view;
+
+	if (index < 0 || index >= DISPLAY_MAX_VIEWS) {
+		err_msg("Display: Invalid view %d\n", index);
+		return -1;
+	}
+	if (rot != 0 && rot != 90 && rot != 180 && rot != 270) {
+		err_msg("Display: Invalid rotation %d\n", rot);
+		return -1;
+	}
+
+	pthread_mutex_lock(&sink->lock);
+	view = &sink->views[index];
+	view->left = left;
+	view->top = top;
+	view->right = right;
+	view->bottom = bottom;
+	view->rot = rot;
+	view->enabled = right > left && bottom > top;
+	pthread_mutex_unlock(&sink->lock);
+
+	return 0;
+}
+
+/*
+ * Clip a view to the composition. The whole frame is still scaled to the
+ * clipped rectangle, as views are only ever clipped by a window resize
+ * racing with set_view.
+ *
+ * Return: 1 = something to draw, 0 = nothing to draw
+ */
+static int clip_view(struct display_sink *sink, struct display_view *view,
+		     struct display_view *clip)
+{
+	*clip = *view;
+	if (clip->left < 0)
+		clip->left = 0;
+	if (clip->top < 0)
+		clip->top = 0;
+	if (clip->right > sink->width)
+		clip->right = sink->width;
+	if (clip->bottom > sink->height)
+		clip->bottom = sink->height;
+
+	return view->enabled && clip->right > clip->left &&
+	       clip->bottom > clip->top;
+}
+
+/*
+ * Draw a view into an RGB565 picture at bits, the composition or a
+ * window buffer. The scaler only flips, so a 90 or 270 degree view is
+ * converted into rot_buf at its unrotated size and turned from there.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int draw_view_sw(struct display_sink *sink, struct display_view *view,
+			struct mediaBuffer *frame, u8 *bits, int stride)
+{
+	u8 *dst = bits + view->top * stride + view->left * 2;
+	int width = view->right - view->left;
+	int height = view->bottom - view->top;
+	u8 *p;
+
+	sink->sw_draws++;
+	if (view->rot != 90 && view->rot != 270)
+		return color_convert_scaled(frame, dst, stride, width, height,
+					    view->rot == 180, CC_RGB565);
+
+	if (sink->rot_size < width * height * 2) {
+		p = realloc(sink->rot_buf, width * height * 2);
+		if (p == NULL) {
+			err_msg("Display: Could not allocate rotation "
+				"buffer\n");
+			return -1;
+		}
+		sink->rot_buf = p;
+		sink->rot_size = width * height * 2;
+	}
+	if (color_convert_scaled(frame, sink->rot_buf, height * 2, height,
+				 width, 0, CC_RGB565) < 0)
+		return -1;
+	rotate_rgb565(sink->rot_buf, height, width, dst, stride, view->rot);
+
+	return 0;
+}
+
+/*
+ * Turn a src_width x src_height picture clockwise by rot degrees (90 or
+ * 270), the direction g2d rotates in
+ */
+static void rotate_rgb565(const u8 *src, int src_width, int src_height,
+			  u8 *dst, int dst_stride, int rot)
+{
+	const u16 *s = (const u16 *)src;
+	u16 *out;
+	int x, y;
+
+	for (y = 0; y < src_width; y++) {
+		out = (u16 *)(dst + y * dst_stride);
+		if (rot == 90) {
+			for (x = 0; x < src_height; x++)
+				out[x] = s[(src_height - 1 - x) * src_width +
+					   y];
+		} else {
+			for (x = 0; x < src_height; x++)
+				out[x] = s[x * src_width + src_width - 1 - y];
+		}
+	}
+}
+
+static void queue_view_g2d(struct display_sink *sink,
+			   struct g2d_session *g2d, struct display_view *view,
+			   struct mediaBuffer *frame)
+{
+	struct g2d_surface src, dst;
+
+	memset(&src, 0, sizeof(src));
+	src.format = G2D_NV16;
+	src.planes[0] = (int)(unsigned long)frame->pBufOut;
+	src.planes[1] = src.planes[0] + frame->width * frame->height;
+	src.right = frame->imageWidth > 0 ? frame->imageWidth : frame->width;
+	src.bottom = frame->imageHeight > 0 ? frame->imageHeight :
+					       frame->height;
+	src.stride = frame->width;
+	src.width = frame->width;
+	src.height = frame->height;
+	src.rot = G2D_ROTATION_0;
+
+	dst = sink->comp_surf;
+	dst.left = view->left;
+	dst.top = view->top;
+	dst.right = view->right;
+	dst.bottom = view->bottom;
+	dst.rot = view->rot == 90 ? G2D_ROTATION_90 :
+		  view->rot == 180 ? G2D_ROTATION_180 :
+		  view->rot == 270 ? G2D_ROTATION_270 : G2D_ROTATION_0;
+
+	g2d_session_blit(g2d, &src, &dst);
+	sink->blits++;
+}
+
+static void copy_rows(ANativeWindow_Buffer *buf, const u8 *src,
+		      int src_stride, int width, int height)
+{
+	u8 *dst = buf->bits;
+	int row;
+
+	for (row = 0; row < height; row++) {
+		memcpy(dst, src, width * 2);
+		dst += buf->stride * 2;
+		src += src_stride;
+	}
+}
+
+/*
+ * Window buffers are not preserved between frames, so everything outside
+ * the views is cleared. Views are already clipped to width x height.
+ */
+static void clear_background(ANativeWindow_Buffer *buf, int width,
+			     int height, struct display_view *views,
+			     int count)
+{
+	struct display_view *v[DISPLAY_MAX_VIEWS], *t;
+	u8 *line;
+	int x, y, i, j, n;
+
+	for (y = 0; y < height; y++) {
+		/* Views crossing this row, from left to right */
+		n = 0;
+		for (i = 0; i < count; i++) {
+			if (!views[i].enabled || y < views[i].top ||
+			    y >= views[i].bottom)
+				continue;
+			for (j = n++; j > 0 && v[j - 1]->left > views[i].left;
+			     j--)
+				v[j] = v[j - 1];
+			v[j] = &views[i];
+		}
+
+		line = (u8 *)buf->bits + y * buf->stride * 2;
+		x = 0;
+		for (i = 0; i < n; i++) {
+			t = v[i];
+			if (t->left > x)
+				memset(line + x * 2, 0, (t->left - x) * 2);
+			if (t->right > x)
+				x = t->right;
+		}
+		if (width > x)
+			memset(line + x * 2, 0, (width - x) * 2);
+	}
+}
+
+/*
+ * Draw every view on the CPU straight into the window buffer, which saves
+ * the composition copy when g2d has nothing to do. Called with the lock
+ * held; every enabled view must have a frame.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int render_direct(struct display_sink *sink,
+			 struct mediaBuffer *frames[], int count)
+{
+	struct display_view views[DISPLAY_MAX_VIEWS], *v;
+	ANativeWindow_Buffer buf;
+	int width, height, i;
+
+	if (ANativeWindow_lock(sink->window, &buf, NULL) < 0) {
+		err_msg("Display: Could not lock window\n");
+		sink->frames_dropped++;
+		return -1;
+	}
+
+	/* The buffer can lag behind a window resize for a frame */
+	width = buf.width < sink->width ? buf.width : sink->width;
+	height = buf.height < sink->height ? buf.height : sink->height;
+
+	TRACE_BEGIN("sw draw", frames[0] ? frames[0]->frameId : 0);
+	for (i = 0; i < count; i++) {
+		v = &views[i];
+		if (!clip_view(sink, &sink->views[i], v))
+			v->enabled = 0;
+		if (v->right > width)
+			v->right = width;
+		if (v->bottom > height)
+			v->bottom = height;
+		if (v->right <= v->left || v->bottom <= v->top)
+			v->enabled = 0;
+	}
+	clear_background(&buf, width, height, views, count);
+	for (i = 0; i < count; i++) {
+		if (views[i].enabled)
+			draw_view_sw(sink, &views[i], frames[i], buf.bits,
+				     buf.stride * 2);
+	}
+	TRACE_END("sw draw", frames[0] ? frames[0]->frameId : 0);
+
+	ANativeWindow_unlockAndPost(sink->window);
+	sink->frames_shown++;
+
+	return 0;
+}
+
+/*
+ * Compose frames[i] into view i and show the result. A NULL frame keeps
+ * the last composed picture of its view. Frames are dropped while no
+ * window is attached.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int display_sink_render(struct display_sink *sink,
+			struct mediaBuffer *frames[], int count)
+{
+	struct g2d_session *g2d = NULL;
+	struct g2d_fence fence;
+	struct display_view view;
+	ANativeWindow_Buffer buf;
+	int use_g2d[DISPLAY_MAX_VIEWS];
+	int width, height, i;
+	int drawn = 0, queued = 0, direct = 1;
+	int ret = 0;
+	long long start;
+
+	pthread_mutex_lock(&sink->lock);
+
+	if (sink->window == NULL || sink->comp == NULL) {
+		sink->frames_dropped++;
+		goto out;
+	}
+
+	if (count > DISPLAY_MAX_VIEWS)
+		count = DISPLAY_MAX_VIEWS;
+	if (sink->comp_buf)
+		g2d = g2d_session_get();
+
+	for (i = 0; i < count; i++) {
+		use_g2d[i] = g2d && frames[i] &&
+			     frames[i]->colorSpace == NV16;
+		if (clip_view(sink, &sink->views[i], &view) &&
+		    (use_g2d[i] || frames[i] == NULL))
+			direct = 0;
+	}
+
+	/* Only g2d needs the composition, whose memory it can address */
+	if (direct) {
+		ret = render_direct(sink, frames, count);
+		goto out;
+	}
+
+	/* CPU drawn views go first, and are cleaned out of the cache before
+	   g2d writes the other views around them */
+	for (i = 0; i < count; i++) {
+		if (frames[i] == NULL || use_g2d[i] ||
+		    !clip_view(sink, &sink->views[i], &view))
+			continue;
+		draw_view_sw(sink, &view, frames[i], sink->comp,
+			     sink->width * 2);
+		drawn++;
+	}
+	if (drawn && sink->comp_buf)
+		contig_sync_for_device(sink->comp_buf);
+
+	/* All g2d views go out in one submission */
+	for (i = 0; i < count; i++) {
+		if (!use_g2d[i] || !clip_view(sink, &sink->views[i], &view))
+			continue;
+		queue_view_g2d(sink, g2d, &view, frames[i]);
+		queued++;
+	}
+	if (queued)
+		g2d_session_flush(g2d, &fence);
+
+	/* Dequeue the window buffer while g2d is still working */
+	if (ANativeWindow_lock(sink->window, &buf, NULL) < 0) {
+		err_msg("Display: Could not lock window\n");
+		if (queued)
+			g2d_session_wait(&fence);
+		sink->frames_dropped++;
+		ret = -1;
+		goto out;
+	}
+
+	if (queued) {
+		start = stage_now_us();
+		g2d_session_wait(&fence);
+		contig_sync_for_cpu(sink->comp_buf);
+		TRACE_SPAN("g2d wait", frames[0] ? frames[0]->frameId : 0,
+			   start);
+	}
+
+	width = buf.width < sink->width ? buf.width : sink->width;
+	height = buf.height < sink->height ? buf.height : sink->height;
+	start = stage_now_us();
+	copy_rows(&buf, sink->comp, sink->width * 2, width, height);
+	stage_record(STAGE_DISPLAY_COPY, stage_now_us() - start);
+	TRACE_SPAN("window copy", frames[0] ? frames[0]->frameId : 0, start);
+
+	ANativeWindow_unlockAndPost(sink->window);
+	sink->frames_shown++;
+
+out:
+	pthread_mutex_unlock(&sink->lock);
+
+	return ret;
+}
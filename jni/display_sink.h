@@ -0,0 +1,68 @@
+#ifndef DISPLAY_SINK_H
+#define DISPLAY_SINK_H
+
+#include "enzo_utils.h"
+#include "g2d.h"
+
+#include <android/native_window.h>
+#include <pthread.h>
+
+/* Local preview and remote view */
+#define DISPLAY_MAX_VIEWS	2
+
+/*
+ * Destination rectangle of one stream inside the window. rot is the
+ * rotation in degrees (0, 90, 180 or 270).
+ */
+struct display_view {
+	int enabled;
+	int left;
+	int top;
+	int right;
+	int bottom;
+	int rot;
+};
+
+/*
+ * Native display compositor. Every decoded stream is scaled and rotated
+ * into its view rectangle of a window sized composition buffer, with all
+ * views blitted in one batched g2d submission. The composition buffer is
+ * then copied into the buffer of the ANativeWindow behind CamView's
+ * Surface. When no view goes through g2d, a NEON scaler draws the views
+ * straight into the window buffer instead.
+ */
+struct display_sink {
+	ANativeWindow *window;
+	pthread_mutex_t lock;
+	int width;
+	int height;
+	struct display_view views[DISPLAY_MAX_VIEWS];
+
+	/* Window buffers have no physical address we could hand to g2d, and
+	   are not preserved between frames, so g2d views are composed here,
+	   as are views that keep their last picture. comp_buf is NULL when
+	   contiguous memory is not available and comp is then plain
+	   memory. */
+	struct g2d_buf *comp_buf;
+	u8 *comp;
+	struct g2d_surface comp_surf;
+
+	/* Software drawn 90 and 270 degree views are converted here first */
+	u8 *rot_buf;
+	int rot_size;
+
+	unsigned long frames_shown;
+	unsigned long frames_dropped;
+	unsigned long blits;
+	unsigned long sw_draws;
+};
+
+int display_sink_init(struct display_sink *sink);
+void display_sink_deinit(struct display_sink *sink);
+int display_sink_set_window(struct display_sink *sink, ANativeWindow *window);
+int display_sink_set_view(struct display_sink *sink, int index, int left,
+			  int top, int right, int bottom, int rot);
+int display_sink_render(struct display_sink *sink,
+			struct mediaBuffer *frames[], int count);
+
+#endif // DISPLAY_SINK_H
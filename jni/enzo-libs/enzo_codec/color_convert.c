@@ -0,0 +1,323 @@
+#include "color_convert.h"
+
+#include <string.h>
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+/*
+ * BT.601 limited range to RGB in 6 bit fixed point:
+ *   R = 1.164 (Y - 16) + 1.596 (V - 128)
+ *   G = 1.164 (Y - 16) - 0.391 (U - 128) - 0.813 (V - 128)
+ *   B = 1.164 (Y - 16) + 2.018 (U - 128)
+ */
+#define CC_Y	75
+#define CC_RV	102
+#define CC_GU	25
+#define CC_GV	52
+#define CC_BU	129
+
+/* Function prototypes */
+static void cc_blend_rows(const u8 *r0, const u8 *r1, u8 *dst, int n, int fy);
+static void cc_setup_map(u16 *xi, u8 *xf, int src_width, int dst_width,
+			 int flip);
+static void cc_scale_row(const u8 *src, int step, const u16 *xi,
+			 const u8 *xf, u8 *dst, int n);
+static inline u8 cc_clamp(int v);
+static void cc_row_c(const u8 *y, const u8 *u, const u8 *v, int uv_step,
+		     void *dst, int x, int width, int dst_format);
+/* End function prototypes */
+
+/*
+ * Return: 0 = success, -1 = failure
+ */
+int color_convert_frame(struct mediaBuffer *src, void *dst, int dst_stride,
+			int dst_format)
+{
+	int width = src->imageWidth > 0 ? src->imageWidth : src->width;
+	int height = src->imageHeight > 0 ? src->imageHeight : src->height;
+	int stride = src->width;
+	int row;
+	const u8 *y, *u, *v;
+	u8 *out = dst;
+
+	if (src->colorSpace != YUV422P && src->colorSpace != NV16) {
+		err_msg("Color convert: Unsupported color space %d\n",
+			src->colorSpace);
+		return -1;
+	}
+
+	for (row = 0; row < height; row++) {
+		y = src->vBufOut + row * stride;
+		if (src->colorSpace == NV16) {
+			/* One interleaved CbCr row per luma row */
+			u = src->vBufOut + stride * src->height + row * stride;
+			v = u + 1;
+			yuv422_to_rgb_row(y, u, v, 2, out, width, dst_format);
+		} else {
+			u = src->vBufOut + stride * src->height +
+			    row * (stride / 2);
+			v = u + (stride / 2) * src->height;
+			yuv422_to_rgb_row(y, u, v, 1, out, width, dst_format);
+		}
+		out += dst_stride;
+	}
+
+	return 0;
+}
+
+/*
+ * Convert one row of 4:2:2 samples. uv_step is 1 for planar chroma and 2
+ * for interleaved (NV16) chroma, where v must point one byte after u.
+ */
+void yuv422_to_rgb_row(const u8 *y, const u8 *u, const u8 *v, int uv_step,
+		       void *dst, int width, int dst_format)
+{
+	int x = 0;
+
+#ifdef __ARM_NEON__
+	uint8x8_t y_off = vdup_n_u8(16), c_off = vdup_n_u8(128);
+	uint8x8_t y_coef = vdup_n_u8(CC_Y);
+	uint8x8x2_t uu, vv;
+	uint8x8_t u_v, v_v, yh, r8, g8, b8;
+	uint8x16_t y16;
+	int16x8_t ys, d, e, r, g, b;
+	uint16x8_t px;
+	uint8x8x4_t rgba;
+	int h;
+
+	rgba.val[3] = vdup_n_u8(0xff);
+
+	for (; x + 16 <= width; x += 16) {
+		y16 = vld1q_u8(y + x);
+		if (uv_step == 2) {
+			uint8x8x2_t uv = vld2_u8(u + x);
+			u_v = uv.val[0];
+			v_v = uv.val[1];
+		} else {
+			u_v = vld1_u8(u + x / 2);
+			v_v = vld1_u8(v + x / 2);
+		}
+		/* Each chroma sample covers two pixels */
+		uu = vzip_u8(u_v, u_v);
+		vv = vzip_u8(v_v, v_v);
+
+		for (h = 0; h < 2; h++) {
+			yh = h ? vget_high_u8(y16) : vget_low_u8(y16);
+			ys = vreinterpretq_s16_u16(vmull_u8(vqsub_u8(yh, y_off),
+							    y_coef));
+			d = vreinterpretq_s16_u16(vsubl_u8(uu.val[h], c_off));
+			e = vreinterpretq_s16_u16(vsubl_u8(vv.val[h], c_off));
+
+			/* Saturating math only clips values that end up
+			   outside 0..255 anyway */
+			r = vqaddq_s16(ys, vmulq_n_s16(e, CC_RV));
+			g = vqsubq_s16(vqsubq_s16(ys, vmulq_n_s16(d, CC_GU)),
+				       vmulq_n_s16(e, CC_GV));
+			b = vqaddq_s16(ys, vmulq_n_s16(d, CC_BU));
+			r8 = vqrshrun_n_s16(r, 6);
+			g8 = vqrshrun_n_s16(g, 6);
+			b8 = vqrshrun_n_s16(b, 6);
+
+			if (dst_format == CC_RGB565) {
+				px = vshll_n_u8(r8, 8);
+				px = vsriq_n_u16(px, vshll_n_u8(g8, 8), 5);
+				px = vsriq_n_u16(px, vshll_n_u8(b8, 8), 11);
+				vst1q_u16((u16 *)dst + x + h * 8, px);
+			} else {
+				rgba.val[0] = r8;
+				rgba.val[1] = g8;
+				rgba.val[2] = b8;
+				vst4_u8((u8 *)dst + (x + h * 8) * 4, rgba);
+			}
+		}
+	}
+#endif
+
+	cc_row_c(y, u, v, uv_step, dst, x, width, dst_format);
+}
+
+/*
+ * Convert and scale a decoded YUV422P or NV16 frame into a dst_width x
+ * dst_height RGB area in one pass. Each output row is blended vertically
+ * from two source rows (NEON), filtered horizontally and converted, so no
+ * scaled YUV copy of the frame is ever made. flip rotates by 180 degrees.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int color_convert_scaled(struct mediaBuffer *src, void *dst, int dst_stride,
+			 int dst_width, int dst_height, int flip,
+			 int dst_format)
+{
+	u8 ytmp[CC_MAX_WIDTH + 2], ctmp[CC_MAX_WIDTH + 4];
+	u8 vtmp[CC_MAX_WIDTH / 2 + 2];
+	u8 yrow[CC_MAX_WIDTH], urow[CC_MAX_WIDTH / 2], vrow[CC_MAX_WIDTH / 2];
+	u16 yxi[CC_MAX_WIDTH], cxi[CC_MAX_WIDTH / 2];
+	u8 yxf[CC_MAX_WIDTH], cxf[CC_MAX_WIDTH / 2];
+	int width = src->imageWidth > 0 ? src->imageWidth : src->width;
+	int height = src->imageHeight > 0 ? src->imageHeight : src->height;
+	int stride = src->width;
+	int cwidth = width / 2, dst_cwidth = (dst_width + 1) / 2;
+	int step_y, sy, y0, y1, fy, row;
+	const u8 *luma, *chroma;
+	u8 *out;
+
+	if (src->colorSpace != YUV422P && src->colorSpace != NV16) {
+		err_msg("Color convert: Unsupported color space %d\n",
+			src->colorSpace);
+		return -1;
+	}
+	if (width > CC_MAX_WIDTH || dst_width > CC_MAX_WIDTH ||
+	    dst_width <= 0 || dst_height <= 0) {
+		err_msg("Color convert: Cannot scale %dx%d to %dx%d\n",
+			width, height, dst_width, dst_height);
+		return -1;
+	}
+
+	cc_setup_map(yxi, yxf, width, dst_width, flip);
+	cc_setup_map(cxi, cxf, cwidth, dst_cwidth, flip);
+
+	luma = src->vBufOut;
+	chroma = luma + stride * src->height;
+	step_y = (height << 16) / dst_height;
+	sy = step_y / 2 - 0x8000;
+
+	for (row = 0; row < dst_height; row++, sy += step_y) {
+		y0 = (sy < 0) ? 0 : sy >> 16;
+		y1 = (y0 + 1 < height) ? y0 + 1 : y0;
+		fy = (sy < 0) ? 0 : (sy >> 8) & 0xFF;
+		out = (u8 *)dst + (flip ? dst_height - 1 - row : row) *
+		      dst_stride;
+
+		cc_blend_rows(luma + y0 * stride, luma + y1 * stride,
+			      ytmp, width, fy);
+		ytmp[width] = ytmp[width - 1];
+		cc_scale_row(ytmp, 1, yxi, yxf, yrow, dst_width);
+
+		if (src->colorSpace == NV16) {
+			cc_blend_rows(chroma + y0 * stride,
+				      chroma + y1 * stride, ctmp, width, fy);
+			ctmp[width] = ctmp[width - 2];
+			ctmp[width + 1] = ctmp[width - 1];
+			cc_scale_row(ctmp, 2, cxi, cxf, urow, dst_cwidth);
+			cc_scale_row(ctmp + 1, 2, cxi, cxf, vrow, dst_cwidth);
+		} else {
+			cc_blend_rows(chroma + y0 * (stride / 2),
+				      chroma + y1 * (stride / 2),
+				      ctmp, cwidth, fy);
+			ctmp[cwidth] = ctmp[cwidth - 1];
+			cc_scale_row(ctmp, 1, cxi, cxf, urow, dst_cwidth);
+			chroma += (stride / 2) * src->height;
+			cc_blend_rows(chroma + y0 * (stride / 2),
+				      chroma + y1 * (stride / 2),
+				      vtmp, cwidth, fy);
+			chroma -= (stride / 2) * src->height;
+			vtmp[cwidth] = vtmp[cwidth - 1];
+			cc_scale_row(vtmp, 1, cxi, cxf, vrow, dst_cwidth);
+		}
+
+		yuv422_to_rgb_row(yrow, urow, vrow, 1, out, dst_width,
+				  dst_format);
+	}
+
+	return 0;
+}
+
+/*
+ * dst = r0 + (r1 - r0) * fy / 256, using 7 bit weights so both fit in
+ * the 8 bit NEON multiplies
+ */
+static void cc_blend_rows(const u8 *r0, const u8 *r1, u8 *dst, int n, int fy)
+{
+	int w1 = (fy + 1) >> 1, w0 = 128 - w1;
+	int x = 0;
+
+	if (w1 == 0) {
+		memcpy(dst, r0, n);
+		return;
+	}
+
+#ifdef __ARM_NEON__
+	uint8x8_t a0 = vdup_n_u8(w0), a1 = vdup_n_u8(w1);
+	uint16x8_t lo, hi;
+	uint8x16_t p, q;
+
+	for (; x + 16 <= n; x += 16) {
+		p = vld1q_u8(r0 + x);
+		q = vld1q_u8(r1 + x);
+		lo = vmull_u8(vget_low_u8(p), a0);
+		lo = vmlal_u8(lo, vget_low_u8(q), a1);
+		hi = vmull_u8(vget_high_u8(p), a0);
+		hi = vmlal_u8(hi, vget_high_u8(q), a1);
+		vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, 7),
+					      vrshrn_n_u16(hi, 7)));
+	}
+#endif
+	for (; x < n; x++)
+		dst[x] = (r0[x] * w0 + r1[x] * w1 + 64) >> 7;
+}
+
+/*
+ * Precompute the source index and blend factor of every output sample.
+ * Sources are padded by one sample, so the last index needs no clamp.
+ */
+static void cc_setup_map(u16 *xi, u8 *xf, int src_width, int dst_width,
+			 int flip)
+{
+	int step = (src_width << 16) / dst_width;
+	int sx = step / 2 - 0x8000;
+	int x, i;
+
+	for (x = 0; x < dst_width; x++, sx += step) {
+		i = flip ? dst_width - 1 - x : x;
+		xi[i] = (sx < 0) ? 0 : sx >> 16;
+		xf[i] = (sx < 0 || xi[i] + 1 >= src_width) ? 0 :
+			(sx >> 8) & 0xFF;
+	}
+}
+
+static void cc_scale_row(const u8 *src, int step, const u16 *xi,
+			 const u8 *xf, u8 *dst, int n)
+{
+	const u8 *s;
+	int x;
+
+	for (x = 0; x < n; x++) {
+		s = src + xi[x] * step;
+		dst[x] = (s[0] * (256 - xf[x]) + s[step] * xf[x] + 128) >> 8;
+	}
+}
+
+static inline u8 cc_clamp(int v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static void cc_row_c(const u8 *y, const u8 *u, const u8 *v, int uv_step,
+		     void *dst, int x, int width, int dst_format)
+{
+	int c, d, e, r, g, b, ci;
+	u16 *out16 = dst;
+	u8 *out32 = dst;
+
+	for (; x < width; x++) {
+		ci = (x / 2) * uv_step;
+		c = (y[x] > 16 ? y[x] - 16 : 0) * CC_Y;
+		d = u[ci] - 128;
+		e = v[ci] - 128;
+		r = cc_clamp((c + CC_RV * e + 32) >> 6);
+		g = cc_clamp((c - CC_GU * d - CC_GV * e + 32) >> 6);
+		b = cc_clamp((c + CC_BU * d + 32) >> 6);
+
+		if (dst_format == CC_RGB565) {
+			out16[x] = ((r & 0xf8) << 8) | ((g & 0xfc) << 3) |
+				   (b >> 3);
+		} else {
+			out32[x * 4] = r;
+			out32[x * 4 + 1] = g;
+			out32[x * 4 + 2] = b;
+			out32[x * 4 + 3] = 0xff;
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef COLOR_CONVERT_H
+#define COLOR_CONVERT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "enzo_utils.h"
+
+/* Widest frame color_convert_scaled handles, on either side */
+#define CC_MAX_WIDTH	2048
+
+/* Output pixel formats */
+enum {
+	CC_RGB565	= 0,
+	CC_RGBA8888	= 1
+};
+
+/* Convert a decoded YUV422P or NV16 frame to RGB565 or RGBA8888 in one
+   pass, using BT.601 limited range coefficients. dst_stride is in bytes. */
+int color_convert_frame(struct mediaBuffer *src, void *dst, int dst_stride,
+			int dst_format);
+/* Same, scaling the frame to dst_width x dst_height on the way. flip
+   rotates the output by 180 degrees. */
+int color_convert_scaled(struct mediaBuffer *src, void *dst, int dst_stride,
+			 int dst_width, int dst_height, int flip,
+			 int dst_format);
+void yuv422_to_rgb_row(const u8 *y, const u8 *u, const u8 *v, int uv_step,
+		       void *dst, int width, int dst_format);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COLOR_CONVERT_H
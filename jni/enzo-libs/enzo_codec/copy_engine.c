@@ -0,0 +1,320 @@
+#include "copy_engine.h"
+#include "enzo_mem.h"
+#include "enzo_utils.h"
+
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+/*
+ * Frame copies either go to the 2D engine, which runs asynchronously to
+ * the CPU, or are done by the CPU with wide loads and prefetching. Which
+ * one is faster depends on the size and on whether the memory is cached:
+ * the CPU is slow reading uncached memory, while the 2D engine has a fixed
+ * setup cost and needs cache maintenance on cacheable buffers. The break
+ * even points are measured once at startup by copy_engine_calibrate.
+ */
+
+static struct copy_engine default_engine = {
+	.dma_threshold = INT_MAX,
+	.dma_threshold_cached = INT_MAX,
+};
+
+/* Function prototypes */
+static int copy_use_dma(struct copy_engine *ce, struct copy_buf *dst,
+			struct copy_buf *src, int size);
+static int copy_dma_start(struct g2d_session *s, struct copy_buf *dst,
+			  struct copy_buf *src, int size);
+static long long copy_time_us(void);
+static int copy_calibrate_pair(struct g2d_session *s, struct g2d_buf *a,
+			       struct g2d_buf *b, int cacheable);
+/* End function prototypes */
+
+int copy_engine_init(struct copy_engine *ce)
+{
+	ce->dma_available = 0;
+	ce->dma_threshold = INT_MAX;
+	ce->dma_threshold_cached = INT_MAX;
+	ce->dma_copies = 0;
+	ce->cpu_copies = 0;
+
+	if (g2d_session_get() == NULL) {
+		err_msg("Copy: No g2d session, using CPU copies only\n");
+		return -1;
+	}
+	ce->dma_available = 1;
+
+	return copy_engine_calibrate(ce);
+}
+
+void copy_engine_deinit(struct copy_engine *ce)
+{
+	ce->dma_available = 0;
+}
+
+/*
+ * Engine shared by the codecs. It is set up by vpuInit; before that all
+ * copies are done by the CPU.
+ */
+struct copy_engine *copy_engine_default(void)
+{
+	return &default_engine;
+}
+
+/*
+ * Time both copy methods on uncached and on cacheable buffers and set
+ * the sizes from which on the 2D engine is used
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int copy_engine_calibrate(struct copy_engine *ce)
+{
+	struct g2d_session *s = g2d_session_get();
+	struct g2d_buf *a, *b;
+
+	if (!ce->dma_available || s == NULL)
+		return -1;
+
+	a = contig_g2d_alloc(COPY_CALIB_MAX, 0);
+	b = contig_g2d_alloc(COPY_CALIB_MAX, 0);
+	if (a != NULL && b != NULL)
+		ce->dma_threshold = copy_calibrate_pair(s, a, b, 0);
+	contig_g2d_free(a);
+	contig_g2d_free(b);
+
+	a = contig_g2d_alloc(COPY_CALIB_MAX, 1);
+	b = contig_g2d_alloc(COPY_CALIB_MAX, 1);
+	if (a != NULL && b != NULL)
+		ce->dma_threshold_cached = copy_calibrate_pair(s, a, b, 1);
+	contig_g2d_free(a);
+	contig_g2d_free(b);
+
+	info_msg("Copy: 2D engine used from %d bytes uncached, "
+		 "%d bytes cached\n", ce->dma_threshold,
+		 ce->dma_threshold_cached);
+
+	return 0;
+}
+
+int copy_sync(struct copy_engine *ce, struct copy_buf *dst,
+	      struct copy_buf *src, int size)
+{
+	struct copy_fence fence;
+
+	if (copy_async(ce, dst, src, size, &fence) < 0)
+		return -1;
+
+	return copy_wait(ce, &fence);
+}
+
+/*
+ * Start a copy. When the 2D engine is used the copy is submitted on the
+ * calling thread's g2d session and the call returns right away; copy_wait
+ * must be called from the same thread before either buffer is touched
+ * again. CPU copies are complete on return.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int copy_async(struct copy_engine *ce, struct copy_buf *dst,
+	       struct copy_buf *src, int size, struct copy_fence *fence)
+{
+	struct g2d_session *s;
+	int ret;
+
+	fence->pending = 0;
+	fence->dst = NULL;
+
+	s = g2d_session_get();
+	ret = copy_queue(ce, s, dst, src, size);
+	if (ret < 0)
+		return -1;
+
+	if (ret > 0) {
+		g2d_session_flush(s, &fence->g2d);
+		fence->pending = 1;
+		if (dst->cacheable)
+			fence->dst = dst->buf;
+	}
+
+	return 0;
+}
+
+/*
+ * Queue a copy on a g2d session without submitting it, so it can be
+ * batched with blits that depend on it. If the CPU is the better choice,
+ * the copy is done right away instead. A cacheable destination must be
+ * invalidated by the caller after the session has finished.
+ *
+ * Return: 1 = queued, 0 = copied by the CPU, -1 = failure
+ */
+int copy_queue(struct copy_engine *ce, struct g2d_session *s,
+	       struct copy_buf *dst, struct copy_buf *src, int size)
+{
+	if (s != NULL && copy_use_dma(ce, dst, src, size) &&
+	    copy_dma_start(s, dst, src, size) == 0) {
+		__atomic_fetch_add(&ce->dma_copies, 1, __ATOMIC_RELAXED);
+		return 1;
+	}
+
+	copy_cpu(dst->vaddr, src->vaddr, size);
+	__atomic_fetch_add(&ce->cpu_copies, 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+int copy_wait(struct copy_engine *ce, struct copy_fence *fence)
+{
+	if (!fence->pending)
+		return 0;
+
+	g2d_session_wait(&fence->g2d);
+
+	/* Lines the CPU may have speculatively loaded during the copy
+	   are stale now */
+	if (fence->dst != NULL)
+		contig_sync_for_cpu(fence->dst);
+
+	fence->pending = 0;
+	fence->dst = NULL;
+
+	return 0;
+}
+
+/*
+ * CPU copy with 64 byte loads and prefetching ahead, which matters most
+ * when reading uncached memory
+ */
+void copy_cpu(void *dst, const void *src, int size)
+{
+#ifdef __ARM_NEON__
+	const u8 *s = src;
+	u8 *d = dst;
+	uint8x16_t v0, v1, v2, v3;
+
+	while (size >= 64) {
+		__builtin_prefetch(s + 256);
+		v0 = vld1q_u8(s);
+		v1 = vld1q_u8(s + 16);
+		v2 = vld1q_u8(s + 32);
+		v3 = vld1q_u8(s + 48);
+		vst1q_u8(d, v0);
+		vst1q_u8(d + 16, v1);
+		vst1q_u8(d + 32, v2);
+		vst1q_u8(d + 48, v3);
+		s += 64;
+		d += 64;
+		size -= 64;
+	}
+	if (size > 0)
+		memcpy(d, s, size);
+#else
+	memcpy(dst, src, size);
+#endif
+}
+
+static int copy_use_dma(struct copy_engine *ce, struct copy_buf *dst,
+			struct copy_buf *src, int size)
+{
+	int cached = dst->cacheable || src->cacheable;
+
+	if (!ce->dma_available || dst->paddr == 0 || src->paddr == 0)
+		return 0;
+	if ((dst->paddr | src->paddr | size) & (COPY_DMA_ALIGN - 1))
+		return 0;
+	/* Cache maintenance needs the buffer handle */
+	if ((dst->cacheable && dst->buf == NULL) ||
+	    (src->cacheable && src->buf == NULL))
+		return 0;
+
+	return size >= (cached ? ce->dma_threshold_cached : ce->dma_threshold);
+}
+
+static int copy_dma_start(struct g2d_session *s, struct copy_buf *dst,
+			  struct copy_buf *src, int size)
+{
+	struct g2d_buf s_buf, d_buf;
+
+	/* Write back what the CPU wrote to the source, and make sure no
+	   dirty destination lines are evicted over the copied data */
+	if (src->cacheable)
+		contig_sync_for_device(src->buf);
+	if (dst->cacheable)
+		contig_cache_op(dst->buf, G2D_CACHE_FLUSH);
+
+	memset(&s_buf, 0, sizeof(struct g2d_buf));
+	memset(&d_buf, 0, sizeof(struct g2d_buf));
+	s_buf.buf_paddr = (int)src->paddr;
+	s_buf.buf_vaddr = src->vaddr;
+	d_buf.buf_paddr = (int)dst->paddr;
+	d_buf.buf_vaddr = dst->vaddr;
+
+	return g2d_session_copy(s, &d_buf, &s_buf, size);
+}
+
+static long long copy_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Return: the smallest size from which on the 2D engine beat the CPU for
+ * every larger size tried, or INT_MAX if it never did
+ */
+static int copy_calibrate_pair(struct g2d_session *s, struct g2d_buf *a,
+			       struct g2d_buf *b, int cacheable)
+{
+	struct copy_buf src, dst;
+	long long t, t_dma, t_cpu;
+	int size, run, threshold = INT_MAX;
+
+	memset(&src, 0, sizeof(struct copy_buf));
+	memset(&dst, 0, sizeof(struct copy_buf));
+	src.vaddr = a->buf_vaddr;
+	src.paddr = a->buf_paddr;
+	src.cacheable = cacheable;
+	src.buf = a;
+	dst.vaddr = b->buf_vaddr;
+	dst.paddr = b->buf_paddr;
+	dst.cacheable = cacheable;
+	dst.buf = b;
+
+	memset(a->buf_vaddr, 0x5a, COPY_CALIB_MAX);
+	contig_sync_for_device(a);
+
+	for (size = COPY_CALIB_MIN; size <= COPY_CALIB_MAX; size *= 2) {
+		t_dma = t_cpu = LLONG_MAX;
+		for (run = 0; run < COPY_CALIB_RUNS; run++) {
+			t = copy_time_us();
+			if (copy_dma_start(s, &dst, &src, size) < 0)
+				return INT_MAX;
+			g2d_session_finish(s);
+			if (cacheable)
+				contig_sync_for_cpu(b);
+			t = copy_time_us() - t;
+			if (t < t_dma)
+				t_dma = t;
+
+			t = copy_time_us();
+			copy_cpu(b->buf_vaddr, a->buf_vaddr, size);
+			t = copy_time_us() - t;
+			if (t < t_cpu)
+				t_cpu = t;
+		}
+
+		if (t_dma < t_cpu) {
+			if (threshold == INT_MAX)
+				threshold = size;
+		} else {
+			threshold = INT_MAX;
+		}
+	}
+
+	return threshold;
+}
@@ -0,0 +1,71 @@
+#ifndef COPY_ENGINE_H
+#define COPY_ENGINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "g2d.h"
+#include "g2d_session.h"
+
+/* The 2D engine is only used for buffers whose physical address and
+   size are multiples of this */
+#define COPY_DMA_ALIGN		64
+/* Copy sizes tried by the calibration, doubling from the minimum */
+#define COPY_CALIB_MIN		(16 * 1024)
+#define COPY_CALIB_MAX		(2 * 1024 * 1024)
+#define COPY_CALIB_RUNS		3
+
+/* One end of a copy */
+struct copy_buf {
+	void *vaddr;
+	unsigned long paddr;	/* 0 if not physically contiguous */
+	int cacheable;
+	struct g2d_buf *buf;	/* Buffer from contig_g2d_alloc, required
+				   for the 2D engine to do cache
+				   maintenance on cacheable memory */
+};
+
+/* Completion handle of an asynchronous copy */
+struct copy_fence {
+	int pending;
+	struct g2d_fence g2d;
+	struct g2d_buf *dst;	/* Cacheable destination to invalidate */
+};
+
+/*
+ * Copy engine structure declaration
+ */
+struct copy_engine {
+	int dma_available;
+
+	/* Smallest copy the 2D engine does faster than the CPU, for
+	   uncached and for cacheable memory */
+	int dma_threshold;
+	int dma_threshold_cached;
+
+	/* The default engine is shared by threads, so these are only
+	   updated atomically */
+	unsigned long dma_copies;
+	unsigned long cpu_copies;
+};
+
+int copy_engine_init(struct copy_engine *ce);
+void copy_engine_deinit(struct copy_engine *ce);
+int copy_engine_calibrate(struct copy_engine *ce);
+struct copy_engine *copy_engine_default(void);
+
+int copy_sync(struct copy_engine *ce, struct copy_buf *dst,
+	      struct copy_buf *src, int size);
+int copy_async(struct copy_engine *ce, struct copy_buf *dst,
+	       struct copy_buf *src, int size, struct copy_fence *fence);
+int copy_queue(struct copy_engine *ce, struct g2d_session *s,
+	       struct copy_buf *dst, struct copy_buf *src, int size);
+int copy_wait(struct copy_engine *ce, struct copy_fence *fence);
+void copy_cpu(void *dst, const void *src, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // COPY_ENGINE_H
@@ -1,9 +1,15 @@
 #include "enzo_codec.h"
 #include "vpu_common.h"
+#include "enzo_mem.h"
+#include "copy_engine.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
+/* Size of the contiguous memory arena reserved by vpuInit */
+static int arena_size;
+
 int encoderInit(struct encoderInstance *encInst, struct mediaBuffer *enc_dst)
 {
 	struct encoder_info *enc = &encInst->enc;
@@ -15,6 +21,11 @@ int encoderInit(struct encoderInstance *encInst, struct mediaBuffer *enc_dst)
 	enc->enc_bit_rate = encInst->bitRate;
 	enc->gop_size = encInst->gopSize;
 	enc->color_space = encInst->colorSpace;
+	enc->qp = encInst->qp;
+	enc->scene_detect = encInst->sceneDetect;
+	enc->static_qp_offset = encInst->staticQpOffset;
+	enc->intra_refresh_period = encInst->intraRefreshPeriod;
+	enc->intra_refresh_mode = encInst->intraRefreshMode;
 
 	if (strcmp(encInst->encoderName, "") == 0)
 		strcpy(enc->encoder_name,"Encoder");
@@ -49,13 +60,122 @@ int encoderEncodeFrame( struct encoderInstance *encInst,
 	if (vpu_encoder_encode_frame(enc, vid_src, enc_dst) < 0)
 		return -1;
 	else {
+		if (enc->scene_detect)
+			encInst->sceneCuts = enc->scene.cuts;
+		if (encInst->statsHook != NULL) {
+			struct encoderStats stats;
+			encoderGetStats(encInst, &stats, 0);
+			encInst->statsHook(encInst, &stats);
+		}
+		return 0;
+	}
+}
+
+int encoderSetBitRate(struct encoderInstance *encInst, int bitRate)
+{
+	struct encoder_info *enc = &encInst->enc;
+	if (vpu_encoder_set_bitrate(enc, bitRate) < 0)
+		return -1;
+	encInst->bitRate = bitRate;
+	return 0;
+}
+
+int encoderSetIntraRefresh(struct encoderInstance *encInst, int period)
+{
+	struct encoder_info *enc = &encInst->enc;
+	if (vpu_encoder_set_intra_refresh(enc, period) < 0)
+		return -1;
+	encInst->intraRefreshPeriod = period;
+	return 0;
+}
+
+int encoderGetStats(struct encoderInstance *encInst,
+		    struct encoderStats *stats, int reset)
+{
+	struct encoder_stats *st = &encInst->enc.stats;
+
+	stats->frames = st->frames;
+	stats->lastFrameSize = st->last_size;
+	stats->minFrameSize = st->min_size;
+	stats->maxFrameSize = st->max_size;
+	stats->meanFrameSize = st->mean;
+	stats->frameSizeStdDev = sqrt(vpu_encoder_stats_variance(st));
+
+	if (reset)
+		memset(st, 0, sizeof(struct encoder_stats));
+
+	return 0;
+}
+
+int simulcastInit(struct simulcastInstance *simInst)
+{
+	struct simulcast_info *sim = &simInst->sim;
+	int i;
+
+	sim->num_layers = simInst->numLayers;
+	for (i = 0; i < simInst->numLayers && i < SIMULCAST_MAX_LAYERS; i++) {
+		if (simInst->layers[i] == NULL)
+			sim->enc[i] = NULL;
+		else
+			sim->enc[i] = &simInst->layers[i]->enc;
+	}
+
+	if (strcmp(simInst->simulcastName, "") == 0)
+		strcpy(sim->name, "Simulcast");
+	else
+		strcpy(sim->name, simInst->simulcastName);
+
+	if (simulcast_init(sim) < 0)
+		return -1;
+	else
 		return 0;
+}
+
+int simulcastDeinit(struct simulcastInstance *simInst)
+{
+	struct simulcast_info *sim = &simInst->sim;
+	sim->num_layers = 0;
+	return 0;
+}
+
+int simulcastEncodeFrame(struct simulcastInstance *simInst,
+			 struct mediaBuffer *vid_src,
+			 struct mediaBuffer *enc_dst)
+{
+	struct simulcast_info *sim = &simInst->sim;
+	int i;
+
+	if (simulcast_load_frame(sim, vid_src) < 0)
+		return -1;
+
+	/* Every layer's source is already in its encoder's input
+	   framebuffer, so the encoders use it in place */
+	for (i = 0; i < sim->num_layers; i++) {
+		if (encoderEncodeFrame(simInst->layers[i], &sim->src[i],
+				       &enc_dst[i]) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+int simulcastSetLayerBitRate(struct simulcastInstance *simInst,
+			     int layer, int bitRate)
+{
+	struct simulcast_info *sim = &simInst->sim;
+
+	if (layer < 0 || layer >= sim->num_layers) {
+		err_msg("%s: Invalid layer %d\n", sim->name, layer);
+		return -1;
 	}
+
+	return encoderSetBitRate(simInst->layers[layer], bitRate);
 }
 
 int decoderInit(struct decoderInstance *decInst, struct mediaBuffer *enc_src) {
 	struct decoder_info *dec = &decInst->dec;
 	dec->format = decInst->type;
+	dec->chroma_interleave = decInst->chromaInterleave;
 	if (strcmp(decInst->decoderName, "") == 0)
 		strcpy(dec->decoder_name, "Decoder");
 	else
@@ -66,6 +186,23 @@ int decoderInit(struct decoderInstance *decInst, struct mediaBuffer *enc_src) {
 		return 0;
 	return 0;
 }
+int decoderGetStreamParams(struct decoderInstance *decInst,
+			   struct decoder_params *params)
+{
+	struct decoder_info *dec = &decInst->dec;
+	if (dec->params.stride == 0)
+		return -1;
+	memcpy(params, &dec->params, sizeof(struct decoder_params));
+	return 0;
+}
+
+int decoderPrewarm(struct decoderInstance *decInst,
+		   const struct decoder_params *params)
+{
+	return vpu_decoder_prewarm(decInst->type, decInst->chromaInterleave,
+				   params);
+}
+
 int decoderDeinit(struct decoderInstance *decInst){
 	struct decoder_info *dec = &decInst->dec;
 	vpu_decoder_deinit(dec);
@@ -88,6 +225,12 @@ int decoderDecodeFrame( struct decoderInstance *decInst,
 int cameraInit(struct cameraInstance *camInst)
 {
 	struct camera_info *cam = &camInst->cam;
+	camInst->replay.active = 0;
+	camInst->recording = 0;
+	if (replay_is_device(camInst->deviceName))
+		return replay_cameraInit(&camInst->replay, camInst->deviceName,
+					 camInst->type, camInst->width,
+					 camInst->height);
 	cam->width = camInst->width;
 	cam->height = camInst->height;
 	cam->fps = camInst->fps;
@@ -102,25 +245,224 @@ int cameraInit(struct cameraInstance *camInst)
 int cameraDeinit(struct cameraInstance *camInst)
 {
 	struct camera_info *cam = &camInst->cam;
+	if (camInst->recording)
+		cameraStopRecording(camInst);
+	if (camInst->replay.active)
+		return replay_cameraDeinit(&camInst->replay);
 	if (v4l2_cameraDeinit(cam) < 0)
 		return -1;
 	else
 		return 0;
 }
 
+int cameraPause(struct cameraInstance *camInst)
+{
+	struct camera_info *cam = &camInst->cam;
+	if (camInst->replay.active)
+		return replay_cameraPause(&camInst->replay);
+	if (v4l2_cameraPause(cam) < 0)
+		return -1;
+	else
+		return 0;
+}
+
+int cameraResume(struct cameraInstance *camInst)
+{
+	struct camera_info *cam = &camInst->cam;
+	if (camInst->replay.active)
+		return replay_cameraResume(&camInst->replay);
+	if (v4l2_cameraResume(cam) < 0)
+		return -1;
+	else
+		return 0;
+}
+
 int cameraGetFrame(struct cameraInstance *camInst,
 		   struct mediaBuffer *cam_src)
 {
 	struct camera_info *cam = &camInst->cam;
+	int ret;
 	/* Set the dst media buffer properties to reflect
-	   the type of encoding that is occuring */
+	   the type of encoding that is occuring. Replayed
+	   frames look like camera frames to the consumers. */
 	cam_src->dataType = camInst->type;
 	cam_src->dataSource = V4L2_CAM;
 	if (camInst->type == RAW_VIDEO)
 		cam_src->dataType = RAW_VIDEO;
 	else if (camInst->type == MJPEG)
 		cam_src->dataType = MJPEG;
-	if (v4l2_cameraGetFrame(cam, cam_src) < 0)
+	if (camInst->replay.active)
+		ret = replay_cameraGetFrame(&camInst->replay, cam_src);
+	else
+		ret = v4l2_cameraGetFrame(cam, cam_src);
+	if (ret < 0)
+		return -1;
+	/* A failed write ends the recording, not the capture */
+	if (camInst->recording &&
+	    replay_recordFrame(&camInst->recorder, cam_src) < 0)
+		cameraStopRecording(camInst);
+	return 0;
+}
+
+int cameraGetCurrentFrame(struct cameraInstance *camInst,
+			  struct mediaBuffer *cam_src)
+{
+	struct camera_info *cam = &camInst->cam;
+	cam_src->dataType = camInst->type;
+	cam_src->dataSource = V4L2_CAM;
+	if (camInst->replay.active)
+		return replay_cameraGetCurrentFrame(&camInst->replay, cam_src);
+	if (v4l2_cameraGetCurrentFrame(cam, cam_src) < 0)
+		return -1;
+	else
+		return 0;
+}
+
+int cameraStartRecording(struct cameraInstance *camInst, const char *path)
+{
+	if (camInst->recording)
+		cameraStopRecording(camInst);
+	if (replay_recordOpen(&camInst->recorder, path, camInst->type,
+			      camInst->width, camInst->height) < 0)
+		return -1;
+	camInst->recording = 1;
+	return 0;
+}
+
+int cameraStopRecording(struct cameraInstance *camInst)
+{
+	if (!camInst->recording)
+		return 0;
+	camInst->recording = 0;
+	return replay_recordClose(&camInst->recorder);
+}
+
+int rtpInit(struct rtpInstance *rtpInst, struct mediaBuffer *enc_hdr)
+{
+	struct rtp_info *rtp = &rtpInst->rtp;
+	rtp->mtu = rtpInst->mtu;
+	rtp->payload_type = rtpInst->payloadType;
+
+	if (strcmp(rtpInst->rtpName, "") == 0)
+		strcpy(rtp->name, "RTP");
+	else
+		strcpy(rtp->name, rtpInst->rtpName);
+
+	if (rtp_h264_init(rtp, rtpInst->destAddress, rtpInst->destPort) < 0)
+		return -1;
+
+	if (enc_hdr != NULL && rtp_h264_set_param_sets(rtp, enc_hdr) < 0) {
+		rtp_h264_deinit(rtp);
+		return -1;
+	}
+
+	rtpInst->packetsSent = 0;
+	rtpInst->bytesSent = 0;
+	return 0;
+}
+
+int rtpDeinit(struct rtpInstance *rtpInst)
+{
+	struct rtp_info *rtp = &rtpInst->rtp;
+	rtp_h264_deinit(rtp);
+	return 0;
+}
+
+int rtpSendFrame(struct rtpInstance *rtpInst,
+		 struct mediaBuffer *enc_src,
+		 unsigned int timestamp)
+{
+	struct rtp_info *rtp = &rtpInst->rtp;
+	int ret;
+
+	if (enc_src->dataType != H264AVC) {
+		err_msg("%s: Only H.264 data can be sent\n", rtp->name);
+		return -1;
+	}
+
+	ret = rtp_h264_send_frame(rtp, enc_src, timestamp);
+	rtpInst->packetsSent = rtp->packets_sent;
+	rtpInst->bytesSent = rtp->bytes_sent;
+	if (ret < 0)
+		return -1;
+	else
+		return 0;
+}
+
+int recorderInit(struct recorderInstance *recInst,
+		 struct mediaBuffer *enc_hdr)
+{
+	struct mp4_info *mp4 = &recInst->mp4;
+	mp4->fps = recInst->fps;
+	mp4->prealloc_size = recInst->preallocSize;
+
+	if (strcmp(recInst->recorderName, "") == 0)
+		strcpy(mp4->name, "Recorder");
+	else
+		strcpy(mp4->name, recInst->recorderName);
+
+	recInst->framesWritten = 0;
+	recInst->fragmentsDropped = 0;
+	recInst->writeErrors = 0;
+	recInst->idrRequested = 0;
+
+	if (mp4_recorder_open(mp4, recInst->fileName, enc_hdr) < 0)
+		return -1;
+
+	/* The recording starts at an IDR */
+	if (recInst->encoder != NULL) {
+		recInst->encoder->forceIFrame = 1;
+		recInst->idrRequested = 1;
+	}
+
+	return 0;
+}
+
+int recorderDeinit(struct recorderInstance *recInst)
+{
+	struct mp4_info *mp4 = &recInst->mp4;
+	int ret;
+
+	ret = mp4_recorder_close(mp4);
+	recInst->framesWritten = mp4->frames_written;
+	recInst->fragmentsDropped = mp4->fragments_dropped;
+	recInst->writeErrors = mp4->write_errors;
+	if (recInst->encoder != NULL && recInst->idrRequested)
+		recInst->encoder->forceIFrame = 0;
+	recInst->idrRequested = 0;
+	if (ret < 0)
+		return -1;
+	else
+		return 0;
+}
+
+int recorderWriteFrame(struct recorderInstance *recInst,
+		       struct mediaBuffer *enc_src)
+{
+	struct mp4_info *mp4 = &recInst->mp4;
+	int ret;
+
+	if (enc_src->dataType != H264AVC) {
+		err_msg("%s: Only H.264 data can be recorded\n", mp4->name);
+		return -1;
+	}
+
+	ret = mp4_recorder_write_frame(mp4, enc_src);
+	recInst->framesWritten = mp4->frames_written;
+	recInst->fragmentsDropped = mp4->fragments_dropped;
+
+	/* Without a GOP the encoder never sends an IDR on its own */
+	if (recInst->encoder != NULL) {
+		if (mp4->wait_idr) {
+			recInst->encoder->forceIFrame = 1;
+			recInst->idrRequested = 1;
+		} else if (recInst->idrRequested) {
+			recInst->encoder->forceIFrame = 0;
+			recInst->idrRequested = 0;
+		}
+	}
+
+	if (ret < 0)
 		return -1;
 	else
 		return 0;
@@ -153,13 +495,38 @@ int vpuInit(void)
 	info_msg("VPU: Init framebuffer pool\n");
 	framebuf_init();
 
+	/* Without the arena every buffer is allocated from the driver
+	   on its own, so a failure here is not fatal */
+	if (arena_size >= 0 && contig_arena_init(arena_size) < 0)
+		warn_msg("VPU: Running without contiguous memory arena\n");
+
+	/* Measure where 2D engine copies beat CPU copies. Without the
+	   2D engine all copies are done by the CPU. */
+	copy_engine_init(copy_engine_default());
+
 	info_msg("VPU was successfully initialized\n\n");
 
 	return 0;
 }
 
+int vpuSetArenaSize(int size)
+{
+	arena_size = size;
+	return 0;
+}
+
+int vpuTrimMemory(int keepBytes)
+{
+	framebuf_pool_trim(keepBytes);
+	return 0;
+}
+
 int vpuDeinit(void)
 {
+	/* Pooled framebuffers must be released before the VPU goes away */
+	framebuf_pool_trim(0);
+	copy_engine_deinit(copy_engine_default());
+	contig_arena_deinit();
 	vpu_UnInit();
 	info_msg("VPU was deinitialized\n\n");
 	return 0;
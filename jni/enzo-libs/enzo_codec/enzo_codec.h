@@ -9,10 +9,26 @@ extern "C" {
 #include "vpu_decode.h"
 #include "vpu_encode.h"
 #include "v4l2_camera.h"
+#include "replay_camera.h"
+#include "rtp_h264.h"
+#include "mp4_mux.h"
+#include "simulcast.h"
 
 #define ENZO_SPS_SIZE	13
 #define ENZO_PPS_SIZE	9
 
+/* Encoded frame size statistics of an encoder session, filled in
+   by encoderGetStats. Sizes are in bytes. */
+struct encoderStats {
+	unsigned long frames;
+	int lastFrameSize;
+	int minFrameSize;
+	int maxFrameSize;
+	double meanFrameSize;
+	double frameSizeStdDev;	/* A low value means an even stream with
+				   no IDR spikes */
+};
+
 /* This structure is used to control and preserve the context
    of an encoder session. Anytime an encoder function is called,
    it must be provided with a valid encoderInstance structure. */
@@ -46,6 +62,29 @@ struct encoderInstance {
 			   state. For H.264 mode, the picture is encoded as an
 			   Instantaneous Decoding Refresh (IDR) picture. */
 	int colorSpace;	/* Color space of the data to be encoded. */
+	int qp;		/* Quantization parameter used when bitRate is 0.
+			   If 0, a QP of 23 is used. */
+	int sceneDetect;/* If 1, each source frame is compared against the
+			   previous one before it is encoded. Scene cuts
+			   force an IDR picture, and while the scene is
+			   static the QP is raised by staticQpOffset (or
+			   the bit rate target is halved when rate control
+			   is used). */
+	int staticQpOffset; /* If 0, an offset of 6 is used */
+	unsigned long sceneCuts; /* Updated after every encoderEncodeFrame
+				    call when sceneDetect is set */
+	int intraRefreshPeriod;	/* If not 0, the encoder runs with an
+				   infinite GOP and instead refreshes a
+				   band of intra macroblocks in every
+				   frame, so the whole picture is refreshed
+				   every intraRefreshPeriod frames. This
+				   avoids the bit rate spike of periodic
+				   IDR pictures. gopSize is ignored. */
+	int intraRefreshMode;	/* Intra refresh mode given to the VPU */
+	void (*statsHook)(struct encoderInstance *encInst,
+			  struct encoderStats *stats);
+				/* If set, called after every encoded
+				   frame with the updated statistics */
 
 	char encoderName[20];
 	
@@ -67,6 +106,10 @@ struct decoderInstance {
 			   input data. This will also be the height
 			   of the decoded data */
 	int fps;	/* Framerate of the decoded data */
+	int chromaInterleave; /* MJPEG only. If 1, frames are decoded
+				 to NV16 (one interleaved CbCr plane)
+				 instead of YUV422P. NV16 can be blitted
+				 by g2d straight to RGB. */
 
 	char decoderName[20];
 	
@@ -92,13 +135,100 @@ struct cameraInstance {
 			   providing. If the camera is providing
 			   encoded data, this doesn't really need to
 			   be set.*/
-	char deviceName[12]; /* The /dev/videoX name of the camera.
-				This value is a c string. */
+	char deviceName[64]; /* The /dev/videoX name of the camera.
+				This value is a c string. A name of
+				REPLAY_PREFIX or REPLAY_FAST_PREFIX
+				followed by the path of a recording
+				replays that recording instead. */
 	
 	struct camera_info cam;	/* Structure that contains in-depth
 				   settings for camera. It should
 				   normally not be modified by the 
 				   user. */
+	struct replay_info replay;	/* Same for a replayed camera */
+	struct replay_recorder recorder;
+	int recording;	/* Frames from cameraGetFrame are recorded */
+};
+
+/* This structure is used to control and preserve the context
+   of an RTP H.264 stream. Anytime an RTP function is called, it
+   must be provided with a valid rtpInstance structure. */
+struct rtpInstance {
+	char destAddress[16];	/* Dotted IPv4 address the stream is sent
+				   to. 127.0.0.1 can be used to test the
+				   packetizer over loopback. */
+	int destPort;	/* UDP port the stream is sent to */
+	int mtu;	/* Maximum size of an RTP packet, including the RTP
+			   header. If 0, a default of 1400 bytes is used. */
+	int payloadType;/* Dynamic RTP payload type. If 0, 96 is used. */
+	unsigned long packetsSent; /* Updated after every rtpSendFrame
+				      call. Together with a timer, this can
+				      be used to measure packets/second. */
+	unsigned long bytesSent;
+
+	char rtpName[12];
+
+	struct rtp_info rtp;	/* Structure that contains in-depth
+				   settings for the packetizer. It should
+				   normally not be modified by the
+				   user. */
+};
+
+/* This structure is used to control and preserve the context
+   of a fragmented MP4 recording. Anytime a recorder function is
+   called, it must be provided with a valid recorderInstance
+   structure. */
+struct recorderInstance {
+	char fileName[128];	/* Path of the .mp4 file to write. An
+				   existing file will be overwritten. */
+	int fps;	/* Frame rate of the encoded data. This should
+			   match the fps given to the encoder, since it
+			   is used to time stamp the samples. */
+	long preallocSize; /* Bytes of file space reserved ahead of
+			      the write position. If 0, 64MB is used. */
+	unsigned long framesWritten;	/* Updated after every
+					   recorderWriteFrame call */
+	unsigned long fragmentsDropped;	/* Number of GOPs lost because
+					   the storage could not keep up */
+	unsigned long writeErrors;	/* Failed file writes, updated by
+					   recorderDeinit. After the first
+					   one the file is not written to
+					   any more. */
+	struct encoderInstance *encoder; /* If set, the recorder sets its
+					    forceIFrame whenever it waits
+					    for an IDR: at the start and
+					    after a dropped fragment, so
+					    that also works with intra
+					    refresh. recorderWriteFrame
+					    must then be called from the
+					    encoding thread. */
+	int idrRequested;
+
+	char recorderName[12];
+
+	struct mp4_info mp4;	/* Structure that contains in-depth
+				   settings for the recorder. It should
+				   normally not be modified by the
+				   user. */
+};
+
+/* This structure is used to control and preserve the context
+   of a simulcast session, where one camera frame is encoded at
+   several resolutions and bit rates. Each layer is a normal
+   encoderInstance that must already be initialized with
+   encoderInit. Layer 0 has the largest resolution, and all
+   following layers must be YUV420P and no larger than the layer
+   before them. */
+struct simulcastInstance {
+	int numLayers;	/* Number of layers, up to SIMULCAST_MAX_LAYERS */
+	struct encoderInstance *layers[SIMULCAST_MAX_LAYERS];
+
+	char simulcastName[12];
+
+	struct simulcast_info sim; /* Structure that contains in-depth
+				      settings for simulcast. It should
+				      normally not be modified by the
+				      user. */
 };
 
 /* This function initializes an encoder with the parameters
@@ -123,6 +253,51 @@ int encoderEncodeFrame( struct encoderInstance *encInst,
 			struct mediaBuffer *vid_src,
 			struct mediaBuffer *enc_dst);
 
+/* Changes the target bit rate of a running encoder. The new rate
+   is used from the next encoded frame on.
+
+   Return: 0 = success, -1 = failure */
+int encoderSetBitRate(struct encoderInstance *encInst, int bitRate);
+
+/* Changes the intra refresh period of an encoder that was
+   initialized with intraRefreshPeriod set.
+
+   Return: 0 = success, -1 = failure */
+int encoderSetIntraRefresh(struct encoderInstance *encInst, int period);
+/* Fills in the frame size statistics of the encoder. If reset is 1,
+   the statistics are restarted afterwards, which allows them to be
+   measured over fixed intervals.
+
+   Return: 0 = success, -1 = failure */
+int encoderGetStats(struct encoderInstance *encInst,
+		    struct encoderStats *stats, int reset);
+
+/* This function sets up a simulcast session from the layers given
+   in the simulcastInstance structure.
+
+   Return: 0 = success, -1 = failure */
+int simulcastInit(struct simulcastInstance *simInst);
+/* This function deinitializes a simulcast session. The layer
+   encoders are not deinitialized.
+
+   Return: 0 = success, -1 = failure */
+int simulcastDeinit(struct simulcastInstance *simInst);
+/* Encodes one frame from a video source on every layer. The
+   source is copied once into the layer 0 encoder, and each lower
+   layer is scaled down from the layer above it, so the camera
+   frame is only read once. enc_dst must hold numLayers
+   mediaBuffers, one per layer.
+
+   Return: 0 = success, -1 = failure */
+int simulcastEncodeFrame(struct simulcastInstance *simInst,
+			 struct mediaBuffer *vid_src,
+			 struct mediaBuffer *enc_dst);
+/* Changes the bit rate of one simulcast layer, given in kbps.
+
+   Return: 0 = success, -1 = failure */
+int simulcastSetLayerBitRate(struct simulcastInstance *simInst,
+			     int layer, int bitRate);
+
 /* This function initializes a decoder with the parameters
    defined in the decoderInstance structure. It must be passed
    encoded data that contains headers that will be parsed.
@@ -135,6 +310,24 @@ int decoderInit(struct decoderInstance *decInst,
  
    Return: 0 = success, -1 = failure */
 int decoderDeinit(struct decoderInstance *decInst);
+/* This function copies the parameters the decoder found in the
+   stream (picture size, framebuffer count, MJPEG source format and
+   stride). Save them to warm start the next session with
+   decoderPrewarm.
+
+   Return: 0 = success, -1 = failure (decoder not initialized) */
+int decoderGetStreamParams(struct decoderInstance *decInst,
+			   struct decoder_params *params);
+/* This function allocates the framebuffers a decoder for a stream
+   with the given parameters will need and parks them in the
+   framebuffer pool. Call it after vpuInit and before decoderInit,
+   for example while the camera starts. decoderInit still parses the
+   first frame; it then finds its framebuffers ready in the pool
+   instead of allocating them after the parse.
+
+   Return: 0 = success, -1 = failure */
+int decoderPrewarm(struct decoderInstance *decInst,
+		   const struct decoder_params *params);
 /* 
    Return: 0 = success, -1 = failure */
 int decoderDecodeFrame( struct decoderInstance *decInst,
@@ -151,6 +344,17 @@ int cameraInit(struct cameraInstance *camInst);
 
    Return: 0 = success, -1 = failure */
 int cameraDeinit(struct cameraInstance *camInst);
+/* This function stops the camera from streaming, but keeps the
+   device open and its buffers mapped, so cameraResume is quick.
+   Frames must not be requested while the camera is paused.
+
+   Return: 0 = success, -1 = failure */
+int cameraPause(struct cameraInstance *camInst);
+/* This function restarts a camera paused by cameraPause. It
+   returns without waiting for a frame.
+
+   Return: 0 = success, -1 = failure */
+int cameraResume(struct cameraInstance *camInst);
 /* This function initializes retrieves a frame of data
    from the camera device associated with a certain
    cameraInstance structure. The output frame will be
@@ -159,12 +363,93 @@ int cameraDeinit(struct cameraInstance *camInst);
    Return: 0 = success, -1 = failure */
 int cameraGetFrame(struct cameraInstance *camInst,
 		   struct mediaBuffer *cam_src);
+/* This function returns the frame the camera currently holds
+   without waiting for a new one. Right after cameraInit this is
+   the first frame the camera delivered, which saves a frame
+   interval when the first frame is only needed to set up a
+   decoder.
+
+   Return: 0 = success, -1 = failure */
+int cameraGetCurrentFrame(struct cameraInstance *camInst,
+			  struct mediaBuffer *cam_src);
+/* This function records every frame cameraGetFrame returns from
+   now on into a file that the camera can replay, with the frame
+   timestamps. Frames are written from the calling thread.
+
+   Return: 0 = success, -1 = failure */
+int cameraStartRecording(struct cameraInstance *camInst, const char *path);
+/* This function finishes the recording started by
+   cameraStartRecording. cameraDeinit does so too.
+
+   Return: 0 = success, -1 = failure */
+int cameraStopRecording(struct cameraInstance *camInst);
+/* This function opens an RTP session with the parameters defined
+   in the rtpInstance structure. If encoder headers are given (the
+   mediaBuffer returned by encoderInit), the SPS/PPS will be sent in
+   front of every IDR picture. enc_hdr may be NULL.
+
+   Return: 0 = success, -1 = failure */
+int rtpInit(struct rtpInstance *rtpInst, struct mediaBuffer *enc_hdr);
+/* This function closes the RTP session.
+
+   Return: 0 = success, -1 = failure */
+int rtpDeinit(struct rtpInstance *rtpInst);
+/* Packetizes one frame from encoderEncodeFrame as RFC 6184 single NAL,
+   STAP-A and FU-A packets and sends them. The packets point into the
+   encoded buffer, so no payload data is copied. The timestamp is in
+   units of the 90 kHz RTP clock.
+
+   Return: 0 = success, -1 = failure */
+int rtpSendFrame(struct rtpInstance *rtpInst,
+		 struct mediaBuffer *enc_src,
+		 unsigned int timestamp);
+
+/* This function creates the MP4 file defined in the recorderInstance
+   structure and starts its writer thread. It must be given the
+   mediaBuffer returned by encoderInit, which contains the SPS/PPS
+   and the picture size.
+
+   Return: 0 = success, -1 = failure */
+int recorderInit(struct recorderInstance *recInst,
+		 struct mediaBuffer *enc_hdr);
+/* This function writes out any remaining frames and closes the file.
+
+   Return: 0 = success, -1 = failure, also when a write failed
+   earlier and the file is incomplete */
+int recorderDeinit(struct recorderInstance *recInst);
+/* Adds one frame from encoderEncodeFrame to the recording. Frames
+   are collected per GOP and written as one moof/mdat fragment by a
+   background thread, so this never waits on the storage.
+
+   Return: 0 = success, -1 = failure, also for every frame after
+   a failed write */
+int recorderWriteFrame(struct recorderInstance *recInst,
+		       struct mediaBuffer *enc_src);
+
 /* This function initializes the video processing unit
    that contains the video codecs on Enzo. It must be 
    called before any encode/decode session can be started.
 
    Return: 0 = success, -1 = failure */
 int vpuInit(void);
+/* All contiguous memory used by the codecs is sub-allocated from
+   one region reserved by vpuInit, which avoids fragmenting the
+   system's contiguous memory over many start/stop cycles. This
+   function sets the size of that region in bytes and must be
+   called before vpuInit. 0 selects the default of 64MB, and -1
+   disables the arena so every buffer is allocated separately.
+
+   Return: 0 = success, -1 = failure */
+int vpuSetArenaSize(int size);
+/* Framebuffers of finished encode/decode sessions are kept in
+   a pool, so a restart with the same picture size does not have
+   to allocate contiguous memory again. This function releases
+   pooled framebuffers until at most keepBytes remain, and
+   should be called when the system is low on memory. 0
+   releases all of them.
+
+   Return: 0 = success, -1 = failure */
+int vpuTrimMemory(int keepBytes);
 /* This function deinitializes the video processing unit.
 
    Return: 0 = success, -1 = failure */
@@ -0,0 +1,276 @@
+#include "enzo_log.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+
+#define LOG_TAG "EnzoCodecLib"
+
+/*
+ * Messages are formatted by the thread that logs them into a slot of a
+ * bounded ring and written out by a background thread, so a storm of per
+ * frame errors costs the pipeline a vsnprintf each, not a blocking write.
+ * The ring is the bounded queue of D. Vyukov: a producer claims a slot
+ * with one compare-and-swap on head and publishes it through the slot's
+ * seq, so producers never take a lock. Only the writer side is serialized.
+ */
+struct log_slot {
+	unsigned int seq;
+	int level;
+	char text[LOG_LINE_MAX];
+};
+
+static struct log_slot log_ring[LOG_RING_SIZE];
+static unsigned int log_head;
+static unsigned int log_tail;
+static volatile unsigned long log_dropped;
+
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t log_write_lock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t log_sem;
+static int log_async;
+static FILE *log_file;
+
+/* Function prototypes */
+static void log_init(void);
+static void *log_thread(void *arg);
+static long long log_now_us(void);
+static unsigned int log_hash(const char *s);
+static void log_write(int level, const char *text);
+static void log_drain(void);
+/* End function prototypes */
+
+static void log_init(void)
+{
+	pthread_t thread;
+	const char *path;
+	unsigned int i;
+
+	for (i = 0; i < LOG_RING_SIZE; i++)
+		log_ring[i].seq = i;
+
+	path = getenv("ENZO_LOG_FILE");
+	if (path != NULL)
+		log_file = fopen(path, "a");
+
+	if (sem_init(&log_sem, 0, 0) < 0)
+		return;
+	if (pthread_create(&thread, NULL, log_thread, NULL) != 0)
+		return;
+	pthread_detach(thread);
+	log_async = 1;
+}
+
+static void *log_thread(void *arg)
+{
+	for (;;) {
+		if (sem_wait(&log_sem) < 0)
+			continue;
+		log_drain();
+	}
+
+	return NULL;
+}
+
+static long long log_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * FNV-1a, only used to spot repeats of the same message
+ */
+static unsigned int log_hash(const char *s)
+{
+	unsigned int h = 2166136261u;
+
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619u;
+	}
+
+	return h ? h : 1;
+}
+
+/*
+ * Called with the write lock held
+ */
+static void log_write(int level, const char *text)
+{
+	static const char levels[] = { 'I', 'W', 'E' };
+	long long now;
+
+	if (log_file == NULL) {
+#ifdef __ANDROID__
+		static const int prio[] = { ANDROID_LOG_INFO, ANDROID_LOG_WARN,
+					    ANDROID_LOG_ERROR };
+
+		__android_log_write(prio[level], LOG_TAG, text);
+		return;
+#else
+		fprintf(stderr, "%s %c: %s\n", LOG_TAG, levels[level], text);
+		return;
+#endif
+	}
+
+	now = log_now_us();
+	fprintf(log_file, "%lld.%06lld %c %s\n", now / 1000000, now % 1000000,
+		levels[level], text);
+	fflush(log_file);
+}
+
+/*
+ * Write out everything in the ring. Runs on the logging thread, or on
+ * any thread through enzo_log_flush.
+ */
+static void log_drain(void)
+{
+	struct log_slot *slot;
+	unsigned long dropped;
+	char text[64];
+
+	pthread_mutex_lock(&log_write_lock);
+
+	for (;;) {
+		slot = &log_ring[log_tail & (LOG_RING_SIZE - 1)];
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) !=
+		    log_tail + 1)
+			break;
+		log_write(slot->level, slot->text);
+		__atomic_store_n(&slot->seq, log_tail + LOG_RING_SIZE,
+				 __ATOMIC_RELEASE);
+		log_tail++;
+	}
+
+	dropped = __sync_fetch_and_and(&log_dropped, 0);
+	if (dropped) {
+		snprintf(text, sizeof(text), "%lu log messages dropped",
+			 dropped);
+		log_write(ENZO_LOG_WARN, text);
+	}
+
+	pthread_mutex_unlock(&log_write_lock);
+}
+
+/*
+ * Log a message through the rate limits of site. Use err_msg, warn_msg
+ * and info_msg rather than calling this directly.
+ */
+void enzo_log(struct log_site *site, int level, const char *fmt, ...)
+{
+	struct log_slot *slot;
+	char text[LOG_LINE_MAX];
+	unsigned long suppressed;
+	unsigned int pos, seq, hash;
+	long long now;
+	va_list ap;
+	int len;
+
+	pthread_once(&log_once, log_init);
+
+	va_start(ap, fmt);
+	len = vsnprintf(text, sizeof(text), fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (len >= (int)sizeof(text))
+		len = sizeof(text) - 1;
+	while (len > 0 && text[len - 1] == '\n')
+		text[--len] = '\0';
+
+	/* The site state is shared by all threads logging from it. A race
+	   can only let a message more or fewer through. */
+	now = log_now_us();
+	hash = log_hash(text);
+	if (now - site->window_start >= LOG_SITE_INTERVAL_US) {
+		site->window_start = now;
+		site->window_count = 0;
+	}
+	if (site->window_count >= LOG_SITE_BURST ||
+	    (site->window_count > 0 && hash == site->last_hash)) {
+		__sync_fetch_and_add(&site->suppressed, 1);
+		return;
+	}
+	site->window_count++;
+	site->last_hash = hash;
+
+	suppressed = __sync_fetch_and_and(&site->suppressed, 0);
+	if (suppressed)
+		snprintf(text + len, sizeof(text) - len,
+			 " (%lu similar suppressed)", suppressed);
+
+	if (!log_async) {
+		pthread_mutex_lock(&log_write_lock);
+		log_write(level, text);
+		pthread_mutex_unlock(&log_write_lock);
+		return;
+	}
+
+	/* Claim a slot, or drop the message if the ring is full */
+	pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &log_ring[pos & (LOG_RING_SIZE - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		if (seq == pos) {
+			if (__sync_bool_compare_and_swap(&log_head, pos,
+							 pos + 1))
+				break;
+		} else if ((int)(seq - pos) < 0) {
+			__sync_fetch_and_add(&log_dropped, 1);
+			return;
+		}
+		pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+	}
+
+	slot->level = level;
+	memcpy(slot->text, text, sizeof(text));
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	sem_post(&log_sem);
+}
+
+/*
+ * Write out all queued messages before returning, for example before
+ * the process exits
+ */
+void enzo_log_flush(void)
+{
+	pthread_once(&log_once, log_init);
+	log_drain();
+}
+
+/*
+ * Send messages to a file instead of logcat or stderr. The ENZO_LOG_FILE
+ * environment variable does the same at startup.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int enzo_log_set_file(const char *path)
+{
+	FILE *f;
+
+	pthread_once(&log_once, log_init);
+
+	f = fopen(path, "a");
+	if (f == NULL)
+		return -1;
+
+	pthread_mutex_lock(&log_write_lock);
+	if (log_file)
+		fclose(log_file);
+	log_file = f;
+	pthread_mutex_unlock(&log_write_lock);
+
+	return 0;
+}
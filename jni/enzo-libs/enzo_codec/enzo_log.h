@@ -0,0 +1,51 @@
+#ifndef ENZO_LOG_H
+#define ENZO_LOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+	ENZO_LOG_INFO = 0,
+	ENZO_LOG_WARN,
+	ENZO_LOG_ERROR
+};
+
+/* Messages waiting to be written. When the ring is full, new messages are
+   dropped and counted rather than waited for. */
+#define LOG_RING_SIZE		256	/* Power of two */
+#define LOG_LINE_MAX		248
+
+/* Each call site prints at most LOG_SITE_BURST messages per interval,
+   and repeats of its last message are only counted */
+#define LOG_SITE_BURST		5
+#define LOG_SITE_INTERVAL_US	1000000
+
+/* Rate limiting state of one err_msg/warn_msg/info_msg call site */
+struct log_site {
+	long long window_start;
+	unsigned int window_count;
+	unsigned int last_hash;
+	unsigned long suppressed;
+};
+
+void enzo_log(struct log_site *site, int level, const char *fmt, ...)
+	__attribute__((format(printf, 3, 4)));
+void enzo_log_flush(void);
+int enzo_log_set_file(const char *path);
+
+/*
+ * Every use of the macro gets a log_site of its own. The message is
+ * formatted on the calling thread and written out by a background thread.
+ */
+#define ENZO_LOG(level, ...) \
+	do { \
+		static struct log_site log_site_; \
+		enzo_log(&log_site_, level, __VA_ARGS__); \
+	} while (0)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ENZO_LOG_H
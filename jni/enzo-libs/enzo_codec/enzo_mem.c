@@ -0,0 +1,472 @@
+#define _GNU_SOURCE
+#include "enzo_mem.h"
+#include "enzo_utils.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * All contiguous memory used by the codecs and the display path is carved
+ * out of one region that is reserved once, instead of each buffer going to
+ * the contiguous memory allocator on its own. Repeated start/stop cycles
+ * then only fragment the arena, which coalesces again as blocks are freed.
+ *
+ * Blocks are managed by a binary buddy allocator over 4KB pages. An
+ * allocation takes the smallest buddy block that fits and immediately
+ * frees the pages past the requested size, so a 1.4MB framebuffer does
+ * not hold on to a 2MB block.
+ */
+
+struct contig_page {
+	int next;	/* Free list links, valid on free block heads */
+	int prev;
+	int order;	/* Order of the free block starting here, or -1 */
+	int alloc;	/* Pages of the allocation starting here, or 0 */
+};
+
+struct contig_arena {
+	pthread_mutex_t lock;
+	int ready;
+	vpu_mem_desc desc;	/* The reserved region */
+	int npages;
+	struct contig_page *pages;
+	int free_head[CONTIG_MAX_ORDER + 1];
+	struct contig_arena_stats stats;
+};
+
+/* Bookkeeping behind every g2d_buf handed out by contig_g2d_alloc */
+struct contig_g2d_meta {
+	vpu_mem_desc desc;	/* Arena block, for uncached buffers */
+	struct g2d_buf *cached;	/* GPU allocation, for cacheable buffers */
+};
+
+static struct contig_arena arena = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* Function prototypes */
+static int contig_reserve(int size);
+static void contig_release(void);
+static void contig_list_add(int block, int order);
+static void contig_list_del(int block, int order);
+static void contig_free_block(int block, int order);
+static void contig_free_range(int start, int end);
+static int contig_alloc_pages(int npages);
+static int contig_in_arena(unsigned long phys);
+/* End function prototypes */
+
+/*
+ * Reserve the arena. A size of 0 uses CONTIG_ARENA_SIZE. If the region
+ * cannot be reserved, allocations go straight to the VPU driver as before.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int contig_arena_init(int size)
+{
+	int i;
+
+	if (size <= 0)
+		size = CONTIG_ARENA_SIZE;
+	size &= ~(CONTIG_PAGE_SIZE - 1);
+
+	pthread_mutex_lock(&arena.lock);
+	if (arena.ready) {
+		pthread_mutex_unlock(&arena.lock);
+		return 0;
+	}
+
+	if (contig_reserve(size) < 0) {
+		pthread_mutex_unlock(&arena.lock);
+		return -1;
+	}
+
+	arena.npages = size >> CONTIG_PAGE_SHIFT;
+	arena.pages = calloc(arena.npages, sizeof(struct contig_page));
+	if (arena.pages == NULL) {
+		err_msg("Arena: Failed to allocate page table\n");
+		contig_release();
+		pthread_mutex_unlock(&arena.lock);
+		return -1;
+	}
+
+	for (i = 0; i < arena.npages; i++)
+		arena.pages[i].order = -1;
+	for (i = 0; i <= CONTIG_MAX_ORDER; i++)
+		arena.free_head[i] = -1;
+	contig_free_range(0, arena.npages);
+
+	memset(&arena.stats, 0, sizeof(struct contig_arena_stats));
+	arena.stats.size = size;
+	arena.ready = 1;
+	pthread_mutex_unlock(&arena.lock);
+
+	info_msg("Arena: Reserved %d bytes at 0x%lx\n", size,
+		 arena.desc.phy_addr);
+
+	return 0;
+}
+
+/*
+ * Give the arena back. Every block must have been freed by then.
+ */
+void contig_arena_deinit(void)
+{
+	pthread_mutex_lock(&arena.lock);
+	if (arena.ready) {
+		if (arena.stats.used > 0)
+			warn_msg("Arena: %d bytes still in use at deinit\n",
+				 arena.stats.used);
+		contig_release();
+		free(arena.pages);
+		arena.pages = NULL;
+		arena.ready = 0;
+	}
+	pthread_mutex_unlock(&arena.lock);
+}
+
+void contig_arena_get_stats(struct contig_arena_stats *stats)
+{
+	int i;
+
+	pthread_mutex_lock(&arena.lock);
+	memcpy(stats, &arena.stats, sizeof(struct contig_arena_stats));
+	stats->largest_free = 0;
+	for (i = CONTIG_MAX_ORDER; i >= 0 && arena.ready; i--) {
+		if (arena.free_head[i] >= 0) {
+			stats->largest_free = CONTIG_PAGE_SIZE << i;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&arena.lock);
+}
+
+/*
+ * Allocate desc->size bytes of physically contiguous memory and fill in
+ * the physical and virtual addresses, like IOGetPhyMem + IOGetVirtMem.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int contig_alloc(vpu_mem_desc *desc)
+{
+	int npages, block = -1;
+	unsigned long offset;
+
+	npages = (desc->size + CONTIG_PAGE_SIZE - 1) >> CONTIG_PAGE_SHIFT;
+
+	pthread_mutex_lock(&arena.lock);
+	if (arena.ready && npages > 0)
+		block = contig_alloc_pages(npages);
+	if (block >= 0) {
+		arena.stats.used += npages << CONTIG_PAGE_SHIFT;
+		arena.stats.allocs++;
+	} else {
+		arena.stats.fallbacks++;
+	}
+	pthread_mutex_unlock(&arena.lock);
+
+	if (block >= 0) {
+		offset = (unsigned long)block << CONTIG_PAGE_SHIFT;
+		desc->phy_addr = arena.desc.phy_addr + offset;
+		desc->cpu_addr = arena.desc.cpu_addr + offset;
+		desc->virt_uaddr = arena.desc.virt_uaddr + offset;
+		return 0;
+	}
+
+	/* The arena is full or not set up, use the driver directly */
+	if (arena.ready)
+		warn_msg("Arena: No block for %d bytes, using driver\n",
+			 desc->size);
+	if (IOGetPhyMem(desc))
+		return -1;
+	desc->virt_uaddr = IOGetVirtMem(desc);
+	if (desc->virt_uaddr <= 0) {
+		IOFreePhyMem(desc);
+		return -1;
+	}
+
+	return 0;
+}
+
+void contig_free(vpu_mem_desc *desc)
+{
+	int block, npages;
+
+	if (desc->phy_addr == 0)
+		return;
+
+	pthread_mutex_lock(&arena.lock);
+	if (contig_in_arena(desc->phy_addr)) {
+		block = (desc->phy_addr - arena.desc.phy_addr) >>
+			CONTIG_PAGE_SHIFT;
+		npages = arena.pages[block].alloc;
+		if (npages > 0) {
+			arena.pages[block].alloc = 0;
+			contig_free_range(block, block + npages);
+			arena.stats.used -= npages << CONTIG_PAGE_SHIFT;
+		} else {
+			err_msg("Arena: Double free of 0x%lx\n",
+				desc->phy_addr);
+		}
+		pthread_mutex_unlock(&arena.lock);
+	} else {
+		pthread_mutex_unlock(&arena.lock);
+		if (desc->virt_uaddr)
+			IOFreeVirtMem(desc);
+		IOFreePhyMem(desc);
+	}
+
+	memset(desc, 0, sizeof(vpu_mem_desc));
+}
+
+/*
+ * Translate between the physical and virtual address of arena memory.
+ *
+ * Return: the translated address, or 0 if it is not in the arena
+ */
+unsigned long contig_phys_to_virt(unsigned long phys)
+{
+	if (!contig_in_arena(phys))
+		return 0;
+	return arena.desc.virt_uaddr + (phys - arena.desc.phy_addr);
+}
+
+unsigned long contig_virt_to_phys(unsigned long virt)
+{
+	if (!arena.ready || virt < arena.desc.virt_uaddr ||
+	    virt >= arena.desc.virt_uaddr + arena.desc.size)
+		return 0;
+	return arena.desc.phy_addr + (virt - arena.desc.virt_uaddr);
+}
+
+/*
+ * Allocate a buffer that can be used as a g2d surface in place of
+ * g2d_alloc. Uncached buffers come from the arena. The arena is mapped
+ * uncached by the VPU driver, so cacheable buffers, meant for frames the
+ * CPU reads or writes, are allocated from the GPU driver instead.
+ *
+ * Cacheable buffers need cache maintenance whenever the buffer changes
+ * hands between the CPU and the hardware, see contig_sync_for_cpu and
+ * contig_sync_for_device.
+ */
+struct g2d_buf *contig_g2d_alloc(int size, int cacheable)
+{
+	struct g2d_buf *buf;
+	struct contig_g2d_meta *meta;
+
+	buf = calloc(1, sizeof(struct g2d_buf) +
+		     sizeof(struct contig_g2d_meta));
+	if (buf == NULL)
+		return NULL;
+	meta = (struct contig_g2d_meta *)(buf + 1);
+
+	if (cacheable) {
+		meta->cached = g2d_alloc(size, 1);
+		if (meta->cached == NULL) {
+			err_msg("Arena: Failed to allocate %d byte cacheable "
+				"g2d buffer\n", size);
+			free(buf);
+			return NULL;
+		}
+		buf->buf_vaddr = meta->cached->buf_vaddr;
+		buf->buf_paddr = meta->cached->buf_paddr;
+	} else {
+		meta->desc.size = size;
+		if (contig_alloc(&meta->desc) < 0) {
+			err_msg("Arena: Failed to allocate %d byte g2d "
+				"buffer\n", size);
+			free(buf);
+			return NULL;
+		}
+		buf->buf_vaddr = (void *)meta->desc.virt_uaddr;
+		buf->buf_paddr = (int)meta->desc.phy_addr;
+	}
+
+	buf->buf_handle = meta;
+	buf->buf_size = size;
+
+	return buf;
+}
+
+void contig_g2d_free(struct g2d_buf *buf)
+{
+	struct contig_g2d_meta *meta;
+
+	if (buf == NULL)
+		return;
+
+	meta = (struct contig_g2d_meta *)buf->buf_handle;
+	if (meta->cached != NULL)
+		g2d_free(meta->cached);
+	else
+		contig_free(&meta->desc);
+	free(buf);
+}
+
+/*
+ * Cache maintenance on a buffer from contig_g2d_alloc. Uncached buffers
+ * need none, so this is a no-op for them.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int contig_cache_op(struct g2d_buf *buf, enum g2d_cache_mode op)
+{
+	struct contig_g2d_meta *meta = (struct contig_g2d_meta *)buf->buf_handle;
+
+	if (meta->cached == NULL)
+		return 0;
+
+	if (g2d_cache_op(meta->cached, op)) {
+		err_msg("Arena: Cache operation %d failed\n", op);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Hand a buffer the hardware has written to the CPU. Stale cache lines
+ * are dropped so the CPU reads what the hardware wrote.
+ */
+int contig_sync_for_cpu(struct g2d_buf *buf)
+{
+	return contig_cache_op(buf, G2D_CACHE_INVALIDATE);
+}
+
+/*
+ * Hand a buffer the CPU has written to the hardware. Dirty cache lines
+ * are written back so the hardware sees what the CPU wrote.
+ */
+int contig_sync_for_device(struct g2d_buf *buf)
+{
+	return contig_cache_op(buf, G2D_CACHE_CLEAN);
+}
+
+static int contig_reserve(int size)
+{
+	memset(&arena.desc, 0, sizeof(vpu_mem_desc));
+	arena.desc.size = size;
+	if (IOGetPhyMem(&arena.desc)) {
+		err_msg("Arena: Unable to reserve %d bytes\n", size);
+		return -1;
+	}
+
+	arena.desc.virt_uaddr = IOGetVirtMem(&arena.desc);
+	if (arena.desc.virt_uaddr <= 0) {
+		err_msg("Arena: Unable to map %d bytes\n", size);
+		IOFreePhyMem(&arena.desc);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void contig_release(void)
+{
+	IOFreeVirtMem(&arena.desc);
+	IOFreePhyMem(&arena.desc);
+	memset(&arena.desc, 0, sizeof(vpu_mem_desc));
+}
+
+static void contig_list_add(int block, int order)
+{
+	struct contig_page *p = &arena.pages[block];
+
+	p->order = order;
+	p->prev = -1;
+	p->next = arena.free_head[order];
+	if (p->next >= 0)
+		arena.pages[p->next].prev = block;
+	arena.free_head[order] = block;
+}
+
+static void contig_list_del(int block, int order)
+{
+	struct contig_page *p = &arena.pages[block];
+
+	if (p->prev >= 0)
+		arena.pages[p->prev].next = p->next;
+	else
+		arena.free_head[order] = p->next;
+	if (p->next >= 0)
+		arena.pages[p->next].prev = p->prev;
+	p->order = -1;
+}
+
+/*
+ * Free one aligned block, merging it with its buddy as long as the buddy
+ * is free too
+ */
+static void contig_free_block(int block, int order)
+{
+	int buddy;
+
+	while (order < CONTIG_MAX_ORDER) {
+		buddy = block ^ (1 << order);
+		if (buddy + (1 << order) > arena.npages ||
+		    arena.pages[buddy].order != order)
+			break;
+		contig_list_del(buddy, order);
+		if (buddy < block)
+			block = buddy;
+		order++;
+	}
+
+	contig_list_add(block, order);
+}
+
+/*
+ * Free pages [start, end) as the largest aligned blocks that fit
+ */
+static void contig_free_range(int start, int end)
+{
+	int order;
+
+	while (start < end) {
+		order = 0;
+		while (order < CONTIG_MAX_ORDER &&
+		       (start & ((2 << order) - 1)) == 0 &&
+		       start + (2 << order) <= end)
+			order++;
+		contig_free_block(start, order);
+		start += 1 << order;
+	}
+}
+
+static int contig_alloc_pages(int npages)
+{
+	int order = 0, i, block;
+
+	while ((1 << order) < npages)
+		order++;
+	if (order > CONTIG_MAX_ORDER)
+		return -1;
+
+	for (i = order; i <= CONTIG_MAX_ORDER; i++) {
+		if (arena.free_head[i] >= 0)
+			break;
+	}
+	if (i > CONTIG_MAX_ORDER)
+		return -1;
+
+	block = arena.free_head[i];
+	contig_list_del(block, i);
+
+	/* Split down to the order that fits, keeping the lower half */
+	while (i > order) {
+		i--;
+		contig_list_add(block + (1 << i), i);
+	}
+
+	/* Give back the pages past the requested size */
+	contig_free_range(block + npages, block + (1 << order));
+	arena.pages[block].alloc = npages;
+
+	return block;
+}
+
+static int contig_in_arena(unsigned long phys)
+{
+	return arena.ready && phys >= arena.desc.phy_addr &&
+	       phys < arena.desc.phy_addr + arena.desc.size;
+}
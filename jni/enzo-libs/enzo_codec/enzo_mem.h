@@ -0,0 +1,47 @@
+#ifndef ENZO_MEM_H
+#define ENZO_MEM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "vpu_io.h"
+#include "g2d.h"
+
+/* Size of the region reserved by vpuInit when no other size is set */
+#define CONTIG_ARENA_SIZE	(64 * 1024 * 1024)
+/* Allocation granularity. Every block starts on a page boundary, which
+   covers the alignment needs of the VPU and the GPU. */
+#define CONTIG_PAGE_SHIFT	12
+#define CONTIG_PAGE_SIZE	(1 << CONTIG_PAGE_SHIFT)
+/* Largest buddy block is 2^CONTIG_MAX_ORDER pages (16MB) */
+#define CONTIG_MAX_ORDER	12
+
+struct contig_arena_stats {
+	int size;		/* Bytes reserved for the arena */
+	int used;		/* Bytes handed out */
+	int largest_free;	/* Largest block that can still be allocated */
+	unsigned long allocs;
+	unsigned long fallbacks;/* Allocations served outside the arena */
+};
+
+int contig_arena_init(int size);
+void contig_arena_deinit(void);
+void contig_arena_get_stats(struct contig_arena_stats *stats);
+
+int contig_alloc(vpu_mem_desc *desc);
+void contig_free(vpu_mem_desc *desc);
+unsigned long contig_phys_to_virt(unsigned long phys);
+unsigned long contig_virt_to_phys(unsigned long virt);
+
+struct g2d_buf *contig_g2d_alloc(int size, int cacheable);
+void contig_g2d_free(struct g2d_buf *buf);
+int contig_cache_op(struct g2d_buf *buf, enum g2d_cache_mode op);
+int contig_sync_for_cpu(struct g2d_buf *buf);
+int contig_sync_for_device(struct g2d_buf *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ENZO_MEM_H
@@ -0,0 +1,284 @@
+#include "enzo_trace.h"
+#include "enzo_utils.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Every thread appends to a buffer of its own. Only the owning thread
+ * writes events, and it publishes them by bumping count after the event
+ * is complete, so the writer never takes a lock and the flush reads only
+ * finished events. A buffer belongs to one trace (gen) and is rewound by
+ * its thread on the first event of the next trace. The events are written
+ * out as Chrome trace JSON, which chrome://tracing and Perfetto both load.
+ */
+struct trace_ev {
+	long long ts;
+	const char *name;
+	unsigned long frame;
+	int dur;	/* Complete events only */
+	char phase;
+};
+
+struct trace_buf {
+	struct trace_ev ev[TRACE_MAX_EVENTS];
+	volatile int count;
+	unsigned int gen;
+	unsigned long dropped;
+	int tid;
+	int exited;
+	char name[16];
+	struct trace_buf *next;
+};
+
+volatile int trace_enabled;
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static pthread_key_t trace_key;
+/* Protects the buffer list and the trace state, never taken per event */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_buf *trace_bufs;
+static volatile unsigned int trace_gen;
+static char trace_path[256];
+
+/* Function prototypes */
+static void trace_create_key(void);
+static void trace_thread_exit(void *arg);
+static struct trace_buf *trace_buf_get(void);
+static void trace_free_exited(void);
+static int trace_write(FILE *f);
+static void trace_add(const char *name, char phase, unsigned long frame,
+		      long long ts, int dur);
+/* End function prototypes */
+
+static void trace_create_key(void)
+{
+	pthread_key_create(&trace_key, trace_thread_exit);
+}
+
+/*
+ * The events of a thread that exits are still wanted by the flush, so
+ * its buffer is only freed when the next trace starts
+ */
+static void trace_thread_exit(void *arg)
+{
+	struct trace_buf *t = arg;
+
+	pthread_mutex_lock(&trace_lock);
+	t->exited = 1;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static struct trace_buf *trace_buf_get(void)
+{
+	struct trace_buf *t;
+
+	pthread_once(&trace_once, trace_create_key);
+
+	t = pthread_getspecific(trace_key);
+	if (t != NULL)
+		return t;
+
+	t = calloc(1, sizeof(struct trace_buf));
+	if (t == NULL)
+		return NULL;
+	t->tid = syscall(__NR_gettid);
+	prctl(PR_GET_NAME, t->name, 0, 0, 0);
+	t->gen = trace_gen;
+
+	pthread_mutex_lock(&trace_lock);
+	t->next = trace_bufs;
+	trace_bufs = t;
+	pthread_mutex_unlock(&trace_lock);
+
+	pthread_setspecific(trace_key, t);
+
+	return t;
+}
+
+/*
+ * Called with the lock held
+ */
+static void trace_free_exited(void)
+{
+	struct trace_buf **p = &trace_bufs, *t;
+
+	while ((t = *p) != NULL) {
+		if (t->exited) {
+			*p = t->next;
+			free(t);
+		} else {
+			p = &t->next;
+		}
+	}
+}
+
+/*
+ * Called with the lock held, after tracing was disabled
+ *
+ * Return: number of events written
+ */
+static int trace_write(FILE *f)
+{
+	struct trace_buf *t;
+	struct trace_ev *e;
+	int pid = getpid();
+	int i, n, total = 0;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+		"\"args\":{\"name\":\"enzocam\"}}", pid);
+
+	for (t = trace_bufs; t; t = t->next) {
+		if (t->gen != trace_gen)
+			continue;
+
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+			"\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			pid, t->tid, t->name);
+
+		n = t->count;
+		__sync_synchronize();
+		for (i = 0; i < n; i++) {
+			e = &t->ev[i];
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\","
+				"\"ts\":%lld,\"pid\":%d,\"tid\":%d,",
+				e->name, e->phase, e->ts, pid, t->tid);
+			if (e->phase == 'X')
+				fprintf(f, "\"dur\":%d,", e->dur);
+			else if (e->phase == 'i')
+				fprintf(f, "\"s\":\"t\",");
+			fprintf(f, "\"args\":{\"frame\":%lu}}", e->frame);
+		}
+		total += n;
+
+		if (t->dropped)
+			warn_msg("Trace: %lu events of thread %d dropped\n",
+				 t->dropped, t->tid);
+	}
+
+	fprintf(f, "\n]}\n");
+
+	return total;
+}
+
+/*
+ * Start recording events, to be written to path by trace_stop
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int trace_start(const char *path)
+{
+	pthread_mutex_lock(&trace_lock);
+	if (trace_enabled) {
+		pthread_mutex_unlock(&trace_lock);
+		err_msg("Trace: Already running\n");
+		return -1;
+	}
+
+	strncpy(trace_path, path, sizeof(trace_path) - 1);
+	trace_path[sizeof(trace_path) - 1] = '\0';
+	trace_free_exited();
+	trace_gen++;
+	__sync_synchronize();
+	trace_enabled = 1;
+	pthread_mutex_unlock(&trace_lock);
+
+	info_msg("Trace: Recording to %s\n", path);
+
+	return 0;
+}
+
+/*
+ * Stop recording and write the trace file
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int trace_stop(void)
+{
+	FILE *f;
+	int events;
+
+	pthread_mutex_lock(&trace_lock);
+	if (!trace_enabled) {
+		pthread_mutex_unlock(&trace_lock);
+		return 0;
+	}
+	trace_enabled = 0;
+	__sync_synchronize();
+
+	f = fopen(trace_path, "w");
+	if (f == NULL) {
+		pthread_mutex_unlock(&trace_lock);
+		err_msg("Trace: Could not create %s\n", trace_path);
+		return -1;
+	}
+	events = trace_write(f);
+	fclose(f);
+	pthread_mutex_unlock(&trace_lock);
+
+	info_msg("Trace: %d events written to %s\n", events, trace_path);
+
+	return 0;
+}
+
+static void trace_add(const char *name, char phase, unsigned long frame,
+		      long long ts, int dur)
+{
+	struct trace_buf *t;
+	struct trace_ev *e;
+
+	t = trace_buf_get();
+	if (t == NULL)
+		return;
+
+	if (t->gen != trace_gen) {
+		t->gen = trace_gen;
+		t->count = 0;
+		t->dropped = 0;
+	}
+	if (t->count >= TRACE_MAX_EVENTS) {
+		t->dropped++;
+		return;
+	}
+
+	e = &t->ev[t->count];
+	e->ts = ts;
+	e->name = name;
+	e->frame = frame;
+	e->dur = dur;
+	e->phase = phase;
+
+	/* The event must be complete before the flush can see it */
+	__sync_synchronize();
+	t->count++;
+}
+
+/*
+ * Append one event to the calling thread's buffer. Use the TRACE_*
+ * macros instead of calling these directly.
+ */
+void trace_event(const char *name, char phase, unsigned long frame)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	trace_add(name, phase, frame,
+		  (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000, 0);
+}
+
+void trace_span(const char *name, unsigned long frame, long long start_us)
+{
+	struct timespec ts;
+	long long now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	trace_add(name, 'X', frame, start_us, (int)(now - start_us));
+}
@@ -0,0 +1,45 @@
+#ifndef ENZO_TRACE_H
+#define ENZO_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Events kept per thread and trace. Events beyond that are dropped. */
+#define TRACE_MAX_EVENTS	16384
+
+extern volatile int trace_enabled;
+
+int trace_start(const char *path);
+int trace_stop(void);
+void trace_event(const char *name, char phase, unsigned long frame);
+void trace_span(const char *name, unsigned long frame, long long start_us);
+
+/*
+ * Trace points. name must be a string literal, frame the id of the frame
+ * being worked on (mediaBuffer.frameId). TRACE_SPAN records a stage that
+ * started at start_us (stage_now_us) and ends now, which suits stages
+ * with early error returns. Without ENZO_TRACE they compile to nothing;
+ * with it, they cost one flag test while no trace is running.
+ */
+#ifdef ENZO_TRACE
+#define TRACE_BEGIN(name, frame) \
+	do { if (trace_enabled) trace_event(name, 'B', frame); } while (0)
+#define TRACE_END(name, frame) \
+	do { if (trace_enabled) trace_event(name, 'E', frame); } while (0)
+#define TRACE_INSTANT(name, frame) \
+	do { if (trace_enabled) trace_event(name, 'i', frame); } while (0)
+#define TRACE_SPAN(name, frame, start_us) \
+	do { if (trace_enabled) trace_span(name, frame, start_us); } while (0)
+#else
+#define TRACE_BEGIN(name, frame)	do { } while (0)
+#define TRACE_END(name, frame)		do { } while (0)
+#define TRACE_INSTANT(name, frame)	do { } while (0)
+#define TRACE_SPAN(name, frame, start_us)	do { } while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ENZO_TRACE_H
@@ -1,4 +1,5 @@
 #include "enzo_utils.h"
+#include "enzo_mem.h"
 
 #include <unistd.h>
 #include <stdio.h>
@@ -59,19 +60,12 @@ int mediaBufferInit(struct mediaBuffer *medBuf, int size)
 	}
 
 	medBuf->desc.size = size;
-	err = IOGetPhyMem(&medBuf->desc);
+	err = contig_alloc(&medBuf->desc);
 	if (err) {
 		err_msg("Media buffer: phys allocation failure\n");
 		return -1;
 	}
 
-	medBuf->desc.virt_uaddr = IOGetVirtMem(&(medBuf->desc));
-	if (medBuf->desc.virt_uaddr <= 0) {
-		IOFreePhyMem(&medBuf->desc);
-		err_msg("Media buffer: IOGetVirtMem failed\n");
-		return -1;
-	}
-
 	info_msg("Media buffer: allocated new buffer with size of %d\n", size);
 
 	medBuf->vBufOut = (unsigned char *)medBuf->desc.virt_uaddr;
@@ -86,7 +80,7 @@ int mediaBufferDeinit(struct mediaBuffer *medBuf)
 		return -1;
 	}
 
-	IOFreePhyMem(&medBuf->desc);
+	contig_free(&medBuf->desc);
 
 	return 0;
 }
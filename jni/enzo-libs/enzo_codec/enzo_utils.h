@@ -6,18 +6,17 @@ extern "C" {
 #endif
 
 #include "vpu_common.h"
+#include "enzo_log.h"
 
-#include <android/log.h>
-#include <jni.h>
 #include <stddef.h>
 
 /* For allocating buffers */
 #include "vpu_io.h"
 
-#define LOG_TAG_ENZO_CODEC "EnzoCodecLib"
-#define info_msg(...) __android_log_print(ANDROID_LOG_INFO,LOG_TAG_ENZO_CODEC,__VA_ARGS__)
-#define warn_msg(...) __android_log_print(ANDROID_LOG_ERROR,LOG_TAG_ENZO_CODEC,__VA_ARGS__)
-#define err_msg(...) __android_log_print(ANDROID_LOG_ERROR,LOG_TAG_ENZO_CODEC,__VA_ARGS__)
+/* Logged asynchronously and rate limited per call site, see enzo_log.h */
+#define info_msg(...) ENZO_LOG(ENZO_LOG_INFO, __VA_ARGS__)
+#define warn_msg(...) ENZO_LOG(ENZO_LOG_WARN, __VA_ARGS__)
+#define err_msg(...) ENZO_LOG(ENZO_LOG_ERROR, __VA_ARGS__)
 
 /* The amount of NAL slices into which an encoded picture can be divided */
 #define MAX_NAL_PER_PICTURE	300
@@ -32,7 +31,8 @@ enum {
 	NV12	= 1,
 	YUV420P = 2,
 	YUV422P = 3,
-	YUYV	= 4
+	YUYV	= 4,
+	NV16	= 5	/* 4:2:2 with interleaved CbCr plane */
 };
 /* Data source enumeration */
 enum {
@@ -130,6 +130,16 @@ struct mediaBuffer {
 	int fd;
 	/* The file descriptor (if the data is coming from a file */
 
+	long long timestamp;
+	/* Capture time of the frame in microseconds, as reported by
+	   the source. Only differences between timestamps of the
+	   same source are meaningful. */
+
+	unsigned long frameId;
+	/* Number of the frame at its source, counting from 1. Components
+	   pass it on from their input to their output, so a frame can be
+	   followed through the pipeline. */
+
 	int bufOutSize;
 	/* The size of the data pointed to by bufOut. This
 	   value is only valid AFTER a component has put
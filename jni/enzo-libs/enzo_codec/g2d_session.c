@@ -0,0 +1,160 @@
+#include "g2d_session.h"
+#include "enzo_utils.h"
+#include "stage_stats.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+/*
+ * A g2d handle is not meant to be shared between threads, and opening
+ * one per frame costs more than the copies it is used for. Every thread
+ * therefore gets one session the first time it asks for it, which stays
+ * open until the thread exits.
+ */
+
+static pthread_once_t session_once = PTHREAD_ONCE_INIT;
+static pthread_key_t session_key;
+
+/* Stored instead of a session by a thread whose g2d_open failed, so it
+   takes the CPU paths without trying again on every copy */
+static struct g2d_session session_failed;
+
+/* Function prototypes */
+static void g2d_session_create_key(void);
+static void g2d_session_destroy(void *arg);
+/* End function prototypes */
+
+/*
+ * Return: the calling thread's session, or NULL if g2d is not available
+ */
+struct g2d_session *g2d_session_get(void)
+{
+	struct g2d_session *s;
+
+	pthread_once(&session_once, g2d_session_create_key);
+
+	s = pthread_getspecific(session_key);
+	if (s == &session_failed)
+		return NULL;
+	if (s != NULL)
+		return s;
+
+	s = calloc(1, sizeof(struct g2d_session));
+	if (s == NULL)
+		return NULL;
+
+	if (g2d_open(&s->handle)) {
+		err_msg("G2D: g2d_open failed, this thread uses the CPU\n");
+		free(s);
+		pthread_setspecific(session_key, &session_failed);
+		return NULL;
+	}
+
+	pthread_setspecific(session_key, s);
+
+	return s;
+}
+
+int g2d_session_copy(struct g2d_session *s, struct g2d_buf *dst,
+		     struct g2d_buf *src, int size)
+{
+	if (g2d_copy(s->handle, dst, src, size)) {
+		err_msg("G2D: copy of %d bytes failed\n", size);
+		return -1;
+	}
+
+	s->queued++;
+	s->ops++;
+
+	return 0;
+}
+
+int g2d_session_blit(struct g2d_session *s, struct g2d_surface *src,
+		     struct g2d_surface *dst)
+{
+	if (g2d_blit(s->handle, src, dst)) {
+		err_msg("G2D: blit failed\n");
+		return -1;
+	}
+
+	s->queued++;
+	s->ops++;
+
+	return 0;
+}
+
+/*
+ * Submit everything queued so far without waiting for it. If a fence is
+ * given, it is set to complete together with the submitted operations.
+ */
+int g2d_session_flush(struct g2d_session *s, struct g2d_fence *fence)
+{
+	if (s->queued > 0) {
+		g2d_flush(s->handle);
+		s->queued = 0;
+		s->submitted++;
+		s->flushes++;
+	}
+
+	if (fence != NULL) {
+		fence->session = s;
+		fence->seq = s->submitted;
+	}
+
+	return 0;
+}
+
+/*
+ * Wait until the operations covered by the fence are done. The hardware
+ * runs a session's operations in order, so this also completes every
+ * earlier fence. It must be called from the thread that owns the session.
+ */
+int g2d_session_wait(struct g2d_fence *fence)
+{
+	struct g2d_session *s = fence->session;
+	long long start;
+
+	if (s == NULL || fence->seq <= s->completed)
+		return 0;
+
+	/* g2d_finish also submits whatever was queued after the flush */
+	start = stage_now_us();
+	g2d_finish(s->handle);
+	stage_record(STAGE_G2D, stage_now_us() - start);
+	if (s->queued > 0) {
+		s->queued = 0;
+		s->submitted++;
+	}
+	s->completed = s->submitted;
+	s->waits++;
+
+	return 0;
+}
+
+/*
+ * Submit anything still queued and wait for all of it
+ */
+int g2d_session_finish(struct g2d_session *s)
+{
+	struct g2d_fence fence;
+
+	g2d_session_flush(s, &fence);
+	return g2d_session_wait(&fence);
+}
+
+static void g2d_session_create_key(void)
+{
+	pthread_key_create(&session_key, g2d_session_destroy);
+}
+
+static void g2d_session_destroy(void *arg)
+{
+	struct g2d_session *s = arg;
+
+	if (s == &session_failed)
+		return;
+
+	g2d_finish(s->handle);
+	g2d_close(s->handle);
+	free(s);
+}
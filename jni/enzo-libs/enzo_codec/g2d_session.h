@@ -0,0 +1,44 @@
+#ifndef G2D_SESSION_H
+#define G2D_SESSION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "g2d.h"
+
+/*
+ * Per-thread g2d session. Copies and blits are queued on the session and
+ * submitted together; a fence marks a point in the queue that a later
+ * stage can wait for.
+ */
+struct g2d_session {
+	void *handle;
+	int queued;		/* Operations queued since the last flush */
+	unsigned long submitted;/* Sequence number of the last flush */
+	unsigned long completed;/* Sequence number known to be done */
+
+	unsigned long ops;
+	unsigned long flushes;
+	unsigned long waits;
+};
+
+struct g2d_fence {
+	struct g2d_session *session;
+	unsigned long seq;
+};
+
+struct g2d_session *g2d_session_get(void);
+int g2d_session_copy(struct g2d_session *s, struct g2d_buf *dst,
+		     struct g2d_buf *src, int size);
+int g2d_session_blit(struct g2d_session *s, struct g2d_surface *src,
+		     struct g2d_surface *dst);
+int g2d_session_flush(struct g2d_session *s, struct g2d_fence *fence);
+int g2d_session_wait(struct g2d_fence *fence);
+int g2d_session_finish(struct g2d_session *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // G2D_SESSION_H
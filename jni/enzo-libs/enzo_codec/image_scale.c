@@ -0,0 +1,112 @@
+#include "image_scale.h"
+
+#include <string.h>
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+/* Function prototypes */
+static void scale_plane_half(const u8 *src, int src_stride,
+			     u8 *dst, int dst_width, int dst_height,
+			     int dst_stride);
+static void scale_plane_bilinear(const u8 *src, int src_width,
+				 int src_height, int src_stride,
+				 u8 *dst, int dst_width, int dst_height,
+				 int dst_stride);
+/* End function prototypes */
+
+void scale_plane(const u8 *src, int src_width, int src_height, int src_stride,
+		 u8 *dst, int dst_width, int dst_height, int dst_stride)
+{
+	int y;
+
+	if (dst_width == src_width && dst_height == src_height) {
+		for (y = 0; y < dst_height; y++)
+			memcpy(dst + y * dst_stride, src + y * src_stride,
+			       dst_width);
+	} else if (dst_width * 2 == src_width && dst_height * 2 == src_height) {
+		scale_plane_half(src, src_stride, dst, dst_width, dst_height,
+				 dst_stride);
+	} else {
+		scale_plane_bilinear(src, src_width, src_height, src_stride,
+				     dst, dst_width, dst_height, dst_stride);
+	}
+}
+
+/*
+ * Average every 2x2 block of the source into one destination pixel
+ */
+static void scale_plane_half(const u8 *src, int src_stride,
+			     u8 *dst, int dst_width, int dst_height,
+			     int dst_stride)
+{
+	const u8 *s0, *s1;
+	u8 *d;
+	int x, y;
+
+	for (y = 0; y < dst_height; y++) {
+		s0 = src + (2 * y) * src_stride;
+		s1 = s0 + src_stride;
+		d = dst + y * dst_stride;
+		x = 0;
+#ifdef __ARM_NEON__
+		for (; x + 16 <= dst_width; x += 16) {
+			uint8x16x2_t r0 = vld2q_u8(s0 + 2 * x);
+			uint8x16x2_t r1 = vld2q_u8(s1 + 2 * x);
+			uint16x8_t lo, hi;
+
+			__builtin_prefetch(s0 + 2 * x + 128);
+			__builtin_prefetch(s1 + 2 * x + 128);
+			lo = vaddl_u8(vget_low_u8(r0.val[0]),
+				      vget_low_u8(r0.val[1]));
+			lo = vaddw_u8(lo, vget_low_u8(r1.val[0]));
+			lo = vaddw_u8(lo, vget_low_u8(r1.val[1]));
+			hi = vaddl_u8(vget_high_u8(r0.val[0]),
+				      vget_high_u8(r0.val[1]));
+			hi = vaddw_u8(hi, vget_high_u8(r1.val[0]));
+			hi = vaddw_u8(hi, vget_high_u8(r1.val[1]));
+			vst1q_u8(d + x, vcombine_u8(vrshrn_n_u16(lo, 2),
+						    vrshrn_n_u16(hi, 2)));
+		}
+#endif
+		for (; x < dst_width; x++)
+			d[x] = (s0[2 * x] + s0[2 * x + 1] +
+				s1[2 * x] + s1[2 * x + 1] + 2) >> 2;
+	}
+}
+
+static void scale_plane_bilinear(const u8 *src, int src_width,
+				 int src_height, int src_stride,
+				 u8 *dst, int dst_width, int dst_height,
+				 int dst_stride)
+{
+	int step_x = (src_width << 16) / dst_width;
+	int step_y = (src_height << 16) / dst_height;
+	int x, y, sx, sy, fx, fy, x0, y0, x1, y1;
+	int top, bottom;
+	const u8 *r0, *r1;
+	u8 *d;
+
+	/* Sample at pixel centers so the image does not shift */
+	sy = step_y / 2 - 0x8000;
+	for (y = 0; y < dst_height; y++, sy += step_y) {
+		y0 = (sy < 0) ? 0 : sy >> 16;
+		y1 = (y0 + 1 < src_height) ? y0 + 1 : y0;
+		fy = (sy < 0) ? 0 : (sy >> 8) & 0xFF;
+		r0 = src + y0 * src_stride;
+		r1 = src + y1 * src_stride;
+		d = dst + y * dst_stride;
+
+		sx = step_x / 2 - 0x8000;
+		for (x = 0; x < dst_width; x++, sx += step_x) {
+			x0 = (sx < 0) ? 0 : sx >> 16;
+			x1 = (x0 + 1 < src_width) ? x0 + 1 : x0;
+			fx = (sx < 0) ? 0 : (sx >> 8) & 0xFF;
+
+			top = r0[x0] * (256 - fx) + r0[x1] * fx;
+			bottom = r1[x0] * (256 - fx) + r1[x1] * fx;
+			d[x] = (top * (256 - fy) + bottom * fy + 32768) >> 16;
+		}
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef IMAGE_SCALE_H
+#define IMAGE_SCALE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "enzo_utils.h"
+
+/* Scale one 8 bit image plane. Exact 2:1 reductions use a 2x2 box
+   filter (NEON accelerated when available), everything else uses
+   bilinear filtering in 16.16 fixed point. */
+void scale_plane(const u8 *src, int src_width, int src_height, int src_stride,
+		 u8 *dst, int dst_width, int dst_height, int dst_stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IMAGE_SCALE_H
@@ -0,0 +1,744 @@
+#define _GNU_SOURCE
+
+#include "mp4_mux.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Sample flags used in the trun box (ISO/IEC 14496-12 8.8.3.1) */
+#define MP4_SYNC_SAMPLE_FLAGS		0x02000000
+#define MP4_NON_SYNC_SAMPLE_FLAGS	0x01010000
+
+/* Function prototypes */
+static int mp4_buf_reserve(struct mp4_buf *b, int size);
+static void mp4_put8(struct mp4_buf *b, unsigned int v);
+static void mp4_put16(struct mp4_buf *b, unsigned int v);
+static void mp4_put32(struct mp4_buf *b, unsigned int v);
+static void mp4_put64(struct mp4_buf *b, unsigned long long v);
+static void mp4_put_bytes(struct mp4_buf *b, const void *data, int size);
+static int mp4_box_start(struct mp4_buf *b, const char *type);
+static int mp4_full_box_start(struct mp4_buf *b, const char *type,
+			      int version, unsigned int flags);
+static void mp4_box_end(struct mp4_buf *b, int start);
+static void mp4_put_matrix(struct mp4_buf *b);
+static int mp4_next_nal(u8 *buf, int size, int *pos, u8 **nal);
+static int mp4_parse_headers(struct mp4_info *mp4, struct mediaBuffer *enc_hdr);
+static int mp4_write_init_segment(struct mp4_info *mp4);
+static int mp4_flush_fragment(struct mp4_info *mp4);
+static int mp4_queue_fragment(struct mp4_info *mp4,
+			      struct mp4_fragment *frag);
+static void *mp4_writer_thread(void *arg);
+static int mp4_stage_append(struct mp4_info *mp4, u8 *data, int size);
+static int mp4_stage_write(struct mp4_info *mp4);
+/* End function prototypes */
+
+int mp4_recorder_open(struct mp4_info *mp4, const char *path,
+		      struct mediaBuffer *enc_hdr)
+{
+	int ret;
+
+	mp4->fd = -1;
+	if (strcmp(mp4->name, "") == 0)
+		strcpy(mp4->name, "Recorder");
+	if (mp4->fps <= 0) {
+		err_msg("%s: Frame rate not set\n", mp4->name);
+		return -1;
+	}
+	if (mp4->prealloc_size <= 0)
+		mp4->prealloc_size = MP4_PREALLOC_SIZE;
+
+	mp4->width = enc_hdr->imageWidth;
+	mp4->height = enc_hdr->imageHeight;
+
+	if (mp4_parse_headers(mp4, enc_hdr) < 0)
+		return -1;
+
+	mp4->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (mp4->fd < 0) {
+		err_msg("%s: Cannot open %s\n", mp4->name, path);
+		return -1;
+	}
+
+	/* Reserve the file space up front so the file system does not have
+	   to allocate blocks while we are recording. Not every file system
+	   supports this, which is not fatal. */
+	ret = fallocate(mp4->fd, FALLOC_FL_KEEP_SIZE, 0, mp4->prealloc_size);
+	if (ret < 0)
+		warn_msg("%s: fallocate failed, errno %d\n", mp4->name, errno);
+
+	mp4->prealloc_end = mp4->prealloc_size;
+	mp4->file_size = 0;
+
+	if (posix_memalign((void **)&mp4->stage, MP4_WRITE_SIZE,
+			   MP4_WRITE_SIZE)) {
+		err_msg("%s: Failed to allocate write buffer\n", mp4->name);
+		goto ERROR;
+	}
+	mp4->stage_fill = 0;
+
+	memset(&mp4->mdat, 0, sizeof(mp4->mdat));
+	mp4->num_samples = 0;
+	mp4->sequence = 1;
+	mp4->decode_time = 0;
+	mp4->wait_idr = 1;
+	mp4->q_head = 0;
+	mp4->q_count = 0;
+	mp4->stop = 0;
+	mp4->frames_written = 0;
+	mp4->fragments_written = 0;
+	mp4->fragments_dropped = 0;
+	mp4->write_errors = 0;
+	mp4->write_failed = 0;
+
+	pthread_mutex_init(&mp4->lock, NULL);
+	pthread_cond_init(&mp4->cond, NULL);
+	if (pthread_create(&mp4->thread, NULL, mp4_writer_thread, mp4)) {
+		err_msg("%s: Could not start writer thread\n", mp4->name);
+		pthread_mutex_destroy(&mp4->lock);
+		pthread_cond_destroy(&mp4->cond);
+		free(mp4->stage);
+		goto ERROR;
+	}
+
+	if (mp4_write_init_segment(mp4) < 0) {
+		mp4_recorder_close(mp4);
+		return -1;
+	}
+
+	info_msg("%s: Recording %dx%d@%d to %s\n", mp4->name,
+		 mp4->width, mp4->height, mp4->fps, path);
+
+	return 0;
+
+ERROR:
+	close(mp4->fd);
+	mp4->fd = -1;
+	return -1;
+}
+
+/*
+ * Return: 0 = success, -1 = failure, including a write that failed
+ * earlier in the background
+ */
+int mp4_recorder_close(struct mp4_info *mp4)
+{
+	int ret;
+
+	if (mp4->fd < 0)
+		return 0;
+
+	/* Whatever was collected of the last GOP is still a valid fragment */
+	mp4_flush_fragment(mp4);
+
+	pthread_mutex_lock(&mp4->lock);
+	mp4->stop = 1;
+	pthread_cond_signal(&mp4->cond);
+	pthread_mutex_unlock(&mp4->lock);
+	pthread_join(mp4->thread, NULL);
+
+	/* Give back the preallocated space we did not use */
+	if (ftruncate(mp4->fd, mp4->file_size) < 0)
+		warn_msg("%s: ftruncate failed, errno %d\n", mp4->name, errno);
+	close(mp4->fd);
+	mp4->fd = -1;
+
+	pthread_mutex_destroy(&mp4->lock);
+	pthread_cond_destroy(&mp4->cond);
+	free(mp4->stage);
+	free(mp4->mdat.data);
+	mp4->stage = NULL;
+	mp4->mdat.data = NULL;
+
+	info_msg("%s: %lu frames in %lu fragments, %lu fragments dropped\n",
+		 mp4->name, mp4->frames_written, mp4->fragments_written,
+		 mp4->fragments_dropped);
+	ret = mp4->write_failed ? -1 : 0;
+	if (ret < 0)
+		err_msg("%s: %lu writes failed, the file is incomplete\n",
+			mp4->name, mp4->write_errors);
+	info_msg("%s: recorder was closed\n\n", mp4->name);
+
+	return ret;
+}
+
+/*
+ * Append one encoded picture to the current fragment. A new fragment is
+ * started at every IDR, so each moof/mdat pair holds one GOP.
+ *
+ * Return: 0 = success, -1 = failure, also once the writer thread failed
+ */
+int mp4_recorder_write_frame(struct mp4_info *mp4, struct mediaBuffer *enc_src)
+{
+	int sync = (enc_src->nalInfo.nalType == CODED_SLICE_IDR);
+	int pos = 0, nal_size, start;
+	u8 *nal;
+
+	if (__atomic_load_n(&mp4->write_failed, __ATOMIC_ACQUIRE))
+		return -1;
+
+	if (mp4->num_samples > 0 &&
+	    (sync || mp4->num_samples == MP4_MAX_SAMPLES))
+		mp4_flush_fragment(mp4);
+
+	/* Frames that reference a dropped fragment cannot be decoded */
+	if (mp4->wait_idr && !sync)
+		return 0;
+	mp4->wait_idr = 0;
+
+	if (mp4->mdat.size == 0) {
+		/* Room for the mdat box header, filled in at flush time */
+		if (mp4_buf_reserve(&mp4->mdat, 8) < 0)
+			return -1;
+		mp4->mdat.size = 8;
+	}
+
+	/* Convert the Annex B start codes into 4 byte NAL lengths */
+	start = mp4->mdat.size;
+	while ((nal_size = mp4_next_nal(enc_src->vBufOut, enc_src->bufOutSize,
+					&pos, &nal)) > 0) {
+		if (mp4_buf_reserve(&mp4->mdat, nal_size + 4) < 0) {
+			/* Without its sample entry a partial frame would
+			   shift every later sample of the fragment, and the
+			   frames after it need the lost one */
+			mp4->mdat.size = start;
+			mp4->wait_idr = 1;
+			return -1;
+		}
+		mp4_put32(&mp4->mdat, nal_size);
+		mp4_put_bytes(&mp4->mdat, nal, nal_size);
+	}
+
+	if (mp4->mdat.size == start) {
+		warn_msg("%s: Frame without NAL units skipped\n", mp4->name);
+		return 0;
+	}
+
+	mp4->sample_size[mp4->num_samples] = mp4->mdat.size - start;
+	mp4->sample_sync[mp4->num_samples] = sync;
+	mp4->num_samples++;
+	mp4->frames_written++;
+
+	return 0;
+}
+
+static int mp4_buf_reserve(struct mp4_buf *b, int size)
+{
+	int alloc;
+	u8 *data;
+
+	if (b->size + size <= b->alloc)
+		return 0;
+
+	alloc = b->alloc ? b->alloc : 4096;
+	while (alloc < b->size + size)
+		alloc *= 2;
+
+	data = realloc(b->data, alloc);
+	if (data == NULL) {
+		err_msg("MP4: Failed to grow buffer to %d bytes\n", alloc);
+		return -1;
+	}
+
+	b->data = data;
+	b->alloc = alloc;
+	return 0;
+}
+
+/* The put functions assume the space was reserved by the caller */
+static void mp4_put8(struct mp4_buf *b, unsigned int v)
+{
+	b->data[b->size++] = v;
+}
+
+static void mp4_put16(struct mp4_buf *b, unsigned int v)
+{
+	mp4_put8(b, v >> 8);
+	mp4_put8(b, v);
+}
+
+static void mp4_put32(struct mp4_buf *b, unsigned int v)
+{
+	mp4_put16(b, v >> 16);
+	mp4_put16(b, v);
+}
+
+static void mp4_put64(struct mp4_buf *b, unsigned long long v)
+{
+	mp4_put32(b, v >> 32);
+	mp4_put32(b, v);
+}
+
+static void mp4_put_bytes(struct mp4_buf *b, const void *data, int size)
+{
+	memcpy(b->data + b->size, data, size);
+	b->size += size;
+}
+
+static int mp4_box_start(struct mp4_buf *b, const char *type)
+{
+	int start = b->size;
+
+	mp4_put32(b, 0);
+	mp4_put_bytes(b, type, 4);
+	return start;
+}
+
+static int mp4_full_box_start(struct mp4_buf *b, const char *type,
+			      int version, unsigned int flags)
+{
+	int start = mp4_box_start(b, type);
+
+	mp4_put32(b, (version << 24) | flags);
+	return start;
+}
+
+static void mp4_box_end(struct mp4_buf *b, int start)
+{
+	unsigned int size = b->size - start;
+
+	b->data[start] = size >> 24;
+	b->data[start + 1] = size >> 16;
+	b->data[start + 2] = size >> 8;
+	b->data[start + 3] = size;
+}
+
+static void mp4_put_matrix(struct mp4_buf *b)
+{
+	mp4_put32(b, 0x00010000);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0x00010000);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0x40000000);
+}
+
+/*
+ * Find the next start code delimited NAL in an Annex B buffer
+ */
+static int mp4_next_nal(u8 *buf, int size, int *pos, u8 **nal)
+{
+	int i = *pos, start;
+
+	/* Skip the start code */
+	while (i + 2 < size && !(buf[i] == 0 && buf[i + 1] == 0 &&
+				 buf[i + 2] == 1))
+		i++;
+	if (i + 2 >= size)
+		return 0;
+	start = i + 3;
+
+	/* Find the next one, a zero before it belongs to the start code */
+	i = start;
+	while (i + 2 < size && !(buf[i] == 0 && buf[i + 1] == 0 &&
+				 (buf[i + 2] == 1 || buf[i + 2] == 0)))
+		i++;
+	if (i + 2 >= size)
+		i = size;
+
+	*nal = buf + start;
+	*pos = i;
+	return i - start;
+}
+
+/*
+ * Pick the SPS and PPS out of the headers returned by encoderInit
+ */
+static int mp4_parse_headers(struct mp4_info *mp4, struct mediaBuffer *enc_hdr)
+{
+	int pos = 0, size;
+	u8 *nal;
+
+	mp4->sps_size = 0;
+	mp4->pps_size = 0;
+
+	while ((size = mp4_next_nal(enc_hdr->vBufOut, enc_hdr->bufOutSize,
+				    &pos, &nal)) > 0) {
+		if ((nal[0] & 0x1F) == SEQ_PARAM_SET &&
+		    size <= (int)sizeof(mp4->sps)) {
+			memcpy(mp4->sps, nal, size);
+			mp4->sps_size = size;
+		} else if ((nal[0] & 0x1F) == PIC_PARAM_SET &&
+			   size <= (int)sizeof(mp4->pps)) {
+			memcpy(mp4->pps, nal, size);
+			mp4->pps_size = size;
+		}
+	}
+
+	if (mp4->sps_size < 4 || mp4->pps_size == 0) {
+		err_msg("%s: Encoder headers do not contain SPS and PPS\n",
+			mp4->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * ftyp + moov. The moov has no samples; everything is in the fragments.
+ */
+static int mp4_write_init_segment(struct mp4_info *mp4)
+{
+	struct mp4_fragment frag;
+	struct mp4_buf *b = &frag.moof;
+	int moov, trak, mdia, minf, dinf, dref, stbl, stsd, avc1, avcc, mvex;
+	int box, i;
+
+	memset(&frag, 0, sizeof(frag));
+	if (mp4_buf_reserve(b, 1024 + mp4->sps_size + mp4->pps_size) < 0)
+		return -1;
+
+	box = mp4_box_start(b, "ftyp");
+	mp4_put_bytes(b, "iso5", 4);
+	mp4_put32(b, 512);
+	mp4_put_bytes(b, "iso5", 4);
+	mp4_put_bytes(b, "iso6", 4);
+	mp4_put_bytes(b, "avc1", 4);
+	mp4_put_bytes(b, "mp41", 4);
+	mp4_box_end(b, box);
+
+	moov = mp4_box_start(b, "moov");
+
+	box = mp4_full_box_start(b, "mvhd", 0, 0);
+	mp4_put32(b, 0);		/* creation time */
+	mp4_put32(b, 0);		/* modification time */
+	mp4_put32(b, MP4_TIMESCALE);
+	mp4_put32(b, 0);		/* duration, unknown */
+	mp4_put32(b, 0x00010000);	/* rate 1.0 */
+	mp4_put16(b, 0x0100);		/* volume 1.0 */
+	mp4_put16(b, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put_matrix(b);
+	for (i = 0; i < 6; i++)
+		mp4_put32(b, 0);	/* pre_defined */
+	mp4_put32(b, 2);		/* next track ID */
+	mp4_box_end(b, box);
+
+	trak = mp4_box_start(b, "trak");
+
+	box = mp4_full_box_start(b, "tkhd", 0, 0x7);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 1);		/* track ID */
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);		/* duration */
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put16(b, 0);		/* layer */
+	mp4_put16(b, 0);		/* alternate group */
+	mp4_put16(b, 0);		/* volume */
+	mp4_put16(b, 0);
+	mp4_put_matrix(b);
+	mp4_put32(b, mp4->width << 16);
+	mp4_put32(b, mp4->height << 16);
+	mp4_box_end(b, box);
+
+	mdia = mp4_box_start(b, "mdia");
+
+	box = mp4_full_box_start(b, "mdhd", 0, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, MP4_TIMESCALE);
+	mp4_put32(b, 0);
+	mp4_put16(b, 0x55C4);		/* language "und" */
+	mp4_put16(b, 0);
+	mp4_box_end(b, box);
+
+	box = mp4_full_box_start(b, "hdlr", 0, 0);
+	mp4_put32(b, 0);
+	mp4_put_bytes(b, "vide", 4);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put_bytes(b, "VideoHandler", 13);
+	mp4_box_end(b, box);
+
+	minf = mp4_box_start(b, "minf");
+
+	box = mp4_full_box_start(b, "vmhd", 0, 1);
+	mp4_put16(b, 0);		/* graphics mode */
+	mp4_put16(b, 0);
+	mp4_put16(b, 0);
+	mp4_put16(b, 0);
+	mp4_box_end(b, box);
+
+	dinf = mp4_box_start(b, "dinf");
+	dref = mp4_full_box_start(b, "dref", 0, 0);
+	mp4_put32(b, 1);
+	box = mp4_full_box_start(b, "url ", 0, 1); /* data in same file */
+	mp4_box_end(b, box);
+	mp4_box_end(b, dref);
+	mp4_box_end(b, dinf);
+
+	stbl = mp4_box_start(b, "stbl");
+
+	stsd = mp4_full_box_start(b, "stsd", 0, 0);
+	mp4_put32(b, 1);
+	avc1 = mp4_box_start(b, "avc1");
+	mp4_put32(b, 0);
+	mp4_put16(b, 0);
+	mp4_put16(b, 1);		/* data reference index */
+	mp4_put16(b, 0);
+	mp4_put16(b, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put16(b, mp4->width);
+	mp4_put16(b, mp4->height);
+	mp4_put32(b, 0x00480000);	/* 72 dpi */
+	mp4_put32(b, 0x00480000);
+	mp4_put32(b, 0);
+	mp4_put16(b, 1);		/* frame count */
+	for (i = 0; i < 8; i++)
+		mp4_put32(b, 0);	/* compressor name */
+	mp4_put16(b, 0x0018);		/* depth */
+	mp4_put16(b, 0xFFFF);
+
+	avcc = mp4_box_start(b, "avcC");
+	mp4_put8(b, 1);			/* configuration version */
+	mp4_put8(b, mp4->sps[1]);	/* profile */
+	mp4_put8(b, mp4->sps[2]);	/* profile compatibility */
+	mp4_put8(b, mp4->sps[3]);	/* level */
+	mp4_put8(b, 0xFF);		/* 4 byte NAL lengths */
+	mp4_put8(b, 0xE1);		/* one SPS */
+	mp4_put16(b, mp4->sps_size);
+	mp4_put_bytes(b, mp4->sps, mp4->sps_size);
+	mp4_put8(b, 1);			/* one PPS */
+	mp4_put16(b, mp4->pps_size);
+	mp4_put_bytes(b, mp4->pps, mp4->pps_size);
+	mp4_box_end(b, avcc);
+
+	mp4_box_end(b, avc1);
+	mp4_box_end(b, stsd);
+
+	/* Empty sample tables, the samples are described by the fragments */
+	box = mp4_full_box_start(b, "stts", 0, 0);
+	mp4_put32(b, 0);
+	mp4_box_end(b, box);
+	box = mp4_full_box_start(b, "stsc", 0, 0);
+	mp4_put32(b, 0);
+	mp4_box_end(b, box);
+	box = mp4_full_box_start(b, "stsz", 0, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_box_end(b, box);
+	box = mp4_full_box_start(b, "stco", 0, 0);
+	mp4_put32(b, 0);
+	mp4_box_end(b, box);
+
+	mp4_box_end(b, stbl);
+	mp4_box_end(b, minf);
+	mp4_box_end(b, mdia);
+	mp4_box_end(b, trak);
+
+	mvex = mp4_box_start(b, "mvex");
+	box = mp4_full_box_start(b, "trex", 0, 0);
+	mp4_put32(b, 1);		/* track ID */
+	mp4_put32(b, 1);		/* sample description index */
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_put32(b, 0);
+	mp4_box_end(b, box);
+	mp4_box_end(b, mvex);
+
+	mp4_box_end(b, moov);
+
+	return mp4_queue_fragment(mp4, &frag);
+}
+
+/*
+ * Close the current fragment: build its moof, patch the mdat header and
+ * hand both buffers to the writer thread
+ */
+static int mp4_flush_fragment(struct mp4_info *mp4)
+{
+	struct mp4_fragment frag;
+	struct mp4_buf *b = &frag.moof;
+	unsigned int duration = MP4_TIMESCALE / mp4->fps;
+	int moof, traf, trun, box, offset_pos, i, ret;
+
+	if (mp4->num_samples == 0)
+		return 0;
+
+	memset(&frag, 0, sizeof(frag));
+	if (mp4_buf_reserve(b, 128 + mp4->num_samples * 12) < 0)
+		return -1;
+
+	moof = mp4_box_start(b, "moof");
+
+	box = mp4_full_box_start(b, "mfhd", 0, 0);
+	mp4_put32(b, mp4->sequence);
+	mp4_box_end(b, box);
+
+	traf = mp4_box_start(b, "traf");
+
+	/* Offsets in trun are relative to the start of the moof */
+	box = mp4_full_box_start(b, "tfhd", 0, 0x020000);
+	mp4_put32(b, 1);
+	mp4_box_end(b, box);
+
+	box = mp4_full_box_start(b, "tfdt", 1, 0);
+	mp4_put64(b, mp4->decode_time);
+	mp4_box_end(b, box);
+
+	/* data offset, sample duration, sample size and sample flags */
+	trun = mp4_full_box_start(b, "trun", 0, 0x000701);
+	mp4_put32(b, mp4->num_samples);
+	offset_pos = b->size;
+	mp4_put32(b, 0);
+	for (i = 0; i < mp4->num_samples; i++) {
+		mp4_put32(b, duration);
+		mp4_put32(b, mp4->sample_size[i]);
+		mp4_put32(b, mp4->sample_sync[i] ? MP4_SYNC_SAMPLE_FLAGS :
+			  MP4_NON_SYNC_SAMPLE_FLAGS);
+	}
+	mp4_box_end(b, trun);
+
+	mp4_box_end(b, traf);
+	mp4_box_end(b, moof);
+
+	/* Sample data starts right after the mdat header */
+	i = b->size - moof + 8;
+	b->data[offset_pos] = i >> 24;
+	b->data[offset_pos + 1] = i >> 16;
+	b->data[offset_pos + 2] = i >> 8;
+	b->data[offset_pos + 3] = i;
+
+	/* The mdat buffer changes owner, so the next GOP gets a new one */
+	frag.mdat = mp4->mdat;
+	memset(&mp4->mdat, 0, sizeof(mp4->mdat));
+	mp4_box_end(&frag.mdat, 0);
+	memcpy(frag.mdat.data + 4, "mdat", 4);
+
+	mp4->decode_time += (unsigned long long)duration * mp4->num_samples;
+	mp4->sequence++;
+	mp4->num_samples = 0;
+
+	ret = mp4_queue_fragment(mp4, &frag);
+	if (ret < 0)
+		mp4->wait_idr = 1;
+
+	return ret;
+}
+
+/*
+ * Hand a fragment over to the writer thread. This never waits on the
+ * file; if the writer has fallen too far behind the fragment is dropped.
+ */
+static int mp4_queue_fragment(struct mp4_info *mp4, struct mp4_fragment *frag)
+{
+	int idx;
+
+	pthread_mutex_lock(&mp4->lock);
+	if (mp4->q_count == MP4_QUEUE_LEN) {
+		pthread_mutex_unlock(&mp4->lock);
+		mp4->fragments_dropped++;
+		warn_msg("%s: Writer is behind, dropping fragment\n",
+			 mp4->name);
+		free(frag->moof.data);
+		free(frag->mdat.data);
+		return -1;
+	}
+
+	idx = (mp4->q_head + mp4->q_count) % MP4_QUEUE_LEN;
+	mp4->queue[idx] = *frag;
+	mp4->q_count++;
+	pthread_cond_signal(&mp4->cond);
+	pthread_mutex_unlock(&mp4->lock);
+
+	return 0;
+}
+
+static void *mp4_writer_thread(void *arg)
+{
+	struct mp4_info *mp4 = arg;
+	struct mp4_fragment frag;
+
+	while (1) {
+		pthread_mutex_lock(&mp4->lock);
+		while (mp4->q_count == 0 && !mp4->stop)
+			pthread_cond_wait(&mp4->cond, &mp4->lock);
+		if (mp4->q_count == 0) {
+			pthread_mutex_unlock(&mp4->lock);
+			break;
+		}
+		frag = mp4->queue[mp4->q_head];
+		mp4->q_head = (mp4->q_head + 1) % MP4_QUEUE_LEN;
+		mp4->q_count--;
+		pthread_mutex_unlock(&mp4->lock);
+
+		/* After a failed write the rest of the file is useless, the
+		   fragments are only freed */
+		if (!mp4->write_failed &&
+		    (mp4_stage_append(mp4, frag.moof.data,
+				      frag.moof.size) < 0 ||
+		     mp4_stage_append(mp4, frag.mdat.data,
+				      frag.mdat.size) < 0))
+			__atomic_store_n(&mp4->write_failed, 1,
+					 __ATOMIC_RELEASE);
+		else if (!mp4->write_failed && frag.mdat.size > 0)
+			mp4->fragments_written++;
+		free(frag.moof.data);
+		free(frag.mdat.data);
+	}
+
+	/* Last, partial write */
+	if (!mp4->write_failed && mp4_stage_write(mp4) < 0)
+		__atomic_store_n(&mp4->write_failed, 1, __ATOMIC_RELEASE);
+
+	return NULL;
+}
+
+static int mp4_stage_append(struct mp4_info *mp4, u8 *data, int size)
+{
+	int room;
+
+	while (size > 0) {
+		room = MP4_WRITE_SIZE - mp4->stage_fill;
+		if (room > size)
+			room = size;
+
+		memcpy(mp4->stage + mp4->stage_fill, data, room);
+		mp4->stage_fill += room;
+		data += room;
+		size -= room;
+
+		if (mp4->stage_fill == MP4_WRITE_SIZE &&
+		    mp4_stage_write(mp4) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int mp4_stage_write(struct mp4_info *mp4)
+{
+	if (mp4->stage_fill == 0)
+		return 0;
+
+	if (mp4->file_size + mp4->stage_fill > mp4->prealloc_end) {
+		if (fallocate(mp4->fd, FALLOC_FL_KEEP_SIZE, mp4->prealloc_end,
+			      mp4->prealloc_size) == 0)
+			mp4->prealloc_end += mp4->prealloc_size;
+	}
+
+	if (fwriten(mp4->fd, mp4->stage, mp4->stage_fill) < 0) {
+		err_msg("%s: Write to file failed, errno %d\n", mp4->name,
+			errno);
+		mp4->write_errors++;
+		mp4->stage_fill = 0;
+		return -1;
+	}
+
+	mp4->file_size += mp4->stage_fill;
+	mp4->stage_fill = 0;
+
+	return 0;
+}
@@ -0,0 +1,99 @@
+#ifndef MP4_MUX_H
+#define MP4_MUX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "enzo_utils.h"
+
+#include <pthread.h>
+#include <sys/types.h>
+
+/* All timing in the file uses the 90 kHz video clock */
+#define MP4_TIMESCALE		90000
+
+/* A fragment is normally one GOP, but is cut at this many samples when
+   the stream has no regular IDRs (for example with intra refresh) */
+#define MP4_MAX_SAMPLES		300
+
+/* Size of each write the background thread issues to the file. Every
+   write except the last one is exactly this size, so all writes start
+   at an offset aligned to it. */
+#define MP4_WRITE_SIZE		(1024 * 1024)
+/* Amount of file space reserved ahead of the write position */
+#define MP4_PREALLOC_SIZE	(64 * 1024 * 1024)
+/* Number of finished fragments that can wait for the writer thread
+   before new fragments are dropped */
+#define MP4_QUEUE_LEN		16
+
+struct mp4_buf {
+	u8 *data;
+	int size;
+	int alloc;
+};
+
+/* A finished moof + mdat pair waiting to be written */
+struct mp4_fragment {
+	struct mp4_buf moof;
+	struct mp4_buf mdat;
+};
+
+/*
+ * Fragmented MP4 recorder structure declaration
+ */
+struct mp4_info {
+	int fd;
+	int width;
+	int height;
+	int fps;
+	off_t prealloc_size;
+	char name[12];
+
+	u8 sps[64];
+	int sps_size;
+	u8 pps[64];
+	int pps_size;
+
+	/* Fragment being built by the encode thread */
+	struct mp4_buf mdat;
+	unsigned int sample_size[MP4_MAX_SAMPLES];
+	int sample_sync[MP4_MAX_SAMPLES];
+	int num_samples;
+	unsigned int sequence;
+	unsigned long long decode_time;
+	int wait_idr;
+
+	/* Writer thread */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct mp4_fragment queue[MP4_QUEUE_LEN];
+	int q_head;
+	int q_count;
+	int stop;
+	u8 *stage;
+	int stage_fill;
+	off_t file_size;
+	off_t prealloc_end;
+
+	/* Statistics */
+	unsigned long frames_written;
+	unsigned long fragments_written;
+	unsigned long fragments_dropped;
+	unsigned long write_errors;
+	int write_failed;	/* Latched by the writer thread, the file is
+				   incomplete from then on */
+};
+
+int mp4_recorder_open(struct mp4_info *mp4, const char *path,
+		      struct mediaBuffer *enc_hdr);
+int mp4_recorder_close(struct mp4_info *mp4);
+int mp4_recorder_write_frame(struct mp4_info *mp4,
+			     struct mediaBuffer *enc_src);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MP4_MUX_H
@@ -0,0 +1,468 @@
+#include "replay_camera.h"
+#include "stage_stats.h"
+#include "enzo_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Frame interval assumed when a recording without a duration loops,
+   such as one of a single frame */
+#define REPLAY_DEFAULT_INTERVAL_US	33333
+
+#define REPLAY_ROUND_UP(x) \
+	(((x) + REPLAY_ALIGN - 1) & ~(off_t)(REPLAY_ALIGN - 1))
+
+/* Function prototypes */
+static int replay_check(struct replay_info *replay,
+			const struct replay_header *hdr);
+static long long replay_loop_us(struct replay_info *replay);
+static void replay_advance(struct replay_info *replay, int *pos,
+			   long long *loop);
+static long long replay_release_us(struct replay_info *replay, int pos,
+				   long long loop);
+static void replay_sleep_until(long long when_us);
+static int replay_pwrite(int fd, const void *buf, size_t size, off_t offset);
+/* End function prototypes */
+
+/*
+ * Return: 0 = usable recording, -1 = failure
+ */
+static int replay_check(struct replay_info *replay,
+			const struct replay_header *hdr)
+{
+	const struct replay_index *e;
+	long long end;
+	int i;
+
+	if (hdr->magic != REPLAY_MAGIC) {
+		err_msg("%s: Not a recording, or not closed\n", replay->name);
+		return -1;
+	}
+	if (hdr->type != replay->type || hdr->width != replay->width ||
+	    hdr->height != replay->height) {
+		err_msg("%s: Recorded type %d at %dx%d, not type %d at %dx%d\n",
+			replay->name, hdr->type, hdr->width, hdr->height,
+			replay->type, replay->width, replay->height);
+		return -1;
+	}
+
+	end = hdr->index_offset +
+	      (long long)hdr->num_frames * sizeof(struct replay_index);
+	if (hdr->num_frames <= 0 ||
+	    hdr->index_offset < (long long)sizeof(*hdr) ||
+	    hdr->index_offset % REPLAY_ALIGN ||
+	    end > (long long)replay->map_size) {
+		err_msg("%s: Bad frame index\n", replay->name);
+		return -1;
+	}
+
+	replay->index = (const struct replay_index *)(replay->map +
+						      hdr->index_offset);
+	replay->num_frames = hdr->num_frames;
+
+	for (i = 0; i < replay->num_frames; i++) {
+		e = &replay->index[i];
+		if (e->offset < (long long)sizeof(*hdr) || e->size <= 0 ||
+		    e->offset + e->size > hdr->index_offset ||
+		    (i && e->timestamp < e[-1].timestamp) ||
+		    (replay->type == RAW_VIDEO &&
+		     e->size < replay->width * replay->height * 2)) {
+			err_msg("%s: Bad index entry of frame %d\n",
+				replay->name, i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Return: time from the first frame of a pass to the first frame of the
+ * next one, one mean frame interval after the last frame
+ */
+static long long replay_loop_us(struct replay_info *replay)
+{
+	const struct replay_index *first = &replay->index[0];
+	const struct replay_index *last;
+	long long span;
+
+	last = &replay->index[replay->num_frames - 1];
+	span = last->timestamp - first->timestamp;
+
+	if (span <= 0)
+		return REPLAY_DEFAULT_INTERVAL_US;
+
+	return span + span / (replay->num_frames - 1);
+}
+
+/*
+ * Move a position to the next frame, back to the first after the last
+ */
+static void replay_advance(struct replay_info *replay, int *pos,
+			   long long *loop)
+{
+	if (++*pos < replay->num_frames)
+		return;
+
+	*pos = 0;
+	*loop += replay_loop_us(replay);
+}
+
+/*
+ * Return: monotonic time at which a paced replay delivers the frame
+ */
+static long long replay_release_us(struct replay_info *replay, int pos,
+				   long long loop)
+{
+	return replay->base_us + loop + replay->index[pos].timestamp -
+	       replay->index[0].timestamp;
+}
+
+static void replay_sleep_until(long long when_us)
+{
+	struct timespec ts;
+	long long left;
+
+	while ((left = when_us - stage_now_us()) > 0) {
+		ts.tv_sec = left / 1000000;
+		ts.tv_nsec = (left % 1000000) * 1000;
+		nanosleep(&ts, NULL);
+	}
+}
+
+/*
+ * Return: 0 = success, -1 = failure
+ */
+static int replay_pwrite(int fd, const void *buf, size_t size, off_t offset)
+{
+	const u8 *p = (const u8 *)buf;
+	ssize_t ret;
+
+	while (size > 0) {
+		ret = pwrite(fd, p, size, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		p += ret;
+		size -= ret;
+		offset += ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Return: 1 if the device name selects a replay, 0 otherwise
+ */
+int replay_is_device(const char *dev_name)
+{
+	return !strncmp(dev_name, REPLAY_PREFIX, strlen(REPLAY_PREFIX)) ||
+	       !strncmp(dev_name, REPLAY_FAST_PREFIX,
+			strlen(REPLAY_FAST_PREFIX));
+}
+
+/*
+ * Maps the recording named by the device name and holds its first frame,
+ * like v4l2_cameraInit holds the first captured one. The recording must
+ * be of the requested type and size.
+ */
+int replay_cameraInit(struct replay_info *replay, const char *dev_name,
+		      int type, int width, int height)
+{
+	const char *path;
+	struct stat st;
+	void *map;
+
+	memset(replay, 0, sizeof(*replay));
+	replay->fd = -1;
+	replay->type = type;
+	replay->width = width;
+	replay->height = height;
+	strcpy(replay->name, "Replay");
+
+	if (!strncmp(dev_name, REPLAY_FAST_PREFIX,
+		     strlen(REPLAY_FAST_PREFIX))) {
+		path = dev_name + strlen(REPLAY_FAST_PREFIX);
+	} else {
+		path = dev_name + strlen(REPLAY_PREFIX);
+		replay->paced = 1;
+	}
+
+	replay->fd = open(path, O_RDONLY);
+	if (replay->fd < 0) {
+		err_msg("Cannot open %s\n", path);
+		return -1;
+	}
+	if (fstat(replay->fd, &st) < 0 ||
+	    st.st_size < (off_t)sizeof(struct replay_header)) {
+		err_msg("%s: %s is too short\n", replay->name, path);
+		goto Error;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, replay->fd, 0);
+	if (map == MAP_FAILED) {
+		err_msg("%s: Cannot mmap %s\n", replay->name, path);
+		goto Error;
+	}
+	replay->map = (u8 *)map;
+	replay->map_size = st.st_size;
+
+	if (replay_check(replay, (const struct replay_header *)replay->map) < 0)
+		goto Error;
+
+	/* Fault the frames in now rather than during the timed frames */
+	madvise(replay->map, replay->map_size, MADV_WILLNEED);
+
+	replay->active = 1;
+	replay->streaming = 1;
+	replay->buf_held = 1;
+	replay->frame_count = 1;
+	replay->base_us = stage_now_us();
+	replay->timestamp = replay->base_us;
+
+	info_msg("%s: %d frames of %s, %s\n", replay->name, replay->num_frames,
+		 path, replay->paced ? "at the recorded pace" : "unpaced");
+
+	return 0;
+
+Error:
+	replay_cameraDeinit(replay);
+	return -1;
+}
+
+int replay_cameraDeinit(struct replay_info *replay)
+{
+	if (replay->map)
+		munmap(replay->map, replay->map_size);
+	if (replay->fd >= 0)
+		close(replay->fd);
+	replay->map = NULL;
+	replay->fd = -1;
+	replay->active = 0;
+
+	if (replay->dropped)
+		info_msg("%s: %lu of %lu frames dropped\n", replay->name,
+			 replay->dropped, replay->frame_count + replay->dropped);
+	info_msg("%s: camera was deinitialized\n\n", replay->name);
+
+	return 0;
+}
+
+/*
+ * Stop delivering frames. The recording resumes where it stopped.
+ */
+int replay_cameraPause(struct replay_info *replay)
+{
+	if (!replay->streaming)
+		return 0;
+
+	replay->pause_us = stage_now_us();
+	replay->streaming = 0;
+	replay->buf_held = 0;
+
+	return 0;
+}
+
+int replay_cameraResume(struct replay_info *replay)
+{
+	if (replay->streaming)
+		return 0;
+
+	replay->base_us += stage_now_us() - replay->pause_us;
+	replay->streaming = 1;
+
+	return 0;
+}
+
+/*
+ * Deliver the next recorded frame. Paced, it waits for the frame's time
+ * and, when the caller is more than REPLAY_NUM_BUFFERS frames behind,
+ * drops the oldest frames like a camera driver. Unpaced, frames come
+ * right away and are stamped with the time they were delivered at.
+ * After the last frame the recording starts over.
+ */
+int replay_cameraGetFrame(struct replay_info *replay,
+			  struct mediaBuffer *cam_src)
+{
+	long long start = stage_now_us();
+	long long loop = replay->loop_us, ahead_loop;
+	int pos = replay->pos, ahead, i;
+
+	if (!replay->streaming) {
+		err_msg("%s: Frame requested while paused\n", replay->name);
+		return -1;
+	}
+
+	replay_advance(replay, &pos, &loop);
+	if (replay->paced) {
+		for (;;) {
+			ahead = pos;
+			ahead_loop = loop;
+			for (i = 0; i < REPLAY_NUM_BUFFERS; i++)
+				replay_advance(replay, &ahead, &ahead_loop);
+			if (replay_release_us(replay, ahead, ahead_loop) > start)
+				break;
+			replay_advance(replay, &pos, &loop);
+			replay->dropped++;
+		}
+		replay->timestamp = replay_release_us(replay, pos, loop);
+		replay_sleep_until(replay->timestamp);
+	} else {
+		replay->timestamp = start;
+	}
+
+	replay->pos = pos;
+	replay->loop_us = loop;
+	replay->buf_held = 1;
+	replay->frame_count++;
+	stage_record(STAGE_CAPTURE_WAIT, stage_now_us() - start);
+	TRACE_SPAN("capture", replay->frame_count, start);
+
+	return replay_cameraGetCurrentFrame(replay, cam_src);
+}
+
+/*
+ * Point cam_src at the current frame in the mapping, without copying
+ * it. Right after init this is the first frame.
+ */
+int replay_cameraGetCurrentFrame(struct replay_info *replay,
+				 struct mediaBuffer *cam_src)
+{
+	const struct replay_index *e = &replay->index[replay->pos];
+
+	if (!replay->buf_held) {
+		err_msg("%s: No frame delivered since resume\n", replay->name);
+		return -1;
+	}
+
+	cam_src->bufOutSize = e->size;
+	cam_src->vBufOut = replay->map + e->offset;
+	cam_src->pBufOut = NULL;
+	cam_src->height = replay->height;
+	cam_src->width = replay->width;
+	cam_src->imageHeight = replay->height;
+	cam_src->imageWidth = replay->width;
+	cam_src->timestamp = replay->timestamp;
+	cam_src->frameId = replay->frame_count;
+
+	if (replay->type == RAW_VIDEO)
+		cam_src->colorSpace = YUYV;
+
+	return 0;
+}
+
+/*
+ * Start a recording. Its header is only written by replay_recordClose,
+ * so a recording that was never closed is not mistaken for a good one.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int replay_recordOpen(struct replay_recorder *rec, const char *path,
+		      int type, int width, int height)
+{
+	memset(rec, 0, sizeof(*rec));
+	rec->type = type;
+	rec->width = width;
+	rec->height = height;
+	rec->offset = REPLAY_ROUND_UP((off_t)sizeof(struct replay_header));
+
+	rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (rec->fd < 0) {
+		err_msg("Could not create %s\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Append a frame as the camera delivered it. This writes from the
+ * calling thread, so it is meant for test captures rather than for
+ * sessions that must keep their frame rate on slow storage.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int replay_recordFrame(struct replay_recorder *rec,
+		       struct mediaBuffer *cam_src)
+{
+	struct replay_index *index, *e;
+	int alloc;
+
+	if (rec->fd < 0 || cam_src->bufOutSize <= 0)
+		return -1;
+
+	if (rec->num_frames == rec->alloc) {
+		alloc = rec->alloc ? rec->alloc * 2 : 256;
+		index = (struct replay_index *)realloc(rec->index,
+					alloc * sizeof(struct replay_index));
+		if (index == NULL) {
+			err_msg("Could not grow the recording index\n");
+			return -1;
+		}
+		rec->index = index;
+		rec->alloc = alloc;
+	}
+
+	if (replay_pwrite(rec->fd, cam_src->vBufOut, cam_src->bufOutSize,
+			  rec->offset) < 0) {
+		err_msg("Could not write frame %d of the recording\n",
+			rec->num_frames);
+		return -1;
+	}
+
+	e = &rec->index[rec->num_frames++];
+	memset(e, 0, sizeof(*e));
+	e->offset = rec->offset;
+	e->size = cam_src->bufOutSize;
+	e->timestamp = cam_src->timestamp;
+	rec->offset = REPLAY_ROUND_UP(rec->offset + cam_src->bufOutSize);
+
+	return 0;
+}
+
+/*
+ * Write the index and the header, and close the file
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int replay_recordClose(struct replay_recorder *rec)
+{
+	struct replay_header hdr;
+	int ret = 0;
+
+	if (rec->fd < 0)
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = REPLAY_MAGIC;
+	hdr.type = rec->type;
+	hdr.width = rec->width;
+	hdr.height = rec->height;
+	hdr.num_frames = rec->num_frames;
+	hdr.index_offset = rec->offset;
+
+	if (replay_pwrite(rec->fd, rec->index,
+			  rec->num_frames * sizeof(struct replay_index),
+			  rec->offset) < 0 ||
+	    replay_pwrite(rec->fd, &hdr, sizeof(hdr), 0) < 0) {
+		err_msg("Could not finish the recording\n");
+		ret = -1;
+	}
+	close(rec->fd);
+	rec->fd = -1;
+
+	if (ret == 0)
+		info_msg("Recorded %d frames\n", rec->num_frames);
+
+	free(rec->index);
+	rec->index = NULL;
+
+	return ret;
+}
@@ -0,0 +1,112 @@
+#ifndef REPLAY_CAMERA_H
+#define REPLAY_CAMERA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "enzo_utils.h"
+
+#include <sys/types.h>
+
+/* Device names that replay a recording instead of opening a camera,
+   at the recorded pace or as fast as frames are asked for */
+#define REPLAY_PREFIX		"replay:"
+#define REPLAY_FAST_PREFIX	"replay-fast:"
+
+/* "EPR1", bumped whenever the file layout changes */
+#define REPLAY_MAGIC		0x31525045
+
+/* Frames start at offsets aligned to this in the file, and so in the
+   mapping the frames are delivered from */
+#define REPLAY_ALIGN		64
+
+/* Frames a paced replay holds before it drops the oldest, like a
+   camera driver with this many buffers */
+#define REPLAY_NUM_BUFFERS	3
+
+/*
+ * Recording file layout, in the byte order of the recording device:
+ * the header, the frames, then an index entry per frame at
+ * index_offset. The index is written when the recording is closed.
+ */
+struct replay_header {
+	unsigned int magic;
+	int type;		/* RAW_VIDEO (YUYV) or MJPEG */
+	int width;
+	int height;
+	int num_frames;
+	int reserved;
+	long long index_offset;
+};
+
+struct replay_index {
+	long long offset;
+	int size;
+	int reserved;
+	long long timestamp;	/* Capture time in microseconds */
+};
+
+/*
+ * Replay camera structure declaration
+ */
+struct replay_info {
+	int active;		/* The camera is a replay */
+	int paced;
+	int fd;
+	u8 *map;
+	size_t map_size;
+	const struct replay_index *index;
+	int num_frames;
+	int type;
+	int width;
+	int height;
+	char name[10];
+
+	int streaming;
+	int buf_held;
+	int pos;		/* Index entry of the current frame */
+	unsigned long frame_count;
+	unsigned long dropped;
+	long long base_us;	/* When the first frame is released */
+	long long loop_us;	/* Added to recorded times by looping */
+	long long pause_us;	/* When the replay was paused */
+	long long timestamp;	/* Of the current frame */
+};
+
+/*
+ * Recorder of camera frames into a replay file
+ */
+struct replay_recorder {
+	int fd;
+	int type;
+	int width;
+	int height;
+	off_t offset;		/* Where the next frame goes */
+	struct replay_index *index;
+	int num_frames;
+	int alloc;
+};
+
+int replay_cameraInit(struct replay_info *replay, const char *dev_name,
+		      int type, int width, int height);
+int replay_cameraDeinit(struct replay_info *replay);
+int replay_cameraGetFrame(struct replay_info *replay,
+			  struct mediaBuffer *cam_src);
+int replay_cameraGetCurrentFrame(struct replay_info *replay,
+				 struct mediaBuffer *cam_src);
+int replay_cameraPause(struct replay_info *replay);
+int replay_cameraResume(struct replay_info *replay);
+int replay_is_device(const char *dev_name);
+
+int replay_recordOpen(struct replay_recorder *rec, const char *path,
+		      int type, int width, int height);
+int replay_recordFrame(struct replay_recorder *rec,
+		       struct mediaBuffer *cam_src);
+int replay_recordClose(struct replay_recorder *rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REPLAY_CAMERA_H
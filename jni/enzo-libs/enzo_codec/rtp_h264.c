@@ -0,0 +1,504 @@
+#define _GNU_SOURCE
+
+#include "rtp_h264.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/* Socket send buffer requested from the kernel. A 720p IDR can be a few
+   hundred packets, so give the kernel enough room to absorb a full batch */
+#define RTP_SNDBUF_SIZE		(1024 * 1024)
+
+struct rtp_batch {
+	int num_msgs;
+	struct mmsghdr msgs[RTP_BATCH_SIZE];
+	struct iovec iov[RTP_BATCH_SIZE][RTP_MAX_IOV];
+	u8 hdr[RTP_BATCH_SIZE][RTP_HDR_SCRATCH];
+};
+
+/* Function prototypes */
+static int rtp_find_nals(struct rtp_info *rtp, struct mediaBuffer *enc_src,
+			 int first);
+static int rtp_start_code_len(u8 *buf, int left);
+static int rtp_get_slot(struct rtp_info *rtp);
+static void rtp_commit_slot(struct rtp_info *rtp, int slot, int niov);
+static void rtp_write_header(struct rtp_info *rtp, u8 *hdr, int marker,
+			     unsigned int timestamp);
+static int rtp_send_single(struct rtp_info *rtp, struct rtp_nal *nal,
+			   int marker, unsigned int timestamp);
+static int rtp_send_stap_a(struct rtp_info *rtp, struct rtp_nal *nal,
+			   int count, int marker, unsigned int timestamp);
+static int rtp_send_fu_a(struct rtp_info *rtp, struct rtp_nal *nal,
+			 int marker, unsigned int timestamp);
+static int rtp_flush(struct rtp_info *rtp);
+static void rtp_random_init(struct rtp_info *rtp);
+/* End function prototypes */
+
+/*
+ * RFC 3550 recommends random initial values for the SSRC and the
+ * sequence number. They are read from the kernel, or derived from the
+ * clock if that fails, without touching the rand() state of the
+ * application.
+ */
+static void rtp_random_init(struct rtp_info *rtp)
+{
+	unsigned int r[2];
+	struct timeval tv;
+	int fd;
+
+	fd = open("/dev/urandom", O_RDONLY);
+	if (fd < 0 || freadn(fd, r, sizeof(r)) != sizeof(r)) {
+		gettimeofday(&tv, NULL);
+		r[0] = (unsigned int)tv.tv_sec * 2654435761u ^
+		       (unsigned int)tv.tv_usec ^ (unsigned int)getpid() << 16;
+		r[1] = r[0] * 2246822519u + (unsigned int)tv.tv_usec;
+	}
+	if (fd >= 0)
+		close(fd);
+
+	rtp->ssrc = r[0];
+	rtp->seq = r[1] & 0xFFFF;
+}
+
+int rtp_h264_init(struct rtp_info *rtp, const char *address, int port)
+{
+	int sndbuf = RTP_SNDBUF_SIZE;
+	int i;
+
+	/* Nothing to close if the init fails */
+	rtp->fd = -1;
+	rtp->batch = NULL;
+
+	if (rtp->mtu <= 0)
+		rtp->mtu = RTP_DEFAULT_MTU;
+	if (rtp->payload_type <= 0)
+		rtp->payload_type = RTP_DEFAULT_PT;
+	if (strcmp(rtp->name, "") == 0)
+		strcpy(rtp->name, "RTP");
+
+	if (rtp->mtu <= RTP_HEADER_SIZE + 2) {
+		err_msg("%s: MTU of %d is too small\n", rtp->name, rtp->mtu);
+		return -1;
+	}
+
+	memset(&rtp->dest, 0, sizeof(rtp->dest));
+	rtp->dest.sin_family = AF_INET;
+	rtp->dest.sin_port = htons(port);
+	if (inet_pton(AF_INET, address, &rtp->dest.sin_addr) != 1) {
+		err_msg("%s: Invalid destination address %s\n",
+			rtp->name, address);
+		return -1;
+	}
+
+	rtp->batch = calloc(1, sizeof(struct rtp_batch));
+	if (rtp->batch == NULL) {
+		err_msg("%s: Failed to allocate packet batch\n", rtp->name);
+		return -1;
+	}
+
+	rtp->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (rtp->fd < 0) {
+		err_msg("%s: Could not create socket\n", rtp->name);
+		free(rtp->batch);
+		rtp->batch = NULL;
+		return -1;
+	}
+
+	if (setsockopt(rtp->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf,
+		       sizeof(sndbuf)) < 0)
+		warn_msg("%s: Could not set socket send buffer size\n",
+			 rtp->name);
+
+	rtp_random_init(rtp);
+
+	/* Every batched message is sent to the same destination, so the
+	   parts of the message headers that never change are set up here */
+	for (i = 0; i < RTP_BATCH_SIZE; i++) {
+		rtp->batch->msgs[i].msg_hdr.msg_name = &rtp->dest;
+		rtp->batch->msgs[i].msg_hdr.msg_namelen = sizeof(rtp->dest);
+		rtp->batch->msgs[i].msg_hdr.msg_iov = rtp->batch->iov[i];
+	}
+
+	rtp->param_sets_size = 0;
+	rtp->packets_sent = 0;
+	rtp->bytes_sent = 0;
+	rtp->send_calls = 0;
+
+	info_msg("%s: Sending to %s:%d, MTU %d, SSRC 0x%08x\n", rtp->name,
+		 address, port, rtp->mtu, rtp->ssrc);
+
+	return 0;
+}
+
+int rtp_h264_deinit(struct rtp_info *rtp)
+{
+	if (rtp->fd >= 0) {
+		close(rtp->fd);
+		rtp->fd = -1;
+	}
+
+	free(rtp->batch);
+	rtp->batch = NULL;
+
+	info_msg("%s: %lu packets, %lu bytes in %lu send calls\n", rtp->name,
+		 rtp->packets_sent, rtp->bytes_sent, rtp->send_calls);
+	info_msg("%s: RTP session was deinitialized\n\n", rtp->name);
+
+	return 0;
+}
+
+/*
+ * Save the SPS/PPS returned by the encoder init so they can be resent
+ * in front of every IDR picture
+ */
+int rtp_h264_set_param_sets(struct rtp_info *rtp, struct mediaBuffer *headers)
+{
+	if (headers->bufOutSize > (int)sizeof(rtp->param_sets)) {
+		err_msg("%s: Parameter sets too large (%d bytes)\n",
+			rtp->name, headers->bufOutSize);
+		return -1;
+	}
+
+	memcpy(rtp->param_sets, headers->vBufOut, headers->bufOutSize);
+	rtp->param_sets_size = headers->bufOutSize;
+
+	return 0;
+}
+
+/*
+ * Packetize one encoded access unit and send it. The payload is never
+ * copied; the iovecs point into the bitstream buffer, so everything is
+ * flushed to the socket before returning.
+ */
+int rtp_h264_send_frame(struct rtp_info *rtp, struct mediaBuffer *enc_src,
+			unsigned int timestamp)
+{
+	int max_payload = rtp->mtu - RTP_HEADER_SIZE;
+	int i, j, num, size, marker, ret = 0;
+	struct rtp_nal *nal;
+
+	num = 0;
+	if (enc_src->nalInfo.nalType == CODED_SLICE_IDR &&
+	    rtp->param_sets_size > 0) {
+		struct mediaBuffer ps;
+
+		memset(&ps, 0, sizeof(ps));
+		ps.vBufOut = rtp->param_sets;
+		ps.bufOutSize = rtp->param_sets_size;
+		num = rtp_find_nals(rtp, &ps, 0);
+		if (num < 0)
+			return -1;
+	}
+	num = rtp_find_nals(rtp, enc_src, num);
+	if (num <= 0) {
+		err_msg("%s: No NAL units found in frame\n", rtp->name);
+		return -1;
+	}
+
+	i = 0;
+	while (i < num) {
+		nal = &rtp->nals[i];
+
+		if (nal->size > max_payload) {
+			marker = (i == num - 1);
+			ret = rtp_send_fu_a(rtp, nal, marker, timestamp);
+			i++;
+		} else {
+			/* Find how many of the following NALs fit in one
+			   aggregation packet together with this one */
+			size = 1;
+			for (j = i; j < num && j - i < RTP_MAX_STAP_NALS; j++) {
+				if (size + 2 + rtp->nals[j].size > max_payload)
+					break;
+				size += 2 + rtp->nals[j].size;
+			}
+
+			marker = (j == num);
+			if (j - i > 1) {
+				ret = rtp_send_stap_a(rtp, nal, j - i, marker,
+						      timestamp);
+				i = j;
+			} else {
+				marker = (i == num - 1);
+				ret = rtp_send_single(rtp, nal, marker,
+						      timestamp);
+				i++;
+			}
+		}
+
+		if (ret < 0)
+			break;
+	}
+
+	if (rtp_flush(rtp) < 0)
+		return -1;
+
+	return ret;
+}
+
+/*
+ * Build the list of NAL units in the buffer, starting at index first.
+ * The slice report from the encoder is used to find the slice boundaries
+ * when it is available, otherwise the buffer is scanned for start codes.
+ */
+static int rtp_find_nals(struct rtp_info *rtp, struct mediaBuffer *enc_src,
+			 int first)
+{
+	struct nalInfoStruct *nalInfo = &enc_src->nalInfo;
+	u8 *buf = enc_src->vBufOut;
+	int size = enc_src->bufOutSize;
+	int i, sc, offset, total, num = first;
+	u8 *p, *end;
+
+	total = 0;
+	for (i = 0; i < nalInfo->nalNumber; i++)
+		total += nalInfo->nalLength[i];
+
+	if (nalInfo->nalNumber > 0 && total == size) {
+		offset = 0;
+		for (i = 0; i < nalInfo->nalNumber &&
+			    num < MAX_NAL_PER_PICTURE; i++) {
+			sc = rtp_start_code_len(buf + offset,
+						nalInfo->nalLength[i]);
+			if (nalInfo->nalLength[i] > sc) {
+				rtp->nals[num].data = buf + offset + sc;
+				rtp->nals[num].size = nalInfo->nalLength[i] - sc;
+				num++;
+			}
+			offset += nalInfo->nalLength[i];
+		}
+		return num;
+	}
+
+	/* Slice report does not describe this buffer, scan for start codes */
+	p = buf;
+	end = buf + size;
+	sc = rtp_start_code_len(p, size);
+	if (sc == 0) {
+		err_msg("%s: Buffer does not start with a start code\n",
+			rtp->name);
+		return -1;
+	}
+	p += sc;
+
+	while (p < end && num < MAX_NAL_PER_PICTURE) {
+		rtp->nals[num].data = p;
+		while (p < end) {
+			sc = rtp_start_code_len(p, end - p);
+			if (sc)
+				break;
+			p++;
+		}
+		rtp->nals[num].size = p - rtp->nals[num].data;
+		if (rtp->nals[num].size > 0)
+			num++;
+		p += sc;
+	}
+
+	return num;
+}
+
+static int rtp_start_code_len(u8 *buf, int left)
+{
+	if (left >= 4 && buf[0] == 0 && buf[1] == 0 && buf[2] == 0 &&
+	    buf[3] == 1)
+		return 4;
+	if (left >= 3 && buf[0] == 0 && buf[1] == 0 && buf[2] == 1)
+		return 3;
+	return 0;
+}
+
+static int rtp_get_slot(struct rtp_info *rtp)
+{
+	if (rtp->batch->num_msgs == RTP_BATCH_SIZE) {
+		if (rtp_flush(rtp) < 0)
+			return -1;
+	}
+
+	return rtp->batch->num_msgs;
+}
+
+static void rtp_commit_slot(struct rtp_info *rtp, int slot, int niov)
+{
+	rtp->batch->msgs[slot].msg_hdr.msg_iovlen = niov;
+	rtp->batch->num_msgs++;
+}
+
+static void rtp_write_header(struct rtp_info *rtp, u8 *hdr, int marker,
+			     unsigned int timestamp)
+{
+	hdr[0] = 0x80;	/* Version 2, no padding, extension or CSRCs */
+	hdr[1] = (marker ? 0x80 : 0x00) | (rtp->payload_type & 0x7F);
+	hdr[2] = rtp->seq >> 8;
+	hdr[3] = rtp->seq & 0xFF;
+	hdr[4] = timestamp >> 24;
+	hdr[5] = timestamp >> 16;
+	hdr[6] = timestamp >> 8;
+	hdr[7] = timestamp;
+	hdr[8] = rtp->ssrc >> 24;
+	hdr[9] = rtp->ssrc >> 16;
+	hdr[10] = rtp->ssrc >> 8;
+	hdr[11] = rtp->ssrc;
+	rtp->seq++;
+}
+
+/*
+ * Single NAL unit packet: RTP header followed by the NAL as is
+ */
+static int rtp_send_single(struct rtp_info *rtp, struct rtp_nal *nal,
+			   int marker, unsigned int timestamp)
+{
+	int slot = rtp_get_slot(rtp);
+	struct iovec *iov;
+	u8 *hdr;
+
+	if (slot < 0)
+		return -1;
+
+	hdr = rtp->batch->hdr[slot];
+	iov = rtp->batch->iov[slot];
+	rtp_write_header(rtp, hdr, marker, timestamp);
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = RTP_HEADER_SIZE;
+	iov[1].iov_base = nal->data;
+	iov[1].iov_len = nal->size;
+	rtp_commit_slot(rtp, slot, 2);
+
+	return 0;
+}
+
+/*
+ * Aggregation packet: STAP-A header, then a 16 bit size and the NAL for
+ * each aggregated unit. The sizes are kept in the header scratch area.
+ */
+static int rtp_send_stap_a(struct rtp_info *rtp, struct rtp_nal *nal,
+			   int count, int marker, unsigned int timestamp)
+{
+	int slot = rtp_get_slot(rtp);
+	struct iovec *iov;
+	u8 *hdr, *sizes;
+	u8 f = 0, nri = 0;
+	int i, niov;
+
+	if (slot < 0)
+		return -1;
+
+	hdr = rtp->batch->hdr[slot];
+	iov = rtp->batch->iov[slot];
+	rtp_write_header(rtp, hdr, marker, timestamp);
+
+	/* The STAP-A F bit is the OR and NRI is the max of the units */
+	for (i = 0; i < count; i++) {
+		f |= nal[i].data[0] & 0x80;
+		if ((nal[i].data[0] & 0x60) > nri)
+			nri = nal[i].data[0] & 0x60;
+	}
+	hdr[RTP_HEADER_SIZE] = f | nri | RTP_NAL_STAP_A;
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = RTP_HEADER_SIZE + 1;
+	niov = 1;
+
+	sizes = hdr + RTP_HEADER_SIZE + 1;
+	for (i = 0; i < count; i++) {
+		sizes[0] = nal[i].size >> 8;
+		sizes[1] = nal[i].size & 0xFF;
+		iov[niov].iov_base = sizes;
+		iov[niov].iov_len = 2;
+		iov[niov + 1].iov_base = nal[i].data;
+		iov[niov + 1].iov_len = nal[i].size;
+		niov += 2;
+		sizes += 2;
+	}
+	rtp_commit_slot(rtp, slot, niov);
+
+	return 0;
+}
+
+/*
+ * Fragmentation units: the NAL header is replaced by the FU indicator and
+ * FU header, and the rest of the NAL is split across packets
+ */
+static int rtp_send_fu_a(struct rtp_info *rtp, struct rtp_nal *nal,
+			 int marker, unsigned int timestamp)
+{
+	int max_frag = rtp->mtu - RTP_HEADER_SIZE - 2;
+	u8 nal_hdr = nal->data[0];
+	u8 *payload = nal->data + 1;
+	int left = nal->size - 1;
+	int slot, frag, first = 1;
+	struct iovec *iov;
+	u8 *hdr;
+
+	while (left > 0) {
+		slot = rtp_get_slot(rtp);
+		if (slot < 0)
+			return -1;
+
+		frag = (left > max_frag) ? max_frag : left;
+
+		hdr = rtp->batch->hdr[slot];
+		iov = rtp->batch->iov[slot];
+		rtp_write_header(rtp, hdr, marker && frag == left, timestamp);
+
+		hdr[RTP_HEADER_SIZE] = (nal_hdr & 0xE0) | RTP_NAL_FU_A;
+		hdr[RTP_HEADER_SIZE + 1] = nal_hdr & 0x1F;
+		if (first)
+			hdr[RTP_HEADER_SIZE + 1] |= 0x80;
+		if (frag == left)
+			hdr[RTP_HEADER_SIZE + 1] |= 0x40;
+
+		iov[0].iov_base = hdr;
+		iov[0].iov_len = RTP_HEADER_SIZE + 2;
+		iov[1].iov_base = payload;
+		iov[1].iov_len = frag;
+		rtp_commit_slot(rtp, slot, 2);
+
+		payload += frag;
+		left -= frag;
+		first = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Hand all queued packets to the kernel with as few system calls as
+ * possible
+ */
+static int rtp_flush(struct rtp_info *rtp)
+{
+	int sent = 0, ret, i;
+
+	while (sent < rtp->batch->num_msgs) {
+		ret = sendmmsg(rtp->fd, &rtp->batch->msgs[sent],
+			       rtp->batch->num_msgs - sent, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			err_msg("%s: sendmmsg failed, errno %d\n",
+				rtp->name, errno);
+			rtp->batch->num_msgs = 0;
+			return -1;
+		}
+
+		for (i = sent; i < sent + ret; i++)
+			rtp->bytes_sent += rtp->batch->msgs[i].msg_len;
+		sent += ret;
+		rtp->send_calls++;
+	}
+
+	rtp->packets_sent += sent;
+	rtp->batch->num_msgs = 0;
+
+	return 0;
+}
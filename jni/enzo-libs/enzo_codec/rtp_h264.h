@@ -0,0 +1,76 @@
+#ifndef RTP_H264_H
+#define RTP_H264_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "enzo_utils.h"
+
+#include <netinet/in.h>
+
+#define RTP_HEADER_SIZE		12
+#define RTP_DEFAULT_MTU		1400
+#define RTP_H264_CLOCK_RATE	90000
+#define RTP_DEFAULT_PT		96
+
+/* Number of packets that are handed to the kernel in one sendmmsg call */
+#define RTP_BATCH_SIZE		32
+/* Maximum number of scatter entries per packet. A STAP-A packet needs two
+   entries (size + payload) per aggregated NAL plus one for the headers. */
+#define RTP_MAX_IOV		15
+#define RTP_MAX_STAP_NALS	((RTP_MAX_IOV - 1) / 2)
+/* Scratch space per packet for the RTP header and the RFC 6184 payload
+   headers (FU indicator/header, STAP-A header and NAL sizes) */
+#define RTP_HDR_SCRATCH		(RTP_HEADER_SIZE + 1 + 2 * RTP_MAX_STAP_NALS)
+
+/* RFC 6184 payload types */
+enum {
+	RTP_NAL_STAP_A	= 24,
+	RTP_NAL_FU_A	= 28
+};
+
+struct rtp_nal {
+	u8 *data;	/* Start of NAL (first byte is the NAL header) */
+	int size;	/* Size of NAL without start code */
+};
+
+/*
+ * RTP H.264 packetizer structure declaration
+ */
+struct rtp_info {
+	int fd;
+	int mtu;
+	int payload_type;
+	u16 seq;
+	unsigned int ssrc;
+	struct sockaddr_in dest;
+	char name[12];
+
+	/* Packets waiting to be sent. Payload iovecs point directly into
+	   the encoder bitstream buffer, only the headers live here. */
+	struct rtp_batch *batch;
+
+	struct rtp_nal nals[MAX_NAL_PER_PICTURE];
+
+	/* SPS/PPS from the encoder init, resent in front of every IDR */
+	u8 param_sets[64];
+	int param_sets_size;
+
+	/* Statistics */
+	unsigned long packets_sent;
+	unsigned long bytes_sent;
+	unsigned long send_calls;
+};
+
+int rtp_h264_init(struct rtp_info *rtp, const char *address, int port);
+int rtp_h264_deinit(struct rtp_info *rtp);
+int rtp_h264_set_param_sets(struct rtp_info *rtp, struct mediaBuffer *headers);
+int rtp_h264_send_frame(struct rtp_info *rtp, struct mediaBuffer *enc_src,
+			unsigned int timestamp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RTP_H264_H
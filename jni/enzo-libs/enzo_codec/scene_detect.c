@@ -0,0 +1,131 @@
+#include "scene_detect.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+/* Function prototypes */
+static unsigned int scene_row_sad(const u8 *a, const u8 *b, int width);
+/* End function prototypes */
+
+int scene_init(struct scene_info *scene, int width, int height)
+{
+	scene->width = width;
+	scene->height = height;
+	scene->rows = (height + SCENE_ROW_STEP - 1) / SCENE_ROW_STEP;
+	if (scene->cut_threshold <= 0)
+		scene->cut_threshold = SCENE_CUT_THRESHOLD;
+	if (scene->static_threshold <= 0)
+		scene->static_threshold = SCENE_STATIC_THRESHOLD;
+
+	scene->prev = malloc(scene->width * scene->rows);
+	if (scene->prev == NULL) {
+		err_msg("Scene: Failed to allocate %d sampled rows\n",
+			scene->rows);
+		return -1;
+	}
+
+	scene->have_prev = 0;
+	scene->static_count = 0;
+	scene->since_cut = 0;
+	scene->state = SCENE_MOTION;
+	scene->last_mad = 0;
+	scene->cuts = 0;
+	scene->static_frames = 0;
+
+	return 0;
+}
+
+void scene_deinit(struct scene_info *scene)
+{
+	free(scene->prev);
+	scene->prev = NULL;
+}
+
+/*
+ * Compare the luma plane against the previous frame and classify it.
+ * The sampled rows are kept for the next call.
+ *
+ * Return: SCENE_CUT, SCENE_STATIC or SCENE_MOTION
+ */
+int scene_analyze(struct scene_info *scene, const u8 *y, int stride)
+{
+	unsigned long long sad = 0;
+	const u8 *src;
+	u8 *prev;
+	int i, mad;
+
+	for (i = 0; i < scene->rows; i++) {
+		src = y + (i * SCENE_ROW_STEP) * stride;
+		prev = scene->prev + i * scene->width;
+		if (scene->have_prev)
+			sad += scene_row_sad(src, prev, scene->width);
+		memcpy(prev, src, scene->width);
+	}
+
+	scene->since_cut++;
+	if (!scene->have_prev) {
+		scene->have_prev = 1;
+		scene->since_cut = 0;
+		return scene->state = SCENE_MOTION;
+	}
+
+	mad = (int)((sad << 4) / ((unsigned long long)scene->width *
+				  scene->rows));
+	scene->last_mad = mad;
+
+	if (mad >= scene->cut_threshold &&
+	    scene->since_cut >= SCENE_MIN_CUT_INTERVAL) {
+		scene->since_cut = 0;
+		scene->static_count = 0;
+		scene->cuts++;
+		return scene->state = SCENE_CUT;
+	}
+
+	if (mad < scene->static_threshold) {
+		if (scene->static_count < SCENE_STATIC_FRAMES)
+			scene->static_count++;
+	} else {
+		scene->static_count = 0;
+	}
+
+	if (scene->static_count >= SCENE_STATIC_FRAMES) {
+		scene->static_frames++;
+		return scene->state = SCENE_STATIC;
+	}
+
+	return scene->state = SCENE_MOTION;
+}
+
+static unsigned int scene_row_sad(const u8 *a, const u8 *b, int width)
+{
+	unsigned int sad = 0;
+	int x = 0;
+
+#ifdef __ARM_NEON__
+	uint32x4_t acc32 = vdupq_n_u32(0);
+	uint16x8_t acc16;
+	uint64x2_t sum64;
+	int n;
+
+	while (x + 16 <= width) {
+		/* 128 iterations of pairwise adds stay within 16 bits */
+		acc16 = vdupq_n_u16(0);
+		for (n = 0; n < 128 && x + 16 <= width; n++, x += 16)
+			acc16 = vpadalq_u8(acc16, vabdq_u8(vld1q_u8(a + x),
+							   vld1q_u8(b + x)));
+		acc32 = vpadalq_u16(acc32, acc16);
+	}
+	sum64 = vpaddlq_u32(acc32);
+	sad = (unsigned int)(vgetq_lane_u64(sum64, 0) +
+			     vgetq_lane_u64(sum64, 1));
+#endif
+
+	for (; x < width; x++)
+		sad += abs(a[x] - b[x]);
+
+	return sad;
+}
@@ -0,0 +1,57 @@
+#ifndef SCENE_DETECT_H
+#define SCENE_DETECT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "enzo_utils.h"
+
+/* Only every SCENE_ROW_STEP'th luma row is compared, which is plenty to
+   tell a cut from noise and keeps the cost to a fraction of a frame read */
+#define SCENE_ROW_STEP		4
+
+/* Thresholds are mean absolute luma differences in 1/16 levels */
+#define SCENE_CUT_THRESHOLD	(28 * 16)
+#define SCENE_STATIC_THRESHOLD	(2 * 16)
+/* Frames in a row below the static threshold before the scene counts
+   as static, and frames after a forced IDR before another cut is taken */
+#define SCENE_STATIC_FRAMES	15
+#define SCENE_MIN_CUT_INTERVAL	10
+
+enum {
+	SCENE_MOTION = 0,
+	SCENE_STATIC,
+	SCENE_CUT
+};
+
+/*
+ * Scene analysis structure declaration
+ */
+struct scene_info {
+	int width;
+	int height;
+	int cut_threshold;
+	int static_threshold;
+
+	u8 *prev;		/* Sampled luma rows of the previous frame */
+	int rows;
+	int have_prev;
+	int static_count;
+	int since_cut;
+	int state;
+	int last_mad;		/* Last mean absolute difference, 1/16 levels */
+
+	unsigned long cuts;
+	unsigned long static_frames;
+};
+
+int scene_init(struct scene_info *scene, int width, int height);
+void scene_deinit(struct scene_info *scene);
+int scene_analyze(struct scene_info *scene, const u8 *y, int stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SCENE_DETECT_H
@@ -0,0 +1,120 @@
+#include "simulcast.h"
+#include "image_scale.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Function prototypes */
+static void simulcast_get_planes(struct encoder_info *enc, u8 **y, u8 **u,
+				 u8 **v);
+static void simulcast_scale_layer(struct simulcast_info *sim, int layer);
+/* End function prototypes */
+
+/*
+ * Check that the layers can be produced from each other. Each encoder
+ * must already be initialized.
+ */
+int simulcast_init(struct simulcast_info *sim)
+{
+	struct encoder_info *enc, *prev;
+	int i;
+
+	if (strcmp(sim->name, "") == 0)
+		strcpy(sim->name, "Simulcast");
+
+	if (sim->num_layers < 1 || sim->num_layers > SIMULCAST_MAX_LAYERS) {
+		err_msg("%s: Invalid number of layers %d\n", sim->name,
+			sim->num_layers);
+		return -1;
+	}
+
+	for (i = 0; i < sim->num_layers; i++) {
+		enc = sim->enc[i];
+		if (enc == NULL || enc->pfbpool == NULL) {
+			err_msg("%s: Encoder for layer %d is not initialized\n",
+				sim->name, i);
+			return -1;
+		}
+
+		/* The lower layers are scaled from the layer above them */
+		if (i > 0) {
+			prev = sim->enc[i - 1];
+			if (enc->color_space != YUV420P ||
+			    prev->color_space != YUV420P) {
+				err_msg("%s: Scaled layers must be YUV420P\n",
+					sim->name);
+				return -1;
+			}
+			if (enc->src_picwidth > prev->src_picwidth ||
+			    enc->src_picheight > prev->src_picheight) {
+				err_msg("%s: Layer %d is larger than layer %d\n",
+					sim->name, i, i - 1);
+				return -1;
+			}
+		}
+
+		vpu_encoder_get_source(enc, &sim->src[i]);
+		info_msg("%s: Layer %d is %dx%d at %d kbps\n", sim->name, i,
+			 enc->src_picwidth, enc->src_picheight,
+			 enc->enc_bit_rate);
+	}
+
+	return 0;
+}
+
+/*
+ * Read the source frame once into the layer 0 encoder, then produce every
+ * lower layer by scaling down the layer above it. Afterwards each layer's
+ * src buffer can be given to its encoder, which uses it in place.
+ */
+int simulcast_load_frame(struct simulcast_info *sim,
+			 struct mediaBuffer *vid_src)
+{
+	int i;
+
+	if (vpu_encoder_load_frame(sim->enc[0], vid_src) < 0)
+		return -1;
+
+	for (i = 1; i < sim->num_layers; i++)
+		simulcast_scale_layer(sim, i);
+
+	/* The layers encode from src, which was set up once at init, so
+	   the encoded frames get the id and time of this frame from it */
+	for (i = 0; i < sim->num_layers; i++) {
+		sim->src[i].frameId = vid_src->frameId;
+		sim->src[i].timestamp = vid_src->timestamp;
+	}
+
+	return 0;
+}
+
+static void simulcast_get_planes(struct encoder_info *enc, u8 **y, u8 **u,
+				 u8 **v)
+{
+	struct frame_buf *pfb = enc->pfbpool[enc->src_fbid];
+	u32 offset = pfb->desc.virt_uaddr - pfb->desc.phy_addr;
+
+	*y = (u8 *)(pfb->addrY + offset);
+	*u = (u8 *)(pfb->addrCb + offset);
+	*v = (u8 *)(pfb->addrCr + offset);
+}
+
+static void simulcast_scale_layer(struct simulcast_info *sim, int layer)
+{
+	struct encoder_info *src = sim->enc[layer - 1];
+	struct encoder_info *dst = sim->enc[layer];
+	struct frame_buf *sfb = src->pfbpool[src->src_fbid];
+	struct frame_buf *dfb = dst->pfbpool[dst->src_fbid];
+	u8 *sy, *su, *sv, *dy, *du, *dv;
+	int sw = src->src_picwidth, sh = src->src_picheight;
+	int dw = dst->src_picwidth, dh = dst->src_picheight;
+
+	simulcast_get_planes(src, &sy, &su, &sv);
+	simulcast_get_planes(dst, &dy, &du, &dv);
+
+	scale_plane(sy, sw, sh, sfb->strideY, dy, dw, dh, dfb->strideY);
+	scale_plane(su, sw / 2, sh / 2, sfb->strideY / 2,
+		    du, dw / 2, dh / 2, dfb->strideY / 2);
+	scale_plane(sv, sw / 2, sh / 2, sfb->strideY / 2,
+		    dv, dw / 2, dh / 2, dfb->strideY / 2);
+}
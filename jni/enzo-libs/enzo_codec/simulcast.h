@@ -0,0 +1,33 @@
+#ifndef SIMULCAST_H
+#define SIMULCAST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "enzo_utils.h"
+#include "vpu_encode.h"
+
+#define SIMULCAST_MAX_LAYERS	4
+
+/*
+ * Simulcast structure declaration. Layer 0 is the full resolution
+ * layer, every following layer must be the same size or smaller than
+ * the one before it.
+ */
+struct simulcast_info {
+	int num_layers;
+	struct encoder_info *enc[SIMULCAST_MAX_LAYERS];
+	struct mediaBuffer src[SIMULCAST_MAX_LAYERS];
+	char name[12];
+};
+
+int simulcast_init(struct simulcast_info *sim);
+int simulcast_load_frame(struct simulcast_info *sim,
+			 struct mediaBuffer *vid_src);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SIMULCAST_H
@@ -0,0 +1,280 @@
+#include "stage_stats.h"
+#include "enzo_utils.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Every thread records into histograms of its own, so timing a stage
+ * costs two clock reads and a few increments without any locking. The
+ * per-thread histograms are only summed up when statistics are read.
+ * Histograms of threads that exit are folded into a retired set, so
+ * their samples are not lost.
+ *
+ * A counter has one writer, its thread, but is read by others, so it is
+ * loaded and stored with relaxed atomics. That keeps the 64 bit sums
+ * from tearing on ARMv7 without a locked read-modify-write.
+ */
+struct stage_thread {
+	unsigned int hist[STAGE_NUM][STAGE_BUCKETS];
+	unsigned int count[STAGE_NUM];
+	unsigned int max_us[STAGE_NUM];
+	unsigned long long sum_us[STAGE_NUM];
+	struct stage_thread *next;
+};
+
+static pthread_once_t stage_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stage_key;
+/* Protects the thread list and the retired set, never taken to record */
+static pthread_mutex_t stage_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stage_thread *stage_threads;
+static struct stage_thread stage_retired;
+
+/* Function prototypes */
+static void stage_create_key(void);
+static void stage_thread_exit(void *arg);
+static struct stage_thread *stage_thread_get(void);
+static void stage_merge(struct stage_thread *dst, struct stage_thread *src,
+			int stage);
+static inline unsigned int load_u32(unsigned int *p);
+static inline void add_u32(unsigned int *p, unsigned int v);
+static int bucket_index(unsigned int us);
+static unsigned int bucket_value(int index);
+/* End function prototypes */
+
+static void stage_create_key(void)
+{
+	pthread_key_create(&stage_key, stage_thread_exit);
+}
+
+static void stage_thread_exit(void *arg)
+{
+	struct stage_thread *t = arg, **p;
+	int i;
+
+	pthread_mutex_lock(&stage_lock);
+	for (p = &stage_threads; *p; p = &(*p)->next) {
+		if (*p == t) {
+			*p = t->next;
+			break;
+		}
+	}
+	for (i = 0; i < STAGE_NUM; i++)
+		stage_merge(&stage_retired, t, i);
+	pthread_mutex_unlock(&stage_lock);
+
+	free(t);
+}
+
+/*
+ * Return: the calling thread's histograms, or NULL if out of memory
+ */
+static struct stage_thread *stage_thread_get(void)
+{
+	struct stage_thread *t;
+
+	pthread_once(&stage_once, stage_create_key);
+
+	t = pthread_getspecific(stage_key);
+	if (t != NULL)
+		return t;
+
+	t = calloc(1, sizeof(struct stage_thread));
+	if (t == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&stage_lock);
+	t->next = stage_threads;
+	stage_threads = t;
+	pthread_mutex_unlock(&stage_lock);
+
+	pthread_setspecific(stage_key, t);
+
+	return t;
+}
+
+static inline unsigned int load_u32(unsigned int *p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+/*
+ * Only for counters of the calling thread, which is their only writer
+ */
+static inline void add_u32(unsigned int *p, unsigned int v)
+{
+	__atomic_store_n(p, load_u32(p) + v, __ATOMIC_RELAXED);
+}
+
+/*
+ * Called with stage_lock held, src may still be recording
+ */
+static void stage_merge(struct stage_thread *dst, struct stage_thread *src,
+			int stage)
+{
+	unsigned int max_us;
+	int i;
+
+	for (i = 0; i < STAGE_BUCKETS; i++)
+		add_u32(&dst->hist[stage][i], load_u32(&src->hist[stage][i]));
+	add_u32(&dst->count[stage], load_u32(&src->count[stage]));
+	__atomic_store_n(&dst->sum_us[stage],
+			 __atomic_load_n(&dst->sum_us[stage], __ATOMIC_RELAXED) +
+			 __atomic_load_n(&src->sum_us[stage], __ATOMIC_RELAXED),
+			 __ATOMIC_RELAXED);
+	max_us = load_u32(&src->max_us[stage]);
+	if (max_us > load_u32(&dst->max_us[stage]))
+		__atomic_store_n(&dst->max_us[stage], max_us, __ATOMIC_RELAXED);
+}
+
+static int bucket_index(unsigned int us)
+{
+	int e;
+
+	if (us < (1 << STAGE_LINEAR_BITS))
+		return us;
+
+	e = 31 - __builtin_clz(us);
+	return (1 << STAGE_LINEAR_BITS) +
+	       ((e - STAGE_LINEAR_BITS) << STAGE_SUB_BITS) +
+	       ((us >> (e - STAGE_SUB_BITS)) & ((1 << STAGE_SUB_BITS) - 1));
+}
+
+/*
+ * Return: the largest time that falls into bucket index
+ */
+static unsigned int bucket_value(int index)
+{
+	int e, sub;
+
+	if (index < (1 << STAGE_LINEAR_BITS))
+		return index;
+
+	index -= 1 << STAGE_LINEAR_BITS;
+	e = (index >> STAGE_SUB_BITS) + STAGE_LINEAR_BITS;
+	sub = index & ((1 << STAGE_SUB_BITS) - 1);
+
+	return (1u << e) + ((unsigned int)(sub + 1) << (e - STAGE_SUB_BITS)) - 1;
+}
+
+long long stage_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Add one sample to the calling thread's histogram of stage
+ */
+void stage_record(int stage, long long us)
+{
+	struct stage_thread *t;
+	unsigned int v;
+
+	if (stage < 0 || stage >= STAGE_NUM)
+		return;
+
+	t = stage_thread_get();
+	if (t == NULL)
+		return;
+
+	if (us < 0)
+		us = 0;
+	v = us > 0x7fffffff ? 0x7fffffff : (unsigned int)us;
+
+	add_u32(&t->hist[stage][bucket_index(v)], 1);
+	add_u32(&t->count[stage], 1);
+	__atomic_store_n(&t->sum_us[stage],
+			 __atomic_load_n(&t->sum_us[stage], __ATOMIC_RELAXED) + v,
+			 __ATOMIC_RELAXED);
+	if (v > load_u32(&t->max_us[stage]))
+		__atomic_store_n(&t->max_us[stage], v, __ATOMIC_RELAXED);
+}
+
+/*
+ * Sum up the histograms of stage over all threads and copy up to count
+ * values, in STAGE_STAT_* order, into stats. Percentiles are the upper
+ * bound of the bucket they fall into, but never more than the maximum.
+ *
+ * Return: number of values copied, -1 for an unknown stage
+ */
+int stage_get_stats(int stage, long long *stats, int count)
+{
+	long long values[STAGE_NUM_STATS];
+	static const int pct[3] = { 50, 95, 99 };
+	struct stage_thread *sum, *t;
+	unsigned long long seen;
+	long long v;
+	int i, p;
+
+	if (stage < 0 || stage >= STAGE_NUM)
+		return -1;
+
+	/* Large, and only the one stage is used */
+	sum = calloc(1, sizeof(struct stage_thread));
+	if (sum == NULL)
+		return -1;
+
+	pthread_mutex_lock(&stage_lock);
+	stage_merge(sum, &stage_retired, stage);
+	for (t = stage_threads; t; t = t->next)
+		stage_merge(sum, t, stage);
+	pthread_mutex_unlock(&stage_lock);
+
+	memset(values, 0, sizeof(values));
+	values[STAGE_STAT_COUNT] = sum->count[stage];
+	values[STAGE_STAT_MAX_US] = sum->max_us[stage];
+	if (sum->count[stage])
+		values[STAGE_STAT_MEAN_US] = sum->sum_us[stage] /
+					     sum->count[stage];
+
+	seen = 0;
+	p = 0;
+	for (i = 0; i < STAGE_BUCKETS && p < 3; i++) {
+		seen += sum->hist[stage][i];
+		while (p < 3 && sum->count[stage] &&
+		       seen * 100 >= (unsigned long long)sum->count[stage] *
+				     pct[p]) {
+			v = bucket_value(i);
+			if (v > values[STAGE_STAT_MAX_US])
+				v = values[STAGE_STAT_MAX_US];
+			values[STAGE_STAT_P50_US + p] = v;
+			p++;
+		}
+	}
+	free(sum);
+
+	if (count > STAGE_NUM_STATS)
+		count = STAGE_NUM_STATS;
+	memcpy(stats, values, count * sizeof(*stats));
+
+	return count;
+}
+
+/*
+ * Clear all histograms. Samples recorded at the same time may survive
+ * partially, which only matters for a reset in the middle of a run.
+ */
+void stage_reset(void)
+{
+	struct stage_thread *t;
+	int i, j;
+
+	pthread_mutex_lock(&stage_lock);
+	for (t = stage_threads; t; t = t->next) {
+		for (i = 0; i < STAGE_NUM; i++) {
+			for (j = 0; j < STAGE_BUCKETS; j++)
+				__atomic_store_n(&t->hist[i][j], 0,
+						 __ATOMIC_RELAXED);
+			__atomic_store_n(&t->count[i], 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&t->max_us[i], 0, __ATOMIC_RELAXED);
+			__atomic_store_n(&t->sum_us[i], 0, __ATOMIC_RELAXED);
+		}
+	}
+	memset(&stage_retired, 0, sizeof(stage_retired));
+	pthread_mutex_unlock(&stage_lock);
+}
@@ -0,0 +1,49 @@
+#ifndef STAGE_STATS_H
+#define STAGE_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Timed stages of the capture, decode, display and encode paths. Order
+   matches CamView.java. */
+enum {
+	STAGE_CAPTURE_WAIT = 0,	/* Waiting for the camera to fill a buffer */
+	STAGE_BITSTREAM_FILL,	/* Copying a frame into the decoder stream */
+	STAGE_VPU_DECODE,	/* Start of the decode until its output */
+	STAGE_G2D,		/* Waiting for g2d copies and blits */
+	STAGE_CHROMA_REPACK,	/* CPU chroma decimation for the encoder */
+	STAGE_DISPLAY_COPY,	/* Copying the composition into the window */
+	STAGE_ENCODE_SOURCE,	/* Loading the encoder source frame */
+	STAGE_VPU_ENCODE,	/* Start of the encode until its output */
+	STAGE_NUM
+};
+
+/* Order of the values returned by stage_get_stats */
+enum {
+	STAGE_STAT_COUNT = 0,
+	STAGE_STAT_MEAN_US,
+	STAGE_STAT_P50_US,
+	STAGE_STAT_P95_US,
+	STAGE_STAT_P99_US,
+	STAGE_STAT_MAX_US,
+	STAGE_NUM_STATS
+};
+
+/* Histogram buckets are exact below 16us, above that each power of two
+   is split into 8 buckets, so percentiles are within 12.5% */
+#define STAGE_LINEAR_BITS	4
+#define STAGE_SUB_BITS		3
+#define STAGE_BUCKETS		((1 << STAGE_LINEAR_BITS) + \
+				 (31 - STAGE_LINEAR_BITS) * (1 << STAGE_SUB_BITS))
+
+long long stage_now_us(void);
+void stage_record(int stage, long long us);
+int stage_get_stats(int stage, long long *stats, int count);
+void stage_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // STAGE_STATS_H
@@ -1,11 +1,15 @@
 #include "v4l2_camera.h"
+#include "stage_stats.h"
+#include "enzo_trace.h"
 
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 /*
  * V4L2 capture device initialization
@@ -200,6 +204,8 @@ static int v4l2_stream_on(struct camera_info *device)
 		err_msg("%s: VIDIOC_STREAMON failed", device->name);
 		return -1;
 	}
+	device->streaming = 1;
+	device->buf_held = 0;
 	info_msg("%s: Stream on\n", device->name);
 
 	return 0;
@@ -218,6 +224,9 @@ static int v4l2_stream_off(struct camera_info *device)
 		err_msg("%s: VIDIOC_STREAMOFF failed", device->name);
 		return -1;
 	}
+	/* STREAMOFF takes every buffer back from the driver */
+	device->streaming = 0;
+	device->buf_held = 0;
 	info_msg("%s: Stream off\n", device->name);
 
 	return 0;
@@ -272,6 +281,7 @@ static int v4l2_dequeue_buffer(struct camera_info *device)
 	int ret;
 	fd_set fds;
 	struct timeval tv;
+	long long start = stage_now_us();
 
 	FD_ZERO(&fds);
 	FD_SET(device->fd, &fds);
@@ -301,6 +311,10 @@ static int v4l2_dequeue_buffer(struct camera_info *device)
 		err_msg("%s: VIDIOC_DQBUF failed", device->name);
 		return -1;
 	}
+	device->buf_held = 1;
+	device->frame_count++;
+	stage_record(STAGE_CAPTURE_WAIT, stage_now_us() - start);
+	TRACE_SPAN("capture", device->frame_count, start);
 
 	return 0;
 }
@@ -315,6 +329,9 @@ int v4l2_cameraInit(struct camera_info *camera)
 	camera->num_buffers = 3;
 	strcpy(camera->name,"USB Cam");
 	camera->buffers = NULL;
+	camera->streaming = 0;
+	camera->buf_held = 0;
+	camera->frame_count = 0;
 		
 	/* Initialize the v4l2 capture devices */
 	if (v4l2_init_device(camera) < 0)
@@ -326,7 +343,8 @@ int v4l2_cameraInit(struct camera_info *camera)
 
 	/* Request a capture buffer from the driver that can be copied
 	 * to framebuffer */
-	v4l2_dequeue_buffer(camera);
+	if (v4l2_dequeue_buffer(camera) < 0)
+		goto Error;
 
 	info_msg("%s: Init done successfully\n\n", camera->name);
 
@@ -346,7 +364,8 @@ int v4l2_cameraDeinit(struct camera_info *camera)
 	   and the cleanup would have occured in the init process */
 
 	if (camera->fd > 0) {
-		v4l2_stream_off(camera);
+		if (camera->streaming)
+			v4l2_stream_off(camera);
 		v4l2_exit_device(camera);
 	}
 
@@ -355,21 +374,62 @@ int v4l2_cameraDeinit(struct camera_info *camera)
 	return 0;
 }
 
+/*
+ * Stop streaming, but keep the device open with its buffers mapped
+ */
+int v4l2_cameraPause(struct camera_info *camera)
+{
+	if (camera->fd <= 0 || !camera->streaming)
+		return 0;
+
+	return v4l2_stream_off(camera);
+}
+
+/*
+ * Restart streaming after v4l2_cameraPause. This does not wait for a
+ * frame, the next v4l2_cameraGetFrame does.
+ */
+int v4l2_cameraResume(struct camera_info *camera)
+{
+	if (camera->fd <= 0)
+		return -1;
+	if (camera->streaming)
+		return 0;
+
+	return v4l2_stream_on(camera);
+}
+
 /*
  * Capture v4l2 frame
  */
 int v4l2_cameraGetFrame(struct camera_info *camera, struct mediaBuffer *cam_src)
 {
-	unsigned int index;
-
-	/* Give the buffer back to the driver so it can be filled again */
-	v4l2_queue_buffer(camera);
+	/* Give the buffer back to the driver so it can be filled again.
+	   After a resume the driver already has all of them. */
+	if (camera->buf_held)
+		v4l2_queue_buffer(camera);
 
 	/* Request a capture buffer from the driver that can be copied
 	 * to framebuffer */
-	v4l2_dequeue_buffer(camera);
+	if (v4l2_dequeue_buffer(camera) < 0)
+		return -1;
+
+	return v4l2_cameraGetCurrentFrame(camera, cam_src);
+}
 
-	index = camera->buf.index;
+/*
+ * Point cam_src at the buffer that is currently dequeued, without
+ * waiting for a new frame. Right after init this is the first frame.
+ */
+int v4l2_cameraGetCurrentFrame(struct camera_info *camera,
+			       struct mediaBuffer *cam_src)
+{
+	unsigned int index = camera->buf.index;
+
+	if (!camera->buf_held) {
+		err_msg("%s: No frame captured since resume\n", camera->name);
+		return -1;
+	}
 
 	cam_src->bufOutSize = camera->buf.bytesused;
 	cam_src->vBufOut = camera->buffers[index].start;
@@ -378,6 +438,9 @@ int v4l2_cameraGetFrame(struct camera_info *camera, struct mediaBuffer *cam_src)
 	cam_src->width = camera->width;
 	cam_src->imageHeight = camera->height;
 	cam_src->imageWidth = camera->width;
+	cam_src->timestamp = (long long)camera->buf.timestamp.tv_sec * 1000000 +
+			     camera->buf.timestamp.tv_usec;
+	cam_src->frameId = camera->frame_count;
 
 	if (camera->type == RAW_VIDEO)
 		cam_src->colorSpace = YUYV;
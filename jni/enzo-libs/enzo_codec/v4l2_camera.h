@@ -26,9 +26,13 @@ struct camera_info {
 	int width;
 	int height;
 	int fps;
-	char dev_name[12];
+	char dev_name[64];
 	char name[10];
 
+	int streaming;
+	int buf_held;	/* buf is dequeued and owned by the application */
+	unsigned long frame_count;
+
 	struct v4l2_buffer buf;
 	struct v4l2_format fmt;
 	struct buf_info *buffers;
@@ -36,7 +40,11 @@ struct camera_info {
 
 int v4l2_cameraDeinit(struct camera_info *camera);
 int v4l2_cameraGetFrame(struct camera_info *camera, struct mediaBuffer *cam_src);
+int v4l2_cameraGetCurrentFrame(struct camera_info *camera,
+			       struct mediaBuffer *cam_src);
 int v4l2_cameraInit(struct camera_info *camera);
+int v4l2_cameraPause(struct camera_info *camera);
+int v4l2_cameraResume(struct camera_info *camera);
 
 #ifdef __cplusplus
 }
@@ -1,23 +1,40 @@
 #include "vpu_common.h"
 #include "enzo_utils.h"
+#include "enzo_mem.h"
 
+#include <pthread.h>
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+/*
+ * Framebuffers that are not in use stay mapped in this pool, so the next
+ * decoder/encoder session that asks for the same (format, stride, height)
+ * gets them without going through the contiguous memory allocator. The
+ * list is kept most recently used first and is only trimmed when an
+ * allocation fails or framebuf_pool_trim is called.
+ */
+static pthread_mutex_t fb_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct frame_buf *fb_idle;
+static struct framebuf_pool_stats fb_stats;
+
+/* Function prototypes */
+static void framebuf_release(struct frame_buf *fb);
+/* End function prototypes */
+
 struct frame_buf *framebuf_alloc(int stdMode, int format, int strideY, int height, int mvCol)
 {
 	struct frame_buf *fb;
 	int err;
 	int y_size, c_size, c_stride;
 
-	//fb = get_framebuf();
-	//if (fb == NULL) {
-	//	err_msg("Frame buffer get_framebuf failed\n");
-	//	return NULL;
-	//}
 	mvCol++;
 	stdMode++;
 
+	fb = get_framebuf(format, strideY, height);
+	if (fb != NULL)
+		return fb;
+
 	fb = calloc(1, sizeof(struct frame_buf));
 	if (fb == NULL) {
 		err_msg("Failed to allocate framebuffer\n");
@@ -26,7 +43,7 @@ struct frame_buf *framebuf_alloc(int stdMode, int format, int strideY, int heigh
 
 	y_size = strideY * height;
 
-	if ((format == YUV422P) || (format == YUYV)) {
+	if ((format == YUV422P) || (format == YUYV) || (format == NV16)) {
 		c_size = y_size / 2;
 		c_stride = strideY / 2;
 	} else {
@@ -40,7 +57,15 @@ struct frame_buf *framebuf_alloc(int stdMode, int format, int strideY, int heigh
 	//info_msg("y_size %d c_size %d\n", y_size, c_size);
 	//info_msg("fb->desc.size %d mvCol %d\n", fb->desc.size, mvCol);
 
-	err = IOGetPhyMem(&fb->desc);
+	err = contig_alloc(&fb->desc);
+	if (err) {
+		/* Memory is tight, give the idle buffers back and retry */
+		if (framebuf_pool_trim(0) > 0) {
+			memset(&(fb->desc), 0, sizeof(vpu_mem_desc));
+			fb->desc.size = y_size + c_size*2;
+			err = contig_alloc(&fb->desc);
+		}
+	}
 	if (err) {
 		err_msg("Frame buffer allocation failure\n");
 		memset(&(fb->desc), 0, sizeof(vpu_mem_desc));
@@ -53,63 +78,145 @@ struct frame_buf *framebuf_alloc(int stdMode, int format, int strideY, int heigh
 	fb->addrCr = fb->addrCb + c_size;
 	fb->strideY = strideY;
 	fb->strideC =  c_stride;
-
-	fb->desc.virt_uaddr = IOGetVirtMem(&(fb->desc));
-	if (fb->desc.virt_uaddr <= 0) {
-		IOFreePhyMem(&fb->desc);
-		memset(&(fb->desc), 0, sizeof(vpu_mem_desc));
-		err_msg("Frame buffer IOGetVirtMem failed\n");
-		free(fb);
-		return NULL;
-	}
+	fb->format = format;
+	fb->height = height;
 
 	return fb;
 }
 
 void framebuf_init(void)
 {
-	//int i;
-
-	//for (i = 0; i < NUM_FRAME_BUFS; i++) {
-	//	fbarray[i] = &fbpool[i];
-	//}
+	pthread_mutex_lock(&fb_lock);
+	memset(&fb_stats, 0, sizeof(struct framebuf_pool_stats));
+	pthread_mutex_unlock(&fb_lock);
 }
 
+/*
+ * Return a framebuffer to the pool. It stays allocated and mapped.
+ */
 void framebuf_free(struct frame_buf *fb)
 {
 	if (fb == NULL)
 		return;
 
-	if (fb->desc.virt_uaddr) {
-		IOFreeVirtMem(&fb->desc);
-	}
+	put_framebuf(fb);
+}
 
-	if (fb->desc.phy_addr) {
-		IOFreePhyMem(&fb->desc);
+/*
+ * Take an idle framebuffer of the given size class out of the pool.
+ *
+ * Return: the framebuffer, or NULL if none is idle
+ */
+struct frame_buf *get_framebuf(int format, int strideY, int height)
+{
+	struct frame_buf *fb, **link;
+
+	pthread_mutex_lock(&fb_lock);
+	for (link = &fb_idle; *link != NULL; link = &(*link)->next) {
+		fb = *link;
+		if (fb->format == format && fb->strideY == strideY &&
+		    fb->height == height) {
+			*link = fb->next;
+			fb->next = NULL;
+			fb->mvColBuf = 0;
+			fb_stats.hits++;
+			fb_stats.idle_count--;
+			fb_stats.idle_bytes -= fb->desc.size;
+			pthread_mutex_unlock(&fb_lock);
+			return fb;
+		}
 	}
+	fb_stats.misses++;
+	pthread_mutex_unlock(&fb_lock);
 
-	memset(&(fb->desc), 0, sizeof(vpu_mem_desc));
-	//put_framebuf(fb);
-	free(fb);
+	return NULL;
 }
 
-/*struct frame_buf *get_framebuf(void)
+void put_framebuf(struct frame_buf *fb)
 {
-	struct frame_buf *fb;
+	pthread_mutex_lock(&fb_lock);
+	fb->next = fb_idle;
+	fb_idle = fb;
+	fb_stats.idle_count++;
+	fb_stats.idle_bytes += fb->desc.size;
+	pthread_mutex_unlock(&fb_lock);
+}
 
-	fb = fbarray[fb_index];
-	fbarray[fb_index] = 0;
+/*
+ * Make sure at least count framebuffers of the given size class sit in
+ * the pool, so a decoder that asks for them later does not have to wait
+ * for the allocator.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int framebuf_pool_prewarm(int stdMode, int format, int strideY, int height,
+			  int mvCol, int count)
+{
+	struct frame_buf *fbs[NUM_FRAME_BUFS];
+	int i, n, ret = 0;
+
+	if (count > NUM_FRAME_BUFS)
+		count = NUM_FRAME_BUFS;
+
+	/* Idle buffers of this class are handed out first, so only the
+	   missing ones are actually allocated */
+	for (n = 0; n < count; n++) {
+		fbs[n] = framebuf_alloc(stdMode, format, strideY, height,
+					mvCol);
+		if (fbs[n] == NULL) {
+			ret = -1;
+			break;
+		}
+	}
+	for (i = 0; i < n; i++)
+		framebuf_free(fbs[i]);
 
-	++fb_index;
-	fb_index &= FB_INDEX_MASK;
+	return ret;
+}
 
-	return fb;
+/*
+ * Release idle framebuffers, least recently used first, until at most
+ * keep_bytes stay in the pool. This is meant to be called under memory
+ * pressure; framebuf_pool_trim(0) empties the pool.
+ *
+ * Return: number of bytes released
+ */
+int framebuf_pool_trim(int keep_bytes)
+{
+	struct frame_buf *fb, **link;
+	int released = 0;
+
+	pthread_mutex_lock(&fb_lock);
+	while (fb_idle != NULL && fb_stats.idle_bytes > keep_bytes) {
+		/* The oldest buffer is at the end of the list */
+		for (link = &fb_idle; (*link)->next != NULL;
+		     link = &(*link)->next)
+			;
+		fb = *link;
+		*link = NULL;
+		fb_stats.idle_count--;
+		fb_stats.idle_bytes -= fb->desc.size;
+		fb_stats.trims++;
+		released += fb->desc.size;
+		framebuf_release(fb);
+	}
+	pthread_mutex_unlock(&fb_lock);
+
+	if (released > 0)
+		info_msg("Framebuffer pool released %d bytes\n", released);
+
+	return released;
 }
 
-void put_framebuf(struct frame_buf *fb)
+void framebuf_pool_get_stats(struct framebuf_pool_stats *stats)
 {
-	--fb_index;
-	fb_index &= FB_INDEX_MASK;
+	pthread_mutex_lock(&fb_lock);
+	memcpy(stats, &fb_stats, sizeof(struct framebuf_pool_stats));
+	pthread_mutex_unlock(&fb_lock);
+}
 
-	fbarray[fb_index] = fb;
-}*/
+static void framebuf_release(struct frame_buf *fb)
+{
+	contig_free(&fb->desc);
+	free(fb);
+}
@@ -24,18 +24,32 @@ struct frame_buf {
 	int strideC;
 	int mvColBuf;
 	vpu_mem_desc desc;
+
+	/* Pool bookkeeping, buffers are handed out by size class */
+	int format;
+	int height;
+	struct frame_buf *next;
 };
 
-//static int fb_index;
-//static struct frame_buf *fbarray[NUM_FRAME_BUFS];
-//static struct frame_buf fbpool[NUM_FRAME_BUFS];
+/* Framebuffer pool statistics */
+struct framebuf_pool_stats {
+	unsigned long hits;	/* Requests served from the pool */
+	unsigned long misses;	/* Requests that needed a new allocation */
+	unsigned long trims;	/* Buffers released back to the system */
+	int idle_count;
+	int idle_bytes;
+};
 
 struct frame_buf *framebuf_alloc(int stdMode, int format,
 				 int strideY, int height, int mvCol);
 void framebuf_free(struct frame_buf *fb);
 void framebuf_init(void);
-struct frame_buf *get_framebuf(void);
+struct frame_buf *get_framebuf(int format, int strideY, int height);
 void put_framebuf(struct frame_buf *fb);
+int framebuf_pool_prewarm(int stdMode, int format, int strideY, int height,
+			  int mvCol, int count);
+int framebuf_pool_trim(int keep_bytes);
+void framebuf_pool_get_stats(struct framebuf_pool_stats *stats);
 
 #ifdef __cplusplus
 }
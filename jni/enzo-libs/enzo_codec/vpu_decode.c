@@ -1,4 +1,7 @@
 #include "vpu_decode.h"
+#include "enzo_mem.h"
+#include "stage_stats.h"
+#include "enzo_trace.h"
 
 #include <errno.h>
 #include <linux/videodev2.h>
@@ -18,6 +21,7 @@
 static int decoder_open(struct decoder_info *dec, struct mediaBuffer *enc_src);
 static void decoder_close(struct decoder_info *dec);
 static int decoder_parse(struct decoder_info *dec);
+static int decoder_fb_count(int minfbcount, int interlace);
 static int decoder_allocate_framebuffer(struct decoder_info *dec);
 static void decoder_free_framebuffer(struct decoder_info *dec);
 static int decoder_decode_frame(struct decoder_info *dec, struct mediaBuffer *enc_src,
@@ -36,28 +40,21 @@ int vpu_decoder_init(struct decoder_info *dec, struct mediaBuffer *enc_src)
 	int ret;
 
 	dec->bs_mem_desc.size = STREAM_BUF_SIZE;
-	ret = IOGetPhyMem(&dec->bs_mem_desc);
+	ret = contig_alloc(&dec->bs_mem_desc);
 	if (ret) {
 		err_msg("%s: Unable to obtain physical mem\n",
 			dec->decoder_name);
 		return -1;
 	}
 
-	if (IOGetVirtMem(&dec->bs_mem_desc) <= 0) {
-		err_msg("%s: Unable to obtain virtual mem\n",
-			dec->decoder_name);
-		IOFreePhyMem(&dec->bs_mem_desc);
-		return -1;
-	}
-
 	if (dec->format == H264AVC) {
 		dec->ps_mem_desc.size = PS_SAVE_SIZE;
-		ret = IOGetPhyMem(&dec->ps_mem_desc);
+		ret = contig_alloc(&dec->ps_mem_desc);
 		if (ret) {
 			err_msg("%s: Unable to obtain"
 				"physical ps save mem\n",
 				dec->decoder_name);
-			IOFreePhyMem(&dec->bs_mem_desc);
+			contig_free(&dec->bs_mem_desc);
 			return -1;
 		}
 		dec->phy_ps_buf=(PhysicalAddress)(&dec->ps_mem_desc.phy_addr);
@@ -79,8 +76,8 @@ int vpu_decoder_init(struct decoder_info *dec, struct mediaBuffer *enc_src)
 	if (ret) {
 		err_msg("%s: Unable to open decoder instance\n",
 			dec->decoder_name);
-		IOFreePhyMem(&dec->bs_mem_desc);
-		IOFreePhyMem(&dec->ps_mem_desc);
+		contig_free(&dec->bs_mem_desc);
+		contig_free(&dec->ps_mem_desc);
 		return -1;
 	}
 
@@ -102,8 +99,16 @@ int vpu_decoder_decode_frame(struct decoder_info *dec,
 			 struct mediaBuffer *vid_dst)
 {
 	int ret;
+
+	TRACE_BEGIN("decode", enc_src->frameId);
 	/* start decoding */
 	ret = decoder_decode_frame(dec, enc_src, vid_dst);
+	/* MJPEG has no reordering, the output is the input frame */
+	if (ret == 0 && dec->format == MJPEG) {
+		vid_dst->frameId = enc_src->frameId;
+		vid_dst->timestamp = enc_src->timestamp;
+	}
+	TRACE_END("decode", enc_src->frameId);
 
 	return ret;
 }
@@ -120,7 +125,7 @@ static int decoder_open(struct decoder_info *dec, struct mediaBuffer *enc_src)
 
 	if (dec->format == MJPEG) {
 		oparam.bitstreamFormat = STD_MJPG;
-		oparam.chromaInterleave = 0;
+		oparam.chromaInterleave = dec->chroma_interleave;
 		info_msg("%s: MJPEG requested\n", dec->decoder_name);
 	} else if (dec->format == H264AVC) {
 		oparam.bitstreamFormat = STD_AVC;
@@ -179,7 +184,7 @@ static int decoder_open(struct decoder_info *dec, struct mediaBuffer *enc_src)
 
 	if (dec->format == H264AVC) {
 		dec->slice_mem_desc.size = dec->phy_slicebuf_size;
-		ret = IOGetPhyMem(&dec->slice_mem_desc);
+		ret = contig_alloc(&dec->slice_mem_desc);
 		if (ret) {
 			err_msg("%s: Unable to obtain"
 				"physical slice save mem\n",dec->decoder_name);
@@ -194,7 +199,7 @@ static int decoder_open(struct decoder_info *dec, struct mediaBuffer *enc_src)
 	if (ret) {
 		err_msg("%s: Couldn't allocate framebuffer\n",
 			dec->decoder_name);
-		IOFreePhyMem(&dec->slice_mem_desc);
+		contig_free(&dec->slice_mem_desc);
 		return -1;
 	}
 
@@ -213,10 +218,10 @@ static void decoder_close(struct decoder_info *dec)
 			err_msg("%s: vpu_DecClose failed\n",dec->decoder_name);
 	}
 
-	IOFreePhyMem(&dec->bs_mem_desc);
+	contig_free(&dec->bs_mem_desc);
 	if (dec->format == H264AVC) {
-		IOFreePhyMem(&dec->slice_mem_desc);
-		IOFreePhyMem(&dec->ps_mem_desc);
+		contig_free(&dec->slice_mem_desc);
+		contig_free(&dec->ps_mem_desc);
 	}
 
 	return;
@@ -349,9 +354,8 @@ static int decoder_parse(struct decoder_info *dec)
 {
 	DecInitialInfo initinfo;
 	DecHandle handle = dec->handle;
-	int align, extended_fbcount;
+	int align;
 	RetCode ret;
-	char *count;
 
 	memset(&initinfo, 0, sizeof(DecInitialInfo));
 
@@ -392,7 +396,10 @@ static int decoder_parse(struct decoder_info *dec)
 		dec->mjpg_fmt = initinfo.mjpg_sourceFormat;
 		info_msg("%s: MJPG SourceFormat: %d\n",
 			dec->decoder_name, initinfo.mjpg_sourceFormat);
-		dec->color_space = YUV422P;
+		if (dec->chroma_interleave)
+			dec->color_space = NV16;
+		else
+			dec->color_space = YUV422P;
 	}
 
 	dec->lastPicWidth = initinfo.picWidth;
@@ -403,32 +410,11 @@ static int decoder_parse(struct decoder_info *dec)
 		initinfo.frameRateRes, initinfo.frameRateDiv,
 		initinfo.minFrameBufferCount);
 
-	/*
-	 * We suggest to add two more buffers than minFrameBufferCount:
-	 *
-	 * vpu_DecClrDispFlag is used to control framebuffer whether can be
-	 * used for decoder again. One framebuffer dequeue from IPU is delayed
-	 * for performance improvement and one framebuffer is delayed for
-	 * display flag clear.
-	 *
-	 * Performance is better when more buffers are used if IPU performance
-	 * is bottleneck.
-	 *
-	 * Two more buffers may be needed for interlace stream from IPU DVI view
-	 */
 	dec->minfbcount = initinfo.minFrameBufferCount;
-	count = getenv("VPU_EXTENDED_BUFFER_COUNT");
-	if (count)
-		extended_fbcount = atoi(count);
-	else
-		extended_fbcount = 2;
-
-	if (initinfo.interlace)
-		dec->regfbcount = dec->minfbcount + extended_fbcount + 2;
-	else
-		dec->regfbcount = dec->minfbcount + extended_fbcount;
-	info_msg("%s: minfb %d, extfb %d\n",dec->decoder_name,
-		 dec->minfbcount, extended_fbcount);
+	dec->regfbcount = decoder_fb_count(dec->minfbcount,
+					   initinfo.interlace);
+	info_msg("%s: minfb %d, regfb %d\n",dec->decoder_name,
+		 dec->minfbcount, dec->regfbcount);
 
 	dec->picwidth = ((initinfo.picWidth + 15) & ~15);
 	align = 16;
@@ -477,9 +463,84 @@ static int decoder_parse(struct decoder_info *dec)
 	dec->phy_slicebuf_size = initinfo.worstSliceSize * 1024;
 	dec->stride = dec->picwidth;
 
+	dec->params.pic_width = initinfo.picWidth;
+	dec->params.pic_height = initinfo.picHeight;
+	dec->params.min_fb_count = initinfo.minFrameBufferCount;
+	dec->params.interlace = initinfo.interlace;
+	dec->params.mjpg_fmt = initinfo.mjpg_sourceFormat;
+	dec->params.stride = dec->stride;
+
 	return 0;
 }
 
+/*
+ * Number of framebuffers to register for a stream.
+ *
+ * We suggest to add two more buffers than minFrameBufferCount:
+ *
+ * vpu_DecClrDispFlag is used to control framebuffer whether can be
+ * used for decoder again. One framebuffer dequeue from IPU is delayed
+ * for performance improvement and one framebuffer is delayed for
+ * display flag clear.
+ *
+ * Performance is better when more buffers are used if IPU performance
+ * is bottleneck.
+ *
+ * Two more buffers may be needed for interlace stream from IPU DVI view
+ */
+static int decoder_fb_count(int minfbcount, int interlace)
+{
+	int extended_fbcount;
+	char *count;
+
+	count = getenv("VPU_EXTENDED_BUFFER_COUNT");
+	if (count)
+		extended_fbcount = atoi(count);
+	else
+		extended_fbcount = 2;
+
+	if (interlace)
+		return minfbcount + extended_fbcount + 2;
+	else
+		return minfbcount + extended_fbcount;
+}
+
+/*
+ * Put the framebuffers a decoder for a stream with these parameters will
+ * ask for into the framebuffer pool. The decoder still parses the first
+ * frame; if the stream turns out to be different, the prepared buffers
+ * just stay idle in the pool.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int vpu_decoder_prewarm(int format, int chroma_interleave,
+			const struct decoder_params *params)
+{
+	int color_space, vpu_fmt, mvCol, height;
+
+	if (format == MJPEG) {
+		color_space = chroma_interleave ? NV16 : YUV422P;
+		vpu_fmt = STD_MJPG;
+		mvCol = 0;
+	} else if (format == H264AVC) {
+		color_space = NV12;
+		vpu_fmt = STD_AVC;
+		mvCol = 1;
+	} else {
+		return -1;
+	}
+
+	if (params->stride <= 0 || params->pic_height <= 0)
+		return -1;
+
+	height = (params->pic_height + 15) & ~15;
+
+	return framebuf_pool_prewarm(vpu_fmt, color_space, params->stride,
+			height, mvCol,
+			decoder_fb_count(params->min_fb_count,
+					 params->interlace));
+}
+
 /*
  * Fill the bitstream ring buffer
  */
@@ -681,7 +742,6 @@ static int decoder_decode_frame(struct decoder_info *dec, struct mediaBuffer *en
 	int err = 0, eos = 0, fill_end_bs = 0, decodefinish = 0;
 	RetCode ret;
 	int loop_id;
-	u32 img_size;
 	double frame_id = 0;
 	int decIndex = 0;
 	int rotid = 0, mirror;
@@ -692,6 +752,7 @@ static int decoder_decode_frame(struct decoder_info *dec, struct mediaBuffer *en
 	char *delay_ms, *endptr;
 	int return_code = 0;
 	int param_change_loop = 0;
+	long long start;
 
 	memset(&outinfo, 0, sizeof(DecOutputInfo));
 	memset(&decparam, 0, sizeof(DecParam));
@@ -705,6 +766,7 @@ static int decoder_decode_frame(struct decoder_info *dec, struct mediaBuffer *en
 	 * 3. after vpu_DecGetOutputInfo.
 	 */
 
+	start = stage_now_us();
 	err = dec_fill_bsbuffer(dec, handle, enc_src,
 		    dec->virt_bsbuf_addr,
 		    (dec->virt_bsbuf_addr + STREAM_BUF_SIZE),
@@ -714,6 +776,8 @@ static int decoder_decode_frame(struct decoder_info *dec, struct mediaBuffer *en
 		err_msg("%s: dec_fill_bsbuffer failed\n", dec->decoder_name);
 		return DEC_ERROR;
 	}
+	stage_record(STAGE_BITSTREAM_FILL, stage_now_us() - start);
+	TRACE_SPAN("bitstream fill", enc_src->frameId, start);
 
 	while (param_change_loop < AVC_PARAM_LOOP_MAX) {
 
@@ -763,8 +827,6 @@ static int decoder_decode_frame(struct decoder_info *dec, struct mediaBuffer *en
 			vpu_DecGiveCommand(handle, SET_ROTATOR_STRIDE, &rot_stride);
 		}
 
-		img_size = dec->picwidth * dec->picheight * 3 / 2;
-
 		if (rot_en || dering_en || tiled2LinearEnable || (dec->format == MJPEG)) {
 			vpu_DecGiveCommand(handle, SET_ROTATOR_OUTPUT,
 						(void *)&fb[rotid]);
@@ -782,6 +844,7 @@ static int decoder_decode_frame(struct decoder_info *dec, struct mediaBuffer *en
 			}
 		}
 
+		start = stage_now_us();
 		ret = vpu_DecStartOneFrame(handle, &decparam);
 		if (ret == RETCODE_JPEG_EOS) {
 			info_msg("%s: JPEG bitstream is end\n",
@@ -841,6 +904,8 @@ static int decoder_decode_frame(struct decoder_info *dec, struct mediaBuffer *en
 			vpu_WaitForInt(100);
 
 		ret = vpu_DecGetOutputInfo(handle, &outinfo);
+		stage_record(STAGE_VPU_DECODE, stage_now_us() - start);
+		TRACE_SPAN("vpu decode", enc_src->frameId, start);
 
 		/* In 8 instances test, we found some instance(s) may not get a chance to be scheduled
 		 * until timeout, so we yield schedule each frame explicitly.
@@ -1008,7 +1073,7 @@ static void write_to_dst(struct decoder_info *dec,
 	pfb = dec->pfbpool[index];
 	buf = (u8 *)(pfb->addrY + pfb->desc.virt_uaddr - pfb->desc.phy_addr);
 
-	if (dec->color_space == YUV422P)
+	if (dec->color_space == YUV422P || dec->color_space == NV16)
 		img_size = stride * height * 2;
 	else
 		img_size = stride * height * 3 / 2;
@@ -1019,7 +1084,7 @@ static void write_to_dst(struct decoder_info *dec,
 	}
 	else {
 		if (dec->format == MJPEG)
-			vid_dst->colorSpace = YUV422P;
+			vid_dst->colorSpace = dec->color_space;
 		else if (dec->format == H264AVC)
 			vid_dst->colorSpace = NV12;
 		vid_dst->dataSource = VPU_CODEC;
@@ -1029,7 +1094,7 @@ static void write_to_dst(struct decoder_info *dec,
 		vid_dst->imageHeight = dec->lastPicHeight;
 		vid_dst->imageWidth = dec->lastPicWidth;
 		vid_dst->vBufOut = (unsigned char *)buf;
-		vid_dst->pBufOut = (unsigned char *)pfb->addrY;
+		vid_dst->pBufOut = (unsigned char *)(unsigned long)pfb->addrY;
 	}
 
 	return;
@@ -11,6 +11,20 @@ extern "C" {
 #include "vpu_io.h"
 #include "vpu_lib.h"
 
+/*
+ * Stream parameters found by parsing the first frame. They are enough to
+ * size the framebuffers, so they can be saved and used to prepare the
+ * framebuffers of the next session before its first frame arrives.
+ */
+struct decoder_params {
+	int pic_width;		/* As coded, before alignment */
+	int pic_height;
+	int min_fb_count;	/* minFrameBufferCount */
+	int interlace;
+	int mjpg_fmt;		/* mjpg_sourceFormat */
+	int stride;
+};
+
 struct decoder_info {
 	DecHandle handle;
 	PhysicalAddress phy_bsbuf_addr;
@@ -42,7 +56,9 @@ struct decoder_info {
 	int post_processing;
 	int disp_clr_index;
 	int color_space;
+	int chroma_interleave;	/* MJPEG: output NV16 instead of YUV422P */
 	int totalfb;
+	struct decoder_params params;
 
 	int decoded_field[32];
 	int lastPicWidth;
@@ -58,6 +74,8 @@ struct decoder_info {
 
 int vpu_decoder_init(struct decoder_info *dec, struct mediaBuffer *enc_src);
 int vpu_decoder_deinit(struct decoder_info *dec);
+int vpu_decoder_prewarm(int format, int chroma_interleave,
+			const struct decoder_params *params);
 int vpu_decoder_decode_frame(struct decoder_info *dec,
 			 struct mediaBuffer *enc_src,
 			 struct mediaBuffer *vid_dst);
@@ -1,5 +1,9 @@
 #include "vpu_encode.h"
 
+#include "copy_engine.h"
+#include "enzo_mem.h"
+#include "stage_stats.h"
+#include "enzo_trace.h"
 #include "g2d.h"
 
 #include <malloc.h>
@@ -17,6 +21,9 @@ static void encoder_close(struct encoder_info *enc);
 static void encoder_free_framebuffer(struct encoder_info *enc);
 static int encoder_open(struct encoder_info *enc);
 static int read_source_frame(struct encoder_info *enc, struct mediaBuffer *vid_src);
+static int encoder_analyze_scene(struct encoder_info *enc, int *quant);
+static int encoder_refresh_mbs(struct encoder_info *enc, int period);
+static void encoder_update_stats(struct encoder_stats *stats, int size);
 static void SaveEncSliceInfo(u8 *SliceParaBuf, int size, struct nalInfoStruct *nalInfo);
 /* End function prototypes */
 
@@ -28,36 +35,25 @@ int vpu_encoder_init(struct encoder_info *enc, struct mediaBuffer *enc_dst)
 	info_msg("%s: Allocating physical contigous bit stream buffer\n",
 		 enc->encoder_name);
 	enc->bs_mem_desc.size = STREAM_BUF_SIZE;
-	ret = IOGetPhyMem(&enc->bs_mem_desc);
+	ret = contig_alloc(&enc->bs_mem_desc);
 	if (ret) {
 		err_msg("%s: Unable to obtain physical memory\n",
 			enc->encoder_name);
 		return -1;
 	}
-	enc->virt_bsbuf_addr = IOGetVirtMem(&enc->bs_mem_desc);
-	if (enc->virt_bsbuf_addr <= 0) {
-		err_msg("%s: Unable to map physical memory\n",
-			enc->encoder_name);
-		IOFreePhyMem(&enc->bs_mem_desc);
-		return -1;
-	}
+	enc->virt_bsbuf_addr = enc->bs_mem_desc.virt_uaddr;
 
 	info_msg("%s: Allocating physical contigous output buffer\n",
 		 enc->encoder_name);
 	enc->outbuf_desc.size = enc->enc_picwidth*enc->enc_picheight;
-	ret = IOGetPhyMem(&enc->outbuf_desc);
+	ret = contig_alloc(&enc->outbuf_desc);
 	if (ret) {
 		err_msg("%s: Unable to obtain physical memory\n",
 			enc->encoder_name);
+		contig_free(&enc->bs_mem_desc);
 		return -1;
 	}
-	enc->virt_outbuf_addr = IOGetVirtMem(&enc->outbuf_desc);
-	if (enc->virt_outbuf_addr <= 0) {
-		err_msg("%s: Unable to map physical memory\n",
-			enc->encoder_name);
-		IOFreePhyMem(&enc->outbuf_desc);
-		return -1;
-	}
+	enc->virt_outbuf_addr = enc->outbuf_desc.virt_uaddr;
 
 	enc->phy_bsbuf_addr = enc->bs_mem_desc.phy_addr;
 	enc->linear2TiledEnable = 0;
@@ -82,6 +78,13 @@ int vpu_encoder_init(struct encoder_info *enc, struct mediaBuffer *enc_dst)
 		return -1;
 	}
 
+	if (enc->scene_detect) {
+		if (scene_init(&enc->scene, enc->src_picwidth,
+			       enc->src_picheight) < 0)
+			return -1;
+		info_msg("%s: Scene analysis enabled\n", enc->encoder_name);
+	}
+
 	if (enc->sliceInfo.enable) {
 		ret = vpu_EncGiveCommand(enc->handle, ENC_SET_REPORT_SLICEINFO, &enc->sliceInfo);
 		if (ret != RETCODE_SUCCESS) {
@@ -107,13 +110,121 @@ int vpu_encoder_deinit(struct encoder_info *enc)
 	if (enc->sliceInfo.addr)
 		free(enc->sliceInfo.addr);
 
-	IOFreePhyMem(&enc->bs_mem_desc);
-	IOFreePhyMem(&enc->outbuf_desc);
+	if (enc->scene_detect)
+		scene_deinit(&enc->scene);
+
+	contig_free(&enc->bs_mem_desc);
+	contig_free(&enc->outbuf_desc);
 
 	info_msg("%s: encoder was deinitialized\n\n", enc->encoder_name);
 	return 0;
 }
 
+/*
+ * Copy/convert a frame into the encoder source framebuffer without
+ * encoding it. A following encode that is given the buffer from
+ * vpu_encoder_get_source will then use the frame in place.
+ */
+int vpu_encoder_load_frame(struct encoder_info *enc, struct mediaBuffer *vid_src)
+{
+	if (read_source_frame(enc, vid_src) <= 0) {
+		err_msg("%s: no data read from video source\n", enc->encoder_name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Describe the encoder source framebuffer as a media buffer, so other
+ * components can write frames directly into it
+ */
+int vpu_encoder_get_source(struct encoder_info *enc, struct mediaBuffer *src_buf)
+{
+	struct frame_buf *pfb = enc->pfbpool[enc->src_fbid];
+
+	src_buf->dataType = RAW_VIDEO;
+	src_buf->dataSource = VPU_CODEC;
+	src_buf->colorSpace = enc->color_space;
+	src_buf->width = pfb->strideY;
+	src_buf->height = (enc->src_picheight + 15) & ~15;
+	src_buf->imageWidth = enc->src_picwidth;
+	src_buf->imageHeight = enc->src_picheight;
+	src_buf->bufOutSize = pfb->desc.size;
+	src_buf->vBufOut = (unsigned char *)
+		(pfb->addrY + pfb->desc.virt_uaddr - pfb->desc.phy_addr);
+	src_buf->pBufOut = (unsigned char *)(unsigned long)pfb->addrY;
+
+	return 0;
+}
+
+/*
+ * Change the target bit rate of a running encoder
+ */
+int vpu_encoder_set_bitrate(struct encoder_info *enc, int bit_rate)
+{
+	RetCode ret;
+	int rate = bit_rate;
+
+	/* Keep the reduced rate if the scene is currently static */
+	if (enc->scene_detect && enc->scene.state == SCENE_STATIC)
+		rate = bit_rate / 2;
+
+	ret = vpu_EncGiveCommand(enc->handle, ENC_SET_BITRATE, &rate);
+	if (ret != RETCODE_SUCCESS) {
+		err_msg("%s: Failed to set bit rate, ret %d\n",
+			enc->encoder_name, ret);
+		return -1;
+	}
+
+	enc->enc_bit_rate = bit_rate;
+	info_msg("%s: bit rate changed to %d kbps\n", enc->encoder_name,
+		 bit_rate);
+
+	return 0;
+}
+
+/*
+ * Change the intra refresh period of a running encoder. The period is
+ * the number of frames it takes to refresh every macroblock once.
+ */
+int vpu_encoder_set_intra_refresh(struct encoder_info *enc, int period)
+{
+	RetCode ret;
+	int mbs;
+
+	if (enc->intra_refresh_period <= 0 || period <= 0) {
+		err_msg("%s: Intra refresh must be enabled at init\n",
+			enc->encoder_name);
+		return -1;
+	}
+
+	mbs = encoder_refresh_mbs(enc, period);
+	ret = vpu_EncGiveCommand(enc->handle, ENC_SET_INTRA_MB_REFRESH_NUMBER,
+				 &mbs);
+	if (ret != RETCODE_SUCCESS) {
+		err_msg("%s: Failed to set intra refresh, ret %d\n",
+			enc->encoder_name, ret);
+		return -1;
+	}
+
+	enc->intra_refresh_period = period;
+	info_msg("%s: intra refresh every %d frames (%d MBs/frame)\n",
+		 enc->encoder_name, period, mbs);
+
+	return 0;
+}
+
+/*
+ * Variance of the encoded frame sizes in bytes^2
+ */
+double vpu_encoder_stats_variance(struct encoder_stats *stats)
+{
+	if (stats->frames < 2)
+		return 0;
+	return stats->m2 / (stats->frames - 1);
+}
+
 int vpu_encoder_encode_frame(struct encoder_info *enc, struct mediaBuffer *vid_src, struct mediaBuffer *enc_dst)
 {
 	EncHandle handle = enc->handle;
@@ -121,13 +232,9 @@ int vpu_encoder_encode_frame(struct encoder_info *enc, struct mediaBuffer *vid_s
 	EncOutputInfo outinfo;
 	RetCode ret = 0;
 	int src_fbid = enc->src_fbid;
-	int loop_id;
+	int loop_id, quant, force_i;
 	unsigned char *vbuf;
-
-	/* Timer related variables */
-	struct timeval total_start, total_end;
-	int sec, usec;
-	double total_time;
+	long long start;
 
 	enc_param.encLeftOffset = 0;
 	enc_param.encTopOffset = 0;
@@ -149,28 +256,27 @@ int vpu_encoder_encode_frame(struct encoder_info *enc, struct mediaBuffer *vid_s
 	   to the VPU encoder. Otherwise, the source data will need to
 	   be mem copied into the preallocated encoder source frame
 	   buffer. */
-	gettimeofday(&total_start, NULL);
+	start = stage_now_us();
 	ret = read_source_frame(enc, vid_src);
 	if (ret <= 0) {
 		err_msg("%s: no data read from video source\n", enc->encoder_name);
 		return -1;
 	}
-	gettimeofday(&total_end, NULL);
-	sec = total_end.tv_sec - total_start.tv_sec;
-	usec = total_end.tv_usec - total_start.tv_usec;
-	if (usec < 0) {
-		sec--;
-		usec = usec + 1000000;
-	}
-	total_time = (sec * 1000000) + usec;
-	//info_msg("encode csc took %f us\n", total_time);
+	stage_record(STAGE_ENCODE_SOURCE, stage_now_us() - start);
+	TRACE_SPAN("encode source", vid_src->frameId, start);
+
+	quant = enc->qp > 0 ? enc->qp : 23;
+	force_i = enc->force_i_frame;
+	if (enc->scene_detect && encoder_analyze_scene(enc, &quant) == SCENE_CUT)
+		force_i = 1;
 
 	enc_param.sourceFrame = &enc->fb[src_fbid];
-	enc_param.quantParam = 23;
-	enc_param.forceIPicture = enc->force_i_frame;
+	enc_param.quantParam = quant;
+	enc_param.forceIPicture = force_i;
 	enc_param.skipPicture = 0;
 	enc_param.enableAutoSkip = 1;
 
+	start = stage_now_us();
 	ret = vpu_EncStartOneFrame(handle, &enc_param);
 	if (ret != RETCODE_SUCCESS) {
 		err_msg("%s: vpu_EncStartOneFrame failed Err code:%d\n",
@@ -195,6 +301,8 @@ int vpu_encoder_encode_frame(struct encoder_info *enc, struct mediaBuffer *vid_s
 			enc->encoder_name, ret);
 		return -1;
 	}
+	stage_record(STAGE_VPU_ENCODE, stage_now_us() - start);
+	TRACE_SPAN("vpu encode", vid_src->frameId, start);
 
 	if (outinfo.skipEncoded)
 		warn_msg("%s: Skip encoding one Frame!\n", enc->encoder_name);
@@ -204,7 +312,11 @@ int vpu_encoder_encode_frame(struct encoder_info *enc, struct mediaBuffer *vid_s
 	vbuf = (unsigned char *)enc->virt_bsbuf_addr + outinfo.bitstreamBuffer
 		- enc->phy_bsbuf_addr;
 
+	encoder_update_stats(&enc->stats, outinfo.bitstreamSize);
+
 	enc_dst->frameType = outinfo.picType;
+	enc_dst->frameId = vid_src->frameId;
+	enc_dst->timestamp = vid_src->timestamp;
 	enc_dst->bufOutSize = outinfo.bitstreamSize;
 	enc_dst->vBufOut = (unsigned char*)vbuf;
 	enc_dst->pBufOut = (unsigned char*)outinfo.bitstreamBuffer;
@@ -220,6 +332,77 @@ int vpu_encoder_encode_frame(struct encoder_info *enc, struct mediaBuffer *vid_s
 	return 0;
 }
 
+/*
+ * Compare the source frame with the previous one. A scene cut forces an
+ * IDR, so the new content is not predicted from unrelated references.
+ * While nothing moves, the picture is coded coarser: with a constant QP
+ * the QP is raised, with rate control the target bit rate is halved.
+ */
+static int encoder_analyze_scene(struct encoder_info *enc, int *quant)
+{
+	struct frame_buf *pfb = enc->pfbpool[enc->src_fbid];
+	int prev_state = enc->scene.state;
+	int state, rate;
+	u8 *y;
+
+	y = (u8 *)(pfb->addrY + pfb->desc.virt_uaddr - pfb->desc.phy_addr);
+	state = scene_analyze(&enc->scene, y, pfb->strideY);
+
+	if (state == SCENE_CUT)
+		info_msg("%s: Scene cut (mad %d/16), forcing IDR\n",
+			 enc->encoder_name, enc->scene.last_mad);
+
+	if (enc->enc_bit_rate == 0) {
+		if (state == SCENE_STATIC) {
+			*quant += enc->static_qp_offset > 0 ?
+				  enc->static_qp_offset : 6;
+			if (*quant > 51)
+				*quant = 51;
+		}
+	} else if ((state == SCENE_STATIC) != (prev_state == SCENE_STATIC)) {
+		rate = enc->enc_bit_rate;
+		if (state == SCENE_STATIC)
+			rate /= 2;
+		if (vpu_EncGiveCommand(enc->handle, ENC_SET_BITRATE, &rate)
+		    != RETCODE_SUCCESS)
+			warn_msg("%s: Failed to change bit rate\n",
+				 enc->encoder_name);
+	}
+
+	return state;
+}
+
+/*
+ * Number of intra macroblocks per frame needed to refresh the whole
+ * picture within the given number of frames
+ */
+static int encoder_refresh_mbs(struct encoder_info *enc, int period)
+{
+	int mbs = ((enc->enc_picwidth + 15) / 16) *
+		  ((enc->enc_picheight + 15) / 16);
+
+	return (mbs + period - 1) / period;
+}
+
+/*
+ * Welford's running mean/variance of the encoded frame sizes
+ */
+static void encoder_update_stats(struct encoder_stats *stats, int size)
+{
+	double delta;
+
+	stats->frames++;
+	stats->last_size = size;
+	if (stats->frames == 1 || size < stats->min_size)
+		stats->min_size = size;
+	if (size > stats->max_size)
+		stats->max_size = size;
+
+	delta = size - stats->mean;
+	stats->mean += delta / stats->frames;
+	stats->m2 += delta * (size - stats->mean);
+}
+
 static int encoder_allocate_framebuffer(struct encoder_info *enc)
 {
 	EncHandle handle = enc->handle;
@@ -380,6 +563,10 @@ static int encoder_open(struct encoder_info *enc)
 	encop.bitRate = enc->enc_bit_rate;
 	info_msg("%s: bit rate is %d kbps\n",enc->encoder_name,
 		 (int)encop.bitRate);
+	/* With intra refresh every frame carries part of the intra MBs, so
+	   only the first picture is an IDR (GOP size 0 means infinite) */
+	if (enc->intra_refresh_period > 0)
+		enc->gop_size = 0;
 	encop.gopSize = enc->gop_size;
 	info_msg("%s: GOP size is %d\n",enc->encoder_name,
 		 (int)encop.gopSize);
@@ -389,7 +576,15 @@ static int encoder_open(struct encoder_info *enc)
 
 	encop.initialDelay = 0;
 	encop.vbvBufferSize = 0;        /* 0 = ignore 8 */
-	encop.intraRefresh = 0;
+	if (enc->intra_refresh_period > 0) {
+		encop.intraRefresh = encoder_refresh_mbs(enc,
+						enc->intra_refresh_period);
+		info_msg("%s: intra refresh every %d frames (%d MBs/frame)\n",
+			 enc->encoder_name, enc->intra_refresh_period,
+			 encop.intraRefresh);
+	} else {
+		encop.intraRefresh = 0;
+	}
 	encop.sliceReport = 1;
 	encop.mbReport = 0;
 	encop.mbQpReport = 0;
@@ -441,6 +636,17 @@ static int encoder_open(struct encoder_info *enc)
 		return -1;
 	}
 
+	if (enc->intra_refresh_period > 0) {
+		ret = vpu_EncGiveCommand(handle, ENC_SET_INTRA_REFRESH_MODE,
+					 &enc->intra_refresh_mode);
+		if (ret != RETCODE_SUCCESS) {
+			err_msg("%s: Failed to set intra refresh mode, ret %d\n",
+				enc->encoder_name, ret);
+			vpu_EncClose(handle);
+			return -1;
+		}
+	}
+
 	ret = vpu_EncGetInitialInfo(handle, &initinfo);
 	if (ret != RETCODE_SUCCESS) {
 		err_msg("%s: Encoder GetInitialInfo failed\n",
@@ -518,23 +724,24 @@ static int encoder_get_headers(struct encoder_info *enc, struct mediaBuffer *enc
 static int read_source_frame(struct encoder_info *enc, struct mediaBuffer *vid_src)
 {
 	unsigned char *vdst_y, *vdst_u, *vdst_v;
-	unsigned char *pdst_y, *pdst_u, *pdst_v;
+	unsigned char *pdst_y;
 	unsigned char *vsrc_y, *vsrc_u, *vsrc_v;
-	unsigned char *psrc_y, *psrc_u, *psrc_v;
-	unsigned long *vdst_u_l, *vdst_v_l, *vsrc_u_l, *vsrc_v_l;
+	unsigned char *psrc_y;
 	struct frame_buf *pfb = enc->pfbpool[enc->src_fbid];
 	FrameBuffer *fb = enc->fb;
 	int src_fbid = enc->src_fbid;
 	int format = vid_src->colorSpace;
 	int chromaInterleave = 0;
 	int img_size, y_size, c_size;
-	int i, j, c_count;
+	int i, c_count;
 	int ret = 0;
 	/* Boolean used to help unpack packed formats */
 	bool chroma;
-	/* g2d buffers that will be used for zero copies */
-	struct g2d_buf s_buf, d_buf;
-	void *g2d_handle;
+	/* Copy engine descriptors of the source and destination frame */
+	struct copy_engine *ce = copy_engine_default();
+	struct copy_buf s_buf, d_buf;
+	struct copy_fence fence;
+	long long start;
 
 	if (enc->color_space == NV12)
 		chromaInterleave = 1;
@@ -546,7 +753,7 @@ static int read_source_frame(struct encoder_info *enc, struct mediaBuffer *vid_s
 	}
 
 	if ((format != YUV420P) && (format != YUYV) &&
-	    (format != YUV422P) && (format != NV12)) {
+	    (format != YUV422P) && (format != NV12) && (format != NV16)) {
 		err_msg("%s: Video data is not in a valid color space\n",
 			enc->encoder_name);
 		return -1;
@@ -554,7 +761,7 @@ static int read_source_frame(struct encoder_info *enc, struct mediaBuffer *vid_s
 
 	y_size = enc->src_picwidth * enc->src_picheight;
 
-	if ((format == YUV422P) || (format == YUYV)) {
+	if ((format == YUV422P) || (format == YUYV) || (format == NV16)) {
 		c_size = y_size / 2;
 	} else
 		c_size = y_size / 4;
@@ -569,16 +776,17 @@ static int read_source_frame(struct encoder_info *enc, struct mediaBuffer *vid_s
 		 (pfb->addrCr + pfb->desc.virt_uaddr - pfb->desc.phy_addr);
 
 	pdst_y = (unsigned char*)fb[src_fbid].bufY;
-	pdst_u = (unsigned char*)fb[src_fbid].bufCb;
-	pdst_v = (unsigned char*)fb[src_fbid].bufCr;
 	
 	vsrc_y = vid_src->vBufOut;
 	vsrc_u = vid_src->vBufOut + y_size;
 	vsrc_v = vsrc_u + c_size;
 
 	psrc_y = vid_src->pBufOut;
-	psrc_u = vid_src->pBufOut + y_size;
-	psrc_v = psrc_u + c_size;
+
+	/* The frame was already written into our source framebuffer
+	   (see vpu_encoder_get_source), nothing to copy */
+	if (psrc_y != NULL && psrc_y == pdst_y)
+		return img_size;
 
 	/* Read from YUV420 file source */
 	if (vid_src->dataSource == FILE_SRC) {
@@ -596,59 +804,61 @@ static int read_source_frame(struct encoder_info *enc, struct mediaBuffer *vid_s
 	   the output buffer of that process can be given directly to the
 	   vpu encoder input to avoid memcpy */
 	if (vid_src->dataSource == VPU_CODEC) {
+		memset(&s_buf, 0, sizeof(struct copy_buf));
+		memset(&d_buf, 0, sizeof(struct copy_buf));
+		s_buf.paddr = (unsigned long)psrc_y;
+		s_buf.vaddr = vsrc_y;
+		d_buf.paddr = (unsigned long)pdst_y;
+		d_buf.vaddr = vdst_y;
+
 		if (format == YUV422P) {
-			if(g2d_open(&g2d_handle)) {
-				err_msg("%s: g2d_open fail.\n", enc->encoder_name);
+			/* Start the Y component copy, and copy the U and V
+			   components over while it runs, decimating the
+			   extra samples */
+			if (copy_async(ce, &d_buf, &s_buf, y_size, &fence) < 0)
 				return -1;
+
+			start = stage_now_us();
+			for (i = 0; i < c_size / 2; i += enc->src_picwidth) {
+				copy_cpu(vdst_u + i, vsrc_u + 2 * i,
+					 enc->src_picwidth);
+				copy_cpu(vdst_v + i, vsrc_v + 2 * i,
+					 enc->src_picwidth);
 			}
+			stage_record(STAGE_CHROMA_REPACK, stage_now_us() - start);
 
-			/* Use g2d to dma the Y component to the VPU input buffer */
-			s_buf.buf_paddr = (int)psrc_y;
-			s_buf.buf_vaddr = vsrc_y;
-			d_buf.buf_paddr = (int)pdst_y;
-			d_buf.buf_vaddr = vdst_y;
-			g2d_copy(g2d_handle, &d_buf, &s_buf, y_size);
-			g2d_finish(g2d_handle);
-			g2d_close(g2d_handle);
+			copy_wait(ce, &fence);
+			return img_size;
+		} else if (format == NV16) {
+			/* The Y component is copied as is. Every other row of
+			   the interleaved CbCr plane is dropped, and split
+			   into two planes unless the encoder is NV12 too. */
+			if (copy_async(ce, &d_buf, &s_buf, y_size, &fence) < 0)
+				return -1;
 
-			/* Now copy the U and V components over and decimate the
-			   extra samples */
-			j =0;
-			i = 0;
-			vdst_u_l = (unsigned long *)vdst_u;
-			vdst_v_l = (unsigned long *)vdst_v;
-			vsrc_u_l = (unsigned long *)vsrc_u;
-			vsrc_v_l = (unsigned long *)vsrc_v;
-			while (i < c_size/2) {
-				*vdst_u_l = *vsrc_u_l;
-				vdst_u_l++;
-				vsrc_u_l++;
-				*vdst_v_l = *vsrc_v_l;
-				vdst_v_l++;
-				vsrc_v_l++;
-				i += 4;
-				j += 4;
-				if (j == enc->src_picwidth) {
-					j = 0;
-					vsrc_u_l += enc->src_picwidth/4;
-					vsrc_v_l += enc->src_picwidth/4;
+			start = stage_now_us();
+			for (i = 0; i < enc->src_picheight / 2; i++) {
+				vsrc_u = vid_src->vBufOut + y_size +
+					 2 * i * enc->src_picwidth;
+				if (chromaInterleave) {
+					copy_cpu(vdst_u + i * enc->src_picwidth,
+						 vsrc_u, enc->src_picwidth);
+					continue;
+				}
+				for (c_count = 0; c_count < enc->src_picwidth / 2;
+				     c_count++) {
+					*vdst_u++ = vsrc_u[2 * c_count];
+					*vdst_v++ = vsrc_u[2 * c_count + 1];
 				}
 			}
+			stage_record(STAGE_CHROMA_REPACK, stage_now_us() - start);
+
+			copy_wait(ce, &fence);
 			return img_size;
 		} else if (format == NV12) {
-			if(g2d_open(&g2d_handle)) {
-				err_msg("%s: g2d_open fail.\n", enc->encoder_name);
+			/* Copy the whole buffer to the VPU input buffer */
+			if (copy_sync(ce, &d_buf, &s_buf, img_size) < 0)
 				return -1;
-			}
-
-			/* Use g2d to dma the whole buffer to the VPU input buffer */
-			s_buf.buf_paddr = (int)psrc_y;
-			s_buf.buf_vaddr = vsrc_y;
-			d_buf.buf_paddr = (int)pdst_y;
-			d_buf.buf_vaddr = vdst_y;
-			g2d_copy(g2d_handle, &d_buf, &s_buf, img_size);
-			g2d_finish(g2d_handle);
-			g2d_close(g2d_handle);
 			return img_size;
 		}
 	}
@@ -691,10 +901,10 @@ static int read_source_frame(struct encoder_info *enc, struct mediaBuffer *vid_s
 		}
 		return vid_src->bufOutSize;
 	} else if (format == YUV420P) {
-			memcpy(vdst_y, vsrc_y, img_size);
+			copy_cpu(vdst_y, vsrc_y, img_size);
 			return img_size;
 	} else if (format == NV12) {
-			memcpy(vdst_y, vsrc_y, img_size);
+			copy_cpu(vdst_y, vsrc_y, img_size);
 			return img_size;
 	} else {
 		err_msg("%s: Unsupported format for VPU input\n", enc->encoder_name);
@@ -704,13 +914,13 @@ static int read_source_frame(struct encoder_info *enc, struct mediaBuffer *vid_s
 
 static void SaveEncSliceInfo(u8 *SliceParaBuf, int size, struct nalInfoStruct *nalInfo)
 {
-	int i, nMbAddr, nSliceBits;
+	int i, nSliceBits;
 
+	/* Bytes 2 and 3 of an entry hold the first macroblock of the
+	   slice, which is not needed */
 	for(i=0; i<size / 8; i++) {
-		nMbAddr = (SliceParaBuf[2] << 8) | SliceParaBuf[3];
 		nSliceBits = (int)(SliceParaBuf[4] << 24)|(SliceParaBuf[5] << 16)|
 				(SliceParaBuf[6] << 8)|(SliceParaBuf[7]);
-		//info_msg("[%2d] mbIndex.%3d, Bits.%d\n", i, nMbAddr, nSliceBits);
 		SliceParaBuf += 8;
 		nalInfo->nalLength[i] = nSliceBits/8;
 	}
@@ -7,10 +7,21 @@ extern "C" {
 
 #include "enzo_utils.h"
 #include "vpu_common.h"
+#include "scene_detect.h"
 
 #include "vpu_io.h"
 #include "vpu_lib.h"
 
+/* Running encoded frame size statistics */
+struct encoder_stats {
+	unsigned long frames;
+	int last_size;
+	int min_size;
+	int max_size;
+	double mean;		/* Mean frame size in bytes */
+	double m2;		/* Sum of squared deviations from the mean */
+};
+
 struct encoder_info {
 	EncHandle handle;		/* Encoder handle */
 	PhysicalAddress phy_bsbuf_addr; /* Physical bitstream buffer */
@@ -37,6 +48,13 @@ struct encoder_info {
 	int color_space;
 	int gop_size;
 	int force_i_frame;
+	int qp;			/* QP used when enc_bit_rate is 0 */
+	int scene_detect;	/* Analyze the source before each encode */
+	int static_qp_offset;	/* Added to qp while the scene is static */
+	struct scene_info scene;
+	int intra_refresh_period; /* Frames per full intra refresh, 0 = off */
+	int intra_refresh_mode;	/* Passed to ENC_SET_INTRA_REFRESH_MODE */
+	struct encoder_stats stats;
 	vpu_mem_desc bs_mem_desc;
 	vpu_mem_desc outbuf_desc;
 	void *g2d_handle;
@@ -49,6 +67,11 @@ int vpu_encoder_deinit(struct encoder_info *enc);
 int vpu_encoder_encode_frame(struct encoder_info *enc,
 			 struct mediaBuffer *vid_src,
 			 struct mediaBuffer *enc_dst);
+int vpu_encoder_load_frame(struct encoder_info *enc, struct mediaBuffer *vid_src);
+int vpu_encoder_get_source(struct encoder_info *enc, struct mediaBuffer *src_buf);
+int vpu_encoder_set_bitrate(struct encoder_info *enc, int bit_rate);
+int vpu_encoder_set_intra_refresh(struct encoder_info *enc, int period);
+double vpu_encoder_stats_variance(struct encoder_stats *stats);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,279 @@
+#include "frame_pool.h"
+#include "enzo_mem.h"
+#include "copy_engine.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Function prototypes */
+static int set_layout(struct pool_frame *f, int color_space, int width,
+		      int height);
+static int alloc_data(struct pool_frame *f, int size);
+static void free_data(struct pool_frame *f);
+static struct pool_frame *get_free_frame(struct frame_pool *pool);
+/* End function prototypes */
+
+/*
+ * Planes are packed the way the decoder writes them, with the chroma
+ * planes right after the luma plane
+ *
+ * Return: total size in bytes, or -1 for an unknown color space
+ */
+static int set_layout(struct pool_frame *f, int color_space, int width,
+		      int height)
+{
+	int i, size = 0;
+
+	f->num_planes = 1;
+	f->stride[0] = width;
+	f->plane_size[0] = width * height;
+
+	switch (color_space) {
+	case NV12:
+		f->num_planes = 2;
+		f->stride[1] = width;
+		f->plane_size[1] = width * height / 2;
+		break;
+	case NV16:
+		f->num_planes = 2;
+		f->stride[1] = width;
+		f->plane_size[1] = width * height;
+		break;
+	case YUV420P:
+		f->num_planes = 3;
+		f->stride[1] = f->stride[2] = width / 2;
+		f->plane_size[1] = f->plane_size[2] = width * height / 4;
+		break;
+	case YUV422P:
+		f->num_planes = 3;
+		f->stride[1] = f->stride[2] = width / 2;
+		f->plane_size[1] = f->plane_size[2] = width * height / 2;
+		break;
+	case YUYV:
+		f->stride[0] = width * 2;
+		f->plane_size[0] = width * height * 2;
+		break;
+	default:
+		return -1;
+	}
+
+	for (i = 0; i < f->num_planes; i++) {
+		f->planes[i] = f->data + size;
+		size += f->plane_size[i];
+	}
+
+	return size;
+}
+
+static int alloc_data(struct pool_frame *f, int size)
+{
+	if (f->size >= size)
+		return 0;
+	free_data(f);
+
+	/* Contiguous memory lets the copy engine move the frame */
+	f->buf = contig_g2d_alloc(size, 1);
+	if (f->buf) {
+		f->data = f->buf->buf_vaddr;
+	} else {
+		f->data = malloc(size);
+		if (f->data == NULL) {
+			err_msg("Frame pool: Could not allocate frame\n");
+			return -1;
+		}
+	}
+	f->size = size;
+
+	return 0;
+}
+
+static void free_data(struct pool_frame *f)
+{
+	if (f->buf)
+		contig_g2d_free(f->buf);
+	else
+		free(f->data);
+	f->buf = NULL;
+	f->data = NULL;
+	f->size = 0;
+}
+
+/*
+ * Called with the lock held. A frame with no references is not reachable
+ * by consumers, so it can be filled without the lock.
+ */
+static struct pool_frame *get_free_frame(struct frame_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < FRAME_POOL_SIZE; i++) {
+		if (pool->frames[i].refs == 0)
+			return &pool->frames[i];
+	}
+
+	return NULL;
+}
+
+int frame_pool_init(struct frame_pool *pool)
+{
+	memset(pool, 0, sizeof(*pool));
+	if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+		err_msg("Frame pool: Could not init lock\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Every frame must have been released by its consumers. The memory of a
+ * frame that is still held is leaked rather than freed under a reader.
+ */
+void frame_pool_deinit(struct frame_pool *pool)
+{
+	int i;
+
+	for (i = 0; i < FRAME_POOL_SIZE; i++) {
+		if (pool->frames[i].refs > 1 ||
+		    (pool->frames[i].refs == 1 &&
+		     &pool->frames[i] != pool->latest)) {
+			warn_msg("Frame pool: Frame %d still in use, "
+				 "leaking it\n", i);
+			continue;
+		}
+		free_data(&pool->frames[i]);
+	}
+	pthread_mutex_destroy(&pool->lock);
+}
+
+/*
+ * Copy a decoded frame into the pool and make it the newest frame. Does
+ * not wait for consumers.
+ *
+ * Return: 0 = published or nobody is interested, -1 = dropped
+ */
+int frame_pool_publish(struct frame_pool *pool, struct mediaBuffer *frame)
+{
+	struct pool_frame *f;
+	struct copy_buf dst, src;
+	struct pool_frame layout;
+	int size;
+
+	pthread_mutex_lock(&pool->lock);
+	if (!pool->wanted) {
+		pthread_mutex_unlock(&pool->lock);
+		return 0;
+	}
+	f = get_free_frame(pool);
+	if (f == NULL) {
+		pool->dropped++;
+		pthread_mutex_unlock(&pool->lock);
+		return -1;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	memset(&layout, 0, sizeof(layout));
+	size = set_layout(&layout, frame->colorSpace, frame->width,
+			  frame->height);
+	if (size < 0 || size > frame->bufOutSize) {
+		err_msg("Frame pool: Unsupported frame\n");
+		goto drop;
+	}
+	if (alloc_data(f, size) < 0)
+		goto drop;
+
+	memset(&dst, 0, sizeof(dst));
+	dst.vaddr = f->data;
+	if (f->buf) {
+		dst.paddr = f->buf->buf_paddr;
+		dst.cacheable = 1;
+		dst.buf = f->buf;
+	}
+	memset(&src, 0, sizeof(src));
+	src.vaddr = frame->vBufOut;
+	src.paddr = (unsigned long)frame->pBufOut;
+	if (copy_sync(copy_engine_default(), &dst, &src, size) < 0)
+		goto drop;
+
+	set_layout(f, frame->colorSpace, frame->width, frame->height);
+	f->width = frame->width;
+	f->height = frame->height;
+	f->color_space = frame->colorSpace;
+	f->timestamp = frame->timestamp;
+	f->frame_id = frame->frameId;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->latest)
+		pool->latest->refs--;
+	f->sequence = ++pool->sequence;
+	f->refs = 1;
+	pool->latest = f;
+	pool->published++;
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+
+drop:
+	pthread_mutex_lock(&pool->lock);
+	pool->dropped++;
+	pthread_mutex_unlock(&pool->lock);
+	return -1;
+}
+
+/*
+ * Take a reference on the newest frame. The first call only tells the
+ * pipeline to start publishing, so it usually returns NULL.
+ *
+ * Return: frame, or NULL if none has been published yet
+ */
+struct pool_frame *frame_pool_acquire(struct frame_pool *pool)
+{
+	struct pool_frame *f;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->wanted = 1;
+	f = pool->latest;
+	if (f)
+		f->refs++;
+	pthread_mutex_unlock(&pool->lock);
+
+	return f;
+}
+
+/*
+ * Check a frame handle that came from outside, like from Java, before
+ * it is dereferenced
+ *
+ * Return: 1 = frame is one of the pool's frames, 0 = it is not
+ */
+int frame_pool_owns(struct frame_pool *pool, struct pool_frame *frame)
+{
+	int i;
+
+	for (i = 0; i < FRAME_POOL_SIZE; i++) {
+		if (frame == &pool->frames[i])
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Drop a reference taken by frame_pool_acquire
+ *
+ * Return: 0 = success, -1 = not a frame of this pool
+ */
+int frame_pool_release(struct frame_pool *pool, struct pool_frame *frame)
+{
+	if (!frame_pool_owns(pool, frame)) {
+		err_msg("Frame pool: Release of an unknown frame\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if (frame->refs > 0)
+		frame->refs--;
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
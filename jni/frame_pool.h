@@ -0,0 +1,63 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include "enzo_utils.h"
+#include "g2d.h"
+
+#include <pthread.h>
+
+/* Enough for the newest frame, one held by a slow consumer and one being
+   filled, plus one spare */
+#define FRAME_POOL_SIZE		4
+#define FRAME_MAX_PLANES	3
+
+/*
+ * One decoded frame handed to consumers. The planes point into data and
+ * stay valid until the last reference is released.
+ */
+struct pool_frame {
+	int refs;
+
+	struct g2d_buf *buf;	/* NULL when data is plain memory */
+	u8 *data;
+	int size;
+
+	int width;
+	int height;
+	int color_space;
+	long long timestamp;
+	unsigned long frame_id;
+	unsigned long sequence;
+
+	int num_planes;
+	u8 *planes[FRAME_MAX_PLANES];
+	int plane_size[FRAME_MAX_PLANES];
+	int stride[FRAME_MAX_PLANES];
+};
+
+/*
+ * Decoded frames shared with consumers outside the pipeline, like the
+ * Java analytics. The pipeline publishes into a slot nobody references,
+ * so a consumer holding a frame never blocks it; when every slot is held
+ * the frame is dropped for the consumers instead. Frames are only copied
+ * out once a consumer has asked for one.
+ */
+struct frame_pool {
+	pthread_mutex_t lock;
+	struct pool_frame frames[FRAME_POOL_SIZE];
+	struct pool_frame *latest;	/* Holds one reference of its own */
+	int wanted;
+
+	unsigned long sequence;
+	unsigned long published;
+	unsigned long dropped;
+};
+
+int frame_pool_init(struct frame_pool *pool);
+void frame_pool_deinit(struct frame_pool *pool);
+int frame_pool_publish(struct frame_pool *pool, struct mediaBuffer *frame);
+struct pool_frame *frame_pool_acquire(struct frame_pool *pool);
+int frame_pool_owns(struct frame_pool *pool, struct pool_frame *frame);
+int frame_pool_release(struct frame_pool *pool, struct pool_frame *frame);
+
+#endif // FRAME_POOL_H
@@ -0,0 +1,1387 @@
+#include "host.h"
+#include "enzo_codec.h"
+#include "enzo_mem.h"
+#include "copy_engine.h"
+#include "cam_session.h"
+#include "display_sink.h"
+#include "frame_pool.h"
+#include "stage_stats.h"
+#include "host_codec.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Runs the codec, display, frame pool and copy paths of the pipeline on
+ * the host stand-ins, so they can be timed and checked under perf,
+ * valgrind and the sanitizers. The decoder is fed one JPEG frame over and
+ * over or a camera recording, the other paths get synthetic pictures.
+ * The pipeline benchmark runs a whole camera session on a recording.
+ */
+
+struct bench_opts {
+	int frames;
+	int width;
+	int height;
+	int win_width;
+	int win_height;
+	int rot;
+	int verbose;
+	const char *jpeg;	/* Frame for the decoder */
+	const char *output;	/* Last decoded frame, the encoded stream or
+				   the MP4 recording */
+	const char *capture;	/* Camera recording to replay */
+	int paced;		/* Replay at the recorded pace */
+};
+
+/* NAL units of one access unit without their start codes, as sent or
+   as reassembled from RTP packets */
+struct bench_au {
+	u8 *data;
+	int size;
+	int alloc;
+	int num;
+	int nal_size[MAX_NAL_PER_PICTURE];
+};
+
+/* Receiving end of one RTP session of the rtp benchmark */
+struct rtp_sink {
+	unsigned int ssrc;
+	int started;
+	u16 next_seq;
+	int in_fu;
+	int broken;		/* Packets of the access unit went missing */
+	struct bench_au au;
+	const struct bench_au *expect;
+	unsigned long done;	/* Access units ended by a marker bit */
+};
+
+struct rtp_bench {
+	int fd;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int stop;
+	struct rtp_sink sinks[2];
+	unsigned long single;
+	unsigned long stap_a;
+	unsigned long fu_a;
+	unsigned long lost;	/* Packets */
+	unsigned long bad;	/* Malformed packets */
+	unsigned long matched;	/* Access units */
+	unsigned long mismatched;
+	unsigned long incomplete;
+};
+
+/* Startup of the session of the pipeline benchmark */
+struct session_ready {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int done;
+	int ok;
+};
+
+/* Function prototypes */
+static long long now_us(void);
+static int frame_alloc(struct mediaBuffer *frame, int color_space,
+		       int width, int height);
+static void frame_fill(struct mediaBuffer *frame);
+static void frame_next(struct mediaBuffer *frame);
+static void report(const char *name, int frames, long long us);
+static void report_stage(const char *name, int stage);
+static int write_file(const char *path, const void *buf, int size, int append);
+static int load_file(const char *path, struct mediaBuffer *buf);
+static int record_jpeg(struct bench_opts *o, const char *path);
+static int replay_prepare(struct bench_opts *o, char *tmp, int tmp_size,
+			  char *dev_name, int dev_size,
+			  struct replay_header *hdr);
+static int bench_decode(struct bench_opts *o);
+static int bench_replay(struct bench_opts *o);
+static int encoder_open(struct bench_opts *o, struct encoderInstance *enc,
+			struct mediaBuffer *hdr);
+static int bench_encode(struct bench_opts *o);
+static int bench_record(struct bench_opts *o);
+static int au_add(struct bench_au *au, const u8 *data, int size,
+		  int new_nal);
+static int au_split(struct bench_au *au, const u8 *buf, int size);
+static int au_equal(const struct bench_au *a, const struct bench_au *b);
+static void rtp_receive(struct rtp_bench *rb, const u8 *p, int len);
+static void *rtp_receiver(void *arg);
+static int rtp_send_checked(struct rtp_bench *rb, struct rtpInstance *rtp,
+			    struct rtp_sink *sink, const struct bench_au *au,
+			    struct mediaBuffer *frame, unsigned int ts);
+static int bench_rtp(struct bench_opts *o);
+static int bench_display(struct bench_opts *o, int color_space);
+static int bench_frame_pool(struct bench_opts *o);
+static int bench_copy(struct bench_opts *o);
+static void on_session_ready(struct cam_session *session, int ok, void *arg);
+static int session_show(struct cam_session *session, ANativeWindow *window,
+			struct bench_opts *o, int frames);
+static int bench_pipeline(struct bench_opts *o);
+static void usage(const char *prog);
+/* End function prototypes */
+
+static long long now_us(void)
+{
+	return stage_now_us();
+}
+
+static int frame_alloc(struct mediaBuffer *frame, int color_space,
+		       int width, int height)
+{
+	memset(frame, 0, sizeof(*frame));
+	if (mediaBufferInit(frame, width * height * 2) < 0)
+		return -1;
+
+	frame->dataType = RAW_VIDEO;
+	frame->dataSource = BUFFER;
+	frame->colorSpace = color_space;
+	frame->width = width;
+	frame->height = height;
+	frame->imageWidth = width;
+	frame->imageHeight = height;
+	frame->bufOutSize = width * height * 2;
+
+	return 0;
+}
+
+/*
+ * A diagonal luma ramp over flat chroma. Both 4:2:2 layouts have the
+ * chroma right after the luma, so this fits NV16 and YUV422P.
+ */
+static void frame_fill(struct mediaBuffer *frame)
+{
+	int luma = frame->width * frame->height;
+	u8 *p = frame->vBufOut;
+	int x, y;
+
+	for (y = 0; y < frame->height; y++)
+		for (x = 0; x < frame->width; x++)
+			*p++ = 16 + ((x + y) & 0xff) * 219 / 255;
+	memset(frame->vBufOut + luma, 128, luma);
+}
+
+/*
+ * The picture stays the same, only the frame is made to look new
+ */
+static void frame_next(struct mediaBuffer *frame)
+{
+	frame->timestamp = now_us();
+	frame->frameId++;
+}
+
+static void report(const char *name, int frames, long long us)
+{
+	printf("%-12s %6d frames %10.3f ms %9.1f us/frame %8.1f fps\n",
+	       name, frames, us / 1000.0, frames ? (double)us / frames : 0,
+	       us ? frames * 1000000.0 / us : 0);
+}
+
+static void report_stage(const char *name, int stage)
+{
+	long long s[STAGE_NUM_STATS];
+
+	if (stage_get_stats(stage, s, STAGE_NUM_STATS) < 0 ||
+	    s[STAGE_STAT_COUNT] == 0)
+		return;
+
+	printf("  %-18s n=%lld mean=%lld p50=%lld p95=%lld p99=%lld "
+	       "max=%lld us\n", name, s[STAGE_STAT_COUNT],
+	       s[STAGE_STAT_MEAN_US], s[STAGE_STAT_P50_US],
+	       s[STAGE_STAT_P95_US], s[STAGE_STAT_P99_US],
+	       s[STAGE_STAT_MAX_US]);
+}
+
+/*
+ * Return: 0 = success, -1 = failure
+ */
+static int write_file(const char *path, const void *buf, int size, int append)
+{
+	int fd, ret;
+
+	fd = open(path, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC),
+		  0644);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	ret = write(fd, buf, size) == size ? 0 : -1;
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Read a whole file into a malloc'd buffer
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int load_file(const char *path, struct mediaBuffer *buf)
+{
+	struct stat st;
+	int fd, ret = -1;
+
+	memset(buf, 0, sizeof(*buf));
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0) {
+		perror(path);
+		goto out;
+	}
+	buf->vBufOut = malloc(st.st_size);
+	if (buf->vBufOut == NULL ||
+	    read(fd, buf->vBufOut, st.st_size) != st.st_size) {
+		free(buf->vBufOut);
+		buf->vBufOut = NULL;
+		goto out;
+	}
+	buf->dataType = MJPEG;
+	buf->dataSource = BUFFER;
+	buf->bufOutSize = st.st_size;
+	ret = 0;
+
+out:
+	if (fd >= 0)
+		close(fd);
+	return ret;
+}
+
+/*
+ * Record the -j frame as a 30 fps MJPEG camera of its size would
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int record_jpeg(struct bench_opts *o, const char *path)
+{
+	static struct jpeg_info jpeg;
+	struct replay_recorder rec;
+	struct mediaBuffer frame;
+	int i, ret = -1;
+
+	if (load_file(o->jpeg, &frame) < 0)
+		return -1;
+	if (jpeg_parse(&jpeg, frame.vBufOut, frame.bufOutSize) <= 0) {
+		fprintf(stderr, "%s: not a baseline JPEG\n", o->jpeg);
+		goto out;
+	}
+
+	if (replay_recordOpen(&rec, path, MJPEG, jpeg.width, jpeg.height) < 0)
+		goto out;
+	for (i = 0; i < o->frames; i++) {
+		frame.timestamp = i * 1000000LL / 30;
+		if (replay_recordFrame(&rec, &frame) < 0)
+			break;
+	}
+	if (replay_recordClose(&rec) == 0 && i == o->frames)
+		ret = 0;
+
+out:
+	free(frame.vBufOut);
+	return ret;
+}
+
+/*
+ * Decode the JPEG given with -j like camera frames, one frame per call
+ * as the pipeline does. Without -j there is nothing to decode.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int bench_decode(struct bench_opts *o)
+{
+	struct decoderInstance dec;
+	struct mediaBuffer src, dst;
+	long long start;
+	int i, ret = -1;
+
+	if (o->jpeg == NULL) {
+		printf("%-12s skipped, no frame given with -j\n", "decode");
+		return 0;
+	}
+	if (load_file(o->jpeg, &src) < 0)
+		return -1;
+
+	memset(&dec, 0, sizeof(dec));
+	memset(&dst, 0, sizeof(dst));
+	dec.type = MJPEG;
+	dec.chromaInterleave = 1;
+	if (decoderInit(&dec, &src) < 0)
+		goto out_src;
+
+	stage_reset();
+	start = now_us();
+	for (i = 0; i < o->frames; i++) {
+		frame_next(&src);
+		if (decoderDecodeFrame(&dec, &src, &dst) < 0)
+			goto out_dec;
+	}
+	report("decode", o->frames, now_us() - start);
+	report_stage("bitstream fill", STAGE_BITSTREAM_FILL);
+	report_stage("vpu decode", STAGE_VPU_DECODE);
+	if (o->verbose)
+		printf("  %dx%d in %dx%d buffers, %d bytes per frame\n",
+		       dst.imageWidth, dst.imageHeight, dst.width, dst.height,
+		       src.bufOutSize);
+	ret = 0;
+	if (o->output)
+		ret = write_file(o->output, dst.vBufOut, dst.bufOutSize, 0);
+
+out_dec:
+	decoderDeinit(&dec);
+out_src:
+	free(src.vBufOut);
+	return ret;
+}
+
+/*
+ * Find the MJPEG recording to replay and name the camera replaying it.
+ * Without -c the -j frame is recorded to tmp first, one frame per
+ * benchmark frame. The caller removes tmp when it is set.
+ *
+ * Return: 0 = success, 1 = nothing to replay, -1 = failure
+ */
+static int replay_prepare(struct bench_opts *o, char *tmp, int tmp_size,
+			  char *dev_name, int dev_size,
+			  struct replay_header *hdr)
+{
+	const char *path = o->capture;
+	int fd, len;
+
+	if (path == NULL) {
+		if (o->jpeg == NULL)
+			return 1;
+		snprintf(tmp, tmp_size, "/tmp/enzo_bench-%d.rec",
+			 (int)getpid());
+		if (record_jpeg(o, tmp) < 0)
+			return -1;
+		path = tmp;
+	}
+
+	/* The camera must be opened at the recorded size */
+	fd = open(path, O_RDONLY);
+	len = fd < 0 ? -1 : freadn(fd, hdr, sizeof(*hdr));
+	if (fd >= 0)
+		close(fd);
+	if (len != sizeof(*hdr) || hdr->type != MJPEG) {
+		fprintf(stderr, "%s: not an MJPEG recording\n", path);
+		return -1;
+	}
+
+	len = snprintf(dev_name, dev_size, "%s%s",
+		       o->paced ? REPLAY_PREFIX : REPLAY_FAST_PREFIX, path);
+	if (len >= dev_size) {
+		fprintf(stderr, "%s: path too long\n", path);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Replay an MJPEG camera recording into the decoder, like the capture
+ * thread of the pipeline does with a camera
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int bench_replay(struct bench_opts *o)
+{
+	static struct cameraInstance cam;
+	struct decoderInstance dec;
+	struct mediaBuffer frame, dst;
+	struct replay_header hdr;
+	char tmp[64] = "";
+	long long start;
+	int i, ret;
+
+	memset(&cam, 0, sizeof(cam));
+	ret = replay_prepare(o, tmp, sizeof(tmp), cam.deviceName,
+			     sizeof(cam.deviceName), &hdr);
+	if (ret > 0) {
+		printf("%-12s skipped, no recording given with -c or "
+		       "frame with -j\n", "replay");
+		return 0;
+	}
+	if (ret < 0)
+		goto out;
+	ret = -1;
+
+	cam.type = MJPEG;
+	cam.width = hdr.width;
+	cam.height = hdr.height;
+	cam.fps = 30;
+	if (cameraInit(&cam) < 0)
+		goto out;
+
+	memset(&frame, 0, sizeof(frame));
+	memset(&dst, 0, sizeof(dst));
+	memset(&dec, 0, sizeof(dec));
+	dec.type = MJPEG;
+	dec.chromaInterleave = 1;
+	if (cameraGetCurrentFrame(&cam, &frame) < 0 ||
+	    decoderInit(&dec, &frame) < 0)
+		goto out_cam;
+
+	stage_reset();
+	start = now_us();
+	for (i = 0; i < o->frames; i++) {
+		if (cameraGetFrame(&cam, &frame) < 0 ||
+		    decoderDecodeFrame(&dec, &frame, &dst) < 0)
+			goto out_dec;
+	}
+	report("replay", o->frames, now_us() - start);
+	report_stage("capture wait", STAGE_CAPTURE_WAIT);
+	report_stage("bitstream fill", STAGE_BITSTREAM_FILL);
+	report_stage("vpu decode", STAGE_VPU_DECODE);
+	if (o->verbose)
+		printf("  %d recorded frames, %lu dropped\n",
+		       cam.replay.num_frames, cam.replay.dropped);
+	ret = 0;
+	if (o->output)
+		ret = write_file(o->output, dst.vBufOut, dst.bufOutSize, 0);
+
+out_dec:
+	decoderDeinit(&dec);
+out_cam:
+	cameraDeinit(&cam);
+out:
+	if (tmp[0])
+		unlink(tmp);
+	return ret;
+}
+
+/*
+ * Open a 30 fps H.264 encoder for 4:2:0 frames of the -s size. The
+ * SPS/PPS come back in hdr.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int encoder_open(struct bench_opts *o, struct encoderInstance *enc,
+			struct mediaBuffer *hdr)
+{
+	memset(enc, 0, sizeof(*enc));
+	memset(hdr, 0, sizeof(*hdr));
+	enc->type = H264AVC;
+	enc->width = o->width;
+	enc->height = o->height;
+	enc->fps = 30;
+	enc->gopSize = 30;
+	enc->colorSpace = YUV420P;
+
+	return encoderInit(enc, hdr);
+}
+
+/*
+ * Encode synthetic 4:2:0 frames to H.264
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int bench_encode(struct bench_opts *o)
+{
+	struct encoderInstance enc;
+	struct mediaBuffer src, hdr, out;
+	long long start, bytes = 0;
+	int i, ret = -1;
+
+	if (frame_alloc(&src, YUV420P, o->width, o->height) < 0)
+		return -1;
+
+	memset(&out, 0, sizeof(out));
+	if (encoder_open(o, &enc, &hdr) < 0)
+		goto out_frame;
+	if (o->output &&
+	    write_file(o->output, hdr.vBufOut, hdr.bufOutSize, 0) < 0)
+		goto out_enc;
+
+	frame_fill(&src);
+	stage_reset();
+	start = now_us();
+	for (i = 0; i < o->frames; i++) {
+		frame_next(&src);
+		if (encoderEncodeFrame(&enc, &src, &out) < 0)
+			goto out_enc;
+		bytes += out.bufOutSize;
+		if (o->output &&
+		    write_file(o->output, out.vBufOut, out.bufOutSize, 1) < 0)
+			goto out_enc;
+	}
+	report("encode", o->frames, now_us() - start);
+	report_stage("encode source", STAGE_ENCODE_SOURCE);
+	report_stage("vpu encode", STAGE_VPU_ENCODE);
+	if (o->verbose)
+		printf("  %lld bytes per frame in %d NAL units\n",
+		       bytes / o->frames, out.nalInfo.nalNumber);
+	ret = 0;
+
+out_enc:
+	encoderDeinit(&enc);
+out_frame:
+	mediaBufferDeinit(&src);
+	return ret;
+}
+
+/*
+ * Encode synthetic frames and mux them into a fragmented MP4 file, the
+ * -o file or a temporary one. The recorder asks the encoder for the
+ * IDRs it needs, as an application recording intra refresh would.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int bench_record(struct bench_opts *o)
+{
+	static struct recorderInstance rec;
+	struct encoderInstance enc;
+	struct mediaBuffer src, hdr, out;
+	char tmp[64] = "";
+	const char *path = o->output;
+	struct stat st;
+	long long start;
+	int i, ret = -1;
+
+	if (path == NULL) {
+		snprintf(tmp, sizeof(tmp), "/tmp/enzo_bench-%d.mp4",
+			 (int)getpid());
+		path = tmp;
+	}
+
+	if (frame_alloc(&src, YUV420P, o->width, o->height) < 0)
+		return -1;
+
+	memset(&out, 0, sizeof(out));
+	if (encoder_open(o, &enc, &hdr) < 0)
+		goto out_frame;
+
+	memset(&rec, 0, sizeof(rec));
+	if (strlen(path) >= sizeof(rec.fileName)) {
+		fprintf(stderr, "%s: path too long\n", path);
+		goto out_enc;
+	}
+	strcpy(rec.fileName, path);
+	rec.fps = enc.fps;
+	rec.encoder = &enc;
+	if (recorderInit(&rec, &hdr) < 0)
+		goto out_enc;
+
+	frame_fill(&src);
+	stage_reset();
+	start = now_us();
+	for (i = 0; i < o->frames; i++) {
+		frame_next(&src);
+		if (encoderEncodeFrame(&enc, &src, &out) < 0 ||
+		    recorderWriteFrame(&rec, &out) < 0)
+			break;
+	}
+	/* Closing waits for the writer, so it is part of the time */
+	ret = recorderDeinit(&rec);
+	report("record", i, now_us() - start);
+	report_stage("vpu encode", STAGE_VPU_ENCODE);
+	if (o->verbose && stat(path, &st) == 0)
+		printf("  %lu frames written, %lu fragments dropped, "
+		       "%lld bytes\n", rec.framesWritten,
+		       rec.fragmentsDropped, (long long)st.st_size);
+	if (i < o->frames || rec.framesWritten == 0) {
+		fprintf(stderr, "%s: recording failed after %d frames\n",
+			path, i);
+		ret = -1;
+	}
+
+out_enc:
+	encoderDeinit(&enc);
+out_frame:
+	mediaBufferDeinit(&src);
+	if (tmp[0])
+		unlink(tmp);
+	return ret;
+}
+
+/*
+ * Append data to the last NAL unit of the access unit, or start a new
+ * one with it
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int au_add(struct bench_au *au, const u8 *data, int size,
+		  int new_nal)
+{
+	u8 *p;
+	int alloc;
+
+	if (new_nal) {
+		if (au->num == MAX_NAL_PER_PICTURE)
+			return -1;
+		au->nal_size[au->num++] = 0;
+	} else if (au->num == 0) {
+		return -1;
+	}
+
+	if (au->size + size > au->alloc) {
+		alloc = au->alloc ? au->alloc : 64 * 1024;
+		while (alloc < au->size + size)
+			alloc *= 2;
+		p = realloc(au->data, alloc);
+		if (p == NULL)
+			return -1;
+		au->data = p;
+		au->alloc = alloc;
+	}
+	memcpy(au->data + au->size, data, size);
+	au->size += size;
+	au->nal_size[au->num - 1] += size;
+
+	return 0;
+}
+
+/*
+ * Append the NAL units of an Annex B buffer
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int au_split(struct bench_au *au, const u8 *buf, int size)
+{
+	int i, start = -1, end;
+
+	for (i = 0; i + 2 < size; i++) {
+		if (buf[i] || buf[i + 1] || buf[i + 2] != 1)
+			continue;
+		if (start >= 0) {
+			/* The zero of a four byte start code is not part of
+			   the NAL before it, NALs never end in a zero */
+			end = i > start && buf[i - 1] == 0 ? i - 1 : i;
+			if (au_add(au, buf + start, end - start, 1) < 0)
+				return -1;
+		}
+		start = i + 3;
+		i += 2;
+	}
+	if (start < 0)
+		return -1;
+
+	return au_add(au, buf + start, size - start, 1);
+}
+
+static int au_equal(const struct bench_au *a, const struct bench_au *b)
+{
+	return a->num == b->num && a->size == b->size &&
+	       !memcmp(a->nal_size, b->nal_size, a->num * sizeof(int)) &&
+	       !memcmp(a->data, b->data, a->size);
+}
+
+/*
+ * Depacketize one RTP packet as in RFC 6184. The marker bit ends an
+ * access unit, which is then compared with the one that was sent.
+ */
+static void rtp_receive(struct rtp_bench *rb, const u8 *p, int len)
+{
+	struct rtp_sink *sink = NULL;
+	unsigned int ssrc;
+	const u8 *q, *end = p + len;
+	int i, n, seq, type, err = 0;
+
+	if (len < RTP_HEADER_SIZE + 1 || p[0] != 0x80) {
+		rb->bad++;
+		return;
+	}
+	seq = p[2] << 8 | p[3];
+	ssrc = (unsigned int)p[8] << 24 | p[9] << 16 | p[10] << 8 | p[11];
+
+	pthread_mutex_lock(&rb->lock);
+	for (i = 0; i < 2; i++)
+		if (rb->sinks[i].ssrc == ssrc && rb->sinks[i].expect)
+			sink = &rb->sinks[i];
+	if (sink == NULL) {
+		rb->bad++;
+		pthread_mutex_unlock(&rb->lock);
+		return;
+	}
+
+	if (sink->started && seq != sink->next_seq) {
+		rb->lost += (seq - sink->next_seq) & 0xFFFF;
+		sink->broken = 1;
+		sink->in_fu = 0;
+	}
+	sink->started = 1;
+	sink->next_seq = seq + 1;
+
+	q = p + RTP_HEADER_SIZE;
+	type = q[0] & 0x1f;
+	if (type >= 1 && type <= 23) {
+		rb->single++;
+		err = au_add(&sink->au, q, end - q, 1);
+	} else if (type == RTP_NAL_STAP_A) {
+		rb->stap_a++;
+		for (q++; q + 2 <= end && !err; q += n) {
+			n = q[0] << 8 | q[1];
+			q += 2;
+			err = q + n > end || au_add(&sink->au, q, n, 1);
+		}
+	} else if (type == RTP_NAL_FU_A && end - q > 2) {
+		u8 hdr = (q[0] & 0xe0) | (q[1] & 0x1f);
+
+		rb->fu_a++;
+		if (q[1] & 0x80) {
+			err = au_add(&sink->au, &hdr, 1, 1);
+			sink->in_fu = 1;
+		} else if (!sink->in_fu) {
+			sink->broken = 1;
+		}
+		if (sink->in_fu && !err)
+			err = au_add(&sink->au, q + 2, end - q - 2, 0);
+		if (q[1] & 0x40)
+			sink->in_fu = 0;
+	} else {
+		err = 1;
+	}
+	if (err) {
+		rb->bad++;
+		sink->broken = 1;
+	}
+
+	if (p[1] & 0x80) {
+		if (sink->broken)
+			rb->incomplete++;
+		else if (au_equal(&sink->au, sink->expect))
+			rb->matched++;
+		else
+			rb->mismatched++;
+		sink->au.num = 0;
+		sink->au.size = 0;
+		sink->broken = 0;
+		sink->in_fu = 0;
+		sink->done++;
+		pthread_cond_broadcast(&rb->cond);
+	}
+	pthread_mutex_unlock(&rb->lock);
+}
+
+static void *rtp_receiver(void *arg)
+{
+	struct rtp_bench *rb = arg;
+	static u8 pkt[65536];
+	int len;
+
+	while (!__atomic_load_n(&rb->stop, __ATOMIC_RELAXED)) {
+		len = recv(rb->fd, pkt, sizeof(pkt), 0);
+		if (len > 0)
+			rtp_receive(rb, pkt, len);
+	}
+
+	return NULL;
+}
+
+/*
+ * Send one access unit and wait until the receiver has it, or gave it
+ * up as incomplete
+ *
+ * Return: packets sent, -1 = failure
+ */
+static int rtp_send_checked(struct rtp_bench *rb, struct rtpInstance *rtp,
+			    struct rtp_sink *sink, const struct bench_au *au,
+			    struct mediaBuffer *frame, unsigned int ts)
+{
+	unsigned long before = rtp->packetsSent, target;
+	struct timespec deadline;
+	int ret = 0;
+
+	pthread_mutex_lock(&rb->lock);
+	sink->expect = au;
+	target = sink->done + 1;
+	pthread_mutex_unlock(&rb->lock);
+
+	if (rtpSendFrame(rtp, frame, ts) < 0)
+		return -1;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 1;
+	pthread_mutex_lock(&rb->lock);
+	while (sink->done < target && ret == 0)
+		ret = pthread_cond_timedwait(&rb->cond, &rb->lock, &deadline);
+	if (sink->done < target)
+		rb->incomplete++;
+	pthread_mutex_unlock(&rb->lock);
+
+	return rtp->packetsSent - before;
+}
+
+/*
+ * Send encoder output to a receiver on 127.0.0.1 and check that every
+ * NAL unit arrives as it was sent. One session uses the default MTU, so
+ * the slices go as FU-A and the SPS/PPS in front of them as STAP-A. The
+ * other one has an MTU of one slice and no SPS/PPS, so every slice goes
+ * as a single NAL unit packet.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int bench_rtp(struct bench_opts *o)
+{
+	static struct rtpInstance rtp[2];
+	static struct rtp_bench rb;
+	struct encoderInstance enc;
+	struct mediaBuffer src, hdr, out;
+	struct bench_au au[2];
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	struct timeval tv = { 0, 100000 };
+	pthread_t thread;
+	long long start, us;
+	unsigned long packets = 0;
+	int i, j, n, max_nal = 0, sessions = 1, opened = 0;
+	int rcvbuf = 8 * 1024 * 1024, ret = -1;
+
+	memset(&rb, 0, sizeof(rb));
+	memset(rtp, 0, sizeof(rtp));
+	memset(au, 0, sizeof(au));
+	memset(&out, 0, sizeof(out));
+	pthread_mutex_init(&rb.lock, NULL);
+	pthread_cond_init(&rb.cond, NULL);
+
+	/* All frames are alike, so one encoded frame is sent over and over
+	   and the encoder does not count into the packet rate */
+	if (frame_alloc(&src, YUV420P, o->width, o->height) < 0)
+		return -1;
+	if (encoder_open(o, &enc, &hdr) < 0)
+		goto out_frame;
+	frame_fill(&src);
+	frame_next(&src);
+	if (encoderEncodeFrame(&enc, &src, &out) < 0 ||
+	    au_split(&au[0], hdr.vBufOut, hdr.bufOutSize) < 0 ||
+	    au_split(&au[0], out.vBufOut, out.bufOutSize) < 0 ||
+	    au_split(&au[1], out.vBufOut, out.bufOutSize) < 0)
+		goto out_enc;
+	for (i = 0; i < au[1].num; i++)
+		if (au[1].nal_size[i] > max_nal)
+			max_nal = au[1].nal_size[i];
+
+	rb.fd = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (rb.fd < 0 || bind(rb.fd, (struct sockaddr *)&addr,
+			      sizeof(addr)) < 0 ||
+	    getsockname(rb.fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+		perror("rtp receiver");
+		goto out_sock;
+	}
+	setsockopt(rb.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	setsockopt(rb.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	/* A UDP datagram holds at most 65507 bytes */
+	if (max_nal + RTP_HEADER_SIZE + 16 <= 65507)
+		sessions = 2;
+	for (i = 0; i < sessions; i++) {
+		strcpy(rtp[i].destAddress, "127.0.0.1");
+		rtp[i].destPort = ntohs(addr.sin_port);
+		rtp[i].mtu = i ? max_nal + RTP_HEADER_SIZE + 16 : 0;
+		if (rtpInit(&rtp[i], i ? NULL : &hdr) < 0)
+			goto out_rtp;
+		opened++;
+		rb.sinks[i].ssrc = rtp[i].rtp.ssrc;
+	}
+
+	if (pthread_create(&thread, NULL, rtp_receiver, &rb) != 0)
+		goto out_rtp;
+
+	start = now_us();
+	for (i = 0; i < o->frames; i++) {
+		for (j = 0; j < sessions; j++) {
+			n = rtp_send_checked(&rb, &rtp[j], &rb.sinks[j],
+					     &au[j], &out, i * 3000);
+			if (n < 0)
+				break;
+			packets += n;
+		}
+		if (j < sessions)
+			break;
+	}
+	us = now_us() - start;
+
+	__atomic_store_n(&rb.stop, 1, __ATOMIC_RELAXED);
+	pthread_join(thread, NULL);
+
+	report("rtp", i, us);
+	printf("  %lu packets %10.0f packets/s, %lu single, %lu STAP-A, "
+	       "%lu FU-A\n", packets, us ? packets * 1000000.0 / us : 0,
+	       rb.single, rb.stap_a, rb.fu_a);
+	if (o->verbose || rb.lost || rb.bad || rb.incomplete || rb.mismatched)
+		printf("  %lu access units intact, %lu different, %lu "
+		       "incomplete, %lu packets lost, %lu malformed\n",
+		       rb.matched, rb.mismatched, rb.incomplete, rb.lost,
+		       rb.bad);
+	if (sessions == 1)
+		printf("  single NAL unit packets skipped, slices of %d bytes "
+		       "do not fit a datagram\n", max_nal);
+
+	/* Loss is possible on a busy host, changed data never is */
+	if (i == o->frames && rb.matched > 0 && rb.mismatched == 0 &&
+	    rb.bad == 0)
+		ret = 0;
+
+out_rtp:
+	for (i = 0; i < opened; i++)
+		rtpDeinit(&rtp[i]);
+out_sock:
+	if (rb.fd >= 0)
+		close(rb.fd);
+out_enc:
+	encoderDeinit(&enc);
+out_frame:
+	mediaBufferDeinit(&src);
+	free(au[0].data);
+	free(au[1].data);
+	pthread_mutex_destroy(&rb.lock);
+	pthread_cond_destroy(&rb.cond);
+	return ret;
+}
+
+/*
+ * Compose into a window like the preview does. NV16 frames go through
+ * g2d, YUV422P frames through the CPU scaler.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int bench_display(struct bench_opts *o, int color_space)
+{
+	struct display_sink sink;
+	struct mediaBuffer frame, *frames[1];
+	ANativeWindow *window;
+	long long start;
+	int i, ret = -1;
+
+	if (frame_alloc(&frame, color_space, o->width, o->height) < 0)
+		return -1;
+	window = host_window_create(o->win_width, o->win_height);
+	if (window == NULL)
+		goto out_frame;
+
+	display_sink_init(&sink);
+	if (display_sink_set_window(&sink, window) < 0 ||
+	    display_sink_set_view(&sink, 0, 0, 0, o->win_width,
+				  o->win_height, o->rot) < 0)
+		goto out_sink;
+
+	frame_fill(&frame);
+	stage_reset();
+	frames[0] = &frame;
+	start = now_us();
+	for (i = 0; i < o->frames; i++) {
+		frame_next(&frame);
+		if (display_sink_render(&sink, frames, 1) < 0)
+			goto out_sink;
+	}
+	report(color_space == NV16 ? "display-g2d" : "display-sw",
+	       o->frames, now_us() - start);
+	report_stage("g2d wait", STAGE_G2D);
+	report_stage("window copy", STAGE_DISPLAY_COPY);
+	if (o->verbose)
+		printf("  shown %lu dropped %lu blits %lu sw %lu posted %lu\n",
+		       sink.frames_shown, sink.frames_dropped, sink.blits,
+		       sink.sw_draws, host_window_posted(window));
+	ret = 0;
+
+out_sink:
+	display_sink_deinit(&sink);
+	ANativeWindow_release(window);
+out_frame:
+	mediaBufferDeinit(&frame);
+	return ret;
+}
+
+/*
+ * Publish every frame to a consumer that holds on to one frame and
+ * releases the one before, like the Java analytics
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int bench_frame_pool(struct bench_opts *o)
+{
+	struct frame_pool pool;
+	struct pool_frame *held = NULL, *f;
+	struct mediaBuffer frame;
+	long long start;
+	int i;
+
+	if (frame_alloc(&frame, NV16, o->width, o->height) < 0)
+		return -1;
+	if (frame_pool_init(&pool) < 0) {
+		mediaBufferDeinit(&frame);
+		return -1;
+	}
+
+	/* The first acquire only asks for frames */
+	f = frame_pool_acquire(&pool);
+	if (f)
+		frame_pool_release(&pool, f);
+
+	frame_fill(&frame);
+	start = now_us();
+	for (i = 0; i < o->frames; i++) {
+		frame_next(&frame);
+		frame_pool_publish(&pool, &frame);
+		f = frame_pool_acquire(&pool);
+		if (held)
+			frame_pool_release(&pool, held);
+		held = f;
+	}
+	report("frame-pool", o->frames, now_us() - start);
+	if (o->verbose)
+		printf("  published %lu dropped %lu\n", pool.published,
+		       pool.dropped);
+
+	if (held)
+		frame_pool_release(&pool, held);
+	frame_pool_deinit(&pool);
+	mediaBufferDeinit(&frame);
+
+	return 0;
+}
+
+/*
+ * Return: 0 = success, -1 = failure
+ */
+static int bench_copy(struct bench_opts *o)
+{
+	struct copy_buf dst, src;
+	struct g2d_buf *a, *b;
+	int size = o->width * o->height * 2;
+	long long start;
+	int i, ret = 0;
+
+	a = contig_g2d_alloc(size, 0);
+	b = contig_g2d_alloc(size, 1);
+	if (a == NULL || b == NULL) {
+		fprintf(stderr, "Could not allocate copy buffers\n");
+		ret = -1;
+		goto out;
+	}
+	memset(a->buf_vaddr, 0x5a, size);
+
+	memset(&src, 0, sizeof(src));
+	src.vaddr = a->buf_vaddr;
+	src.paddr = a->buf_paddr;
+	src.buf = a;
+	memset(&dst, 0, sizeof(dst));
+	dst.vaddr = b->buf_vaddr;
+	dst.paddr = b->buf_paddr;
+	dst.cacheable = 1;
+	dst.buf = b;
+
+	start = now_us();
+	for (i = 0; i < o->frames; i++) {
+		if (copy_sync(copy_engine_default(), &dst, &src, size) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	report("copy", i, now_us() - start);
+
+out:
+	if (a)
+		contig_g2d_free(a);
+	if (b)
+		contig_g2d_free(b);
+	return ret;
+}
+
+static void on_session_ready(struct cam_session *session, int ok, void *arg)
+{
+	struct session_ready *ready = arg;
+
+	pthread_mutex_lock(&ready->lock);
+	ready->done = 1;
+	ready->ok = ok;
+	pthread_cond_broadcast(&ready->cond);
+	pthread_mutex_unlock(&ready->lock);
+}
+
+/*
+ * Give the session the window, as CamView does when its Surface is
+ * created, and let the pipeline run until it has shown frames frames.
+ * Meanwhile decoded frames are taken from the pool like the Java
+ * analytics does.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int session_show(struct cam_session *session, ANativeWindow *window,
+			struct bench_opts *o, int frames)
+{
+	long long stats[PIPELINE_NUM_STATS], last_shown = -1, idle_since = 0;
+	struct pool_frame *f;
+
+	if (display_sink_set_window(&session->display, window) < 0 ||
+	    display_sink_set_view(&session->display, 0, 0, 0, o->win_width,
+				  o->win_height, o->rot) < 0 ||
+	    cam_session_process(session) < 0)
+		return -1;
+
+	for (;;) {
+		pipeline_get_stats(&session->pipeline, stats,
+				   PIPELINE_NUM_STATS);
+		if (stats[PIPELINE_STAT_SHOWN] >= frames)
+			return 0;
+		if (stats[PIPELINE_STAT_FAILED])
+			break;
+
+		/* A stuck pipeline ends the benchmark instead of hanging */
+		if (stats[PIPELINE_STAT_SHOWN] != last_shown) {
+			last_shown = stats[PIPELINE_STAT_SHOWN];
+			idle_since = now_us();
+		} else if (now_us() - idle_since > 2000000) {
+			break;
+		}
+
+		f = frame_pool_acquire(&session->frames);
+		if (f)
+			frame_pool_release(&session->frames, f);
+		usleep(1000);
+	}
+
+	fprintf(stderr, "pipeline: stopped after %lld of %d frames\n",
+		stats[PIPELINE_STAT_SHOWN], frames);
+	return -1;
+}
+
+/*
+ * Run a camera session like CamView does, on a replayed recording: start
+ * it, stream half of the frames into a window, pause and resume it, and
+ * stream the other half. The session brings the VPU up and down itself,
+ * as the only user of it in the app, so its startup timeline is that of
+ * a cold start.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int bench_pipeline(struct bench_opts *o)
+{
+	struct session_ready ready;
+	struct cam_session *session;
+	struct replay_header hdr;
+	long long times[CAM_NUM_TIMES], stats[PIPELINE_NUM_STATS];
+	long long start, pause_us, resume_us, us;
+	char tmp[64] = "", dev_name[64];
+	ANativeWindow *window;
+	int first = o->frames / 2, shown = 0, ret;
+
+	ret = replay_prepare(o, tmp, sizeof(tmp), dev_name, sizeof(dev_name),
+			     &hdr);
+	if (ret > 0) {
+		printf("%-12s skipped, no recording given with -c or "
+		       "frame with -j\n", "pipeline");
+		return 0;
+	}
+	if (ret < 0)
+		goto out;
+	ret = -1;
+
+	window = host_window_create(o->win_width, o->win_height);
+	if (window == NULL)
+		goto out;
+	session = cam_session_create(dev_name, hdr.width, hdr.height, 30,
+				     NULL);
+	if (session == NULL)
+		goto out_window;
+
+	memset(&ready, 0, sizeof(ready));
+	pthread_mutex_init(&ready.lock, NULL);
+	pthread_cond_init(&ready.cond, NULL);
+	vpuDeinit();
+	if (cam_session_start(session, on_session_ready, &ready) < 0)
+		goto out_session;
+	pthread_mutex_lock(&ready.lock);
+	while (!ready.done)
+		pthread_cond_wait(&ready.cond, &ready.lock);
+	pthread_mutex_unlock(&ready.lock);
+	if (!ready.ok)
+		goto out_session;
+	stage_reset();
+
+	start = now_us();
+	if (first > 0 &&
+	    session_show(session, window, o, first) < 0)
+		goto out_session;
+	us = now_us() - start;
+	pipeline_get_stats(&session->pipeline, stats, PIPELINE_NUM_STATS);
+	shown = stats[PIPELINE_STAT_SHOWN];
+
+	/* Like the app going to the background and back */
+	start = now_us();
+	if (cam_session_pause(session) < 0)
+		goto out_session;
+	pause_us = now_us() - start;
+	start = now_us();
+	if (cam_session_resume(session) < 0)
+		goto out_session;
+	resume_us = now_us() - start;
+
+	start = now_us();
+	if (session_show(session, window, o, o->frames - first) < 0)
+		goto out_session;
+	cam_session_stop_processing(session);
+	us += now_us() - start;
+	pipeline_get_stats(&session->pipeline, stats, PIPELINE_NUM_STATS);
+	shown += stats[PIPELINE_STAT_SHOWN];
+
+	report("pipeline", shown, us);
+	cam_session_get_timeline(session, times, CAM_NUM_TIMES);
+	printf("  startup: VPU %lld camera %lld first frame %lld decoder "
+	       "%lld ready %lld us\n", times[CAM_TIME_VPU_READY],
+	       times[CAM_TIME_CAMERA_OPEN], times[CAM_TIME_FIRST_FRAME],
+	       times[CAM_TIME_DECODER_READY], times[CAM_TIME_READY]);
+	printf("  pause %lld us, resume %lld us\n", pause_us, resume_us);
+	report_stage("capture wait", STAGE_CAPTURE_WAIT);
+	report_stage("vpu decode", STAGE_VPU_DECODE);
+	report_stage("g2d wait", STAGE_G2D);
+	if (o->verbose) {
+		printf("  after resume: captured %lld skipped %lld errors "
+		       "%lld\n", stats[PIPELINE_STAT_CAPTURED],
+		       stats[PIPELINE_STAT_SKIPPED],
+		       stats[PIPELINE_STAT_ERRORS]);
+		printf("  pool published %lu dropped %lu, window posted %lu\n",
+		       session->frames.published, session->frames.dropped,
+		       host_window_posted(window));
+	}
+	ret = 0;
+
+out_session:
+	cam_session_destroy(session);
+	vpuInit();
+	pthread_mutex_destroy(&ready.lock);
+	pthread_cond_destroy(&ready.cond);
+out_window:
+	ANativeWindow_release(window);
+out:
+	if (tmp[0])
+		unlink(tmp);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] [decode|replay|encode|record|rtp|"
+		"display|display-sw|frame-pool|copy|pipeline]...\n"
+		"  -n frames   Frames per benchmark (default 300)\n"
+		"  -s WxH      Frame size (default 1280x720)\n"
+		"  -w WxH      Window size (default 1024x600)\n"
+		"  -r degrees  Rotation of the view (default 0)\n"
+		"  -j file     JPEG frame to decode\n"
+		"  -c file     MJPEG camera recording to replay\n"
+		"  -p          Replay at the recorded pace\n"
+		"  -o file     Write the last decoded frame, the encoded "
+		"stream or the recording\n"
+		"  -v          Print counters after each benchmark\n"
+		"Without a benchmark name, all of them run.\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	static const char *all[] = { "decode", "replay", "encode", "record",
+				     "rtp", "display", "display-sw",
+				     "frame-pool", "copy", "pipeline" };
+	struct bench_opts o = {
+		.frames = 300,
+		.width = 1280,
+		.height = 720,
+		.win_width = 1024,
+		.win_height = 600,
+	};
+	const char **names = all;
+	int count = sizeof(all) / sizeof(all[0]);
+	int i, c, blocks, ret = 0;
+	long bytes;
+
+	while ((c = getopt(argc, argv, "n:s:w:r:j:c:po:vh")) != -1) {
+		switch (c) {
+		case 'n':
+			o.frames = atoi(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%dx%d", &o.width, &o.height) != 2)
+				goto bad;
+			break;
+		case 'w':
+			if (sscanf(optarg, "%dx%d", &o.win_width,
+				   &o.win_height) != 2)
+				goto bad;
+			break;
+		case 'r':
+			o.rot = atoi(optarg);
+			break;
+		case 'j':
+			o.jpeg = optarg;
+			break;
+		case 'c':
+			o.capture = optarg;
+			break;
+		case 'p':
+			o.paced = 1;
+			break;
+		case 'o':
+			o.output = optarg;
+			break;
+		case 'v':
+			o.verbose = 1;
+			break;
+		default:
+			goto bad;
+		}
+	}
+	if (o.frames < 1 || o.width < 16 || o.height < 16 ||
+	    o.win_width < 16 || o.win_height < 16 || (o.width & 15) ||
+	    (o.height & 15))
+		goto bad;
+	if (optind < argc) {
+		names = (const char **)&argv[optind];
+		count = argc - optind;
+	}
+
+	if (vpuInit() < 0)
+		return 1;
+
+	for (i = 0; i < count && ret == 0; i++) {
+		if (!strcmp(names[i], "decode"))
+			ret = bench_decode(&o);
+		else if (!strcmp(names[i], "replay"))
+			ret = bench_replay(&o);
+		else if (!strcmp(names[i], "encode"))
+			ret = bench_encode(&o);
+		else if (!strcmp(names[i], "record"))
+			ret = bench_record(&o);
+		else if (!strcmp(names[i], "rtp"))
+			ret = bench_rtp(&o);
+		else if (!strcmp(names[i], "display"))
+			ret = bench_display(&o, NV16);
+		else if (!strcmp(names[i], "display-sw"))
+			ret = bench_display(&o, YUV422P);
+		else if (!strcmp(names[i], "frame-pool"))
+			ret = bench_frame_pool(&o);
+		else if (!strcmp(names[i], "copy"))
+			ret = bench_copy(&o);
+		else if (!strcmp(names[i], "pipeline"))
+			ret = bench_pipeline(&o);
+		else
+			goto bad_deinit;
+	}
+
+	vpuDeinit();
+	enzo_log_flush();
+
+	host_phys_stats(&blocks, &bytes);
+	if (blocks) {
+		fprintf(stderr, "%d contiguous blocks (%ld bytes) leaked\n",
+			blocks, bytes);
+		ret = -1;
+	}
+
+	return ret < 0 ? 1 : 0;
+
+bad_deinit:
+	vpuDeinit();
+bad:
+	usage(argv[0]);
+	return 2;
+}
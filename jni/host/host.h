@@ -0,0 +1,22 @@
+#ifndef HOST_H
+#define HOST_H
+
+#include <android/native_window.h>
+
+/*
+ * Helpers of the host Linux stand-ins for the i.MX libraries. They are
+ * not part of the vpu, g2d or Android APIs, only the bench and the other
+ * stand-ins use them.
+ */
+
+unsigned long host_phys_alloc(int size, void **vaddr);
+void host_phys_free(unsigned long paddr);
+void *host_phys_to_virt(unsigned long paddr);
+void host_phys_stats(int *blocks, long *bytes);
+
+void host_vpu_set_latency(int dec_us, int enc_us);
+
+ANativeWindow *host_window_create(int width, int height);
+unsigned long host_window_posted(ANativeWindow *window);
+
+#endif // HOST_H
@@ -0,0 +1,80 @@
+#ifndef HOST_CODEC_H
+#define HOST_CODEC_H
+
+/*
+ * CPU codecs behind the libvpu stand-in. The JPEG decoder handles the
+ * baseline frames UVC cameras send, the H.264 writer produces intra
+ * pictures of I_PCM macroblocks. Neither knows about the vpu API.
+ */
+
+#define JPEG_MAX_COMPS		3
+#define JPEG_HUFF_LOOKUP	9
+
+struct jpeg_huff {
+	unsigned char lookup_len[1 << JPEG_HUFF_LOOKUP]; /* 0 = longer code */
+	unsigned char lookup_val[1 << JPEG_HUFF_LOOKUP];
+	int maxcode[17];	/* Largest code of each length, -1 if none */
+	int valoffset[17];	/* Code to index into vals */
+	unsigned char vals[256];
+};
+
+struct jpeg_comp {
+	int id;
+	int h;			/* Sampling factors */
+	int v;
+	int tq;			/* Quantization table */
+	int td;			/* DC and AC Huffman tables */
+	int ta;
+	int pred;		/* DC prediction */
+};
+
+struct jpeg_info {
+	int width;
+	int height;
+	int format;		/* ChromaFormat of vpu_lib.h */
+	int ncomps;
+	struct jpeg_comp comps[JPEG_MAX_COMPS];
+	int hmax;
+	int vmax;
+	int mcux;		/* MCUs per row and column */
+	int mcuy;
+	int restart;		/* MCUs per restart interval, 0 = none */
+	unsigned short qt[4][64];	/* Zigzag order */
+	int qt_defined[4];
+	struct jpeg_huff dc[2];
+	struct jpeg_huff ac[2];
+	const unsigned char *scan;	/* Entropy coded data */
+	const unsigned char *scan_end;
+};
+
+/* Where jpeg_decode writes the picture, in the source subsampling */
+struct jpeg_out {
+	unsigned char *y;
+	unsigned char *cb;	/* CbCr if interleaved */
+	unsigned char *cr;
+	int y_stride;
+	int c_stride;
+	int interleave;
+};
+
+struct h264_pcm_src {
+	const unsigned char *y;
+	const unsigned char *cb;	/* CbCr if interleaved (NV12) */
+	const unsigned char *cr;
+	int y_stride;
+	int c_stride;
+	int interleave;
+};
+
+int jpeg_find_soi(const unsigned char *buf, int len);
+int jpeg_parse(struct jpeg_info *j, const unsigned char *buf, int len);
+int jpeg_decode(struct jpeg_info *j, struct jpeg_out *out);
+
+int h264_pcm_sps(unsigned char *buf, int size, int width, int height);
+int h264_pcm_pps(unsigned char *buf, int size);
+int h264_pcm_slice(unsigned char *buf, int size, struct h264_pcm_src *src,
+		   int width, int height, int first_mb, int num_mbs,
+		   int idr_id);
+int h264_pcm_max_size(int width, int height, int slices);
+
+#endif // HOST_CODEC_H
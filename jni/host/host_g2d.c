@@ -0,0 +1,364 @@
+#include "host.h"
+#include "g2d.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Stand-in for libg2d. Operations are checked when they are queued and
+ * done on the CPU by g2d_finish, so their cost shows up where the GPU's
+ * would be waited for. Blits scale with nearest neighbour sampling, which
+ * is enough to see the picture and to profile the code around g2d, not to
+ * judge the GPU's output. Surfaces are addressed by physical address like
+ * on the GPU, and an address outside the blocks from host_phys_alloc
+ * fails the operation.
+ */
+#define G2D_MAX_QUEUED		64
+
+struct g2d_op {
+	int copy;
+	struct g2d_surface src;	/* Blits */
+	struct g2d_surface dst;
+	void *copy_dst;		/* Copies */
+	void *copy_src;
+	int size;
+};
+
+struct host_g2d {
+	struct g2d_op queue[G2D_MAX_QUEUED];
+	int queued;
+	unsigned long ops;
+};
+
+/* Function prototypes */
+static void *phys_range(int paddr, int size);
+static int plane_size(struct g2d_surface *s, int plane);
+static int map_surface(struct g2d_surface *s, unsigned char *planes[3]);
+static void read_pixel(struct g2d_surface *s, unsigned char *planes[3],
+		       int x, int y, int *r, int *g, int *b);
+static void write_pixel(struct g2d_surface *s, unsigned char *planes[3],
+			int x, int y, int r, int g, int b);
+static void do_blit(struct g2d_surface *src, struct g2d_surface *dst);
+/* End function prototypes */
+
+static void *phys_range(int paddr, int size)
+{
+	void *vaddr = host_phys_to_virt((unsigned long)paddr);
+
+	if (vaddr == NULL || size <= 0 ||
+	    host_phys_to_virt((unsigned long)paddr + size - 1) == NULL)
+		return NULL;
+
+	return vaddr;
+}
+
+/*
+ * Return: bytes of one plane, or 0 if the format has no such plane
+ */
+static int plane_size(struct g2d_surface *s, int plane)
+{
+	int luma = s->stride * s->height;
+
+	switch (s->format) {
+	case G2D_RGB565:
+	case G2D_BGR565:
+	case G2D_YUYV:
+	case G2D_YVYU:
+	case G2D_UYVY:
+	case G2D_VYUY:
+		return plane == 0 ? luma * 2 : 0;
+	case G2D_NV12:
+	case G2D_NV21:
+		return plane == 0 ? luma : plane == 1 ? luma / 2 : 0;
+	case G2D_NV16:
+	case G2D_NV61:
+		return plane < 2 ? luma : 0;
+	case G2D_I420:
+	case G2D_YV12:
+		return plane == 0 ? luma : luma / 4;
+	default:
+		return plane == 0 ? luma * 4 : 0;
+	}
+}
+
+/*
+ * Return: 0 = success, -1 = failure
+ */
+static int map_surface(struct g2d_surface *s, unsigned char *planes[3])
+{
+	int i, size;
+
+	for (i = 0; i < 3; i++) {
+		planes[i] = NULL;
+		size = plane_size(s, i);
+		if (size == 0)
+			continue;
+		planes[i] = phys_range(s->planes[i], size);
+		if (planes[i] == NULL) {
+			fprintf(stderr, "g2d: Plane %d at 0x%x is not in "
+				"contiguous memory\n", i, s->planes[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void read_pixel(struct g2d_surface *s, unsigned char *planes[3],
+		       int x, int y, int *r, int *g, int *b)
+{
+	int luma, u, v, c;
+	unsigned char *p;
+
+	switch (s->format) {
+	case G2D_RGB565:
+		p = planes[0] + (y * s->stride + x) * 2;
+		c = p[0] | p[1] << 8;
+		*r = (c >> 8 & 0xf8) | (c >> 13);
+		*g = (c >> 3 & 0xfc) | (c >> 9 & 3);
+		*b = (c << 3 & 0xf8) | (c >> 2 & 7);
+		return;
+	case G2D_RGBA8888:
+	case G2D_RGBX8888:
+		p = planes[0] + (y * s->stride + x) * 4;
+		*r = p[0];
+		*g = p[1];
+		*b = p[2];
+		return;
+	case G2D_NV12:
+		luma = planes[0][y * s->stride + x];
+		p = planes[1] + (y / 2) * s->stride + (x & ~1);
+		u = p[0];
+		v = p[1];
+		break;
+	case G2D_NV16:
+		luma = planes[0][y * s->stride + x];
+		p = planes[1] + y * s->stride + (x & ~1);
+		u = p[0];
+		v = p[1];
+		break;
+	case G2D_I420:
+		luma = planes[0][y * s->stride + x];
+		u = planes[1][(y / 2) * (s->stride / 2) + x / 2];
+		v = planes[2][(y / 2) * (s->stride / 2) + x / 2];
+		break;
+	case G2D_YUYV:
+		p = planes[0] + y * s->stride * 2 + (x & ~1) * 2;
+		luma = p[(x & 1) * 2];
+		u = p[1];
+		v = p[3];
+		break;
+	default:
+		*r = *g = *b = 0;
+		return;
+	}
+
+	/* BT.601 limited range */
+	luma = 298 * (luma - 16);
+	u -= 128;
+	v -= 128;
+	*r = (luma + 409 * v + 128) >> 8;
+	*g = (luma - 100 * u - 208 * v + 128) >> 8;
+	*b = (luma + 516 * u + 128) >> 8;
+	*r = *r < 0 ? 0 : *r > 255 ? 255 : *r;
+	*g = *g < 0 ? 0 : *g > 255 ? 255 : *g;
+	*b = *b < 0 ? 0 : *b > 255 ? 255 : *b;
+}
+
+static void write_pixel(struct g2d_surface *s, unsigned char *planes[3],
+			int x, int y, int r, int g, int b)
+{
+	unsigned char *p;
+	int c;
+
+	switch (s->format) {
+	case G2D_RGB565:
+		p = planes[0] + (y * s->stride + x) * 2;
+		c = (r & 0xf8) << 8 | (g & 0xfc) << 3 | b >> 3;
+		p[0] = c;
+		p[1] = c >> 8;
+		break;
+	case G2D_RGBA8888:
+	case G2D_RGBX8888:
+		p = planes[0] + (y * s->stride + x) * 4;
+		p[0] = r;
+		p[1] = g;
+		p[2] = b;
+		p[3] = 0xff;
+		break;
+	default:
+		break;
+	}
+}
+
+static void do_blit(struct g2d_surface *src, struct g2d_surface *dst)
+{
+	unsigned char *sp[3], *dp[3];
+	int sw, sh, dw, dh, dx, dy, sx, sy;
+	int r, g, b;
+
+	map_surface(src, sp);
+	map_surface(dst, dp);
+	sw = src->right - src->left;
+	sh = src->bottom - src->top;
+	dw = dst->right - dst->left;
+	dh = dst->bottom - dst->top;
+
+	for (dy = 0; dy < dh; dy++) {
+		for (dx = 0; dx < dw; dx++) {
+			switch (dst->rot) {
+			case G2D_ROTATION_90:
+				sx = dy * sw / dh;
+				sy = sh - 1 - dx * sh / dw;
+				break;
+			case G2D_ROTATION_180:
+				sx = sw - 1 - dx * sw / dw;
+				sy = sh - 1 - dy * sh / dh;
+				break;
+			case G2D_ROTATION_270:
+				sx = sw - 1 - dy * sw / dh;
+				sy = dx * sh / dw;
+				break;
+			default:
+				sx = dx * sw / dw;
+				sy = dy * sh / dh;
+				break;
+			}
+			read_pixel(src, sp, src->left + sx, src->top + sy,
+				   &r, &g, &b);
+			write_pixel(dst, dp, dst->left + dx, dst->top + dy,
+				    r, g, b);
+		}
+	}
+}
+
+int g2d_open(void **handle)
+{
+	*handle = calloc(1, sizeof(struct host_g2d));
+
+	return *handle ? 0 : -1;
+}
+
+int g2d_close(void *handle)
+{
+	free(handle);
+
+	return 0;
+}
+
+int g2d_blit(void *handle, struct g2d_surface *src, struct g2d_surface *dst)
+{
+	struct host_g2d *g = handle;
+	unsigned char *planes[3];
+	struct g2d_op *op;
+
+	if (dst->format != G2D_RGB565 && dst->format != G2D_RGBA8888 &&
+	    dst->format != G2D_RGBX8888) {
+		fprintf(stderr, "g2d: Unsupported destination format %d\n",
+			dst->format);
+		return -1;
+	}
+	if (map_surface(src, planes) < 0 || map_surface(dst, planes) < 0)
+		return -1;
+	if (src->right <= src->left || src->bottom <= src->top ||
+	    dst->right <= dst->left || dst->bottom <= dst->top ||
+	    src->left < 0 || src->top < 0 || dst->left < 0 || dst->top < 0 ||
+	    src->right > src->width || src->bottom > src->height ||
+	    dst->right > dst->width || dst->bottom > dst->height) {
+		fprintf(stderr, "g2d: Bad blit rectangle\n");
+		return -1;
+	}
+	if (g->queued == G2D_MAX_QUEUED)
+		g2d_finish(g);
+
+	op = &g->queue[g->queued++];
+	op->copy = 0;
+	op->src = *src;
+	op->dst = *dst;
+
+	return 0;
+}
+
+int g2d_copy(void *handle, struct g2d_buf *d, struct g2d_buf *s, int size)
+{
+	struct host_g2d *g = handle;
+	struct g2d_op *op;
+	void *dst, *src;
+
+	dst = phys_range(d->buf_paddr, size);
+	src = phys_range(s->buf_paddr, size);
+	if (dst == NULL || src == NULL) {
+		fprintf(stderr, "g2d: Copy of %d bytes outside contiguous "
+			"memory\n", size);
+		return -1;
+	}
+	if (g->queued == G2D_MAX_QUEUED)
+		g2d_finish(g);
+
+	op = &g->queue[g->queued++];
+	op->copy = 1;
+	op->copy_dst = dst;
+	op->copy_src = src;
+	op->size = size;
+
+	return 0;
+}
+
+int g2d_flush(void *handle)
+{
+	return 0;
+}
+
+int g2d_finish(void *handle)
+{
+	struct host_g2d *g = handle;
+	struct g2d_op *op;
+	int i;
+
+	for (i = 0; i < g->queued; i++) {
+		op = &g->queue[i];
+		if (op->copy)
+			memcpy(op->copy_dst, op->copy_src, op->size);
+		else
+			do_blit(&op->src, &op->dst);
+	}
+	g->ops += g->queued;
+	g->queued = 0;
+
+	return 0;
+}
+
+/*
+ * Caches are coherent on the host
+ */
+int g2d_cache_op(struct g2d_buf *buf, enum g2d_cache_mode op)
+{
+	return 0;
+}
+
+struct g2d_buf *g2d_alloc(int size, int cacheable)
+{
+	struct g2d_buf *buf;
+
+	buf = calloc(1, sizeof(struct g2d_buf));
+	if (buf == NULL)
+		return NULL;
+
+	buf->buf_paddr = (int)host_phys_alloc(size, &buf->buf_vaddr);
+	if (buf->buf_paddr == 0) {
+		free(buf);
+		return NULL;
+	}
+	buf->buf_size = size;
+
+	return buf;
+}
+
+int g2d_free(struct g2d_buf *buf)
+{
+	host_phys_free((unsigned long)buf->buf_paddr);
+	free(buf);
+
+	return 0;
+}
@@ -0,0 +1,270 @@
+#include "host_codec.h"
+
+#include <string.h>
+
+/*
+ * H.264 writer of the libvpu stand-in. Every picture is an IDR made of
+ * I_PCM macroblocks, which carry the samples as they are. That makes
+ * valid Baseline streams of a realistic structure (parameter sets,
+ * slices, start codes) without a real encoder, at the price of 384
+ * bytes per macroblock.
+ */
+#define PCM_MB_BYTES		384	/* 16x16 luma, two 8x8 chroma */
+
+struct nal_writer {
+	unsigned char *p;
+	unsigned char *end;
+	unsigned int acc;
+	int bits;		/* Bits in acc not written yet */
+	int zeros;		/* Zero bytes just written */
+	int overflow;
+};
+
+/* Function prototypes */
+static void nal_start(struct nal_writer *w, unsigned char *buf, int size,
+		      int header);
+static int nal_end(struct nal_writer *w, unsigned char *buf);
+static void put_byte(struct nal_writer *w, int b);
+static void put_bits(struct nal_writer *w, unsigned int v, int n);
+static void put_ue(struct nal_writer *w, unsigned int v);
+static void put_se(struct nal_writer *w, int v);
+static void put_align(struct nal_writer *w);
+static void put_trailing(struct nal_writer *w);
+static void put_pcm_mb(struct nal_writer *w, struct h264_pcm_src *src,
+		       int width, int height, int mbx, int mby);
+/* End function prototypes */
+
+static void nal_start(struct nal_writer *w, unsigned char *buf, int size,
+		      int header)
+{
+	static const unsigned char start_code[4] = { 0, 0, 0, 1 };
+
+	memset(w, 0, sizeof(*w));
+	w->p = buf;
+	w->end = buf + size;
+	if (size < 5) {
+		w->overflow = 1;
+		return;
+	}
+	memcpy(w->p, start_code, sizeof(start_code));
+	w->p += sizeof(start_code);
+	*w->p++ = header;
+}
+
+/*
+ * Return: bytes of the NAL unit with its start code, -1 if it did not fit
+ */
+static int nal_end(struct nal_writer *w, unsigned char *buf)
+{
+	return w->overflow ? -1 : w->p - buf;
+}
+
+/*
+ * Writes one byte of the RBSP, with an emulation prevention byte where
+ * it would otherwise continue two zero bytes into a start code
+ */
+static void put_byte(struct nal_writer *w, int b)
+{
+	if (w->p + 2 > w->end) {
+		w->overflow = 1;
+		return;
+	}
+	if (w->zeros >= 2 && b <= 3) {
+		*w->p++ = 3;
+		w->zeros = 0;
+	}
+	*w->p++ = b;
+	w->zeros = b ? 0 : w->zeros + 1;
+}
+
+/* Up to 24 bits */
+static void put_bits(struct nal_writer *w, unsigned int v, int n)
+{
+	w->acc = w->acc << n | v;
+	w->bits += n;
+	while (w->bits >= 8) {
+		w->bits -= 8;
+		put_byte(w, (w->acc >> w->bits) & 0xff);
+	}
+}
+
+static void put_ue(struct nal_writer *w, unsigned int v)
+{
+	int len = 0;
+
+	while ((v + 1) >> (len + 1))
+		len++;
+	put_bits(w, 0, len);
+	put_bits(w, v + 1, len + 1);
+}
+
+static void put_se(struct nal_writer *w, int v)
+{
+	put_ue(w, v > 0 ? 2 * v - 1 : -2 * v);
+}
+
+static void put_align(struct nal_writer *w)
+{
+	if (w->bits)
+		put_bits(w, 0, 8 - w->bits);
+}
+
+static void put_trailing(struct nal_writer *w)
+{
+	put_bits(w, 1, 1);
+	put_align(w);
+}
+
+/*
+ * Macroblocks over the edge of the picture repeat its last column and
+ * row. Samples of 0 are raised to 1, which the first version of the
+ * standard requires of PCM samples and which keeps them from needing
+ * emulation prevention.
+ */
+static void put_pcm_mb(struct nal_writer *w, struct h264_pcm_src *src,
+		       int width, int height, int mbx, int mby)
+{
+	const unsigned char *row;
+	int x, y, sx, sy, plane, v;
+	int cw = (width + 1) / 2, ch = (height + 1) / 2;
+
+	put_ue(w, 25);		/* I_PCM */
+	put_align(w);
+
+	for (y = 0; y < 16; y++) {
+		sy = mby * 16 + y;
+		row = src->y + (sy < height ? sy : height - 1) * src->y_stride;
+		for (x = 0; x < 16; x++) {
+			sx = mbx * 16 + x;
+			v = row[sx < width ? sx : width - 1];
+			put_byte(w, v ? v : 1);
+		}
+	}
+
+	for (plane = 0; plane < 2; plane++) {
+		for (y = 0; y < 8; y++) {
+			sy = mby * 8 + y;
+			sy = sy < ch ? sy : ch - 1;
+			if (src->interleave)
+				row = src->cb + sy * src->c_stride + plane;
+			else
+				row = (plane ? src->cr : src->cb) +
+				      sy * src->c_stride;
+			for (x = 0; x < 8; x++) {
+				sx = mbx * 8 + x;
+				sx = sx < cw ? sx : cw - 1;
+				v = row[src->interleave ? sx * 2 : sx];
+				put_byte(w, v ? v : 1);
+			}
+		}
+	}
+}
+
+/*
+ * Baseline sequence parameter set of an intra only stream, cropped to
+ * the picture size
+ *
+ * Return: bytes written, -1 = failure
+ */
+int h264_pcm_sps(unsigned char *buf, int size, int width, int height)
+{
+	struct nal_writer w;
+	int mbw = (width + 15) / 16, mbh = (height + 15) / 16;
+	int crop = mbw * 16 != width || mbh * 16 != height;
+
+	nal_start(&w, buf, size, 0x67);
+	put_bits(&w, 66, 8);		/* Baseline */
+	put_bits(&w, 0xc0, 8);		/* Constrained */
+	put_bits(&w, mbw * mbh <= 3600 ? 31 : mbw * mbh <= 8192 ? 40 : 51, 8);
+	put_ue(&w, 0);			/* seq_parameter_set_id */
+	put_ue(&w, 0);			/* log2_max_frame_num_minus4 */
+	put_ue(&w, 2);			/* pic_order_cnt_type */
+	put_ue(&w, 1);			/* max_num_ref_frames */
+	put_bits(&w, 0, 1);		/* gaps_in_frame_num_allowed */
+	put_ue(&w, mbw - 1);
+	put_ue(&w, mbh - 1);
+	put_bits(&w, 1, 1);		/* frame_mbs_only */
+	put_bits(&w, 1, 1);		/* direct_8x8_inference */
+	put_bits(&w, crop, 1);
+	if (crop) {
+		put_ue(&w, 0);
+		put_ue(&w, (mbw * 16 - width) / 2);
+		put_ue(&w, 0);
+		put_ue(&w, (mbh * 16 - height) / 2);
+	}
+	put_bits(&w, 0, 1);		/* vui_parameters_present */
+	put_trailing(&w);
+
+	return nal_end(&w, buf);
+}
+
+/*
+ * Return: bytes written, -1 = failure
+ */
+int h264_pcm_pps(unsigned char *buf, int size)
+{
+	struct nal_writer w;
+
+	nal_start(&w, buf, size, 0x68);
+	put_ue(&w, 0);			/* pic_parameter_set_id */
+	put_ue(&w, 0);			/* seq_parameter_set_id */
+	put_bits(&w, 0, 1);		/* CAVLC */
+	put_bits(&w, 0, 1);		/* bottom_field_pic_order_present */
+	put_ue(&w, 0);			/* num_slice_groups_minus1 */
+	put_ue(&w, 0);			/* num_ref_idx_l0_default_minus1 */
+	put_ue(&w, 0);			/* num_ref_idx_l1_default_minus1 */
+	put_bits(&w, 0, 1);		/* weighted_pred */
+	put_bits(&w, 0, 2);		/* weighted_bipred_idc */
+	put_se(&w, 0);			/* pic_init_qp_minus26 */
+	put_se(&w, 0);			/* pic_init_qs_minus26 */
+	put_se(&w, 0);			/* chroma_qp_index_offset */
+	put_bits(&w, 1, 1);		/* deblocking_filter_control_present */
+	put_bits(&w, 0, 1);		/* constrained_intra_pred */
+	put_bits(&w, 0, 1);		/* redundant_pic_cnt_present */
+	put_trailing(&w);
+
+	return nal_end(&w, buf);
+}
+
+/*
+ * One IDR slice of num_mbs macroblocks from first_mb on. Consecutive
+ * IDR pictures must differ in idr_id.
+ *
+ * Return: bytes written, -1 = failure
+ */
+int h264_pcm_slice(unsigned char *buf, int size, struct h264_pcm_src *src,
+		   int width, int height, int first_mb, int num_mbs,
+		   int idr_id)
+{
+	struct nal_writer w;
+	int mbw = (width + 15) / 16, mb;
+
+	nal_start(&w, buf, size, 0x65);
+	put_ue(&w, first_mb);
+	put_ue(&w, 7);			/* I, all slices of the picture */
+	put_ue(&w, 0);			/* pic_parameter_set_id */
+	put_bits(&w, 0, 4);		/* frame_num */
+	put_ue(&w, idr_id);
+	put_bits(&w, 0, 1);		/* no_output_of_prior_pics */
+	put_bits(&w, 0, 1);		/* long_term_reference */
+	put_se(&w, 0);			/* slice_qp_delta */
+	put_ue(&w, 1);			/* Deblocking off */
+
+	for (mb = first_mb; mb < first_mb + num_mbs && !w.overflow; mb++)
+		put_pcm_mb(&w, src, width, height, mb % mbw, mb / mbw);
+	put_trailing(&w);
+
+	return nal_end(&w, buf);
+}
+
+/*
+ * Return: upper bound of the bytes of one picture in the given slices
+ */
+int h264_pcm_max_size(int width, int height, int slices)
+{
+	int mbs = ((width + 15) / 16) * ((height + 15) / 16);
+
+	/* mb_type, alignment and an emulation prevention byte around
+	   each macroblock, the slice header and the start code */
+	return mbs * (PCM_MB_BYTES + 4) + slices * 32;
+}
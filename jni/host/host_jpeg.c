@@ -0,0 +1,728 @@
+#include "host_codec.h"
+#include "vpu_lib.h"
+
+#include <string.h>
+
+/*
+ * Baseline JPEG decoder of the libvpu stand-in. It takes what the JPU of
+ * the i.MX6 takes: 8 bit sequential Huffman frames with one or three
+ * components, one interleaved scan and optional restart intervals. UVC
+ * cameras leave out the Huffman tables, so the ones of Annex K are used
+ * when a frame has none. The IDCT is the accurate integer one of the
+ * IJG library.
+ */
+#define CONST_BITS	13
+#define PASS1_BITS	2
+
+#define FIX_0_298631336	2446
+#define FIX_0_390180644	3196
+#define FIX_0_541196100	4433
+#define FIX_0_765366865	6270
+#define FIX_0_899976223	7373
+#define FIX_1_175875602	9633
+#define FIX_1_501321110	12299
+#define FIX_1_847759065	15137
+#define FIX_1_961570560	16069
+#define FIX_2_053119869	16819
+#define FIX_2_562915447	20995
+#define FIX_3_072711026	25172
+
+#define DESCALE(x, n)	(((x) + (1 << ((n) - 1))) >> (n))
+
+struct jpeg_bits {
+	const unsigned char *p;
+	const unsigned char *end;
+	unsigned int acc;	/* Next bits, MSB first */
+	int n;
+	int marker;		/* p is at a marker, feed zeros */
+};
+
+/* Function prototypes */
+static int get16(const unsigned char *p);
+static int huff_build(struct jpeg_huff *h, const unsigned char *bits,
+		      const unsigned char *vals);
+static void huff_defaults(struct jpeg_info *j);
+static int parse_sof(struct jpeg_info *j, const unsigned char *p, int len);
+static int parse_dqt(struct jpeg_info *j, const unsigned char *p, int len);
+static int parse_dht(struct jpeg_info *j, const unsigned char *p, int len);
+static int parse_sos(struct jpeg_info *j, const unsigned char *p, int len);
+static void bits_fill(struct jpeg_bits *b);
+static int bits_get(struct jpeg_bits *b, int n);
+static void bits_restart(struct jpeg_bits *b);
+static int huff_decode(struct jpeg_bits *b, const struct jpeg_huff *h);
+static int decode_block(struct jpeg_info *j, struct jpeg_bits *b,
+			struct jpeg_comp *c, int *coef);
+static void idct(const int *in, unsigned char *out, int stride, int step);
+/* End function prototypes */
+
+static const unsigned char zigzag[64] = {
+	 0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+};
+
+/* Annex K.3 */
+static const unsigned char dc_lum_bits[16] = {
+	0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0,
+};
+static const unsigned char dc_chrom_bits[16] = {
+	0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+};
+static const unsigned char dc_vals[12] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+};
+static const unsigned char ac_lum_bits[16] = {
+	0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d,
+};
+static const unsigned char ac_lum_vals[162] = {
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+	0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+	0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+	0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+	0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+	0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+	0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+	0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+	0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+	0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+	0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+	0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+	0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+	0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+	0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+	0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa,
+};
+static const unsigned char ac_chrom_bits[16] = {
+	0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77,
+};
+static const unsigned char ac_chrom_vals[162] = {
+	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+	0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+	0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+	0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+	0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+	0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+	0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+	0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+	0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+	0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+	0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+	0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+	0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+	0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+	0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+	0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa,
+};
+
+static int get16(const unsigned char *p)
+{
+	return p[0] << 8 | p[1];
+}
+
+/*
+ * Builds the canonical code of a table (Annex C), with a lookup table
+ * for the codes of up to JPEG_HUFF_LOOKUP bits
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int huff_build(struct jpeg_huff *h, const unsigned char *bits,
+		      const unsigned char *vals)
+{
+	int l, i, k = 0, code = 0, shift, idx;
+
+	memset(h->lookup_len, 0, sizeof(h->lookup_len));
+	for (l = 1; l <= 16; l++) {
+		h->valoffset[l] = k - code;
+		for (i = 0; i < bits[l - 1]; i++, k++, code++) {
+			if (k == 256)
+				return -1;
+			h->vals[k] = vals[k];
+			if (l > JPEG_HUFF_LOOKUP)
+				continue;
+			shift = JPEG_HUFF_LOOKUP - l;
+			for (idx = code << shift;
+			     idx < (code + 1) << shift; idx++) {
+				h->lookup_len[idx] = l;
+				h->lookup_val[idx] = vals[k];
+			}
+		}
+		h->maxcode[l] = bits[l - 1] ? code - 1 : -1;
+		if (code > 1 << l)
+			return -1;
+		code <<= 1;
+	}
+
+	return 0;
+}
+
+static void huff_defaults(struct jpeg_info *j)
+{
+	huff_build(&j->dc[0], dc_lum_bits, dc_vals);
+	huff_build(&j->dc[1], dc_chrom_bits, dc_vals);
+	huff_build(&j->ac[0], ac_lum_bits, ac_lum_vals);
+	huff_build(&j->ac[1], ac_chrom_bits, ac_chrom_vals);
+}
+
+/*
+ * Return: 0 = success, -1 = failure
+ */
+static int parse_sof(struct jpeg_info *j, const unsigned char *p, int len)
+{
+	struct jpeg_comp *c;
+	int i;
+
+	if (len < 6 || p[0] != 8)
+		return -1;
+	j->height = get16(p + 1);
+	j->width = get16(p + 3);
+	j->ncomps = p[5];
+	if (j->width == 0 || j->height == 0 ||
+	    (j->ncomps != 1 && j->ncomps != 3) || len < 6 + j->ncomps * 3)
+		return -1;
+
+	for (i = 0; i < j->ncomps; i++) {
+		c = &j->comps[i];
+		c->id = p[6 + i * 3];
+		c->h = p[7 + i * 3] >> 4;
+		c->v = p[7 + i * 3] & 15;
+		c->tq = p[8 + i * 3];
+		if (c->h < 1 || c->h > 2 || c->v < 1 || c->v > 2 || c->tq > 3)
+			return -1;
+		/* Chroma at full resolution of a subsampled luma is not
+		   something the JPU decodes either */
+		if (i > 0 && (c->h != 1 || c->v != 1))
+			return -1;
+	}
+
+	/* A single component is one non-interleaved block per MCU */
+	if (j->ncomps == 1) {
+		j->comps[0].h = 1;
+		j->comps[0].v = 1;
+		j->format = FORMAT_400;
+	} else if (j->comps[0].h == 2) {
+		j->format = j->comps[0].v == 2 ? FORMAT_420 : FORMAT_422;
+	} else {
+		j->format = j->comps[0].v == 2 ? FORMAT_224 : FORMAT_444;
+	}
+	j->hmax = j->comps[0].h;
+	j->vmax = j->comps[0].v;
+	j->mcux = (j->width + 8 * j->hmax - 1) / (8 * j->hmax);
+	j->mcuy = (j->height + 8 * j->vmax - 1) / (8 * j->vmax);
+
+	return 0;
+}
+
+/*
+ * Return: 0 = success, -1 = failure
+ */
+static int parse_dqt(struct jpeg_info *j, const unsigned char *p, int len)
+{
+	int pq, tq, i;
+
+	while (len > 0) {
+		pq = p[0] >> 4;
+		tq = p[0] & 15;
+		if (pq > 1 || tq > 3 || len < 1 + 64 * (pq + 1))
+			return -1;
+		for (i = 0; i < 64; i++)
+			j->qt[tq][i] = pq ? get16(p + 1 + i * 2) : p[1 + i];
+		j->qt_defined[tq] = 1;
+		p += 1 + 64 * (pq + 1);
+		len -= 1 + 64 * (pq + 1);
+	}
+
+	return 0;
+}
+
+/*
+ * Return: 0 = success, -1 = failure
+ */
+static int parse_dht(struct jpeg_info *j, const unsigned char *p, int len)
+{
+	struct jpeg_huff *h;
+	int tc, th, i, count;
+
+	while (len > 0) {
+		if (len < 17)
+			return -1;
+		tc = p[0] >> 4;
+		th = p[0] & 15;
+		if (tc > 1 || th > 1)
+			return -1;
+		for (i = 0, count = 0; i < 16; i++)
+			count += p[1 + i];
+		if (count > 256 || len < 17 + count)
+			return -1;
+		h = tc ? &j->ac[th] : &j->dc[th];
+		if (huff_build(h, p + 1, p + 17) < 0)
+			return -1;
+		p += 17 + count;
+		len -= 17 + count;
+	}
+
+	return 0;
+}
+
+/*
+ * Return: 0 = success, -1 = failure
+ */
+static int parse_sos(struct jpeg_info *j, const unsigned char *p, int len)
+{
+	struct jpeg_comp *c;
+	int i, ns = p[0];
+
+	if (len < 4 + ns * 2 || ns != j->ncomps)
+		return -1;
+
+	for (i = 0; i < ns; i++) {
+		c = &j->comps[i];
+		if (p[1 + i * 2] != c->id)
+			return -1;
+		c->td = p[2 + i * 2] >> 4;
+		c->ta = p[2 + i * 2] & 15;
+		if (c->td > 1 || c->ta > 1 || !j->qt_defined[c->tq])
+			return -1;
+		c->pred = 0;
+	}
+
+	/* Spectral selection and successive approximation of baseline */
+	p += 1 + ns * 2;
+	if (p[0] != 0 || p[1] != 63 || p[2] != 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Return: offset of the first SOI marker, or -1 if there is none
+ */
+int jpeg_find_soi(const unsigned char *buf, int len)
+{
+	const unsigned char *p = buf, *end = buf + len - 1;
+
+	while (p < end) {
+		p = memchr(p, 0xff, end - p);
+		if (p == NULL)
+			break;
+		if (p[1] == 0xd8)
+			return p - buf;
+		p++;
+	}
+
+	return -1;
+}
+
+/*
+ * Parses the frame starting with the SOI marker at buf, up to its EOI.
+ *
+ * Return: length of the frame, 0 if it does not end within len bytes,
+ * -1 if it is not a frame this decoder supports
+ */
+int jpeg_parse(struct jpeg_info *j, const unsigned char *buf, int len)
+{
+	const unsigned char *p, *end = buf + len;
+	int pos = 2, marker, seg, ret, have_sof = 0;
+
+	memset(j->qt_defined, 0, sizeof(j->qt_defined));
+	huff_defaults(j);
+	j->restart = 0;
+
+	for (;;) {
+		if (pos + 4 > len)
+			return 0;
+		if (buf[pos] != 0xff)
+			return -1;
+		marker = buf[pos + 1];
+		if (marker == 0xff) {
+			pos++;
+			continue;
+		}
+		if (marker == 0xd9)
+			return -1;
+		seg = get16(buf + pos + 2);
+		if (seg < 2)
+			return -1;
+		if (pos + 2 + seg > len)
+			return 0;
+		p = buf + pos + 4;
+		seg -= 2;
+
+		switch (marker) {
+		case 0xc0:	/* Baseline */
+		case 0xc1:	/* Extended sequential, Huffman */
+			ret = parse_sof(j, p, seg);
+			have_sof = 1;
+			break;
+		case 0xc4:
+			ret = parse_dht(j, p, seg);
+			break;
+		case 0xdb:
+			ret = parse_dqt(j, p, seg);
+			break;
+		case 0xdd:
+			ret = seg < 2 ? -1 : 0;
+			if (ret == 0)
+				j->restart = get16(p);
+			break;
+		case 0xda:
+			ret = have_sof ? parse_sos(j, p, seg) : -1;
+			break;
+		default:
+			/* Other frame types are not decoded */
+			if (marker >= 0xc2 && marker <= 0xcf && marker != 0xc4 &&
+			    marker != 0xc8 && marker != 0xcc)
+				return -1;
+			ret = 0;
+			break;
+		}
+		if (ret < 0)
+			return -1;
+		pos += 4 + seg;
+		if (marker == 0xda)
+			break;
+	}
+
+	/* The entropy coded data runs up to the first marker other than
+	   a stuffed zero or a restart */
+	j->scan = buf + pos;
+	for (p = j->scan; p < end - 1; p++) {
+		p = memchr(p, 0xff, end - 1 - p);
+		if (p == NULL)
+			break;
+		marker = p[1];
+		if (marker == 0 || (marker >= 0xd0 && marker <= 0xd7) ||
+		    marker == 0xff)
+			continue;
+		if (marker != 0xd9)
+			return -1;
+		j->scan_end = p;
+		return p + 2 - buf;
+	}
+
+	return 0;
+}
+
+static void bits_fill(struct jpeg_bits *b)
+{
+	int c;
+
+	while (b->n <= 24) {
+		c = 0;
+		if (!b->marker && b->p < b->end) {
+			c = *b->p++;
+			if (c == 0xff) {
+				if (b->p < b->end && *b->p == 0) {
+					b->p++;
+				} else {
+					b->p--;
+					b->marker = 1;
+					c = 0;
+				}
+			}
+		}
+		b->acc |= (unsigned int)c << (24 - b->n);
+		b->n += 8;
+	}
+}
+
+static int bits_get(struct jpeg_bits *b, int n)
+{
+	int v;
+
+	if (n == 0)
+		return 0;
+	bits_fill(b);
+	v = b->acc >> (32 - n);
+	b->acc <<= n;
+	b->n -= n;
+
+	return v;
+}
+
+/*
+ * Drops the padding bits of the interval and steps over its RSTn marker
+ */
+static void bits_restart(struct jpeg_bits *b)
+{
+	const unsigned char *p = b->p;
+
+	while (p < b->end - 1 &&
+	       !(p[0] == 0xff && p[1] >= 0xd0 && p[1] <= 0xd7))
+		p++;
+	b->p = p < b->end - 1 ? p + 2 : b->end;
+	b->acc = 0;
+	b->n = 0;
+	b->marker = 0;
+}
+
+/*
+ * Return: decoded symbol, or -1 for a code the table does not have
+ */
+static int huff_decode(struct jpeg_bits *b, const struct jpeg_huff *h)
+{
+	int look, l, code;
+
+	bits_fill(b);
+	look = b->acc >> (32 - JPEG_HUFF_LOOKUP);
+	l = h->lookup_len[look];
+	if (l) {
+		b->acc <<= l;
+		b->n -= l;
+		return h->lookup_val[look];
+	}
+
+	for (l = JPEG_HUFF_LOOKUP + 1; l <= 16; l++) {
+		code = b->acc >> (32 - l);
+		if (code <= h->maxcode[l]) {
+			b->acc <<= l;
+			b->n -= l;
+			return h->vals[code + h->valoffset[l]];
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Decodes and dequantizes one block into natural order
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int decode_block(struct jpeg_info *j, struct jpeg_bits *b,
+			struct jpeg_comp *c, int *coef)
+{
+	const unsigned short *q = j->qt[c->tq];
+	int k, s, r, v;
+
+	memset(coef, 0, 64 * sizeof(int));
+
+	s = huff_decode(b, &j->dc[c->td]);
+	if (s < 0 || s > 11)
+		return -1;
+	v = bits_get(b, s);
+	if (s && v < 1 << (s - 1))
+		v -= (1 << s) - 1;
+	c->pred += v;
+	coef[0] = c->pred * q[0];
+
+	for (k = 1; k < 64; k++) {
+		s = huff_decode(b, &j->ac[c->ta]);
+		if (s < 0)
+			return -1;
+		r = s >> 4;
+		s &= 15;
+		if (s == 0) {
+			if (r != 15)
+				break;
+			k += 15;
+			continue;
+		}
+		k += r;
+		if (k > 63)
+			return -1;
+		v = bits_get(b, s);
+		if (v < 1 << (s - 1))
+			v -= (1 << s) - 1;
+		coef[zigzag[k]] = v * q[k];
+	}
+
+	/* Keeps the IDCT in range for corrupt data, valid coefficients
+	   of 8 bit samples are far smaller */
+	for (k = 0; k < 64; k++) {
+		if (coef[k] > 4095)
+			coef[k] = 4095;
+		else if (coef[k] < -4096)
+			coef[k] = -4096;
+	}
+
+	return 0;
+}
+
+static void idct(const int *in, unsigned char *out, int stride, int step)
+{
+	int ws[64], row[8], *w;
+	int tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13;
+	int z1, z2, z3, z4, z5, i, x, v;
+	const int *c;
+
+	/* Columns */
+	for (i = 0; i < 8; i++) {
+		c = in + i;
+		w = ws + i;
+		if (!c[8] && !c[16] && !c[24] && !c[32] && !c[40] && !c[48] &&
+		    !c[56]) {
+			v = c[0] * (1 << PASS1_BITS);
+			for (x = 0; x < 8; x++)
+				w[x * 8] = v;
+			continue;
+		}
+
+		z2 = c[16];
+		z3 = c[48];
+		z1 = (z2 + z3) * FIX_0_541196100;
+		tmp2 = z1 - z3 * FIX_1_847759065;
+		tmp3 = z1 + z2 * FIX_0_765366865;
+		tmp0 = (c[0] + c[32]) * (1 << CONST_BITS);
+		tmp1 = (c[0] - c[32]) * (1 << CONST_BITS);
+		tmp10 = tmp0 + tmp3;
+		tmp13 = tmp0 - tmp3;
+		tmp11 = tmp1 + tmp2;
+		tmp12 = tmp1 - tmp2;
+
+		tmp0 = c[56];
+		tmp1 = c[40];
+		tmp2 = c[24];
+		tmp3 = c[8];
+		z1 = tmp0 + tmp3;
+		z2 = tmp1 + tmp2;
+		z3 = tmp0 + tmp2;
+		z4 = tmp1 + tmp3;
+		z5 = (z3 + z4) * FIX_1_175875602;
+		tmp0 *= FIX_0_298631336;
+		tmp1 *= FIX_2_053119869;
+		tmp2 *= FIX_3_072711026;
+		tmp3 *= FIX_1_501321110;
+		z1 *= -FIX_0_899976223;
+		z2 *= -FIX_2_562915447;
+		z3 = z3 * -FIX_1_961570560 + z5;
+		z4 = z4 * -FIX_0_390180644 + z5;
+		tmp0 += z1 + z3;
+		tmp1 += z2 + z4;
+		tmp2 += z2 + z3;
+		tmp3 += z1 + z4;
+
+		w[0] = DESCALE(tmp10 + tmp3, CONST_BITS - PASS1_BITS);
+		w[56] = DESCALE(tmp10 - tmp3, CONST_BITS - PASS1_BITS);
+		w[8] = DESCALE(tmp11 + tmp2, CONST_BITS - PASS1_BITS);
+		w[48] = DESCALE(tmp11 - tmp2, CONST_BITS - PASS1_BITS);
+		w[16] = DESCALE(tmp12 + tmp1, CONST_BITS - PASS1_BITS);
+		w[40] = DESCALE(tmp12 - tmp1, CONST_BITS - PASS1_BITS);
+		w[24] = DESCALE(tmp13 + tmp0, CONST_BITS - PASS1_BITS);
+		w[32] = DESCALE(tmp13 - tmp0, CONST_BITS - PASS1_BITS);
+	}
+
+	/* Rows */
+	for (i = 0; i < 8; i++, out += stride) {
+		w = ws + i * 8;
+
+		z2 = w[2];
+		z3 = w[6];
+		z1 = (z2 + z3) * FIX_0_541196100;
+		tmp2 = z1 - z3 * FIX_1_847759065;
+		tmp3 = z1 + z2 * FIX_0_765366865;
+		tmp0 = (w[0] + w[4]) * (1 << CONST_BITS);
+		tmp1 = (w[0] - w[4]) * (1 << CONST_BITS);
+		tmp10 = tmp0 + tmp3;
+		tmp13 = tmp0 - tmp3;
+		tmp11 = tmp1 + tmp2;
+		tmp12 = tmp1 - tmp2;
+
+		tmp0 = w[7];
+		tmp1 = w[5];
+		tmp2 = w[3];
+		tmp3 = w[1];
+		z1 = tmp0 + tmp3;
+		z2 = tmp1 + tmp2;
+		z3 = tmp0 + tmp2;
+		z4 = tmp1 + tmp3;
+		z5 = (z3 + z4) * FIX_1_175875602;
+		tmp0 *= FIX_0_298631336;
+		tmp1 *= FIX_2_053119869;
+		tmp2 *= FIX_3_072711026;
+		tmp3 *= FIX_1_501321110;
+		z1 *= -FIX_0_899976223;
+		z2 *= -FIX_2_562915447;
+		z3 = z3 * -FIX_1_961570560 + z5;
+		z4 = z4 * -FIX_0_390180644 + z5;
+		tmp0 += z1 + z3;
+		tmp1 += z2 + z4;
+		tmp2 += z2 + z3;
+		tmp3 += z1 + z4;
+
+		row[0] = tmp10 + tmp3;
+		row[7] = tmp10 - tmp3;
+		row[1] = tmp11 + tmp2;
+		row[6] = tmp11 - tmp2;
+		row[2] = tmp12 + tmp1;
+		row[5] = tmp12 - tmp1;
+		row[3] = tmp13 + tmp0;
+		row[4] = tmp13 - tmp0;
+
+		for (x = 0; x < 8; x++) {
+			v = DESCALE(row[x], CONST_BITS + PASS1_BITS + 3) + 128;
+			out[x * step] = v < 0 ? 0 : v > 255 ? 255 : v;
+		}
+	}
+}
+
+/*
+ * Decodes the frame found by the last jpeg_parse. Whole MCUs are
+ * written, so the planes must be padded to the MCU size. A gray frame
+ * only writes the luma.
+ *
+ * Return: number of MCUs that could not be decoded, 0 = success
+ */
+int jpeg_decode(struct jpeg_info *j, struct jpeg_out *out)
+{
+	struct jpeg_bits b;
+	struct jpeg_comp *c;
+	unsigned char *dst;
+	int coef[64];
+	int mx, my, i, bx, by, x, y, left, bad, errors = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.p = j->scan;
+	b.end = j->scan_end;
+	left = j->restart;
+
+	for (my = 0; my < j->mcuy; my++) {
+		for (mx = 0; mx < j->mcux; mx++) {
+			if (j->restart && left == 0) {
+				bits_restart(&b);
+				for (i = 0; i < j->ncomps; i++)
+					j->comps[i].pred = 0;
+				left = j->restart;
+			}
+			left--;
+
+			bad = 0;
+			for (i = 0; i < j->ncomps; i++) {
+				c = &j->comps[i];
+				for (by = 0; by < c->v; by++) {
+					for (bx = 0; bx < c->h; bx++) {
+						if (decode_block(j, &b, c, coef) < 0) {
+							bad = 1;
+							memset(coef, 0, sizeof(coef));
+						}
+						x = (mx * c->h + bx) * 8;
+						y = (my * c->v + by) * 8;
+						if (i == 0)
+							dst = out->y + y * out->y_stride + x;
+						else if (out->interleave)
+							dst = out->cb + y * out->c_stride +
+							      x * 2 + i - 1;
+						else
+							dst = (i == 1 ? out->cb : out->cr) +
+							      y * out->c_stride + x;
+						idct(coef, dst, i ? out->c_stride : out->y_stride,
+						     i && out->interleave ? 2 : 1);
+					}
+				}
+			}
+			errors += bad;
+		}
+	}
+
+	return errors;
+}
@@ -0,0 +1,222 @@
+#include "host.h"
+#include "vpu_io.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/*
+ * Stand-in for the VPU driver's physically contiguous memory. The VPU and
+ * g2d interfaces pass physical and even virtual addresses around as int,
+ * so all blocks come from one region mapped below 2GB, where the virtual
+ * address of a block doubles as its physical address. Each block is
+ * followed by an inaccessible guard page and is made inaccessible again
+ * when freed, so overruns and use after free of hardware buffers fault
+ * right away, with or without a sanitizer.
+ */
+#define HOST_PAGE_SIZE		4096UL
+#define HOST_PHYS_MIN		0x10000000UL
+#define HOST_PHYS_MAX		0x80000000UL
+#define HOST_PHYS_DEFAULT_MB	256
+
+struct phys_block {
+	unsigned long paddr;
+	unsigned long size;	/* Including the guard page */
+	struct phys_block *next;	/* Sorted by paddr */
+};
+
+static pthread_mutex_t phys_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct phys_block *phys_blocks;
+static unsigned long phys_start;
+static unsigned long phys_end;
+
+/* Function prototypes */
+static int phys_reserve(void);
+/* End function prototypes */
+
+/*
+ * Called with the lock held. The size can be set with HOST_PHYS_MB.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+static int phys_reserve(void)
+{
+	unsigned long size, addr;
+	const char *env;
+	void *p;
+
+	if (phys_start)
+		return 0;
+
+	env = getenv("HOST_PHYS_MB");
+	size = (env ? strtoul(env, NULL, 0) : HOST_PHYS_DEFAULT_MB) << 20;
+	if (size == 0 || size > HOST_PHYS_MAX - HOST_PHYS_MIN)
+		size = (unsigned long)HOST_PHYS_DEFAULT_MB << 20;
+
+	/* Without MAP_FIXED the kernel, and valgrind, only take the hint
+	   if nothing is mapped there yet, so walk up until one is taken */
+	for (addr = HOST_PHYS_MIN; addr + size <= HOST_PHYS_MAX;
+	     addr += 0x10000000UL) {
+		p = mmap((void *)addr, size, PROT_NONE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED)
+			continue;
+		if ((unsigned long)p == addr) {
+			phys_start = addr;
+			phys_end = addr + size;
+			return 0;
+		}
+		munmap(p, size);
+	}
+
+	fprintf(stderr, "host: Could not map %lu MB of physical memory "
+		"below 2GB\n", size >> 20);
+
+	return -1;
+}
+
+/*
+ * Return: physical address, or 0 on failure
+ */
+unsigned long host_phys_alloc(int size, void **vaddr)
+{
+	struct phys_block *b, **p;
+	unsigned long paddr, len;
+
+	if (size <= 0)
+		return 0;
+	len = ((size + HOST_PAGE_SIZE - 1) & ~(HOST_PAGE_SIZE - 1)) +
+	      HOST_PAGE_SIZE;
+
+	b = malloc(sizeof(struct phys_block));
+	if (b == NULL)
+		return 0;
+
+	pthread_mutex_lock(&phys_lock);
+	if (phys_reserve() < 0)
+		goto fail;
+
+	paddr = phys_start;
+	for (p = &phys_blocks; *p; p = &(*p)->next) {
+		if ((*p)->paddr - paddr >= len)
+			break;
+		paddr = (*p)->paddr + (*p)->size;
+	}
+	if (phys_end - paddr < len)
+		goto fail;
+	if (mprotect((void *)paddr, len - HOST_PAGE_SIZE,
+		     PROT_READ | PROT_WRITE))
+		goto fail;
+
+	b->paddr = paddr;
+	b->size = len;
+	b->next = *p;
+	*p = b;
+	pthread_mutex_unlock(&phys_lock);
+
+	*vaddr = (void *)paddr;
+
+	return paddr;
+
+fail:
+	pthread_mutex_unlock(&phys_lock);
+	free(b);
+	return 0;
+}
+
+void host_phys_free(unsigned long paddr)
+{
+	struct phys_block *b, **p;
+
+	pthread_mutex_lock(&phys_lock);
+	for (p = &phys_blocks; (b = *p) != NULL; p = &b->next) {
+		if (b->paddr == paddr) {
+			*p = b->next;
+			break;
+		}
+	}
+	if (b) {
+		/* Drop the pages, a new block there starts out zeroed */
+		madvise((void *)b->paddr, b->size, MADV_DONTNEED);
+		mprotect((void *)b->paddr, b->size, PROT_NONE);
+	}
+	pthread_mutex_unlock(&phys_lock);
+
+	if (b == NULL) {
+		fprintf(stderr, "host: Free of unknown physical address "
+			"0x%lx\n", paddr);
+		return;
+	}
+	free(b);
+}
+
+/*
+ * Return: pointer to paddr, or NULL if it is not inside a block
+ */
+void *host_phys_to_virt(unsigned long paddr)
+{
+	struct phys_block *b;
+	void *vaddr = NULL;
+
+	pthread_mutex_lock(&phys_lock);
+	for (b = phys_blocks; b && b->paddr <= paddr; b = b->next) {
+		if (paddr - b->paddr < b->size - HOST_PAGE_SIZE) {
+			vaddr = (void *)paddr;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&phys_lock);
+
+	return vaddr;
+}
+
+void host_phys_stats(int *blocks, long *bytes)
+{
+	struct phys_block *b;
+
+	*blocks = 0;
+	*bytes = 0;
+	pthread_mutex_lock(&phys_lock);
+	for (b = phys_blocks; b; b = b->next) {
+		(*blocks)++;
+		*bytes += b->size - HOST_PAGE_SIZE;
+	}
+	pthread_mutex_unlock(&phys_lock);
+}
+
+int IOGetPhyMem(vpu_mem_desc *buff)
+{
+	void *vaddr;
+
+	buff->phy_addr = host_phys_alloc(buff->size, &vaddr);
+	if (buff->phy_addr == 0)
+		return -1;
+	buff->cpu_addr = (unsigned long)vaddr;
+
+	return 0;
+}
+
+int IOFreePhyMem(vpu_mem_desc *buff)
+{
+	if (buff->phy_addr)
+		host_phys_free(buff->phy_addr);
+	buff->phy_addr = 0;
+	buff->cpu_addr = 0;
+	buff->virt_uaddr = 0;
+
+	return 0;
+}
+
+/*
+ * Blocks are mapped at their physical address already
+ */
+int IOGetVirtMem(vpu_mem_desc *buff)
+{
+	return (int)buff->phy_addr;
+}
+
+int IOFreeVirtMem(vpu_mem_desc *buff)
+{
+	return 0;
+}
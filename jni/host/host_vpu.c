@@ -0,0 +1,930 @@
+#include "host.h"
+#include "host_codec.h"
+#include "vpu_lib.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Stand-in for libvpu that does the work on the CPU. It decodes MJPEG
+ * and encodes H.264, the two things this project asks of the VPU:
+ *
+ *  - The decoder takes frames from the bitstream ring buffer like the
+ *    JPU in streaming mode. vpu_DecGetInitialInfo parses and consumes the
+ *    first frame, each vpu_DecStartOneFrame decodes the next one into
+ *    the rotator output. Other stream formats fail to open.
+ *  - The encoder writes every picture as an IDR of I_PCM macroblocks,
+ *    in slices of whole macroblock rows, with the slice report of the
+ *    real one. Rate control and intra refresh settings are accepted and
+ *    have no effect.
+ *
+ * As on the chip, there is one core: a frame holds it from StartOneFrame
+ * to GetOutputInfo, and other instances wait for it. The work is done
+ * in StartOneFrame, then the core stays busy until the frame latency has
+ * passed since the start, so vpu_IsBusy and vpu_WaitForInt behave as
+ * with the hardware. The latencies come from VPU_EMU_DEC_LATENCY_US and
+ * VPU_EMU_ENC_LATENCY_US or host_vpu_set_latency. With 0, a frame takes
+ * as long as the CPU needs for it.
+ *
+ * Bitstream and frame buffers are addressed by physical address and
+ * must lie in blocks from host_phys_alloc.
+ */
+#define DEC_MIN_FRAME_BUFFERS	1
+#define ENC_MIN_FRAME_BUFFERS	2
+#define SLICE_INFO_BYTES	8
+#define PCM_MB_BITS		3081	/* I_PCM macroblock in a slice */
+
+struct CodecInst {
+	unsigned long bs_paddr;		/* Bitstream buffer */
+	unsigned char *bs_vaddr;
+	int bs_size;
+	int width;
+	int height;
+	int chroma_interleave;
+	int registered;			/* Frame buffers registered */
+	int frame_done;			/* A frame waits for GetOutputInfo */
+
+	/* Decoder */
+	unsigned long rd;		/* Ring buffer pointers */
+	unsigned long wr;
+	int fill;
+	int eos;
+	int seq_init;
+	struct jpeg_info jpeg;
+	unsigned char *scratch;		/* Frames that wrap around */
+	FrameBuffer rot_out;
+	int rot_out_set;
+	int rot_stride;
+	int fb_count;
+	int consumed;
+	int err_mcus;
+
+	/* Encoder */
+	int mbw;
+	int mbh;
+	int rows_per_slice;
+	int src_stride;
+	int idr_id;
+	EncReportInfo slice_report;
+	unsigned long out_paddr;
+	int out_size;
+	int slices;
+};
+
+struct host_vpu {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int init_count;
+	struct CodecInst *owner;	/* Frame in flight on the core */
+	long long busy_until;		/* us, CLOCK_MONOTONIC */
+	int dec_latency_us;
+	int enc_latency_us;
+};
+
+/* Function prototypes */
+static long long now_us(void);
+static void sleep_until(long long t);
+static int env_latency(const char *name);
+static void core_acquire(struct CodecInst *inst);
+static void core_finish(long long start, int latency_us);
+static void core_release(struct CodecInst *inst);
+static int core_owned(struct CodecInst *inst);
+static void *phys_range(unsigned long paddr, long size);
+static const unsigned char *ring_frame(struct CodecInst *inst, int *len);
+static void ring_consume(struct CodecInst *inst, int size);
+static int dec_next_frame(struct CodecInst *inst, int *skip, int *len);
+static RetCode dec_to_rot_out(struct CodecInst *inst);
+static int enc_slice_rows(EncOpenParam *param, int mbw);
+static void enc_report_slice(struct CodecInst *inst, int first_mb, int bytes);
+/* End function prototypes */
+
+/* i.MX6Q, revision 1.0 */
+unsigned int system_rev = 0x63000 | CHIP_REV_1_0;
+
+static struct host_vpu vpu = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(long long t)
+{
+	struct timespec ts;
+
+	ts.tv_sec = t / 1000000;
+	ts.tv_nsec = (t % 1000000) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+			       NULL) == EINTR)
+		;
+}
+
+static int env_latency(const char *name)
+{
+	const char *s = getenv(name);
+
+	return s ? atoi(s) : 0;
+}
+
+/*
+ * Waits until no other instance has a frame on the core
+ */
+static void core_acquire(struct CodecInst *inst)
+{
+	pthread_mutex_lock(&vpu.lock);
+	while (vpu.owner && vpu.owner != inst)
+		pthread_cond_wait(&vpu.cond, &vpu.lock);
+	vpu.owner = inst;
+	pthread_mutex_unlock(&vpu.lock);
+}
+
+/*
+ * The frame started at start is done once the latency has passed, or
+ * now if the CPU took longer than that
+ */
+static void core_finish(long long start, int latency_us)
+{
+	long long done = now_us();
+
+	pthread_mutex_lock(&vpu.lock);
+	vpu.busy_until = start + latency_us > done ?
+			 start + latency_us : done;
+	pthread_mutex_unlock(&vpu.lock);
+}
+
+static void core_release(struct CodecInst *inst)
+{
+	pthread_mutex_lock(&vpu.lock);
+	if (vpu.owner == inst) {
+		vpu.owner = NULL;
+		pthread_cond_broadcast(&vpu.cond);
+	}
+	pthread_mutex_unlock(&vpu.lock);
+}
+
+static int core_owned(struct CodecInst *inst)
+{
+	int owned;
+
+	pthread_mutex_lock(&vpu.lock);
+	owned = vpu.owner == inst;
+	pthread_mutex_unlock(&vpu.lock);
+
+	return owned;
+}
+
+static void *phys_range(unsigned long paddr, long size)
+{
+	void *vaddr = host_phys_to_virt(paddr);
+
+	if (vaddr == NULL || size <= 0 ||
+	    host_phys_to_virt(paddr + size - 1) == NULL)
+		return NULL;
+
+	return vaddr;
+}
+
+/*
+ * Return: the filled part of the ring buffer as one piece, copied out if
+ * it wraps around
+ */
+static const unsigned char *ring_frame(struct CodecInst *inst, int *len)
+{
+	int off = inst->rd - inst->bs_paddr, first;
+
+	*len = inst->fill;
+	if (off + inst->fill <= inst->bs_size)
+		return inst->bs_vaddr + off;
+
+	first = inst->bs_size - off;
+	memcpy(inst->scratch, inst->bs_vaddr + off, first);
+	memcpy(inst->scratch + first, inst->bs_vaddr, inst->fill - first);
+
+	return inst->scratch;
+}
+
+static void ring_consume(struct CodecInst *inst, int size)
+{
+	int off = inst->rd - inst->bs_paddr;
+
+	inst->rd = inst->bs_paddr + (off + size) % inst->bs_size;
+	inst->fill -= size;
+}
+
+/*
+ * Finds the next frame in the ring buffer and parses it into inst->jpeg.
+ * Data in front of its SOI marker is dropped.
+ *
+ * Return: 1 = frame found, 0 = no complete frame, -1 = unsupported frame
+ */
+static int dec_next_frame(struct CodecInst *inst, int *skip, int *len)
+{
+	const unsigned char *buf;
+	int size, ret;
+
+	buf = ring_frame(inst, &size);
+	*skip = jpeg_find_soi(buf, size);
+	if (*skip < 0)
+		return 0;
+
+	ret = jpeg_parse(&inst->jpeg, buf + *skip, size - *skip);
+	if (ret <= 0) {
+		*len = 0;
+		return ret;
+	}
+	*len = ret;
+
+	return 1;
+}
+
+/*
+ * Decodes the parsed frame into the rotator output. Chroma keeps the
+ * subsampling of the frame, with the planes at half the luma stride per
+ * subsampled direction, or interleaved at the luma stride.
+ */
+static RetCode dec_to_rot_out(struct CodecInst *inst)
+{
+	struct jpeg_info *j = &inst->jpeg;
+	struct jpeg_out out;
+	int rows = j->mcuy * 8 * j->vmax, c_rows = rows / j->vmax;
+	int c_width = inst->rot_stride / j->hmax;
+
+	if (j->mcux * 8 * j->hmax > inst->rot_stride)
+		return RETCODE_INVALID_STRIDE;
+
+	memset(&out, 0, sizeof(out));
+	out.y_stride = inst->rot_stride;
+	out.interleave = inst->chroma_interleave;
+	out.c_stride = out.interleave ? c_width * 2 : c_width;
+	out.y = phys_range(inst->rot_out.bufY, (long)out.y_stride * rows);
+	if (j->format != FORMAT_400) {
+		out.cb = phys_range(inst->rot_out.bufCb,
+				    (long)out.c_stride * c_rows);
+		if (!out.interleave)
+			out.cr = phys_range(inst->rot_out.bufCr,
+					    (long)out.c_stride * c_rows);
+		if (out.cb == NULL || (!out.interleave && out.cr == NULL))
+			out.y = NULL;
+	}
+	if (out.y == NULL) {
+		fprintf(stderr, "vpu: Rotator output is not in contiguous "
+			"memory\n");
+		return RETCODE_INVALID_FRAME_BUFFER;
+	}
+
+	inst->err_mcus = jpeg_decode(j, &out);
+
+	return RETCODE_SUCCESS;
+}
+
+/*
+ * Rows of macroblocks per slice. Slices are cut at row boundaries, with
+ * at least one row each.
+ */
+static int enc_slice_rows(EncOpenParam *param, int mbw)
+{
+	EncSliceMode *m = &param->slicemode;
+	int rows;
+
+	if (m->sliceMode == 0 || m->sliceSize <= 0)
+		return 0x7fff;
+
+	if (m->sliceSizeMode)
+		rows = m->sliceSize / mbw;
+	else
+		rows = m->sliceSize / (mbw * PCM_MB_BITS);
+
+	return rows > 0 ? rows : 1;
+}
+
+/*
+ * Slice report entry: the first macroblock in bytes 2-3 and the slice
+ * bits in bytes 4-7, big endian
+ */
+static void enc_report_slice(struct CodecInst *inst, int first_mb, int bytes)
+{
+	unsigned char *p;
+	int bits = bytes * 8;
+
+	if (!inst->slice_report.enable || inst->slice_report.addr == NULL)
+		return;
+
+	p = inst->slice_report.addr + inst->slices * SLICE_INFO_BYTES;
+	p[0] = inst->slices >> 8;
+	p[1] = inst->slices;
+	p[2] = first_mb >> 8;
+	p[3] = first_mb;
+	p[4] = bits >> 24;
+	p[5] = bits >> 16;
+	p[6] = bits >> 8;
+	p[7] = bits;
+}
+
+/*
+ * Sets the time a decoded and an encoded frame keep the core busy,
+ * counted from vpu_DecStartOneFrame and vpu_EncStartOneFrame
+ */
+void host_vpu_set_latency(int dec_us, int enc_us)
+{
+	pthread_mutex_lock(&vpu.lock);
+	vpu.dec_latency_us = dec_us > 0 ? dec_us : 0;
+	vpu.enc_latency_us = enc_us > 0 ? enc_us : 0;
+	pthread_mutex_unlock(&vpu.lock);
+}
+
+RetCode vpu_Init(void *cb)
+{
+	pthread_mutex_lock(&vpu.lock);
+	if (vpu.init_count++ == 0) {
+		vpu.dec_latency_us = env_latency("VPU_EMU_DEC_LATENCY_US");
+		vpu.enc_latency_us = env_latency("VPU_EMU_ENC_LATENCY_US");
+	}
+	pthread_mutex_unlock(&vpu.lock);
+
+	return RETCODE_SUCCESS;
+}
+
+void vpu_UnInit(void)
+{
+	pthread_mutex_lock(&vpu.lock);
+	if (vpu.init_count > 0)
+		vpu.init_count--;
+	pthread_mutex_unlock(&vpu.lock);
+}
+
+RetCode vpu_GetVersionInfo(vpu_versioninfo *verinfo)
+{
+	verinfo->fw_major = 0;
+	verinfo->fw_minor = 0;
+	verinfo->fw_release = 0;
+	verinfo->fw_code = 0;
+	verinfo->lib_major = (VPU_LIB_VERSION_CODE >> 12) & 0x0f;
+	verinfo->lib_minor = (VPU_LIB_VERSION_CODE >> 8) & 0x0f;
+	verinfo->lib_release = VPU_LIB_VERSION_CODE & 0xff;
+
+	return RETCODE_SUCCESS;
+}
+
+int vpu_IsBusy(void)
+{
+	int busy;
+
+	pthread_mutex_lock(&vpu.lock);
+	busy = vpu.owner != NULL && now_us() < vpu.busy_until;
+	pthread_mutex_unlock(&vpu.lock);
+
+	return busy;
+}
+
+/*
+ * Return: 0 = the frame on the core is done, -1 = timeout
+ */
+int vpu_WaitForInt(int timeout_in_ms)
+{
+	long long until, deadline = now_us() + timeout_in_ms * 1000LL;
+	int busy;
+
+	pthread_mutex_lock(&vpu.lock);
+	busy = vpu.owner != NULL;
+	until = vpu.busy_until;
+	pthread_mutex_unlock(&vpu.lock);
+
+	if (!busy || until > deadline) {
+		sleep_until(deadline);
+		return -1;
+	}
+	sleep_until(until);
+
+	return 0;
+}
+
+/*
+ * Drops the frame of the instance, if it has one on the core
+ */
+RetCode vpu_SWReset(DecHandle handle, int index)
+{
+	if (handle) {
+		handle->frame_done = 0;
+		core_release(handle);
+	}
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_DecOpen(DecHandle *handle, DecOpenParam *param)
+{
+	struct CodecInst *inst;
+
+	if (param->bitstreamFormat != STD_MJPG) {
+		fprintf(stderr, "vpu: Only MJPEG is decoded on the host\n");
+		return RETCODE_NOT_SUPPORTED;
+	}
+	if (phys_range(param->bitstreamBuffer,
+		       param->bitstreamBufferSize) == NULL) {
+		fprintf(stderr, "vpu: Bitstream buffer is not in contiguous "
+			"memory\n");
+		return RETCODE_INVALID_PARAM;
+	}
+
+	inst = calloc(1, sizeof(struct CodecInst));
+	if (inst == NULL)
+		return RETCODE_FAILURE;
+	inst->scratch = malloc(param->bitstreamBufferSize);
+	if (inst->scratch == NULL) {
+		free(inst);
+		return RETCODE_FAILURE;
+	}
+
+	inst->bs_paddr = param->bitstreamBuffer;
+	inst->bs_vaddr = host_phys_to_virt(param->bitstreamBuffer);
+	inst->bs_size = param->bitstreamBufferSize;
+	inst->rd = inst->wr = inst->bs_paddr;
+	inst->chroma_interleave = param->chromaInterleave;
+	*handle = inst;
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_DecClose(DecHandle handle)
+{
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+	if (core_owned(handle))
+		return RETCODE_FRAME_NOT_COMPLETE;
+
+	free(handle->scratch);
+	free(handle);
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_DecSetEscSeqInit(DecHandle handle, int escape)
+{
+	return handle ? RETCODE_SUCCESS : RETCODE_INVALID_HANDLE;
+}
+
+RetCode vpu_DecGetInitialInfo(DecHandle handle, DecInitialInfo *info)
+{
+	int skip, len, ret;
+
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+	if (handle->seq_init)
+		return RETCODE_CALLED_BEFORE;
+
+	ret = dec_next_frame(handle, &skip, &len);
+	if (ret <= 0) {
+		info->errorcode = ret < 0;
+		return RETCODE_FAILURE;
+	}
+	ring_consume(handle, skip + len);
+
+	handle->width = handle->jpeg.width;
+	handle->height = handle->jpeg.height;
+	handle->seq_init = 1;
+
+	info->picWidth = handle->width;
+	info->picHeight = handle->height;
+	memset(&info->picCropRect, 0, sizeof(info->picCropRect));
+	info->minFrameBufferCount = DEC_MIN_FRAME_BUFFERS;
+	info->mjpg_sourceFormat = handle->jpeg.format;
+	info->interlace = 0;
+	info->errorcode = 0;
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_DecRegisterFrameBuffer(DecHandle handle, FrameBuffer *bufArray,
+				   int num, int stride, DecBufInfo *pBufInfo)
+{
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+	if (!handle->seq_init)
+		return RETCODE_WRONG_CALL_SEQUENCE;
+	if (num < DEC_MIN_FRAME_BUFFERS)
+		return RETCODE_INSUFFICIENT_FRAME_BUFFERS;
+	if (stride < handle->width || (stride & 7))
+		return RETCODE_INVALID_STRIDE;
+
+	handle->fb_count = num;
+	handle->registered = 1;
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_DecGetBitstreamBuffer(DecHandle handle, PhysicalAddress *paRdPtr,
+				  PhysicalAddress *paWrPtr, Uint32 *size)
+{
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+
+	*paRdPtr = handle->rd;
+	*paWrPtr = handle->wr;
+	*size = handle->bs_size - handle->fill;
+
+	return RETCODE_SUCCESS;
+}
+
+/*
+ * A size of 0 marks the end of the stream
+ */
+RetCode vpu_DecUpdateBitstreamBuffer(DecHandle handle, Uint32 size)
+{
+	int off;
+
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+	if (size == 0) {
+		handle->eos = 1;
+		return RETCODE_SUCCESS;
+	}
+	if (size > (Uint32)(handle->bs_size - handle->fill))
+		return RETCODE_INVALID_PARAM;
+
+	off = handle->wr - handle->bs_paddr;
+	handle->wr = handle->bs_paddr + (off + size) % handle->bs_size;
+	handle->fill += size;
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_DecBitBufferFlush(DecHandle handle)
+{
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+
+	handle->rd = handle->wr;
+	handle->fill = 0;
+	handle->eos = 0;
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_DecStartOneFrame(DecHandle handle, DecParam *param)
+{
+	long long start;
+	int skip, len, ret, latency;
+	RetCode rc;
+
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+	if (!handle->registered)
+		return RETCODE_WRONG_CALL_SEQUENCE;
+	if (!handle->rot_out_set)
+		return RETCODE_ROTATOR_OUTPUT_NOT_SET;
+	if (handle->rot_stride == 0)
+		return RETCODE_ROTATOR_STRIDE_NOT_SET;
+
+	core_acquire(handle);
+	start = now_us();
+
+	ret = dec_next_frame(handle, &skip, &len);
+	if (ret == 0) {
+		core_release(handle);
+		return handle->eos ? RETCODE_JPEG_EOS : RETCODE_JPEG_BIT_EMPTY;
+	}
+
+	if (ret < 0) {
+		/* Drop the SOI marker so the next frame is tried next */
+		ring_consume(handle, skip + 2);
+		handle->consumed = skip + 2;
+		handle->err_mcus = 1;
+	} else {
+		rc = dec_to_rot_out(handle);
+		if (rc != RETCODE_SUCCESS) {
+			core_release(handle);
+			return rc;
+		}
+		ring_consume(handle, skip + len);
+		handle->consumed = skip + len;
+		handle->width = handle->jpeg.width;
+		handle->height = handle->jpeg.height;
+	}
+	handle->frame_done = 1;
+
+	pthread_mutex_lock(&vpu.lock);
+	latency = vpu.dec_latency_us;
+	pthread_mutex_unlock(&vpu.lock);
+	core_finish(start, latency);
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_DecGetOutputInfo(DecHandle handle, DecOutputInfo *info)
+{
+	long long until;
+
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+	if (!handle->frame_done || !core_owned(handle))
+		return RETCODE_WRONG_CALL_SEQUENCE;
+
+	pthread_mutex_lock(&vpu.lock);
+	until = vpu.busy_until;
+	pthread_mutex_unlock(&vpu.lock);
+	sleep_until(until);
+
+	memset(info, 0, sizeof(DecOutputInfo));
+	info->indexFrameDisplay = handle->rot_out.myIndex;
+	info->indexFrameDecoded = handle->rot_out.myIndex;
+	info->decodingSuccess = handle->err_mcus == 0;
+	info->numOfErrMBs = handle->err_mcus;
+	info->decPicWidth = handle->width;
+	info->decPicHeight = handle->height;
+	info->consumedByte = handle->consumed;
+	info->progressiveFrame = 1;
+
+	handle->frame_done = 0;
+	core_release(handle);
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_DecClrDispFlag(DecHandle handle, int index)
+{
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+	if (index < 0 || index >= handle->fb_count)
+		return RETCODE_INVALID_PARAM;
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_DecGiveCommand(DecHandle handle, CodecCommand cmd, void *parameter)
+{
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+
+	switch (cmd) {
+	case SET_ROTATOR_OUTPUT:
+		handle->rot_out = *(FrameBuffer *)parameter;
+		handle->rot_out_set = 1;
+		return RETCODE_SUCCESS;
+	case SET_ROTATOR_STRIDE:
+		handle->rot_stride = *(int *)parameter;
+		return RETCODE_SUCCESS;
+	case SET_ROTATION_ANGLE:
+	case SET_MIRROR_DIRECTION:
+		/* The frame is decoded as it is */
+		return *(int *)parameter ? RETCODE_NOT_SUPPORTED :
+					   RETCODE_SUCCESS;
+	case ENABLE_ROTATION:
+	case ENABLE_MIRRORING:
+	case ENABLE_DERING:
+		return RETCODE_NOT_SUPPORTED;
+	case DISABLE_ROTATION:
+	case DISABLE_MIRRORING:
+	case DISABLE_DERING:
+	case DEC_SET_FRAME_DELAY:
+		return RETCODE_SUCCESS;
+	default:
+		return RETCODE_INVALID_COMMAND;
+	}
+}
+
+RetCode vpu_EncOpen(EncHandle *handle, EncOpenParam *param)
+{
+	struct CodecInst *inst;
+	int mbw, mbh, rows;
+
+	if (param->bitstreamFormat != STD_AVC) {
+		fprintf(stderr, "vpu: Only H.264 is encoded on the host\n");
+		return RETCODE_NOT_SUPPORTED;
+	}
+	if (param->picWidth < 16 || param->picHeight < 16 ||
+	    (param->picWidth & 1) || (param->picHeight & 1))
+		return RETCODE_INVALID_PARAM;
+	if (phys_range(param->bitstreamBuffer,
+		       param->bitstreamBufferSize) == NULL) {
+		fprintf(stderr, "vpu: Bitstream buffer is not in contiguous "
+			"memory\n");
+		return RETCODE_INVALID_PARAM;
+	}
+
+	mbw = (param->picWidth + 15) / 16;
+	mbh = (param->picHeight + 15) / 16;
+	rows = enc_slice_rows(param, mbw);
+	if (h264_pcm_max_size(param->picWidth, param->picHeight,
+			      (mbh + rows - 1) / rows) >
+	    (int)param->bitstreamBufferSize) {
+		fprintf(stderr, "vpu: %dx%d I_PCM pictures do not fit into "
+			"the bitstream buffer\n", param->picWidth,
+			param->picHeight);
+		return RETCODE_INVALID_PARAM;
+	}
+
+	inst = calloc(1, sizeof(struct CodecInst));
+	if (inst == NULL)
+		return RETCODE_FAILURE;
+
+	inst->bs_paddr = param->bitstreamBuffer;
+	inst->bs_vaddr = host_phys_to_virt(param->bitstreamBuffer);
+	inst->bs_size = param->bitstreamBufferSize;
+	inst->width = param->picWidth;
+	inst->height = param->picHeight;
+	inst->chroma_interleave = param->chromaInterleave;
+	inst->mbw = mbw;
+	inst->mbh = mbh;
+	inst->rows_per_slice = rows;
+	*handle = inst;
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_EncClose(EncHandle handle)
+{
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+	if (core_owned(handle))
+		return RETCODE_FRAME_NOT_COMPLETE;
+
+	free(handle);
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_EncGetInitialInfo(EncHandle handle, EncInitialInfo *info)
+{
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+
+	memset(info, 0, sizeof(EncInitialInfo));
+	info->minFrameBufferCount = ENC_MIN_FRAME_BUFFERS;
+	info->reportBufSize.sliceInfoBufSize = handle->mbh * SLICE_INFO_BYTES;
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_EncRegisterFrameBuffer(EncHandle handle, FrameBuffer *bufArray,
+				   int num, int frameBufStride,
+				   int sourceBufStride,
+				   PhysicalAddress subSampBaseA,
+				   PhysicalAddress subSampBaseB,
+				   EncExtBufInfo *pBufInfo)
+{
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+	if (num < ENC_MIN_FRAME_BUFFERS)
+		return RETCODE_INSUFFICIENT_FRAME_BUFFERS;
+	if (frameBufStride < handle->width || sourceBufStride < handle->width)
+		return RETCODE_INVALID_STRIDE;
+
+	handle->src_stride = sourceBufStride;
+	handle->registered = 1;
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_EncStartOneFrame(EncHandle handle, EncParam *param)
+{
+	struct h264_pcm_src src;
+	FrameBuffer *fb = param->sourceFrame;
+	int rows, c_stride, c_rows, first, mbs, size, latency;
+	long long start;
+
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+	if (!handle->registered)
+		return RETCODE_WRONG_CALL_SEQUENCE;
+	if (fb == NULL || param->encLeftOffset < 0 || param->encTopOffset < 0 ||
+	    param->encLeftOffset + handle->width > handle->src_stride)
+		return RETCODE_INVALID_PARAM;
+
+	/* Chroma offsets of the cropped source are whole samples */
+	rows = handle->height + param->encTopOffset;
+	memset(&src, 0, sizeof(src));
+	src.interleave = handle->chroma_interleave;
+	src.y_stride = handle->src_stride;
+	c_stride = src.interleave ? src.y_stride : src.y_stride / 2;
+	src.c_stride = c_stride;
+	c_rows = (rows + 1) / 2;
+	src.y = phys_range(fb->bufY, (long)src.y_stride * rows);
+	src.cb = phys_range(fb->bufCb, (long)c_stride * c_rows);
+	src.cr = src.interleave ? src.cb :
+		 phys_range(fb->bufCr, (long)c_stride * c_rows);
+	if (src.y == NULL || src.cb == NULL || src.cr == NULL) {
+		fprintf(stderr, "vpu: Source frame is not in contiguous "
+			"memory\n");
+		return RETCODE_INVALID_FRAME_BUFFER;
+	}
+	src.y += param->encTopOffset * src.y_stride + param->encLeftOffset;
+	src.cb += param->encTopOffset / 2 * c_stride +
+		  param->encLeftOffset / 2 * (src.interleave ? 2 : 1);
+	if (!src.interleave)
+		src.cr += param->encTopOffset / 2 * c_stride +
+			  param->encLeftOffset / 2;
+
+	core_acquire(handle);
+	start = now_us();
+
+	/* Pictures go to the start of the buffer, as without ring mode */
+	handle->out_paddr = handle->bs_paddr;
+	handle->out_size = 0;
+	handle->slices = 0;
+	for (first = 0; first < handle->mbw * handle->mbh; first += mbs) {
+		mbs = handle->rows_per_slice * handle->mbw;
+		if (first + mbs > handle->mbw * handle->mbh)
+			mbs = handle->mbw * handle->mbh - first;
+		size = h264_pcm_slice(handle->bs_vaddr + handle->out_size,
+				      handle->bs_size - handle->out_size, &src,
+				      handle->width, handle->height, first,
+				      mbs, handle->idr_id);
+		if (size < 0) {
+			core_release(handle);
+			return RETCODE_FAILURE;
+		}
+		enc_report_slice(handle, first, size);
+		handle->out_size += size;
+		handle->slices++;
+	}
+	handle->idr_id ^= 1;
+	handle->frame_done = 1;
+
+	pthread_mutex_lock(&vpu.lock);
+	latency = vpu.enc_latency_us;
+	pthread_mutex_unlock(&vpu.lock);
+	core_finish(start, latency);
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_EncGetOutputInfo(EncHandle handle, EncOutputInfo *info)
+{
+	long long until;
+
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+	if (!handle->frame_done || !core_owned(handle))
+		return RETCODE_WRONG_CALL_SEQUENCE;
+
+	pthread_mutex_lock(&vpu.lock);
+	until = vpu.busy_until;
+	pthread_mutex_unlock(&vpu.lock);
+	sleep_until(until);
+
+	memset(info, 0, sizeof(EncOutputInfo));
+	info->bitstreamBuffer = handle->out_paddr;
+	info->bitstreamSize = handle->out_size;
+	info->picType = 0;		/* I */
+	info->numOfSlices = handle->slices;
+	if (handle->slice_report.enable) {
+		info->sliceInfo.enable = 1;
+		info->sliceInfo.addr = handle->slice_report.addr;
+		info->sliceInfo.size = handle->slices * SLICE_INFO_BYTES;
+		info->pSliceInfo = (Uint32 *)handle->slice_report.addr;
+	}
+
+	handle->frame_done = 0;
+	core_release(handle);
+
+	return RETCODE_SUCCESS;
+}
+
+RetCode vpu_EncGiveCommand(EncHandle handle, CodecCommand cmd, void *parameter)
+{
+	EncHeaderParam *hdr = parameter;
+
+	if (handle == NULL)
+		return RETCODE_INVALID_HANDLE;
+
+	switch (cmd) {
+	case ENC_PUT_AVC_HEADER:
+		if (hdr->headerType == SPS_RBSP)
+			hdr->size = h264_pcm_sps(handle->bs_vaddr,
+						 handle->bs_size,
+						 handle->width,
+						 handle->height);
+		else if (hdr->headerType == PPS_RBSP)
+			hdr->size = h264_pcm_pps(handle->bs_vaddr,
+						 handle->bs_size);
+		else
+			return RETCODE_NOT_SUPPORTED;
+		if (hdr->size < 0)
+			return RETCODE_FAILURE;
+		hdr->buf = handle->bs_paddr;
+		return RETCODE_SUCCESS;
+	case ENC_SET_REPORT_SLICEINFO:
+		handle->slice_report = *(EncReportInfo *)parameter;
+		return RETCODE_SUCCESS;
+	case ENC_SET_BITRATE:
+	case ENC_SET_FRAME_RATE:
+	case ENC_SET_GOP_NUMBER:
+	case ENC_SET_INTRA_QP:
+	case ENC_SET_INTRA_MB_REFRESH_NUMBER:
+	case ENC_SET_INTRA_REFRESH_MODE:
+		/* Every picture is intra coded at full quality */
+		return RETCODE_SUCCESS;
+	default:
+		return RETCODE_INVALID_COMMAND;
+	}
+}
@@ -0,0 +1,184 @@
+#include "host.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Stand-in for the ANativeWindow behind a Surface. It keeps two buffers
+ * and alternates between them like a double buffered BufferQueue. Rows
+ * are padded to a multiple of 32 pixels, as gralloc does, so code that
+ * ignores the buffer stride shows up on the host too.
+ */
+#define WINDOW_NUM_BUFFERS	2
+#define WINDOW_STRIDE_ALIGN	32
+
+struct ANativeWindow {
+	pthread_mutex_t lock;
+	int refs;
+	int width;		/* Size of the surface */
+	int height;
+	int buf_width;		/* From setBuffersGeometry, 0 = surface size */
+	int buf_height;
+	int format;
+	int locked;
+	int cur;
+	void *bits[WINDOW_NUM_BUFFERS];
+	int alloc_size[WINDOW_NUM_BUFFERS];
+	unsigned long posted;
+};
+
+/* Function prototypes */
+static int bytes_per_pixel(int format);
+/* End function prototypes */
+
+static int bytes_per_pixel(int format)
+{
+	return format == WINDOW_FORMAT_RGB_565 ? 2 : 4;
+}
+
+/*
+ * Return: window holding one reference, or NULL on failure
+ */
+ANativeWindow *host_window_create(int width, int height)
+{
+	ANativeWindow *w;
+
+	w = calloc(1, sizeof(ANativeWindow));
+	if (w == NULL)
+		return NULL;
+
+	pthread_mutex_init(&w->lock, NULL);
+	w->refs = 1;
+	w->width = width;
+	w->height = height;
+	w->format = WINDOW_FORMAT_RGBA_8888;
+
+	return w;
+}
+
+unsigned long host_window_posted(ANativeWindow *window)
+{
+	unsigned long posted;
+
+	pthread_mutex_lock(&window->lock);
+	posted = window->posted;
+	pthread_mutex_unlock(&window->lock);
+
+	return posted;
+}
+
+void ANativeWindow_acquire(ANativeWindow *window)
+{
+	pthread_mutex_lock(&window->lock);
+	window->refs++;
+	pthread_mutex_unlock(&window->lock);
+}
+
+void ANativeWindow_release(ANativeWindow *window)
+{
+	int i, refs;
+
+	pthread_mutex_lock(&window->lock);
+	refs = --window->refs;
+	pthread_mutex_unlock(&window->lock);
+	if (refs > 0)
+		return;
+
+	for (i = 0; i < WINDOW_NUM_BUFFERS; i++)
+		free(window->bits[i]);
+	pthread_mutex_destroy(&window->lock);
+	free(window);
+}
+
+int32_t ANativeWindow_getWidth(ANativeWindow *window)
+{
+	return window->buf_width ? window->buf_width : window->width;
+}
+
+int32_t ANativeWindow_getHeight(ANativeWindow *window)
+{
+	return window->buf_height ? window->buf_height : window->height;
+}
+
+int32_t ANativeWindow_getFormat(ANativeWindow *window)
+{
+	return window->format;
+}
+
+int32_t ANativeWindow_setBuffersGeometry(ANativeWindow *window, int32_t width,
+					 int32_t height, int32_t format)
+{
+	if (width < 0 || height < 0 || (width == 0) != (height == 0))
+		return -1;
+
+	pthread_mutex_lock(&window->lock);
+	window->buf_width = width;
+	window->buf_height = height;
+	if (format)
+		window->format = format;
+	pthread_mutex_unlock(&window->lock);
+
+	return 0;
+}
+
+int32_t ANativeWindow_lock(ANativeWindow *window,
+			   ANativeWindow_Buffer *outBuffer,
+			   ARect *inOutDirtyBounds)
+{
+	int width, height, stride, size;
+	void *bits;
+
+	pthread_mutex_lock(&window->lock);
+	if (window->locked) {
+		pthread_mutex_unlock(&window->lock);
+		fprintf(stderr, "window: Already locked\n");
+		return -1;
+	}
+
+	width = ANativeWindow_getWidth(window);
+	height = ANativeWindow_getHeight(window);
+	stride = (width + WINDOW_STRIDE_ALIGN - 1) & ~(WINDOW_STRIDE_ALIGN - 1);
+	size = stride * height * bytes_per_pixel(window->format);
+
+	if (window->alloc_size[window->cur] != size) {
+		bits = realloc(window->bits[window->cur], size);
+		if (bits == NULL) {
+			pthread_mutex_unlock(&window->lock);
+			return -1;
+		}
+		window->bits[window->cur] = bits;
+		window->alloc_size[window->cur] = size;
+	}
+
+	outBuffer->width = width;
+	outBuffer->height = height;
+	outBuffer->stride = stride;
+	outBuffer->format = window->format;
+	outBuffer->bits = window->bits[window->cur];
+	if (inOutDirtyBounds) {
+		inOutDirtyBounds->left = 0;
+		inOutDirtyBounds->top = 0;
+		inOutDirtyBounds->right = width;
+		inOutDirtyBounds->bottom = height;
+	}
+	window->locked = 1;
+	pthread_mutex_unlock(&window->lock);
+
+	return 0;
+}
+
+int32_t ANativeWindow_unlockAndPost(ANativeWindow *window)
+{
+	pthread_mutex_lock(&window->lock);
+	if (!window->locked) {
+		pthread_mutex_unlock(&window->lock);
+		return -1;
+	}
+	window->locked = 0;
+	window->cur = (window->cur + 1) % WINDOW_NUM_BUFFERS;
+	window->posted++;
+	pthread_mutex_unlock(&window->lock);
+
+	return 0;
+}
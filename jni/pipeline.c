@@ -0,0 +1,239 @@
+#include "pipeline.h"
+#include "enzo_trace.h"
+
+#include <string.h>
+#include <time.h>
+
+/* Function prototypes */
+static long long now_us(void);
+static void update_avg(long long *avg, long long sample);
+static int frame_is_stale(struct pipeline *pl, long long timestamp);
+static void pipeline_backoff(struct pipeline *pl);
+static void *pipeline_thread(void *arg);
+/* End function prototypes */
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Exponential moving average over roughly the last 16 samples
+ */
+static void update_avg(long long *avg, long long sample)
+{
+	if (*avg == 0)
+		*avg = sample;
+	else
+		*avg += (sample - *avg) / 16;
+}
+
+/*
+ * Return: 1 = a newer frame is already waiting, 0 = show this frame
+ */
+static int frame_is_stale(struct pipeline *pl, long long timestamp)
+{
+	long long age = now_us() - timestamp;
+
+	if (pl->interval_us == 0 || age < 0 || age > PIPELINE_MAX_AGE_US)
+		return 0;
+
+	return age > pl->interval_us * 3 / 2;
+}
+
+/*
+ * Sleep for about one camera interval after an error, as the next frame
+ * is not due before then anyway
+ */
+static void pipeline_backoff(struct pipeline *pl)
+{
+	struct timespec ts;
+	long long us;
+
+	pthread_mutex_lock(&pl->lock);
+	us = pl->interval_us > 0 ? pl->interval_us : PIPELINE_RETRY_US;
+	pthread_mutex_unlock(&pl->lock);
+
+	if (us > PIPELINE_MAX_AGE_US)
+		us = PIPELINE_MAX_AGE_US;
+	ts.tv_sec = us / 1000000;
+	ts.tv_nsec = (us % 1000000) * 1000;
+	nanosleep(&ts, NULL);
+}
+
+static void *pipeline_thread(void *arg)
+{
+	struct pipeline *pl = arg;
+	struct mediaBuffer *frames[DISPLAY_MAX_VIEWS];
+	long long start, elapsed;
+	int i, failures = 0;
+
+	info_msg("Pipeline started\n");
+
+	while (!__atomic_load_n(&pl->stop, __ATOMIC_RELAXED)) {
+		if (cameraGetFrame(pl->camera, pl->cam_buf) < 0) {
+			err_msg("Could not get camera frame\n");
+			pthread_mutex_lock(&pl->lock);
+			pl->errors++;
+			if (++failures >= PIPELINE_MAX_CAPTURE_FAILURES)
+				pl->failed = 1;
+			pthread_mutex_unlock(&pl->lock);
+			if (failures >= PIPELINE_MAX_CAPTURE_FAILURES) {
+				err_msg("Camera failed %d times in a row, "
+					"stopping the pipeline\n", failures);
+				break;
+			}
+			pipeline_backoff(pl);
+			continue;
+		}
+		failures = 0;
+
+		pthread_mutex_lock(&pl->lock);
+		pl->captured++;
+		if (pl->last_timestamp)
+			update_avg(&pl->interval_us, pl->cam_buf->timestamp -
+				   pl->last_timestamp);
+		pl->last_timestamp = pl->cam_buf->timestamp;
+		pthread_mutex_unlock(&pl->lock);
+
+		if (frame_is_stale(pl, pl->cam_buf->timestamp)) {
+			TRACE_INSTANT("skipped", pl->cam_buf->frameId);
+			pthread_mutex_lock(&pl->lock);
+			pl->skipped++;
+			pthread_mutex_unlock(&pl->lock);
+			continue;
+		}
+
+		start = now_us();
+
+		if (decoderDecodeFrame(pl->decoder, pl->cam_buf,
+				       pl->yuv_buf) < 0) {
+			err_msg("Could not decode MJPG frame\n");
+			pthread_mutex_lock(&pl->lock);
+			pl->errors++;
+			pthread_mutex_unlock(&pl->lock);
+			pipeline_backoff(pl);
+			continue;
+		}
+
+		/* Until remote streams exist, every view shows the camera */
+		for (i = 0; i < DISPLAY_MAX_VIEWS; i++)
+			frames[i] = pl->yuv_buf;
+		TRACE_BEGIN("render", pl->yuv_buf->frameId);
+		display_sink_render(pl->display, frames, DISPLAY_MAX_VIEWS);
+		TRACE_END("render", pl->yuv_buf->frameId);
+
+		/* Consumers get the frame after it is on screen, and never
+		   hold up the loop */
+		if (pl->frames) {
+			TRACE_BEGIN("publish", pl->yuv_buf->frameId);
+			frame_pool_publish(pl->frames, pl->yuv_buf);
+			TRACE_END("publish", pl->yuv_buf->frameId);
+		}
+
+		elapsed = now_us() - start;
+		pthread_mutex_lock(&pl->lock);
+		pl->shown++;
+		update_avg(&pl->process_us, elapsed);
+		if (elapsed > pl->process_max_us)
+			pl->process_max_us = elapsed;
+		pthread_mutex_unlock(&pl->lock);
+	}
+
+	info_msg("Pipeline stopped\n");
+
+	return NULL;
+}
+
+/*
+ * Start the pipeline thread. The camera, decoder, buffers and display
+ * must be set up, and stay valid until pipeline_stop returns.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int pipeline_start(struct pipeline *pl)
+{
+	if (pl->started)
+		return 0;
+
+	/* The lock outlives the thread, so stats stay readable after stop */
+	if (!pl->initialized) {
+		pthread_mutex_init(&pl->lock, NULL);
+		pl->initialized = 1;
+	}
+	pl->stop = 0;
+	pl->captured = 0;
+	pl->shown = 0;
+	pl->skipped = 0;
+	pl->errors = 0;
+	pl->last_timestamp = 0;
+	pl->interval_us = 0;
+	pl->process_us = 0;
+	pl->process_max_us = 0;
+	pl->failed = 0;
+
+	if (pthread_create(&pl->thread, NULL, pipeline_thread, pl) != 0) {
+		err_msg("Could not start pipeline thread\n");
+		return -1;
+	}
+	pl->started = 1;
+
+	return 0;
+}
+
+/*
+ * Stop the pipeline and wait for the frame in flight to finish. The
+ * thread notices the request after the current camera dequeue returns.
+ * This is also needed after the pipeline stopped itself on failures.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int pipeline_stop(struct pipeline *pl)
+{
+	if (!pl->started)
+		return 0;
+
+	__atomic_store_n(&pl->stop, 1, __ATOMIC_RELAXED);
+	if (pthread_join(pl->thread, NULL) != 0) {
+		err_msg("Could not join pipeline thread\n");
+		return -1;
+	}
+	pl->started = 0;
+
+	return 0;
+}
+
+/*
+ * Copy up to count values, in PIPELINE_STAT_* order, into stats. The
+ * values of the last run are kept after the pipeline stops.
+ *
+ * Return: number of values copied
+ */
+int pipeline_get_stats(struct pipeline *pl, long long *stats, int count)
+{
+	long long values[PIPELINE_NUM_STATS];
+
+	if (!pl->initialized) {
+		memset(values, 0, sizeof(values));
+	} else {
+		pthread_mutex_lock(&pl->lock);
+		values[PIPELINE_STAT_CAPTURED] = pl->captured;
+		values[PIPELINE_STAT_SHOWN] = pl->shown;
+		values[PIPELINE_STAT_SKIPPED] = pl->skipped;
+		values[PIPELINE_STAT_ERRORS] = pl->errors;
+		values[PIPELINE_STAT_CAMERA_INTERVAL_US] = pl->interval_us;
+		values[PIPELINE_STAT_PROCESS_US] = pl->process_us;
+		values[PIPELINE_STAT_PROCESS_MAX_US] = pl->process_max_us;
+		values[PIPELINE_STAT_FAILED] = pl->failed;
+		pthread_mutex_unlock(&pl->lock);
+	}
+
+	if (count > PIPELINE_NUM_STATS)
+		count = PIPELINE_NUM_STATS;
+	memcpy(stats, values, count * sizeof(*stats));
+
+	return count;
+}
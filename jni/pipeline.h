@@ -0,0 +1,74 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "enzo_codec.h"
+#include "display_sink.h"
+#include "frame_pool.h"
+
+#include <pthread.h>
+
+/* Frame ages beyond this are taken to mean the camera timestamps are
+   not on the monotonic clock, which disables frame skipping */
+#define PIPELINE_MAX_AGE_US	1000000
+
+/* Wait after a failed capture or decode while the camera interval is
+   still unknown, so an error returned at once cannot spin the loop */
+#define PIPELINE_RETRY_US	33333
+
+/* Captures in a row that may fail before the pipeline gives up, about
+   two seconds at 30 fps */
+#define PIPELINE_MAX_CAPTURE_FAILURES	60
+
+/* Order of the values returned by pipeline_get_stats, matching
+   CamView.java */
+enum {
+	PIPELINE_STAT_CAPTURED = 0,
+	PIPELINE_STAT_SHOWN,
+	PIPELINE_STAT_SKIPPED,
+	PIPELINE_STAT_ERRORS,
+	PIPELINE_STAT_CAMERA_INTERVAL_US,
+	PIPELINE_STAT_PROCESS_US,
+	PIPELINE_STAT_PROCESS_MAX_US,
+	PIPELINE_STAT_FAILED,
+	PIPELINE_NUM_STATS
+};
+
+/*
+ * Capture -> decode -> display loop running on its own thread. The loop
+ * blocks on the camera, so it runs at the camera's frame rate. A frame
+ * older than one and a half camera intervals means a newer one is already
+ * queued, so it is skipped before decoding and the newest frame is always
+ * the one shown. After PIPELINE_MAX_CAPTURE_FAILURES failed captures in a
+ * row the thread ends by itself and failed is set.
+ */
+struct pipeline {
+	struct cameraInstance *camera;
+	struct decoderInstance *decoder;
+	struct mediaBuffer *cam_buf;
+	struct mediaBuffer *yuv_buf;
+	struct display_sink *display;
+	struct frame_pool *frames;	/* Optional, for other consumers */
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int initialized;
+	int started;
+	int stop;		/* Read by the thread, only accessed atomically */
+
+	/* Statistics, protected by lock */
+	unsigned long captured;
+	unsigned long shown;
+	unsigned long skipped;
+	unsigned long errors;
+	long long last_timestamp;
+	long long interval_us;	/* Average camera frame interval */
+	long long process_us;	/* Average decode + display time */
+	long long process_max_us;
+	int failed;		/* Stopped because the camera failed */
+};
+
+int pipeline_start(struct pipeline *pl);
+int pipeline_stop(struct pipeline *pl);
+int pipeline_get_stats(struct pipeline *pl, long long *stats, int count);
+
+#endif // PIPELINE_H
@@ -0,0 +1,107 @@
+#include "stream_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+struct stream_cache_entry {
+	unsigned int magic;
+	int width;
+	int height;
+	struct decoder_params params;
+};
+
+/* Function prototypes */
+static int cache_path(char *path, int size, const char *dir,
+		      const char *dev_name, int width, int height);
+/* End function prototypes */
+
+/*
+ * "/dev/video0" at 1280x720 is cached in "<dir>/stream-video0-1280x720"
+ */
+static int cache_path(char *path, int size, const char *dir,
+		      const char *dev_name, int width, int height)
+{
+	const char *base = strrchr(dev_name, '/');
+	int len;
+
+	if (dir == NULL || dir[0] == '\0')
+		return -1;
+
+	base = base ? base + 1 : dev_name;
+	len = snprintf(path, size, "%s/stream-%s-%dx%d", dir, base,
+		       width, height);
+
+	return (len > 0 && len < size) ? 0 : -1;
+}
+
+/*
+ * Return: 0 = params loaded, -1 = nothing cached
+ */
+int stream_cache_load(const char *dir, const char *dev_name, int width,
+		      int height, struct decoder_params *params)
+{
+	struct stream_cache_entry entry;
+	char path[256];
+	int fd, ret;
+
+	if (cache_path(path, sizeof(path), dir, dev_name, width, height) < 0)
+		return -1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = freadn(fd, &entry, sizeof(entry));
+	close(fd);
+
+	if (ret != sizeof(entry) || entry.magic != STREAM_CACHE_MAGIC ||
+	    entry.width != width || entry.height != height) {
+		warn_msg("Ignoring stale stream cache %s\n", path);
+		return -1;
+	}
+
+	memcpy(params, &entry.params, sizeof(*params));
+
+	return 0;
+}
+
+/*
+ * The entry is written to a temporary file and renamed, so a crash never
+ * leaves a half written entry behind.
+ *
+ * Return: 0 = success, -1 = failure
+ */
+int stream_cache_store(const char *dir, const char *dev_name, int width,
+		       int height, const struct decoder_params *params)
+{
+	struct stream_cache_entry entry;
+	char path[256], tmp[260];
+	int fd, ret;
+
+	if (cache_path(path, sizeof(path), dir, dev_name, width, height) < 0)
+		return -1;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	memset(&entry, 0, sizeof(entry));
+	entry.magic = STREAM_CACHE_MAGIC;
+	entry.width = width;
+	entry.height = height;
+	memcpy(&entry.params, params, sizeof(*params));
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		err_msg("Could not create %s\n", tmp);
+		return -1;
+	}
+	ret = fwriten(fd, &entry, sizeof(entry));
+	close(fd);
+
+	if (ret != sizeof(entry) || rename(tmp, path) < 0) {
+		err_msg("Could not write %s\n", path);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
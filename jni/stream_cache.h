@@ -0,0 +1,18 @@
+#ifndef STREAM_CACHE_H
+#define STREAM_CACHE_H
+
+#include "enzo_codec.h"
+
+/* "ESP1", bumped whenever struct decoder_params changes */
+#define STREAM_CACHE_MAGIC	0x31505345
+
+/*
+ * Stream parameters of the last session per camera device and resolution,
+ * kept in one small file each under the app's cache directory.
+ */
+int stream_cache_load(const char *dir, const char *dev_name, int width,
+		      int height, struct decoder_params *params);
+int stream_cache_store(const char *dir, const char *dev_name, int width,
+		       int height, const struct decoder_params *params);
+
+#endif // STREAM_CACHE_H
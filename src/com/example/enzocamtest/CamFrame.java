@@ -0,0 +1,94 @@
+package com.example.enzocamtest;
+
+import java.nio.ByteBuffer;
+
+/**
+ * A decoded camera frame shared with native code. The planes are read-only
+ * views of native memory, so nothing is copied, and they must not be used
+ * after release() or after the CamView is closed, which releases every
+ * frame still held. Frames come from CamView.acquireFrame().
+ */
+public class CamFrame {
+    // Layout of the info array filled in natively, see CamView.c
+    static final int INFO_WIDTH = 0;
+    static final int INFO_HEIGHT = 1;
+    static final int INFO_COLOR_SPACE = 2;
+    static final int INFO_TIMESTAMP = 3;
+    static final int INFO_SEQUENCE = 4;
+    static final int INFO_PLANES = 5;
+    static final int INFO_STRIDE = 6;
+    static final int MAX_PLANES = 3;
+    static final int INFO_SIZE = INFO_STRIDE + MAX_PLANES;
+
+    // Color spaces, from enzo_utils.h
+    public static final int NV12 = 1;
+    public static final int YUV420P = 2;
+    public static final int YUV422P = 3;
+    public static final int YUYV = 4;
+    public static final int NV16 = 5;
+
+    public final int width;
+    public final int height;
+    public final int colorSpace;
+    public final long timestampUs;
+    public final long sequence;
+
+    private final CamView mView;
+    private final ByteBuffer[] mPlanes;
+    private final int[] mStrides;
+    private volatile long mHandle;
+
+    CamFrame(CamView view, long handle, ByteBuffer[] planes, long[] info) {
+        mView = view;
+        mHandle = handle;
+        width = (int)info[INFO_WIDTH];
+        height = (int)info[INFO_HEIGHT];
+        colorSpace = (int)info[INFO_COLOR_SPACE];
+        timestampUs = info[INFO_TIMESTAMP];
+        sequence = info[INFO_SEQUENCE];
+
+        int count = (int)info[INFO_PLANES];
+        mPlanes = new ByteBuffer[count];
+        mStrides = new int[count];
+        for (int i = 0; i < count; i++) {
+            mPlanes[i] = planes[i].asReadOnlyBuffer();
+            mStrides[i] = (int)info[INFO_STRIDE + i];
+        }
+    }
+
+    /**
+     * Number of planes: 1 for YUYV, 2 for NV12/NV16 (Y and interleaved
+     * CbCr), 3 for the planar formats (Y, Cb, Cr).
+     */
+    public int getPlaneCount() {
+        return mPlanes.length;
+    }
+
+    public ByteBuffer getPlane(int plane) {
+        if (mHandle == 0)
+            throw new IllegalStateException("Frame was released");
+        return mPlanes[plane];
+    }
+
+    public int getRowStride(int plane) {
+        return mStrides[plane];
+    }
+
+    /**
+     * Gives the frame back to the pool. The planes must not be read after
+     * this.
+     */
+    public void release() {
+        mView.releaseFrame(this);
+    }
+
+    /**
+     * Invalidates the frame and returns its native handle, or 0 if it was
+     * already released. Called by CamView with its frame lock held.
+     */
+    long detach() {
+        long handle = mHandle;
+        mHandle = 0;
+        return handle;
+    }
+}
@@ -1,23 +1,25 @@
 package com.example.enzocamtest;
 
 import java.io.File;
+import java.nio.ByteBuffer;
+import java.util.ArrayList;
 
 import android.content.Context;
-import android.graphics.Bitmap;
-import android.graphics.Canvas;
 import android.graphics.Rect;
 import android.util.AttributeSet;
 import android.util.Log;
+import android.view.Surface;
 import android.view.SurfaceHolder;
 import android.view.SurfaceView;
 
-public class CamView extends SurfaceView implements SurfaceHolder.Callback, Runnable {
+public class CamView extends SurfaceView implements SurfaceHolder.Callback {
 	private static String TAG = "EnzoCam";
 	private static String deviceName = "/dev/video0";
 
-	private Bitmap mLocalCamBitmap;
-	private Bitmap mRemoteCamBitmap;
-	private Canvas mCanvas;
+	// View indices understood by setViewRect
+	private static final int VIEW_LOCAL = 0;
+	private static final int VIEW_REMOTE = 1;
+
 	private SurfaceHolder mHolder;
 	private Rect mLocalCamViewWindow;
 	private Rect mRemoteCamViewWindow;
@@ -25,14 +27,77 @@ public class CamView extends SurfaceView implements SurfaceHolder.Callback, Runn
     private int mCamHeight = 720;
     private int mPreviewWidth = 320;
     private int mPreviewHeight = 240;
+    private int mLocalRotation = 0;
+    private int mRemoteRotation = 0;
     
-    private boolean mRunning = true;
-    
-    private native int startCamera(String deviceName, int width, int height);
-    private native void processCamera();
-    private native boolean cameraAttached();
-    private native void stopCamera();
-    private native void loadNextFrame(Bitmap bitmap);
+    // Pipeline statistics, in the order of pipeline.h
+    public static final int STAT_CAPTURED = 0;
+    public static final int STAT_SHOWN = 1;
+    public static final int STAT_SKIPPED = 2;
+    public static final int STAT_ERRORS = 3;
+    public static final int STAT_CAMERA_INTERVAL_US = 4;
+    public static final int STAT_PROCESS_US = 5;
+    public static final int STAT_PROCESS_MAX_US = 6;
+    public static final int STAT_FAILED = 7;
+    private long[] mStats = new long[8];
+
+    // Timed stages and their statistics, in the order of stage_stats.h
+    public static final int STAGE_CAPTURE_WAIT = 0;
+    public static final int STAGE_BITSTREAM_FILL = 1;
+    public static final int STAGE_VPU_DECODE = 2;
+    public static final int STAGE_G2D = 3;
+    public static final int STAGE_CHROMA_REPACK = 4;
+    public static final int STAGE_DISPLAY_COPY = 5;
+    public static final int STAGE_ENCODE_SOURCE = 6;
+    public static final int STAGE_VPU_ENCODE = 7;
+    private static final String[] STAGE_NAMES = {
+        "capture wait", "bitstream fill", "VPU decode", "g2d",
+        "chroma repack", "display copy", "encode source", "VPU encode"
+    };
+    public static final int STAGE_STAT_COUNT = 0;
+    public static final int STAGE_STAT_MEAN_US = 1;
+    public static final int STAGE_STAT_P50_US = 2;
+    public static final int STAGE_STAT_P95_US = 3;
+    public static final int STAGE_STAT_P99_US = 4;
+    public static final int STAGE_STAT_MAX_US = 5;
+    private long[] mStageStats = new long[6];
+
+    // Startup timeline, in the order of cam_session.h
+    public static final int TIME_VPU_READY = 0;
+    public static final int TIME_CAMERA_OPEN = 1;
+    public static final int TIME_FIRST_FRAME = 2;
+    public static final int TIME_DECODER_READY = 3;
+    public static final int TIME_READY = 4;
+    private long[] mTimeline = new long[5];
+
+    // Native session handle returned by startCamera, 0 when not open
+    private long mSession = 0;
+    // Frames handed out and not released yet, also the lock that keeps
+    // close() from freeing the pool under acquireFrame/releaseFrame
+    private final ArrayList<CamFrame> mFrames = new ArrayList<CamFrame>();
+
+    private native long startCamera(String deviceName, int width, int height,
+            String cacheDir);
+    private native void processCamera(long session);
+    private native boolean cameraAttached(long session);
+    private native void stopCamera(long session);
+    private native void stopProcessing(long session);
+    private native int pauseCamera(long session);
+    private native int resumeCamera(long session);
+    private native int getStats(long session, long[] stats);
+    private native int getStartupTimeline(long session, long[] times);
+    public static native int getStageStats(int stage, long[] stats);
+    public static native void resetStageStats();
+    // Frame pipeline tracing, see enzo_trace.h. Writes Chrome trace JSON
+    // that chrome://tracing and Perfetto load. Needs an ENZO_TRACE build.
+    public static native int startTrace(String path);
+    public static native int stopTrace();
+    private native long acquireFrame(long session, ByteBuffer[] planes,
+                                     long[] info);
+    private native void releaseFrame(long session, long frame);
+    private native int setSurface(long session, Surface surface);
+    private native int setViewRect(long session, int view, int left, int top,
+                                   int right, int bottom, int rotation);
 
     static {
         System.loadLibrary("camview");
@@ -43,10 +108,6 @@ public class CamView extends SurfaceView implements SurfaceHolder.Callback, Runn
         mHolder = getHolder();
         mHolder.addCallback(this);
         
-        mLocalCamBitmap = Bitmap.createBitmap(mCamWidth, mCamHeight, Bitmap.Config.RGB_565);
-        mRemoteCamBitmap = Bitmap.createBitmap(mCamWidth, mCamHeight, Bitmap.Config.RGB_565);
-        mCanvas = new Canvas(mLocalCamBitmap);
-        
         connect(deviceName, mCamWidth, mCamHeight);
     }
     
@@ -55,33 +116,93 @@ public class CamView extends SurfaceView implements SurfaceHolder.Callback, Runn
         mHolder = getHolder();
         mHolder.addCallback(this);
         
-        mLocalCamBitmap = Bitmap.createBitmap(mCamWidth, mCamHeight, Bitmap.Config.RGB_565);
-        mRemoteCamBitmap = Bitmap.createBitmap(mCamWidth, mCamHeight, Bitmap.Config.RGB_565);
-        mCanvas = new Canvas(mLocalCamBitmap);
-        
         connect(deviceName, mCamWidth, mCamHeight);
     }
     
-    @Override
-    public void run() {
-    	
-    	Log.d(TAG, "Started running loop!");
-    	
-    	while(mRunning) {
-    	
-	    	//loadNextFrame(mLocalCamBitmap);
-	    	loadNextFrame(mRemoteCamBitmap);
-	    	
-	        mCanvas = mHolder.lockCanvas();
-	        if(mCanvas != null) {
-	        	mCanvas.drawBitmap(mLocalCamBitmap, null, mLocalCamViewWindow, null);
-	        	mCanvas.drawBitmap(mRemoteCamBitmap, null, mRemoteCamViewWindow, null);
-	            mHolder.unlockCanvasAndPost(mCanvas);
-	        }
-    	}
-    	
-    	Log.d(TAG, "Exiting running loop!");
-    	
+    /**
+     * Fills mStats with the native pipeline statistics, in STAT_* order,
+     * and logs them together with the per-stage timings.
+     */
+    public long[] updateStats() {
+        getStats(mSession, mStats);
+        Log.d(TAG, "Frames captured = " + mStats[STAT_CAPTURED]
+                + ", shown = " + mStats[STAT_SHOWN]
+                + ", skipped = " + mStats[STAT_SKIPPED]
+                + ", errors = " + mStats[STAT_ERRORS]);
+        Log.d(TAG, "Camera interval = " + mStats[STAT_CAMERA_INTERVAL_US]
+                + " us, processing = " + mStats[STAT_PROCESS_US]
+                + " us (max " + mStats[STAT_PROCESS_MAX_US] + " us)");
+        if (mStats[STAT_FAILED] != 0)
+            Log.e(TAG, "Pipeline stopped, the camera keeps failing");
+        for (int i = 0; i < STAGE_NAMES.length; i++) {
+            if (getStageStats(i, mStageStats) < 0
+                    || mStageStats[STAGE_STAT_COUNT] == 0)
+                continue;
+            Log.d(TAG, "Stage " + STAGE_NAMES[i] + ": "
+                    + mStageStats[STAGE_STAT_COUNT] + " samples, mean "
+                    + mStageStats[STAGE_STAT_MEAN_US] + " us, p50 "
+                    + mStageStats[STAGE_STAT_P50_US] + " us, p95 "
+                    + mStageStats[STAGE_STAT_P95_US] + " us, p99 "
+                    + mStageStats[STAGE_STAT_P99_US] + " us, max "
+                    + mStageStats[STAGE_STAT_MAX_US] + " us");
+        }
+        return mStats;
+    }
+
+    /**
+     * Returns the newest decoded frame without copying it, or null if
+     * there is none yet. Frames are only kept for consumers once this has
+     * been called, so the first call usually returns null. Every frame
+     * must be released, and only a few can be held at a time; while all
+     * are held, new frames are not published but display goes on.
+     */
+    public CamFrame acquireFrame() {
+        synchronized (mFrames) {
+            if (mSession == 0)
+                return null;
+
+            ByteBuffer[] planes = new ByteBuffer[CamFrame.MAX_PLANES];
+            long[] info = new long[CamFrame.INFO_SIZE];
+            long frame = acquireFrame(mSession, planes, info);
+            if (frame == 0)
+                return null;
+
+            CamFrame camFrame = new CamFrame(this, frame, planes, info);
+            mFrames.add(camFrame);
+            return camFrame;
+        }
+    }
+
+    void releaseFrame(CamFrame frame) {
+        synchronized (mFrames) {
+            long handle = frame.detach();
+            if (handle != 0 && mFrames.remove(frame) && mSession != 0)
+                releaseFrame(mSession, handle);
+        }
+    }
+
+    /**
+     * Called from the native startup thread once the camera started by
+     * connect() is ready to stream, or failed to start.
+     */
+    private void onCameraReady(long session, boolean ok) {
+        getStartupTimeline(session, mTimeline);
+        Log.i(TAG, "Camera " + (ok ? "ready" : "failed") + " after "
+                + mTimeline[TIME_READY] / 1000 + " ms (VPU "
+                + mTimeline[TIME_VPU_READY] / 1000 + " ms, camera open "
+                + mTimeline[TIME_CAMERA_OPEN] / 1000 + " ms, first frame "
+                + mTimeline[TIME_FIRST_FRAME] / 1000 + " ms, decoder "
+                + mTimeline[TIME_DECODER_READY] / 1000 + " ms)");
+    }
+
+    /**
+     * Whether the camera is open and streaming can start. False while
+     * the camera is still starting, after it failed and after close().
+     */
+    public boolean isCameraAttached() {
+        synchronized (mFrames) {
+            return mSession != 0 && cameraAttached(mSession);
+        }
     }
 
     @Override
@@ -118,26 +239,71 @@ public class CamView extends SurfaceView implements SurfaceHolder.Callback, Runn
         Log.d(TAG, "bottom = " + bottom);
         
         mRemoteCamViewWindow = new Rect(left, top, right, bottom);
+
+        // Both streams are scaled into these rects natively
+        if (mSession == 0)
+            return;
+
+        setViewRect(mSession, VIEW_LOCAL, mLocalCamViewWindow.left, mLocalCamViewWindow.top,
+                mLocalCamViewWindow.right, mLocalCamViewWindow.bottom, mLocalRotation);
+        setViewRect(mSession, VIEW_REMOTE, mRemoteCamViewWindow.left, mRemoteCamViewWindow.top,
+                mRemoteCamViewWindow.right, mRemoteCamViewWindow.bottom, mRemoteRotation);
+        setSurface(mSession, holder.getSurface());
     }
 
     @Override
     public void surfaceCreated(SurfaceHolder holder) {
     	Log.d(TAG, "Surface created!");
-    	mRunning = true;
-    	(new Thread(this)).start();
+    	// Frames go from the camera to the Surface on a native thread
+    	if (mSession != 0) {
+    	    if (resumeCamera(mSession) < 0)
+    	        Log.e(TAG, "Could not resume camera");
+    	    processCamera(mSession);
+    	}
     }
 
     @Override
     public void surfaceDestroyed(SurfaceHolder holder) {
-    	mRunning = false;
-    	stopCamera();
-    	Log.d(TAG, "Camera closed!");
+    	// The camera and decoder stay open, so the next surfaceCreated
+    	// only has to restart streaming
+    	if (mSession != 0) {
+    	    stopProcessing(mSession);
+    	    updateStats();
+    	    pauseCamera(mSession);
+    	}
+    	Log.d(TAG, "Camera paused!");
+    }
+
+    /**
+     * Closes the camera for good. Call this when the view is no longer
+     * going to be shown.
+     */
+    public void close() {
+        synchronized (mFrames) {
+            // The pool memory goes away with the session, so frames still
+            // held become invalid first
+            for (CamFrame frame : mFrames) {
+                long handle = frame.detach();
+                if (handle != 0 && mSession != 0)
+                    releaseFrame(mSession, handle);
+            }
+            mFrames.clear();
+
+            if (mSession != 0) {
+                stopProcessing(mSession);
+                setSurface(mSession, null);
+                stopCamera(mSession);
+                mSession = 0;
+            }
+        }
+        Log.d(TAG, "Camera closed!");
     }
     
     private void connect(String deviceName, int width, int height) {
         boolean deviceReady = true;
 
-        File deviceFile = new File(deviceName);
+        // A replayed recording is checked like a device node
+        File deviceFile = new File(deviceName.replaceFirst("^replay(-fast)?:", ""));
         if(deviceFile.exists()) {
             if(!deviceFile.canRead()) {
                 Log.d(TAG, "Insufficient permissions on " + deviceName +
@@ -151,7 +317,11 @@ public class CamView extends SurfaceView implements SurfaceHolder.Callback, Runn
 
         if(deviceReady) {
             Log.i(TAG, "Preparing camera with device name " + deviceName);
-            startCamera(deviceName, width, height);
+            // Returns right away, onCameraReady reports when it is done
+            mSession = startCamera(deviceName, width, height,
+                    getContext().getCacheDir().getAbsolutePath());
+            if (mSession == 0)
+                Log.e(TAG, "Could not start camera " + deviceName);
         }
     }
 }
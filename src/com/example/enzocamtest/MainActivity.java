@@ -12,4 +12,10 @@ public class MainActivity extends Activity {
 		mCamView = new CamView(this);
 		setContentView(mCamView);
 	}
+
+	@Override
+	protected void onDestroy() {
+		mCamView.close();
+		super.onDestroy();
+	}
 }